@@ -10,6 +10,19 @@ using namespace gv;
 static bool s_initialized = false;
 static BrickPool* s_pInstance = NULL;
 
+static GLenum GetGradientPixelFormat(GLint internalTexFmtGrads)
+{
+    //octahedral encoded gradients only have two components
+    return internalTexFmtGrads == GL_RG16 ? GL_RG : GL_RGB;
+}
+
+static bool UseGradientInterpolation(GLint internalTexFmtGrads)
+{
+    //interpolating octahedral encoded gradients is not the same as interpolating
+    //the gradients (especially across the folds) and would mix with the zero gradient code
+    return internalTexFmtGrads != GL_RG16;
+}
+
 BrickPool& BrickPool::instance()
 {
     if(s_pInstance == NULL)
@@ -44,8 +57,8 @@ BrickPool::BrickPool() :
     m_uploadPBO(0),
     m_internalTexFmtColors(GL_RGBA8),
     m_pixelFmtColors(GL_UNSIGNED_BYTE),
-    m_internalTexFmtGrads(GL_RGBA8),
-    m_pixelFmtGrads(GL_FLOAT),
+    m_internalTexFmtGrads(GL_RG16),
+    m_pixelFmtGrads(GL_UNSIGNED_SHORT),
     m_isCompressed(false),
     m_lightingEnabled(true),
     m_numBricksUploaded(0)
@@ -94,14 +107,14 @@ bool BrickPool::init(size_t brickDimX,
     size_t gradientTextureBrickSize =  (m_brickDimX + m_borderVoxels) 
                                      * (m_brickDimY + m_borderVoxels) 
                                      * (m_brickDimZ + m_borderVoxels) 
-                                     * sizeof(vox::Vec3f);
+                                     * sizeof(vox::OctNormal);
 
     m_dimX = (m_brickDimX + m_borderVoxels) * dimX;
     m_dimY = (m_brickDimY + m_borderVoxels) * dimY;
     m_dimZ = (m_brickDimZ + m_borderVoxels) * dimZ;
 
     //size_t colorTextureSize = m_dimX * m_dimY * m_dimZ * sizeof(vox::Vec4ub);
-    //size_t gradientTextureSize = m_dimX * m_dimY * m_dimZ * sizeof(vox::Vec3f);
+    //size_t gradientTextureSize = m_dimX * m_dimY * m_dimZ * sizeof(vox::OctNormal);
 
     m_colorTextureID = voxOpenGL::GLUtils::Create3DTexture(m_internalTexFmtColors,
 													       m_dimX,
@@ -117,11 +130,11 @@ bool BrickPool::init(size_t brickDimX,
 													          m_dimX,
 													          m_dimY,
 													          m_dimZ,
-													          GL_RGB,
+													          GetGradientPixelFormat(m_internalTexFmtGrads),
 													          m_pixelFmtGrads,
 													          NULL,
 													          false,
-                                                              true);
+                                                              UseGradientInterpolation(m_internalTexFmtGrads));
 
     m_pboSize = (colorTextureBrickSize + gradientTextureBrickSize) * numPboBricks;
     //use this to initialize the pbo
@@ -211,11 +224,11 @@ bool BrickPool::initSpecial(GLint internalTexFmtColors,
 													              m_dimX,
 													              m_dimY,
 													              m_dimZ,
-													              GL_RGB,
+													              GetGradientPixelFormat(m_internalTexFmtGrads),
 													              m_pixelFmtGrads,
 													              NULL,
 													              false,
-                                                                  true);
+                                                                  UseGradientInterpolation(m_internalTexFmtGrads));
         GLint compressedSizeNormals;
 		glGetTexLevelParameteriv(GL_TEXTURE_3D, 
                                  0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB, &compressedSizeNormals);
@@ -545,8 +558,8 @@ void BrickPool::uploadPBOToTextures()
                             copyOp.xSize,
                             copyOp.ySize,
                             copyOp.zSize,
-                            GL_RGB,
-                            GL_FLOAT,
+                            GetGradientPixelFormat(m_internalTexFmtGrads),
+                            m_pixelFmtGrads,
                             (const GLvoid*)copyOp.pboOffset);
         }
     }
@@ -741,7 +754,7 @@ bool BrickPool::uploadBrick(GigaVoxelsOctTree::Node* pNode,
         vox::Vec4ub* pBrick = (vox::Vec4ub*)pFreeBrickNode->takeBrick();
         memset(pBrick, 0, pFreeBrickNode->getBrickColorsSize());
 
-        vox::Vec3f* pBrickGradients = (vox::Vec3f*)pFreeBrickNode->takeBrickGradients();
+        vox::OctNormal* pBrickGradients = (vox::OctNormal*)pFreeBrickNode->takeBrickGradients();
         memset(pBrickGradients, 0, pFreeBrickNode->getBrickGradientsSize());
 
         pNode->copyMipMapToBrick(pBrick, pBrickGradients);
@@ -0,0 +1,487 @@
+#include "GigaVoxels/GigaVoxelsNodeUsageListCompressor.h"
+
+#include "VoxVizCore/SlabThreads.h"
+
+using namespace gv;
+
+static const int k_NumNodeListItems = NodeUsageListCompressor::k_NumNodeLists
+                                       * NodeUsageListCompressor::k_NumComponentsPerList;
+
+//passes over fewer rows or keys than this run on the calling thread
+static const size_t k_MinRowsPerSlab = 16;
+static const size_t k_MinKeysPerSlab = 1024;
+
+//copies the 12 items of a pixel's lists into items[1..12] with the last item
+//copied in front and the first one after, so that items i, i-1 and i+1 of the
+//list are at i+1, i and i+2 like the shader's wrapping prev/next indices
+static void GetListItems(const unsigned int* pNodeUsageLists,
+                         size_t layerSize,
+                         size_t pixel,
+                         unsigned int items[k_NumNodeListItems + 2])
+{
+    for(int list = 0; list < NodeUsageListCompressor::k_NumNodeLists; ++list)
+    {
+        const unsigned int* pList = pNodeUsageLists + (((list * layerSize) + pixel) * 4);
+        for(int i = 0; i < NodeUsageListCompressor::k_NumComponentsPerList; ++i)
+            items[1 + (list * NodeUsageListCompressor::k_NumComponentsPerList) + i] = pList[i];
+    }
+    items[0] = items[k_NumNodeListItems];
+    items[k_NumNodeListItems + 1] = items[1];
+}
+
+//the lists of neighbors past the edges are empty
+static void ClearListItems(unsigned int items[k_NumNodeListItems + 2])
+{
+    for(int i = 0; i < k_NumNodeListItems + 2; ++i)
+        items[i] = 0u;
+}
+
+namespace
+{
+    //GenerateSelectionMask.frag and ComputeActiveTexels.frag for a range of rows
+    class SelectionMaskSlabTask : public vox::SlabTask
+    {
+    private:
+        const unsigned int* m_pNodeUsageLists;
+        int m_width;
+        int m_height;
+        unsigned int* m_pSelectionMask;
+        unsigned int* m_pActiveTexels;
+    public:
+        SelectionMaskSlabTask(const unsigned int* pNodeUsageLists,
+                              int width,
+                              int height,
+                              unsigned int* pSelectionMask,
+                              unsigned int* pActiveTexels) :
+            m_pNodeUsageLists(pNodeUsageLists),
+            m_width(width),
+            m_height(height),
+            m_pSelectionMask(pSelectionMask),
+            m_pActiveTexels(pActiveTexels)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            size_t layerSize = static_cast<size_t>(m_width) * m_height;
+
+            unsigned int items[k_NumNodeListItems + 2];
+            unsigned int topItems[k_NumNodeListItems + 2];
+            unsigned int topRightItems[k_NumNodeListItems + 2];
+            unsigned int rightItems[k_NumNodeListItems + 2];
+
+            for(int y = static_cast<int>(start); y < static_cast<int>(end); ++y)
+            {
+                //the 2x2 blocks of pixels record different ranges of the nodes
+                //they pass, so the pixels two away are compared
+                bool hasTop = y < m_height - 2;
+
+                for(int x = 0; x < m_width; ++x)
+                {
+                    size_t pixel = (static_cast<size_t>(y) * m_width) + x;
+                    unsigned int* pMask = m_pSelectionMask + (pixel * 4);
+                    pMask[0] = 0u;
+                    pMask[1] = static_cast<unsigned int>(x);
+                    pMask[2] = static_cast<unsigned int>(y);
+                    pMask[3] = 1u;
+
+                    GetListItems(m_pNodeUsageLists, layerSize, pixel, items);
+
+                    if(items[1] == 0u)
+                    {
+                        m_pActiveTexels[pixel] = 0u;
+                        continue;
+                    }
+
+                    bool hasRight = x < m_width - 2;
+
+                    if(hasTop)
+                        GetListItems(m_pNodeUsageLists, layerSize, pixel + (2 * m_width), topItems);
+                    else
+                        ClearListItems(topItems);
+
+                    if(hasTop && hasRight)
+                        GetListItems(m_pNodeUsageLists, layerSize, pixel + (2 * m_width) + 2, topRightItems);
+                    else
+                        ClearListItems(topRightItems);
+
+                    if(hasRight)
+                        GetListItems(m_pNodeUsageLists, layerSize, pixel + 2, rightItems);
+                    else
+                        ClearListItems(rightItems);
+
+                    //keep the items that none of the neighbors have at the same,
+                    //previous or next place in their lists
+                    unsigned int selectionBits = 0u;
+                    for(int i = 0; i < k_NumNodeListItems; ++i)
+                    {
+                        unsigned int nodeUsage = items[i + 1];
+                        unsigned int isShared = (nodeUsage == topItems[i]) | (nodeUsage == topItems[i + 1]) | (nodeUsage == topItems[i + 2])
+                                                | (nodeUsage == topRightItems[i]) | (nodeUsage == topRightItems[i + 1]) | (nodeUsage == topRightItems[i + 2])
+                                                | (nodeUsage == rightItems[i]) | (nodeUsage == rightItems[i + 1]) | (nodeUsage == rightItems[i + 2]);
+                        selectionBits |= (isShared ^ 1u) << i;
+                    }
+
+                    //a zero item ends the list
+                    int listLength = 1;
+                    while(listLength < k_NumNodeListItems && items[listLength + 1] != 0u)
+                        ++listLength;
+                    selectionBits &= (1u << listLength) - 1u;
+
+                    pMask[0] = selectionBits;
+                    m_pActiveTexels[pixel] = selectionBits != 0u ? 1u : 0u;
+                }
+            }
+        }
+    };
+
+    //GenerateHistoPyramid.frag for a range of rows of one level. Each texel sums
+    //its 2x2 block in the level below, the texels in the last row and column
+    //also take in the odd row and column left over below them.
+    class HistoPyramidSlabTask : public vox::SlabTask
+    {
+    private:
+        const unsigned int* m_pInput;
+        int m_inputWidth;
+        int m_inputHeight;
+        unsigned int* m_pOutput;
+        int m_outputWidth;
+
+        unsigned int fetch(int x, int y) const
+        {
+            if(x >= m_inputWidth || y >= m_inputHeight)
+                return 0u;
+            return m_pInput[(static_cast<size_t>(y) * m_inputWidth) + x];
+        }
+    public:
+        HistoPyramidSlabTask(const unsigned int* pInput,
+                             int inputWidth,
+                             int inputHeight,
+                             unsigned int* pOutput,
+                             int outputWidth) :
+            m_pInput(pInput),
+            m_inputWidth(inputWidth),
+            m_inputHeight(inputHeight),
+            m_pOutput(pOutput),
+            m_outputWidth(outputWidth)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            for(int y = static_cast<int>(start); y < static_cast<int>(end); ++y)
+            {
+                unsigned int* pRow = m_pOutput + (static_cast<size_t>(y) * m_outputWidth);
+
+                if(m_inputWidth >= 2 && m_inputHeight >= 2)
+                {
+                    const unsigned int* pInputRow0 = m_pInput + (static_cast<size_t>(2 * y) * m_inputWidth);
+                    const unsigned int* pInputRow1 = pInputRow0 + m_inputWidth;
+                    for(int x = 0; x < m_outputWidth; ++x)
+                    {
+                        pRow[x] = pInputRow0[2 * x] + pInputRow0[(2 * x) + 1]
+                                  + pInputRow1[(2 * x) + 1] + pInputRow1[2 * x];
+                    }
+                }
+                else
+                {
+                    //a level 1 texel wide or high, the second texel is past the edge
+                    for(int x = 0; x < m_outputWidth; ++x)
+                    {
+                        pRow[x] = fetch(2 * x, 2 * y) + fetch((2 * x) + 1, 2 * y)
+                                  + fetch((2 * x) + 1, (2 * y) + 1) + fetch(2 * x, (2 * y) + 1);
+                    }
+                }
+
+                int extraY = (2 * y) + 2;
+                if(extraY == m_inputHeight - 1)
+                {
+                    for(int x = 0; x < m_outputWidth; ++x)
+                    {
+                        pRow[x] += fetch(2 * x, extraY) + fetch((2 * x) + 1, extraY);
+
+                        int extraX = (2 * x) + 2;
+                        if(extraX == m_inputWidth - 1)
+                        {
+                            pRow[x] += fetch(extraX, extraY) + fetch(extraX, extraY - 1)
+                                       + fetch(extraX, extraY - 2);
+                        }
+                    }
+                }
+                else
+                {
+                    int x = m_outputWidth - 1;
+                    int extraX = (2 * x) + 2;
+                    if(extraX == m_inputWidth - 1)
+                        pRow[x] += fetch(extraX, extraY - 1) + fetch(extraX, extraY - 2);
+                }
+            }
+        }
+    };
+
+    //CompressNodeUsageList.frag for a range of keys, every key walks down the
+    //histo pyramid to the active texel it is the index of
+    class CompressSlabTask : public vox::SlabTask
+    {
+    private:
+        struct Level
+        {
+            const unsigned int* pCounts;
+            int width;
+            int height;
+        };
+
+        std::vector<Level> m_levels;
+        const unsigned int* m_pSelectionMask;
+        const unsigned int* m_pNodeUsageLists;
+        int m_width;
+        int m_height;
+        int m_maxNodesToPush;
+        unsigned int* m_pOutput;
+
+        unsigned int fetch(int level, int x, int y) const
+        {
+            const Level& lvl = m_levels[level];
+            if(x >= lvl.width || y >= lvl.height)
+                return 0u;
+            return lvl.pCounts[(static_cast<size_t>(y) * lvl.width) + x];
+        }
+
+        void compress(unsigned int key, unsigned int* pUniqueNodeUsage) const
+        {
+            //defines how to walk through a 2x2 block of texels and the odd row
+            //and column after it
+            static const int k_SameLevelTraversalIncr[9][2] =
+            {
+                { 1, 0 }, { -1, 1 }, { 1, 0 },
+                { -1, 1 }, { 1, 0 }, { 1, 0 }, { 0, -1 }, { 0, -1 }, { 0, 0 }
+            };
+
+            unsigned int start = 0u;
+            int texCoordX = 0;
+            int texCoordY = 0;
+            int texSizeX = 1;
+            int texSizeY = 1;
+            int pyramidLevel = static_cast<int>(m_levels.size()) - 1;
+            int curLevelLoopCount = 0;
+
+            unsigned int end = 0u;
+            while(pyramidLevel >= 0)
+            {
+                end = start + fetch(pyramidLevel, texCoordX, texCoordY);
+
+                if(key >= start && key < end)
+                {
+                    --pyramidLevel;
+                    curLevelLoopCount = 0;
+                    texCoordX <<= 1;
+                    texCoordY <<= 1;
+                    if(pyramidLevel >= 0)
+                    {
+                        texSizeX = m_levels[pyramidLevel].width;
+                        texSizeY = m_levels[pyramidLevel].height;
+                    }
+                }
+                else
+                {
+                    texCoordX += k_SameLevelTraversalIncr[curLevelLoopCount][0];
+                    texCoordY += k_SameLevelTraversalIncr[curLevelLoopCount][1];
+                    ++curLevelLoopCount;
+                    if(curLevelLoopCount == 4 && texCoordY != texSizeY-1)
+                    {
+                        curLevelLoopCount = 7;
+                        texCoordX += 2;
+                        texCoordY -= 1;
+                    }
+
+                    if(curLevelLoopCount >= 6 && texCoordX != texSizeX-1)
+                        curLevelLoopCount = 9;
+
+                    start = end;
+                    if(curLevelLoopCount == 9)
+                    {
+                        //the shader's way out of a broken pyramid
+                        pUniqueNodeUsage[0] = start;
+                        pUniqueNodeUsage[1] = end;
+                        pUniqueNodeUsage[2] = key;
+                        pUniqueNodeUsage[3] = static_cast<unsigned int>(pyramidLevel);
+                        return;
+                    }
+                }
+            }
+
+            texCoordX >>= 1;
+            texCoordY >>= 1;
+
+            const unsigned int* pMask = m_pSelectionMask + (((static_cast<size_t>(texCoordY) * m_width) + texCoordX) * 4);
+            unsigned int selectionMaskBits = pMask[0];
+            size_t pixel = (static_cast<size_t>(pMask[2]) * m_width) + pMask[1];
+            size_t layerSize = static_cast<size_t>(m_width) * m_height;
+
+            for(int i = 0; i < 4; ++i)
+                pUniqueNodeUsage[i] = 0u;
+
+            //later items overwrite the first ones when more than 4 are pushed
+            int pushedNodes = 0;
+            for(int itemIndex = 0;
+                itemIndex < k_NumNodeListItems
+                && selectionMaskBits != 0u
+                && pushedNodes < m_maxNodesToPush;
+                ++itemIndex, selectionMaskBits >>= 1u)
+            {
+                if((selectionMaskBits & 1u) != 0u)
+                {
+                    int list = itemIndex / NodeUsageListCompressor::k_NumComponentsPerList;
+                    int component = itemIndex % NodeUsageListCompressor::k_NumComponentsPerList;
+                    pUniqueNodeUsage[pushedNodes % 4] = m_pNodeUsageLists[(((list * layerSize) + pixel) * 4) + component];
+
+                    ++pushedNodes;
+                }
+            }
+        }
+    public:
+        CompressSlabTask(const unsigned int* pSelectionMask,
+                         const unsigned int* pNodeUsageLists,
+                         int width,
+                         int height,
+                         int maxNodesToPush,
+                         unsigned int* pOutput) :
+            m_pSelectionMask(pSelectionMask),
+            m_pNodeUsageLists(pNodeUsageLists),
+            m_width(width),
+            m_height(height),
+            m_maxNodesToPush(maxNodesToPush),
+            m_pOutput(pOutput)
+        {
+        }
+
+        void addLevel(const unsigned int* pCounts, int width, int height)
+        {
+            Level level;
+            level.pCounts = pCounts;
+            level.width = width;
+            level.height = height;
+            m_levels.push_back(level);
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            for(size_t key = start; key < end; ++key)
+                compress(static_cast<unsigned int>(key), m_pOutput + (key * 4));
+        }
+    };
+}
+
+NodeUsageListCompressor::NodeUsageListCompressor() :
+    m_width(0),
+    m_height(0)
+{
+}
+
+void NodeUsageListCompressor::generateSelectionMask(const unsigned int* pNodeUsageLists)
+{
+    size_t pixelCount = static_cast<size_t>(m_width) * m_height;
+    m_selectionMask.resize(pixelCount * 4);
+
+    PyramidLevel& activeTexels = m_histoPyramid[0];
+    activeTexels.counts.resize(pixelCount);
+
+    SelectionMaskSlabTask task(pNodeUsageLists,
+                               m_width,
+                               m_height,
+                               &m_selectionMask[0],
+                               &activeTexels.counts[0]);
+
+    vox::SlabThreads::Run(task, m_height, k_MinRowsPerSlab);
+}
+
+void NodeUsageListCompressor::generateHistoPyramid()
+{
+    for(size_t level = 1; level < m_histoPyramid.size(); ++level)
+    {
+        const PyramidLevel& input = m_histoPyramid[level - 1];
+        PyramidLevel& output = m_histoPyramid[level];
+        output.counts.resize(static_cast<size_t>(output.width) * output.height);
+
+        HistoPyramidSlabTask task(&input.counts[0],
+                                  input.width,
+                                  input.height,
+                                  &output.counts[0],
+                                  output.width);
+
+        vox::SlabThreads::Run(task, output.height, k_MinRowsPerSlab);
+    }
+}
+
+void NodeUsageListCompressor::compressNodeUsageList(const unsigned int* pNodeUsageLists,
+                                                    unsigned int listLength,
+                                                    int maxNodesToPush)
+{
+    m_compressedList.resize(static_cast<size_t>(listLength) * 4);
+    if(listLength == 0)
+        return;
+
+    CompressSlabTask task(&m_selectionMask[0],
+                          pNodeUsageLists,
+                          m_width,
+                          m_height,
+                          maxNodesToPush,
+                          &m_compressedList[0]);
+
+    for(size_t level = 0; level < m_histoPyramid.size(); ++level)
+    {
+        const PyramidLevel& pyramidLevel = m_histoPyramid[level];
+        task.addLevel(&pyramidLevel.counts[0], pyramidLevel.width, pyramidLevel.height);
+    }
+
+    vox::SlabThreads::Run(task, listLength, k_MinKeysPerSlab);
+}
+
+unsigned int NodeUsageListCompressor::compress(const unsigned int* pNodeUsageLists,
+                                               int width,
+                                               int height,
+                                               int maxNodesToPush)
+{
+    m_compressedList.clear();
+
+    if(pNodeUsageLists == NULL || width <= 0 || height <= 0)
+    {
+        m_width = m_height = 0;
+        m_selectionMask.clear();
+        m_histoPyramid.clear();
+        return 0;
+    }
+
+    m_width = width;
+    m_height = height;
+
+    //the levels shrink like the viewport does in GigaVoxelsRenderer
+    m_histoPyramid.clear();
+    while(true)
+    {
+        PyramidLevel level;
+        level.width = width;
+        level.height = height;
+        m_histoPyramid.push_back(level);
+
+        if(width == 1 && height == 1)
+            break;
+
+        if(width != 1)
+            width >>= 1;
+        if(height != 1)
+            height >>= 1;
+    }
+
+    generateSelectionMask(pNodeUsageLists);
+
+    generateHistoPyramid();
+
+    unsigned int listLength = m_histoPyramid.back().counts[0];
+    if(listLength > k_MaxListLength)
+        listLength = k_MaxListLength;
+
+    compressNodeUsageList(pNodeUsageLists, listLength, maxNodesToPush);
+
+    return listLength;
+}
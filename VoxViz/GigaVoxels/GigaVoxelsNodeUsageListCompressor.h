@@ -0,0 +1,89 @@
+#ifndef GIGA_VOXELS_NODE_USAGE_LIST_COMPRESSOR_H
+#define GIGA_VOXELS_NODE_USAGE_LIST_COMPRESSOR_H
+
+#include <cstddef>
+#include <vector>
+
+namespace gv
+{
+    //CPU version of the passes that turn the per pixel node usage lists written
+    //by the GigaVoxels shader into the compacted list of unique node usages that
+    //is read back for the node usage list processors. Runs the same steps as
+    //GenerateSelectionMask.frag, ComputeActiveTexels.frag, GenerateHistoPyramid.frag
+    //and CompressNodeUsageList.frag and gives the same list, each pass is spread
+    //over the SlabThreads.
+    class NodeUsageListCompressor
+    {
+    public:
+        static const int k_NumNodeLists = 3;
+        static const int k_NumComponentsPerList = 4;
+        //the renderer and the list processors never take longer lists
+        static const unsigned int k_MaxListLength = 32768;
+
+    private:
+        struct PyramidLevel
+        {
+            int width;
+            int height;
+            std::vector<unsigned int> counts;
+        };
+
+        int m_width;
+        int m_height;
+        //rgba texels of the selection mask, (bits, x, y, 1)
+        std::vector<unsigned int> m_selectionMask;
+        //level 0 is the active texels
+        std::vector<PyramidLevel> m_histoPyramid;
+        //rgba texels of up to 4 node usages each
+        std::vector<unsigned int> m_compressedList;
+
+        NodeUsageListCompressor(const NodeUsageListCompressor&);
+        NodeUsageListCompressor& operator=(const NodeUsageListCompressor&);
+
+        void generateSelectionMask(const unsigned int* pNodeUsageLists);
+        void generateHistoPyramid();
+        void compressNodeUsageList(const unsigned int* pNodeUsageLists,
+                                   unsigned int listLength,
+                                   int maxNodesToPush);
+    public:
+        NodeUsageListCompressor();
+
+        //pNodeUsageLists holds the 3 layers of width*height rgba lists, laid out
+        //like the node usage texture and GigaVoxelsShaderCodeTester::renderFrame's
+        //output. At most maxNodesToPush items of a pixel's list are kept, the
+        //renderer passes 4 * ((frame count % 3) + 1). Returns the list length.
+        unsigned int compress(const unsigned int* pNodeUsageLists,
+                              int width,
+                              int height,
+                              int maxNodesToPush);
+
+        //rgba texels like the compressed node usage list texture
+        const unsigned int* getCompressedList() const
+        {
+            return m_compressedList.empty() ? NULL : &m_compressedList[0];
+        }
+
+        unsigned int getCompressedListLength() const
+        {
+            return static_cast<unsigned int>(m_compressedList.size() / 4);
+        }
+
+        //the intermediate textures of the last compress
+        const unsigned int* getSelectionMask() const
+        {
+            return m_selectionMask.empty() ? NULL : &m_selectionMask[0];
+        }
+
+        size_t getHistoPyramidLevelCount() const { return m_histoPyramid.size(); }
+
+        const unsigned int* getHistoPyramidLevel(size_t level, int& width, int& height) const
+        {
+            const PyramidLevel& pyramidLevel = m_histoPyramid[level];
+            width = pyramidLevel.width;
+            height = pyramidLevel.height;
+            return &pyramidLevel.counts[0];
+        }
+    };
+};
+
+#endif
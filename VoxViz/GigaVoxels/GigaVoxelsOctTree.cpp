@@ -2,6 +2,8 @@
 
 #include "GigaVoxels/GigaVoxelsOctTreeNodePool.h"
 #include "GigaVoxels/GigaVoxelsBrickPool.h"
+#include "GigaVoxels/GigaVoxelsOctTreeCache.h"
+#include "GigaVoxels/GigaVoxelsNodeUsageListCompressor.h"
 
 #include "VoxVizOpenGL/GLUtils.h"
 #include "VoxVizCore/Referenced.h"
@@ -100,6 +102,7 @@ GigaVoxelsOctTree::GigaVoxelsOctTree() :
     m_brickDimZ(0),
     m_brickDataIsCompressed(false),
     m_brickGradientsAreUnsigned(false),
+    m_brickGradientsAreOctEncoded(false),
     m_rayStepSize(0.0f)
 {
     memset(m_pboIDs, 0, sizeof(m_pboIDs));
@@ -228,7 +231,7 @@ private:
             ++itr)
         {
             NodeUsageList& nodeUsageList = *itr;
-            nodeUsageList.size = 32768;
+            nodeUsageList.size = NodeUsageListCompressor::k_MaxListLength;
             nodeUsageList.pList = new NodeUsageListTexture[nodeUsageList.size];
         }
     }
@@ -328,9 +331,11 @@ public:
         mutex.unlock();
     }
 
+    //copies pList or, if it is NULL, reads the list from the bound pixel pack buffer
     void addNodeUsageList(NodeTree* pNodeTree,
                           unsigned int nodeUsageListLength,
-                          size_t frameIndex)
+                          size_t frameIndex,
+                          const NodeUsageListTexture* pList)
     {
         if(m_sharedNodeUsageListMutex.tryLock())
         {
@@ -347,10 +352,17 @@ public:
 
             NodeUsageList& nodeUsageList = m_nodeUsageListFreePool.front();
 
-            //memcpy(nodeUsageList.pList, pTexture, sizeof(NodeUsageListTexture) * nodeUsageListLength);
-            glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(NodeUsageListTexture) * nodeUsageListLength, nodeUsageList.pList);
+            GLenum errCode = 0;
+            if(pList != NULL)
+            {
+                memcpy(nodeUsageList.pList, pList, sizeof(NodeUsageListTexture) * nodeUsageListLength);
+            }
+            else
+            {
+                glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(NodeUsageListTexture) * nodeUsageListLength, nodeUsageList.pList);
 
-            GLenum errCode = glGetError();
+                errCode = glGetError();
+            }
             if(errCode != 0)
             {
                 std::cerr << "ERROR reading node usage list via glGetBufferSubData. OpenGLError=" 
@@ -432,7 +444,7 @@ public:
         GigaVoxelsOctTree::UploadRequestList localUploadRequestList;
         UniqueNodeUsageList localUniqueNodeUsageList;
         NodeUsageList nodeUsageList;
-        nodeUsageList.size = 32768;//32x32x32 - max number of nodes in 6 level tree
+        nodeUsageList.size = NodeUsageListCompressor::k_MaxListLength;//32x32x32 - max number of nodes in 6 level tree
         nodeUsageList.pList = new NodeUsageListTexture[nodeUsageList.size];
 
         while(m_notDone)
@@ -701,11 +713,13 @@ public:
 
     void addNodeUsageList(NodeTree* pNodeTree,
                           unsigned int nodeUsageListLength,
-                          size_t frameIndex)
+                          size_t frameIndex,
+                          const NodeUsageListTexture* pList=NULL)
     {
         m_workers[m_addToIndex].addNodeUsageList(pNodeTree, 
                                                  nodeUsageListLength, 
-                                                 frameIndex);
+                                                 frameIndex,
+                                                 pList);
         ++m_addToIndex;
         if(m_addToIndex == m_workers.size())
             m_addToIndex = 0;
@@ -809,7 +823,7 @@ GigaVoxelsOctTree::~GigaVoxelsOctTree()
 static void GetBoxFilterAverage(vox::Vec4ub& avgUChar,
                                 vox::Vec3f& avgGrad,
                                 const vox::Vec4ub* pVoxels,
-                                const vox::Vec3f* pVoxelGrads,
+                                const vox::OctNormal* pVoxelGrads,
                                 size_t dimX, size_t dimY, size_t dimZ,
                                 size_t startX, size_t startY, size_t startZ,
                                 size_t sampleX, size_t sampleY, size_t sampleZ)
@@ -857,7 +871,9 @@ static void GetBoxFilterAverage(vox::Vec4ub& avgUChar,
                 avg.b += voxelColor.b;
                 avg.a += voxelColor.a;
 
-                const vox::Vec3f& voxelGrad = pVoxelGrads[(z * dimY * dimX) + (y * dimX) + x];
+                vox::Vec3f voxelGrad;
+                vox::DecodeOctNormal(pVoxelGrads[(z * dimY * dimX) + (y * dimX) + x],
+                                     voxelGrad.x, voxelGrad.y, voxelGrad.z);
 
                 avgGrad.x += voxelGrad.x;
                 avgGrad.y += voxelGrad.y;
@@ -909,16 +925,16 @@ static void GenerateMipMap(const MipMap& curLevelMipMap,
                            MipMap& nextLevelMipMap)
 {
     const vox::Vec4ub* pCurLevel = curLevelMipMap.pData;
-    const vox::Vec3f* pCurLevelGrads = curLevelMipMap.pGradientData;
+    const vox::OctNormal* pCurLevelGrads = curLevelMipMap.pGradientData;
 
     size_t nxtLvlSize = nxtDimX * nxtDimY * nxtDimZ;
 
     vox::Vec4ub* pNextLevel = 
         nextLevelMipMap.pData =
             new vox::Vec4ub[nxtLvlSize];
-    vox::Vec3f* pNextLevelGrads = 
+    vox::OctNormal* pNextLevelGrads = 
         nextLevelMipMap.pGradientData =
-            new vox::Vec3f[nxtLvlSize];
+            new vox::OctNormal[nxtLvlSize];
 
     float scaleX = static_cast<float>(curDimX) / static_cast<float>(nxtDimX);
     float scaleY = static_cast<float>(curDimY) / static_cast<float>(nxtDimY);
@@ -953,7 +969,9 @@ static void GenerateMipMap(const MipMap& curLevelMipMap,
                                     static_cast<size_t>(scaleZ));
 
                 pNextLevel[(nxtZ * nxtDimY * nxtDimX) + (nxtY * nxtDimX) + nxtX] = avg;
-                pNextLevelGrads[(nxtZ * nxtDimY * nxtDimX) + (nxtY * nxtDimX) + nxtX] = Normalize(avgGrad);
+                Normalize(avgGrad);
+                pNextLevelGrads[(nxtZ * nxtDimY * nxtDimX) + (nxtY * nxtDimX) + nxtX] = 
+                    vox::EncodeOctNormal(avgGrad.x, avgGrad.y, avgGrad.z);
             }
         }
     }
@@ -963,7 +981,7 @@ void Scale3DImage(MipMap& fullMipMap,
                   size_t scaleX, size_t scaleY, size_t scaleZ)
 {
     vox::Vec4ub* pScaledData = new vox::Vec4ub[scaleX * scaleY * scaleZ];
-    vox::Vec3f* pScaledGradients = new vox::Vec3f[scaleX * scaleY * scaleZ];
+    vox::OctNormal* pScaledGradients = new vox::OctNormal[scaleX * scaleY * scaleZ];
 
     float scalePctX = static_cast<float>(scaleX) / static_cast<float>(fullMipMap.dimX);
     float scalePctY = static_cast<float>(scaleY) / static_cast<float>(fullMipMap.dimY);
@@ -1048,7 +1066,7 @@ static void GenerateMipMaps(const vox::VolumeDataSet* pVoxels,
 
     size_t voxelCount = fullMipMap.dimX * fullMipMap.dimY * fullMipMap.dimZ;
     fullMipMap.pData = new vox::Vec4ub[voxelCount];
-    fullMipMap.pGradientData = new vox::Vec3f[voxelCount];
+    fullMipMap.pGradientData = new vox::OctNormal[voxelCount];
     
     pVoxels->convert(colorLUT, 
                      fullMipMap.pData,
@@ -1422,19 +1440,19 @@ size_t GigaVoxelsOctTree::Node::getBrickGradientsSize() const
         return m_gradientsDataSize;
 
     size_t count = m_brickDimX * m_brickDimY * m_brickDimZ;
-    return sizeof(vox::Vec3f) * count;
+    return sizeof(vox::OctNormal) * count;
 }
 
 void GigaVoxelsOctTree::Node::copyMipMapToBrick(vox::Vec4ub* pBrick,
-                                                vox::Vec3f* pBrickGradients)
+                                                vox::OctNormal* pBrickGradients)
 {
-    const MipMap& mipMap = *m_pMipMap;
-
     m_pBrick = (char*)pBrick;
     m_pBrickGradients = (char*)pBrickGradients;
 
+    const MipMap& mipMap = *m_pMipMap;
+
     vox::Vec4ub* pWriteTexture = pBrick;
-    vox::Vec3f* pWriteGradTexture = pBrickGradients;
+    vox::OctNormal* pWriteGradTexture = pBrickGradients;
 
     if(m_mipMapStartX == 0)
     {
@@ -1459,7 +1477,7 @@ void GigaVoxelsOctTree::Node::copyMipMapToBrick(vox::Vec4ub* pBrick,
     for(size_t zIdx = m_mipMapStartZ; zIdx < m_mipMapEndZ; ++zIdx)
     {
         vox::Vec4ub* pSubWriteTexture = pWriteTexture;
-        vox::Vec3f* pSubWriteGradTexture = pWriteGradTexture;
+        vox::OctNormal* pSubWriteGradTexture = pWriteGradTexture;
 
         for(size_t yIdx = m_mipMapStartY; yIdx < m_mipMapEndY; ++yIdx)
         {
@@ -1474,16 +1492,16 @@ void GigaVoxelsOctTree::Node::copyMipMapToBrick(vox::Vec4ub* pBrick,
 
             pSubWriteTexture += m_brickDimX;
 
-            vox::Vec3f* pGradData = &mipMap.pGradientData[dataIndex];
+            const vox::OctNormal* pGradData = &mipMap.pGradientData[dataIndex];
                 
             memcpy(pSubWriteGradTexture, 
-                   pGradData, sizeof(vox::Vec3f) * brickDimX);
+                   pGradData, sizeof(vox::OctNormal) * brickDimX);
 
             pSubWriteGradTexture += m_brickDimX;
         }
 
         pWriteTexture += (m_brickDimX * m_brickDimY);
-        pWriteGradTexture += (m_brickDimX * m_brickDimZ);
+        pWriteGradTexture += (m_brickDimX * m_brickDimY);
     }
 }
 
@@ -1612,10 +1630,13 @@ void GigaVoxelsOctTree::Node::setConstantValue(float red, float green, float blu
 {
     vox::Vec4ub constValue;
 
-    constValue.r = static_cast<unsigned char>(red * 255.0f);
-    constValue.g = static_cast<unsigned char>(green * 255.0f);
-    constValue.b = static_cast<unsigned char>(blue * 255.0f);
-    constValue.a = static_cast<unsigned char>(alpha * 255.0f);
+    constValue.r = static_cast<unsigned char>((red * 255.0f) + 0.5f);
+    constValue.g = static_cast<unsigned char>((green * 255.0f) + 0.5f);
+    constValue.b = static_cast<unsigned char>((blue * 255.0f) + 0.5f);
+    constValue.a = static_cast<unsigned char>((alpha * 255.0f) + 0.5f);
+
+    unsigned char* pConstBits = reinterpret_cast<unsigned char*>(&m_pData[4]);
+    memcpy(pConstBits, &constValue, sizeof(vox::Vec4ub));
 
     setNodeTypeFlag(CONSTANT_NODE);
 }
@@ -1633,7 +1654,7 @@ void GigaVoxelsOctTree::Node::allocateBrickGradients(size_t gradSize)
     if(m_pBrickGradients != NULL)
         delete [] m_pBrickGradients;
 
-    m_pBrickGradients = (char*)new vox::Vec3f[gradSize];
+    m_pBrickGradients = new char[gradSize];
 }
 
 void BuildNodeTree(GigaVoxelsOctTree::Node* pNode, 
@@ -1654,16 +1675,22 @@ void BuildNodeTree(GigaVoxelsOctTree::Node* pNode,
 }
 
 void GigaVoxelsOctTree::build(const vox::VolumeDataSet* pVoxels,
-                              const vox::VolumeDataSet::ColorLUT& colorLUT)
+                              const vox::VolumeDataSet::ColorLUT& colorLUT,
+                              const std::string& cacheFile)
 {
     size_t brickDimX;
     size_t brickDimY;
     size_t brickDimZ;
 
-    GenerateMipMaps(pVoxels, colorLUT, brickDimX, brickDimY, brickDimZ, m_mipMaps);
+    if(!GigaVoxelsOctTreeCache::Load(cacheFile, brickDimX, brickDimY, brickDimZ, m_mipMaps))
+    {
+        GenerateMipMaps(pVoxels, colorLUT, brickDimX, brickDimY, brickDimZ, m_mipMaps);
+        GigaVoxelsOctTreeCache::Store(cacheFile, brickDimX, brickDimY, brickDimZ, m_mipMaps);
+    }
     //const_cast<vox::VolumeDataSet*>(pVoxels)->freeVoxels();
 
-    setBrickParams(brickDimX, brickDimY, brickDimZ);
+    //mipmap gradients are always octahedral encoded
+    setBrickParams(brickDimX, brickDimY, brickDimZ, false, false, true);
 
     m_depth = m_mipMaps.size();
     
@@ -1849,6 +1876,29 @@ void GigaVoxelsOctTree::update()
 
 #include <QtCore/QElapsedTimer>
 
+void GigaVoxelsOctTree::addNodeUsageList(const unsigned int* pCompressedList,
+                                         unsigned int listLength)
+{
+    if(pCompressedList == NULL || listLength == 0)
+        return;
+
+    if(NodeUsageListProcessorManager::instance().getWorkerCount() == 0)
+    {
+        std::cerr << "ERROR: GigaVoxelsOctTree::addNodeUsageList called before the node usage list processors were started." << std::endl;
+        return;
+    }
+
+    if(listLength > NodeUsageListCompressor::k_MaxListLength)
+        listLength = NodeUsageListCompressor::k_MaxListLength;
+
+    ++m_updateCount;
+
+    NodeUsageListProcessorManager::instance().addNodeUsageList(m_spNodeTree.get(),
+                                                               listLength,
+                                                               m_updateCount,
+                                                               reinterpret_cast<const NodeUsageListTexture*>(pCompressedList));
+}
+
 void GigaVoxelsOctTree::updateNodeUsageListProcessor()
 {
     NodeUsageListParams& writeList = m_compressedNodeUsageList[m_compressedNodeUsageListWrite];
@@ -1945,12 +1995,12 @@ void GigaVoxelsOctTree::updateNodeUsageListProcessor()
         
         if(errCode == 0)// && pNodeUsageTexture != NULL)
         {
-            if(m_nodeUsageListLengths[m_pboNUReadIndex] > 32768)
+            if(m_nodeUsageListLengths[m_pboNUReadIndex] > NodeUsageListCompressor::k_MaxListLength)
             {
                 //std::cerr << "ERROR reading node usage list? Length="
                 //          << m_nodeUsageListLengths[m_pboNUReadIndex]
                 //          << std::endl;
-                m_nodeUsageListLengths[m_pboNUReadIndex] = 32768;
+                m_nodeUsageListLengths[m_pboNUReadIndex] = NodeUsageListCompressor::k_MaxListLength;
             }
             //else
             {
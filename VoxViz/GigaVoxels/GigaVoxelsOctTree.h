@@ -26,7 +26,7 @@ namespace gv
         size_t dimZ;
         
         vox::Vec4ub* pData;
-        vox::Vec3f* pGradientData;
+        vox::OctNormal* pGradientData;
 
         MipMap() : dimX(0), dimY(0), dimZ(0), pData(NULL) {}
     };
@@ -226,7 +226,7 @@ namespace gv
             size_t getChildNodeBlockIndex() const { return m_childNodeBlockIndex; }
 
             void copyMipMapToBrick(vox::Vec4ub* pBrick,
-                                   vox::Vec3f* pBrickGradients);
+                                   vox::OctNormal* pBrickGradients);
 
             const char* getBrick() const { return m_pBrick; }
             const char* getBrickGradients() const { return m_pBrickGradients; }
@@ -385,6 +385,7 @@ namespace gv
         size_t m_brickDimZ;
         bool m_brickDataIsCompressed;
         bool m_brickGradientsAreUnsigned;
+        bool m_brickGradientsAreOctEncoded;//vox::OctNormal rather than rgb
         float m_rayStepSize;//ray step size in voxel texture space (0 - 1)
         std::string m_filename;
     public:
@@ -399,8 +400,11 @@ namespace gv
         void setFilename(const std::string& filename) { m_filename = filename; }
         const std::string& getFilename() const { return m_filename; }
 
+        //the mip maps are read from cacheFile if it holds them, otherwise they
+        //are generated and stored in it (see GigaVoxelsOctTreeCache)
         void build(const vox::VolumeDataSet* pVoxels,
-                   const vox::VolumeDataSet::ColorLUT& colorLUT);
+                   const vox::VolumeDataSet::ColorLUT& colorLUT,
+                   const std::string& cacheFile=std::string());
 
         void createNodeUsageTextures(int width, int height);
 
@@ -428,6 +432,12 @@ namespace gv
         void asyncDownloadCompressedNodeUsageListLength(int histoPyramidRenderLevel);
         unsigned int getDownloadedCompressedNodeUsageListLength(unsigned int& histoPyramidReadID);
 
+        //hands a compressed node usage list made on the CPU (see
+        //NodeUsageListCompressor) to the node usage list processors like the
+        //list read back from the GPU each update
+        void addNodeUsageList(const unsigned int* pCompressedList,
+                              unsigned int listLength);
+
         NodeUsageListParams& getWriteCompressedNodeUsageList()
         {
             return m_compressedNodeUsageList[m_compressedNodeUsageListWrite];
@@ -445,17 +455,24 @@ namespace gv
             return m_brickGradientsAreUnsigned;
         }
 
+        bool getBrickGradientsAreOctEncoded() const
+        {
+            return m_brickGradientsAreOctEncoded;
+        }
+
         void getBrickParams(size_t& brickDimX,
                             size_t& brickDimY,
                             size_t& brickDimZ,
                             bool& isCompressed,
-                            bool& brickGradientsAreUnsigned)
+                            bool& brickGradientsAreUnsigned,
+                            bool& brickGradientsAreOctEncoded)
         {  
             brickDimX = m_brickDimX;
             brickDimY = m_brickDimY;
             brickDimZ = m_brickDimZ;
             isCompressed = m_brickDataIsCompressed;
-            brickGradientsAreUnsigned = brickGradientsAreUnsigned;
+            brickGradientsAreUnsigned = m_brickGradientsAreUnsigned;
+            brickGradientsAreOctEncoded = m_brickGradientsAreOctEncoded;
         }
 
         float getRayStepSize() const { return m_rayStepSize; }
@@ -465,13 +482,15 @@ namespace gv
                             size_t brickDimY,
                             size_t brickDimZ,
                             bool isCompressed=false,
-                            bool gradientsAreUnsigned=false)
+                            bool gradientsAreUnsigned=false,
+                            bool gradientsAreOctEncoded=false)
         {
             m_brickDimX = brickDimX;
             m_brickDimY = brickDimY;
             m_brickDimZ = brickDimZ;
             m_brickDataIsCompressed = isCompressed;
             m_brickGradientsAreUnsigned = gradientsAreUnsigned;
+            m_brickGradientsAreOctEncoded = gradientsAreOctEncoded;
         }
 
         QVector3D getBrickPoolDimension() const;
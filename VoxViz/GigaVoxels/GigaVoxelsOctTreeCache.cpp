@@ -0,0 +1,316 @@
+#include "GigaVoxels/GigaVoxelsOctTreeCache.h"
+
+#include "VoxVizCore/DiskCache.h"
+#include "VoxVizOpenGL/GLExtensions.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QElapsedTimer>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace gv;
+
+//bump this whenever the mip map generation or the cache file layout changes
+//so that stale cache entries are not loaded
+static const int k_CacheVersion = 4;
+static const char k_CacheMagic[] = { 'G', 'V', 'M', 'C' };
+//must match the border voxels used by GigaVoxelsOctTree::build
+static const int k_BrickBorderVoxels = 2;
+//the least recently used entries of an input file are evicted beyond this
+static const quint64 k_MaxCacheBytes = 4ull * 1024 * 1024 * 1024;
+
+static bool s_cacheEnabled = true;
+
+void GigaVoxelsOctTreeCache::SetEnabled(bool flag)
+{
+    s_cacheEnabled = flag;
+}
+
+bool GigaVoxelsOctTreeCache::GetEnabled()
+{
+    return s_cacheEnabled;
+}
+
+template<typename T>
+static void AddToHash(QCryptographicHash& hash, const T& value)
+{
+    hash.addData(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+std::string GigaVoxelsOctTreeCache::GetCacheFile(const vox::VolumeDataSet* pVoxels,
+                                                 const vox::VolumeDataSet::ColorLUT& colorLUT)
+{
+    if(!s_cacheEnabled || pVoxels->getRawData() == NULL)
+        return std::string();
+
+    //hashing the voxels would take longer than some builds, the input file's
+    //size and time stamp change whenever its voxels do
+    unsigned long long fileSize = 0;
+    unsigned long long fileModified = 0;
+    if(!vox::DiskCache::GetFileStamp(pVoxels->getInputFile(), fileSize, fileModified))
+        return std::string();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    AddToHash(hash, k_CacheVersion);
+    AddToHash(hash, k_BrickBorderVoxels);
+    AddToHash(hash, fileSize);
+    AddToHash(hash, fileModified);
+
+    quint64 dimX = pVoxels->dimX();
+    quint64 dimY = pVoxels->dimY();
+    quint64 dimZ = pVoxels->dimZ();
+    AddToHash(hash, dimX);
+    AddToHash(hash, dimY);
+    AddToHash(hash, dimZ);
+
+    //16 bit volumes are classified through their value range
+    int voxelFormat = pVoxels->getVoxelFormat();
+    unsigned int valueMin = 0;
+    unsigned int valueMax = 0;
+    pVoxels->getVoxelValueRange(valueMin, valueMax);
+    AddToHash(hash, voxelFormat);
+    AddToHash(hash, valueMin);
+    AddToHash(hash, valueMax);
+
+    const vox::BoundingBox& bbox = pVoxels->getBoundingBox();
+    double extents[] = { bbox.xMin(), bbox.yMin(), bbox.zMin(),
+                         bbox.xMax(), bbox.yMax(), bbox.zMax() };
+    hash.addData(reinterpret_cast<const char*>(extents), sizeof(extents));
+
+    for(size_t i = 0; i < colorLUT.size(); ++i)
+    {
+        float color[] = { static_cast<float>(colorLUT[i].x()),
+                          static_cast<float>(colorLUT[i].y()),
+                          static_cast<float>(colorLUT[i].z()),
+                          static_cast<float>(colorLUT[i].w()) };
+        hash.addData(reinterpret_cast<const char*>(color), sizeof(color));
+    }
+
+    QString key(hash.result().toHex());
+
+    QFileInfo inputFileInfo(QString(pVoxels->getInputFile().c_str()));
+    QString cacheFile = inputFileInfo.absoluteFilePath() + ".gvcache/" + key + ".gvm";
+
+    return std::string(cacheFile.toAscii().data());
+}
+
+//brick settings are derived from the max 3d texture size, so entries
+//built for another limit are not loaded
+static qint32 GetMaxTexDim()
+{
+    GLint maxTexDim = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxTexDim);
+    return static_cast<qint32>(maxTexDim);
+}
+
+template<typename T>
+static bool ReadValue(QFile& file, T& value)
+{
+    return file.read(reinterpret_cast<char*>(&value), sizeof(T)) == sizeof(T);
+}
+
+template<typename T>
+static bool WriteValue(QFile& file, const T& value)
+{
+    return file.write(reinterpret_cast<const char*>(&value), sizeof(T)) == sizeof(T);
+}
+
+static bool ReadArray(QFile& file, void* pData, quint64 size)
+{
+    //read in chunks so that int overflow is not an issue for large mip maps
+    char* pRead = reinterpret_cast<char*>(pData);
+    static const quint64 k_ChunkSize = 64 * 1024 * 1024;
+    for(quint64 offset = 0; offset < size; offset += k_ChunkSize)
+    {
+        qint64 chunkSize = static_cast<qint64>(std::min(size - offset, k_ChunkSize));
+        if(file.read(pRead + offset, chunkSize) != chunkSize)
+            return false;
+    }
+    return true;
+}
+
+static bool WriteArray(QFile& file, const void* pData, quint64 size)
+{
+    const char* pWrite = reinterpret_cast<const char*>(pData);
+    static const quint64 k_ChunkSize = 64 * 1024 * 1024;
+    for(quint64 offset = 0; offset < size; offset += k_ChunkSize)
+    {
+        qint64 chunkSize = static_cast<qint64>(std::min(size - offset, k_ChunkSize));
+        if(file.write(pWrite + offset, chunkSize) != chunkSize)
+            return false;
+    }
+    return true;
+}
+
+bool GigaVoxelsOctTreeCache::Load(const std::string& cacheFile,
+                                  size_t& brickDimX,
+                                  size_t& brickDimY,
+                                  size_t& brickDimZ,
+                                  GigaVoxelsOctTree::MipMaps& mipMaps)
+{
+    if(cacheFile.empty())
+        return false;
+
+    QFile file(QString(cacheFile.c_str()));
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    char magic[sizeof(k_CacheMagic)];
+    int version = 0;
+    qint32 maxTexDim = 0;
+    quint32 brickDims[3];
+    quint32 levelCount = 0;
+    if(file.read(magic, sizeof(magic)) != sizeof(magic) ||
+       memcmp(magic, k_CacheMagic, sizeof(magic)) != 0 ||
+       !ReadValue(file, version) ||
+       version != k_CacheVersion ||
+       !ReadValue(file, maxTexDim) ||
+       !ReadValue(file, brickDims) ||
+       !ReadValue(file, levelCount) ||
+       levelCount == 0)
+    {
+        std::cerr << "WARNING: " << cacheFile << " is not an oct tree cache file." << std::endl;
+        return false;
+    }
+
+    if(maxTexDim != GetMaxTexDim())
+        return false;
+
+    GigaVoxelsOctTree::MipMaps cachedMipMaps;
+    bool readOk = true;
+    for(quint32 i = 0; i < levelCount && readOk; ++i)
+    {
+        quint64 dims[3];
+        if(!ReadValue(file, dims))
+        {
+            readOk = false;
+            break;
+        }
+
+        MipMap mipMap;
+        mipMap.dimX = static_cast<size_t>(dims[0]);
+        mipMap.dimY = static_cast<size_t>(dims[1]);
+        mipMap.dimZ = static_cast<size_t>(dims[2]);
+
+        quint64 voxelCount = dims[0] * dims[1] * dims[2];
+        //a corrupt header must not turn into a huge allocation
+        if(voxelCount == 0 ||
+           (voxelCount * (sizeof(vox::Vec4ub) + sizeof(vox::OctNormal))) >
+           static_cast<quint64>(file.size() - file.pos()))
+        {
+            readOk = false;
+            break;
+        }
+
+        mipMap.pData = new vox::Vec4ub[voxelCount];
+        mipMap.pGradientData = new vox::OctNormal[voxelCount];
+        cachedMipMaps.push_back(mipMap);
+
+        readOk = ReadArray(file, mipMap.pData, voxelCount * sizeof(vox::Vec4ub)) &&
+                 ReadArray(file, mipMap.pGradientData, voxelCount * sizeof(vox::OctNormal));
+    }
+
+    if(!readOk)
+    {
+        std::cerr << "WARNING: failed to read oct tree cache " << cacheFile << std::endl;
+        for(size_t i = 0; i < cachedMipMaps.size(); ++i)
+        {
+            delete [] cachedMipMaps[i].pData;
+            delete [] cachedMipMaps[i].pGradientData;
+        }
+        return false;
+    }
+
+    brickDimX = brickDims[0];
+    brickDimY = brickDims[1];
+    brickDimZ = brickDims[2];
+    mipMaps.insert(mipMaps.end(), cachedMipMaps.begin(), cachedMipMaps.end());
+
+    file.close();
+    vox::DiskCache::Touch(cacheFile);
+
+    std::cout << "Read oct tree cache " << cacheFile
+              << " in " << timer.elapsed() << " ms." << std::endl;
+
+    return true;
+}
+
+bool GigaVoxelsOctTreeCache::Store(const std::string& cacheFile,
+                                   size_t brickDimX,
+                                   size_t brickDimY,
+                                   size_t brickDimZ,
+                                   const GigaVoxelsOctTree::MipMaps& mipMaps)
+{
+    if(cacheFile.empty())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QFileInfo cacheFileInfo(QString(cacheFile.c_str()));
+    if(!QDir().mkpath(cacheFileInfo.absolutePath()))
+    {
+        std::cerr << "WARNING: failed to create oct tree cache directory "
+                  << cacheFileInfo.absolutePath().toAscii().data() << std::endl;
+        return false;
+    }
+
+    //write to a temporary file first so that an interrupted write
+    //never leaves behind a cache file that looks valid
+    QString tmpFile = cacheFileInfo.absoluteFilePath() + ".tmp";
+    QFile file(tmpFile);
+    bool writeOk = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    if(writeOk)
+    {
+        quint32 brickDims[] = { static_cast<quint32>(brickDimX),
+                                static_cast<quint32>(brickDimY),
+                                static_cast<quint32>(brickDimZ) };
+        quint32 levelCount = static_cast<quint32>(mipMaps.size());
+        writeOk = file.write(k_CacheMagic, sizeof(k_CacheMagic)) == sizeof(k_CacheMagic) &&
+                  WriteValue(file, k_CacheVersion) &&
+                  WriteValue(file, GetMaxTexDim()) &&
+                  WriteValue(file, brickDims) &&
+                  WriteValue(file, levelCount);
+
+        for(size_t i = 0; i < mipMaps.size() && writeOk; ++i)
+        {
+            const MipMap& mipMap = mipMaps[i];
+            quint64 dims[] = { mipMap.dimX, mipMap.dimY, mipMap.dimZ };
+            quint64 voxelCount = dims[0] * dims[1] * dims[2];
+            writeOk = WriteValue(file, dims) &&
+                      WriteArray(file, mipMap.pData, voxelCount * sizeof(vox::Vec4ub)) &&
+                      WriteArray(file, mipMap.pGradientData, voxelCount * sizeof(vox::OctNormal));
+        }
+        file.close();
+    }
+
+    if(!writeOk)
+    {
+        std::cerr << "WARNING: failed to write oct tree cache " << cacheFile << std::endl;
+        QFile::remove(tmpFile);
+        return false;
+    }
+
+    QFile::remove(cacheFileInfo.absoluteFilePath());
+    if(!QFile::rename(tmpFile, cacheFileInfo.absoluteFilePath()))
+    {
+        std::cerr << "WARNING: failed to rename oct tree cache " << cacheFile << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote oct tree cache " << cacheFile
+              << " in " << timer.elapsed() << " ms." << std::endl;
+
+    vox::DiskCache::Trim(cacheFile, k_MaxCacheBytes);
+
+    return true;
+}
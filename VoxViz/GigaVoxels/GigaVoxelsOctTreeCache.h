@@ -0,0 +1,46 @@
+#ifndef GV_GIGAVOXELS_OCTREE_CACHE_H
+#define GV_GIGAVOXELS_OCTREE_CACHE_H
+
+#include "VoxVizCore/VolumeDataSet.h"
+
+#include "GigaVoxels/GigaVoxelsOctTree.h"
+
+#include <string>
+
+namespace gv
+{
+    //on disk cache of the mip maps that GigaVoxelsOctTree::build generates from
+    //pvm/voxt data sets. Classifying the voxels and filtering the mip maps is what
+    //dominates building the tree, so a cached tree is rebuilt from its mip maps
+    //by the same code that built it. Each cache entry is a file named by a hash
+    //of the input file's size and time stamp, the transfer function and the
+    //volume's dimensions, see vox::DiskCache for how entries are evicted.
+    class GigaVoxelsOctTreeCache
+    {
+    public:
+        static void SetEnabled(bool flag);
+        static bool GetEnabled();
+
+        //returns the file that the mip maps generated from pVoxels and colorLUT
+        //are cached in, or an empty string if the data set can not be cached.
+        //Does not need a GL context.
+        static std::string GetCacheFile(const vox::VolumeDataSet* pVoxels,
+                                        const vox::VolumeDataSet::ColorLUT& colorLUT);
+
+        //returns false if cacheFile is empty, does not exist, can not be read or
+        //was built for another GL_MAX_3D_TEXTURE_SIZE
+        static bool Load(const std::string& cacheFile,
+                         size_t& brickDimX,
+                         size_t& brickDimY,
+                         size_t& brickDimZ,
+                         GigaVoxelsOctTree::MipMaps& mipMaps);
+
+        static bool Store(const std::string& cacheFile,
+                          size_t brickDimX,
+                          size_t brickDimY,
+                          size_t brickDimZ,
+                          const GigaVoxelsOctTree::MipMaps& mipMaps);
+    };
+}
+
+#endif
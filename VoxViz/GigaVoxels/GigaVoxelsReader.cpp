@@ -383,6 +383,7 @@ static GigaVoxelsOctTree* LoadGVX(QXmlStreamReader& xmlStream,
     bool isBinary = false;
     bool isCompressed = false;
     bool gradientsAreUnsigned = true;
+    bool gradientsAreOctEncoded = false;
     bool fullyParsed = false;
     
     std::string filePath = vox::DataSetReader::GetFilePath(filename);
@@ -415,14 +416,16 @@ static GigaVoxelsOctTree* LoadGVX(QXmlStreamReader& xmlStream,
             isBinary = (xmlStream.attributes().value("Binary").toString().compare("YES") == 0);
             isCompressed = (xmlStream.attributes().value("Compressed").toString().compare("YES") == 0);
 
-            //hard code for now
-            gradientsAreUnsigned = true;
+            //gradients are unsigned rgb unless stated otherwise
+            gradientsAreOctEncoded = (xmlStream.attributes().value("Gradients").toString().compare("OCTAHEDRAL") == 0);
+            gradientsAreUnsigned = !gradientsAreOctEncoded;
 
             spOctTree->setBrickParams(brickXSize,
                                       brickYSize,
                                       brickZSize,
                                       isCompressed,
-                                      gradientsAreUnsigned);
+                                      gradientsAreUnsigned,
+                                      gradientsAreOctEncoded);
 
             QVector3D max(min.x() + (delta.x() * xSize),
                           min.y() + (delta.y() * ySize),
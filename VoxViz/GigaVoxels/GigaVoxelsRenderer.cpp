@@ -1,6 +1,7 @@
 #include "GigaVoxels/GigaVoxelsRenderer.h"
 #include "GigaVoxels/GigaVoxelsSceneGraph.h"
 #include "GigaVoxels/GigaVoxelsReader.h"
+#include "GigaVoxels/GigaVoxelsOctTreeCache.h"
 #include "GigaVoxels/GigaVoxelsDatabasePager.h"
 #include "GigaVoxels/GigaVoxelsBrickPool.h"
 
@@ -46,12 +47,27 @@ static voxOpenGL::ShaderProgram* s_pComputeActiveTexelsShader = NULL;
 static voxOpenGL::ShaderProgram* s_pGenerateHistoPyramidShader = NULL;
 static voxOpenGL::ShaderProgram* s_pCompressNodeUsageListShader = NULL;
 static voxOpenGL::ShaderProgram* s_pDebugRendererShader = NULL;
+static std::string s_captureFile;
+static size_t s_captureFrame = 0;
+static bool s_compressNodeUsageListsOnCPU = false;
 
 void GigaVoxelsRenderer::RegisterRenderer()
 {
 	static vox::SmartPtr<GigaVoxelsRenderer> s_spRenderer = new GigaVoxelsRenderer();
 }
 
+void GigaVoxelsRenderer::SetCaptureFile(const std::string& filename,
+                                        size_t frameCount)
+{
+    s_captureFile = filename;
+    s_captureFrame = frameCount;
+}
+
+void GigaVoxelsRenderer::SetCompressNodeUsageListsOnCPU(bool flag)
+{
+    s_compressNodeUsageListsOnCPU = flag;
+}
+
 void GigaVoxelsRenderer::setup()
 {
     //create shader program
@@ -130,7 +146,7 @@ static void AddVertex(vox::FloatArray& vertexArray,
 
 bool GigaVoxelsRenderer::acceptsFileExtension(const std::string& ext) const
 {
-    return ext == "pvm" || ext == "voxt" || ext == "gvp" || ext == "gvx";
+    return ext == "pvm" || ext == "voxt" || ext == "voxc" || ext == "gvp" || ext == "gvx";
 }
 
 static void InitDrawVolumeShader(voxOpenGL::ShaderProgram* pDrawVolumeShader)
@@ -193,6 +209,7 @@ public:
     bool hasData;
     bool hasCompressedBricks;
     bool hasUnsignedGradients;
+    bool hasOctEncodedGradients;
     size_t brickDimX;
     size_t brickDimY;
     size_t brickDimZ;
@@ -215,6 +232,7 @@ public:
         hasData(false),
         hasCompressedBricks(false),
         hasUnsignedGradients(false),
+        hasOctEncodedGradients(false),
         vpWidth(vpW), 
         vpHeight(vpH),
         lightingEnabled(lightingEnabled) {}
@@ -228,7 +246,8 @@ public:
             node.getOctTree()->createNodeUsageTextures(vpWidth, vpHeight);
             node.getOctTree()->getBrickParams(brickDimX, brickDimY, brickDimZ,
                                                 hasCompressedBricks,
-                                                hasUnsignedGradients);
+                                                hasUnsignedGradients,
+                                                hasOctEncodedGradients);
 
             if(BrickPool::initialized() == false)
             {
@@ -272,8 +291,8 @@ public:
                     }
                     BrickPool::instance().initSpecial(GL_RGBA8,
                                                 GL_UNSIGNED_BYTE,
-                                                GL_RGB8,
-                                                GL_UNSIGNED_BYTE,
+                                                hasOctEncodedGradients ? GL_RG16 : GL_RGB8,
+                                                hasOctEncodedGradients ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE,
                                                 hasCompressedBricks,
                                                 brickDimX, brickDimY, brickDimZ,
                                                 poolDimX, poolDimY, poolDimZ,
@@ -433,7 +452,9 @@ void GigaVoxelsRenderer::init(vox::Camera& camera,
 
         GigaVoxelsOctTree* pSVO = new GigaVoxelsOctTree();
     
-        pSVO->build(pVoxels, colorLUT);
+        //reuses the mip maps built from this data set on a previous run
+        pSVO->build(pVoxels, colorLUT,
+                    GigaVoxelsOctTreeCache::GetCacheFile(pVoxels, colorLUT));
 
         pVoxels->setUserData(pSVO);
 
@@ -1066,6 +1087,16 @@ void GigaVoxelsRenderer::draw(vox::Camera& camera,
 		voxOpenGL::GLUtils::CheckOpenGLError();
         
         m_spFrameBufferObject->mapDrawBuffers(1);
+
+        if(s_compressNodeUsageListsOnCPU)
+        {
+            s_timer.startTimer("compressNodeUsageList");
+
+            compressNodeUsageListOnCPU(*spSVO.get(), camera);
+
+            s_timer.stopTimer("compressNodeUsageList");
+            continue;
+        }
     
         s_timer.startTimer("generateNodeUsageSelectionMask");
         //step 2 generate a selection mask used to
@@ -1169,7 +1200,8 @@ void GigaVoxelsRenderer::postDraw(vox::Camera& camera,
         {
             GigaVoxelsOctTree* pSVO = pDrawable->spOctTree.get();
 
-            compressNodeUsageList(*pSVO, camera);
+            if(!s_compressNodeUsageListsOnCPU)
+                compressNodeUsageList(*pSVO, camera);
 
             pDrawable->spOctTree = nullptr;
         }
@@ -1628,8 +1660,12 @@ void GigaVoxelsRenderer::drawVolume(vox::Camera& camera,
     }
 
     bool brickGradientsAreUnsigned = octTree.getBrickGradientsAreUnsigned();
+    bool brickGradientsAreOctEncoded = octTree.getBrickGradientsAreOctEncoded();
     if(getEnableLighting())
+    {
         m_pDrawVolumeShader->setUniformValue("GradientsAreUnsigned", brickGradientsAreUnsigned);
+        m_pDrawVolumeShader->setUniformValue("GradientsAreOctEncoded", brickGradientsAreOctEncoded);
+    }
 
     int octTreeDepthMinusOne = static_cast<int>(octTree.getDepth()) - 1;
     float leafNodeSize = 1.0f / std::pow(2.0f, static_cast<float>(octTreeDepthMinusOne));
@@ -1842,17 +1878,13 @@ void GigaVoxelsRenderer::drawVolume(vox::Camera& camera,
     //glDisable(GL_DEPTH_TEST);
 
     glEnable(GL_CULL_FACE);
-    bool runTest = false;
-    if(runTest)
+
+    if(!s_captureFile.empty() && camera.getFrameCount() >= s_captureFrame)
     {
-        vox::FloatArray& vertexArray = voxels.getFloatVertexArray();
-
-        GigaVoxelsShaderCodeTester::drawVolume(m_pDrawVolumeShader, 
-                                               &octTree,
-                                               vertexArray,
-                                               camera.getLook().x(),
-                                               camera.getLook().y(),
-                                               camera.getLook().z());
+        GigaVoxelsShaderCodeTester::captureOctTree(m_pDrawVolumeShader, &octTree);
+        if(GigaVoxelsShaderCodeTester::writeCapture(s_captureFile))
+            std::cout << "Wrote oct tree capture " << s_captureFile << std::endl;
+        s_captureFile.clear();
     }
 
     voxels.draw();
@@ -1864,7 +1896,10 @@ void GigaVoxelsRenderer::drawVolume(vox::Camera& camera,
         m_pCameraNearPlaneShader->bind();
 
         if(getEnableLighting())
+        {
             m_pCameraNearPlaneShader->setUniformValue("GradientsAreUnsigned", brickGradientsAreUnsigned);
+            m_pCameraNearPlaneShader->setUniformValue("GradientsAreOctEncoded", brickGradientsAreOctEncoded);
+        }
         m_pCameraNearPlaneShader->setUniformValue("MaxTreeTraversals", maxCount * 2);
         m_pCameraNearPlaneShader->setUniformValue("RootNodeIsConstant", rootNodeIsConstant);
 
@@ -1952,13 +1987,6 @@ void GigaVoxelsRenderer::generateNodeUsageSelectionMask(GigaVoxelsOctTree& octTr
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D_ARRAY, octTree.getNodeUsageTextureID());
 
-    /*bool runTest = false;
-    if(runTest)
-    {
-        GigaVoxelsShaderCodeTester::generateNodeUsageSelectionMask(s_pGenerateSelectionMaskShader,
-                                                                   nodeUsageTextureID);
-    }*/
-
     voxOpenGL::GLUtils::DrawScreenAlignedQuad();
 
     s_pGenerateSelectionMaskShader->release();
@@ -1984,19 +2012,6 @@ void GigaVoxelsRenderer::generateSelectionMaskHistoPyramid(GigaVoxelsOctTree& oc
     while(true)
     {
         voxOpenGL::GLUtils::CheckOpenGLError();
-        /*bool runTest = false;
-        if(runTest)
-        {
-            if(histoPyramidRenderLevel == 0)
-                GigaVoxelsShaderCodeTester::computeActiveTexels(m_selectionMaskTextureID);
-            else
-            {
-                
-                GigaVoxelsShaderCodeTester::generateSelectionMaskHistoPyramid(width, height,
-                                                                              histoPyramidTextureID,
-                                                                              histoPyramidRenderLevel-1);
-            }
-        }*/
 
         voxOpenGL::GLUtils::DrawScreenAlignedQuad();
 
@@ -2045,6 +2060,16 @@ void GigaVoxelsRenderer::generateSelectionMaskHistoPyramid(GigaVoxelsOctTree& oc
                                                   camera.getViewportHeight());
 }
 
+//there are potentially 12 items in the list
+//and we can hold 4 in the output so use a FIFO
+//to grab extra and push different amount depending
+//on frame number
+static int MaxNodesToPush(const vox::Camera& camera)
+{
+    int maxNodesPerPixel = 4;
+    return static_cast<int>(maxNodesPerPixel * ((camera.getFrameCount() % 3)+1));
+}
+
 void GigaVoxelsRenderer::compressNodeUsageList(GigaVoxelsOctTree& octTree, 
                                                vox::Camera& camera)
 {
@@ -2060,8 +2085,8 @@ void GigaVoxelsRenderer::compressNodeUsageList(GigaVoxelsOctTree& octTree,
 
     if(nodeUsageList.listLength > 0)
     {
-        if(nodeUsageList.listLength > 32768)
-            nodeUsageList.listLength = 32768;
+        if(nodeUsageList.listLength > NodeUsageListCompressor::k_MaxListLength)
+            nodeUsageList.listLength = NodeUsageListCompressor::k_MaxListLength;
 
         s_timer.startTimer("compressNodeUsageList");
         //std::cout << nodeUsageList.listLength << std::endl;
@@ -2091,25 +2116,7 @@ void GigaVoxelsRenderer::compressNodeUsageList(GigaVoxelsOctTree& octTree,
                                                             nodeUsageList.width);
         }
 
-        //there are potentially 12 items in the list
-        //and we can hold 4 in the output so use a FIFO
-        //to grab extra and push different amount depending
-        //on frame number
-        int maxNodesPerPixel = 4;
-        int maxNodesToPush = static_cast<int>(maxNodesPerPixel 
-                                                * ((camera.getFrameCount() % 3)+1));
-        s_pCompressNodeUsageListShader->setUniformValue("MaxNodesToPushThisFrame", maxNodesToPush);
-
-        /*bool runTest = false;
-        if(runTest)
-        {
-            GigaVoxelsShaderCodeTester::compressNodeUsageList(s_pCompressNodeUsageListShader,
-                                                                nodeUsageList.width,
-                                                                nodeUsageList.height,
-                                                                histoPyramidTextureID,
-                                                                octTree.getNodeUsageTextureID(),
-                                                                m_selectionMaskTextureID);
-        }*/
+        s_pCompressNodeUsageListShader->setUniformValue("MaxNodesToPushThisFrame", MaxNodesToPush(camera));
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, 
@@ -2132,4 +2139,39 @@ void GigaVoxelsRenderer::compressNodeUsageList(GigaVoxelsOctTree& octTree,
 
         s_timer.stopTimer("compressNodeUsageList");
     }
-}
\ No newline at end of file
+}
+
+void GigaVoxelsRenderer::compressNodeUsageListOnCPU(GigaVoxelsOctTree& octTree, 
+                                                    const vox::Camera& camera)
+{
+    int width, height;
+    camera.getViewportWidthHeight(width, height);
+
+    m_nodeUsageLists.resize(static_cast<size_t>(width) * height
+                            * NodeUsageListCompressor::k_NumNodeLists
+                            * NodeUsageListCompressor::k_NumComponentsPerList);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, octTree.getNodeUsageTextureID());
+
+    GLint depth;
+    voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D_ARRAY,
+                                                    width,
+                                                    height,
+                                                    depth,
+                                                    GL_RGBA_INTEGER,
+                                                    GL_UNSIGNED_INT,
+                                                    0,
+                                                    reinterpret_cast<unsigned char*>(&m_nodeUsageLists[0]));
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    //push the same number of nodes per pixel as compressNodeUsageList
+    unsigned int listLength = m_nodeUsageListCompressor.compress(&m_nodeUsageLists[0],
+                                                                 width,
+                                                                 height,
+                                                                 MaxNodesToPush(camera));
+
+    octTree.addNodeUsageList(m_nodeUsageListCompressor.getCompressedList(),
+                             listLength);
+}
@@ -10,6 +10,7 @@
 #include "GigaVoxels/GigaVoxelsOctTree.h"
 #include "GigaVoxels/GigaVoxelsDatabasePager.h"
 #include "GigaVoxels/GigaVoxelsDebugRenderer.h"
+#include "GigaVoxels/GigaVoxelsNodeUsageListCompressor.h"
 
 #include "NvUI/NvUI.h"
 
@@ -43,6 +44,8 @@ namespace gv
         Drawable* m_pUpdateList;
         DatabasePager* m_pDatabasePager;
         GigaVoxelsDebugRenderer m_debugRenderer;
+        NodeUsageListCompressor m_nodeUsageListCompressor;
+        std::vector<unsigned int> m_nodeUsageLists;
 
         //gui parameters
         float m_stateBtnTextSize;
@@ -79,6 +82,16 @@ namespace gv
     public:
 		static void RegisterRenderer();
 
+        //the oct tree drawn in the first frame numbered frameCount or later is
+        //captured and written to filename, so it can be rendered without a GPU
+        static void SetCaptureFile(const std::string& filename,
+                                   size_t frameCount);
+
+        //the node usage lists are read back and compressed by a
+        //NodeUsageListCompressor instead of the selection mask, histopyramid
+        //and compress shaders
+        static void SetCompressNodeUsageListsOnCPU(bool flag);
+
         GigaVoxelsRenderer();
 
         virtual bool acceptsFileExtension(const std::string& ext) const override;
@@ -122,6 +135,9 @@ namespace gv
 
         void compressNodeUsageList(GigaVoxelsOctTree& octTree,
                                    vox::Camera& camera);
+
+        void compressNodeUsageListOnCPU(GigaVoxelsOctTree& octTree,
+                                        const vox::Camera& camera);
     };
 };
 #endif
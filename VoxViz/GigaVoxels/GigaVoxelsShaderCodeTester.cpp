@@ -1,13 +1,21 @@
 #include "GigaVoxels/GigaVoxelsShaderCodeTester.h"
 
+#include "GigaVoxels/GigaVoxelsNodeUsageListCompressor.h"
 #include "VoxVizOpenGL/GLExtensions.h"
 #include "VoxVizOpenGL/GLUtils.h"
+#include "VoxVizCore/ScreenTiles.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QElapsedTimer>
 
 //#include <glm/core/setup.hpp>
 #define GLM_SWIZZLE GLM_SWIZZLE_FULL
 #include <glm/glm.hpp>
 
 #include <iostream>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 
 using namespace glm;
 
@@ -39,47 +47,35 @@ static void GigaVoxelsVertexShader(const glm::vec4& glVertex, glm::vec4& RayPosi
 //TODO deal with samplers
 //TODO set all uniforms
 
-struct usampler3D
-{
-    usampler3D() : w(0), h(0), d(0), data(NULL) {}
-    int w;
-    int h;
-    int d;
-    glm::uvec4* data;
-};
-
-typedef usampler3D usampler2DArray;
-
-struct sampler3D
-{
-    sampler3D() : w(0), h(0), d(0), data(NULL) {}
-    int w;
-    int h;
-    int d;
-    glm::vec4* data;
-};
-
-struct usampler2D
+//the ray caster tester has types of the same names, they must not be merged
+//when both testers are linked into the viewer
+namespace
 {
-    usampler2D() : w(0), h(0), data(NULL) {}
-    int w;
-    int h;
-    glm::uvec4* data;
-};
+    struct usampler3D
+    {
+        usampler3D() : w(0), h(0), d(0), data(NULL) {}
+        int w;
+        int h;
+        int d;
+        glm::uvec4* data;
+    };
 
-struct usamplerPyramid2D
-{
-    usamplerPyramid2D() : numLODs(0) {}
-    int numLODs;
-    std::vector<usampler2D> mipMaps;
-};
+    struct sampler3D
+    {
+        sampler3D() : w(0), h(0), d(0), data(NULL) {}
+        int w;
+        int h;
+        int d;
+        glm::vec4* data;
+    };
 
-struct sampler1D
-{
-    sampler1D() : w(0), data(NULL) {}
-    int w;
-    glm::vec4* data;
-};
+    struct sampler1D
+    {
+        sampler1D() : w(0), data(NULL) {}
+        int w;
+        glm::vec4* data;
+    };
+}
 
 static glm::uvec4 texelFetch(usampler3D& sampler,
                              const glm::ivec3& texCoord,
@@ -112,27 +108,6 @@ static glm::uvec4 texelFetchOffset(usampler3D& sampler,
                          + (texCoord.x + offset.x)];
 }
 
-static glm::uvec4 texelFetch(usampler2D& sampler,
-                             const glm::ivec2& texCoord,
-                             int)
-{
-    if(texCoord.y >= sampler.h ||
-       texCoord.x >= sampler.w)
-    {
-        return glm::uvec4(0u, 0u, 0u, 0u);
-    }
-    return sampler.data[(texCoord.y * sampler.w) 
-                         + texCoord.x];
-}
-
-static glm::uvec4 texelFetch(usamplerPyramid2D& sampler,
-                             const glm::ivec2& texCoord,
-                             int lod)
-{
-    return sampler.mipMaps.at(lod).data[(texCoord.y * sampler.mipMaps.at(lod).w) 
-                                        + texCoord.x];
-}
-
 static glm::vec4 texture(sampler3D& sampler,
                          const glm::vec3& texCoord)
 {
@@ -151,6 +126,24 @@ static glm::vec4 texture(sampler3D& sampler,
                          + x];
 }
 
+//texel that GL_NEAREST filtering picks, texture above rounds to the nearest
+//texel center of a [0, size-1] grid instead
+static glm::vec4 textureNearest(sampler3D& sampler,
+                                const glm::vec3& texCoord)
+{
+    int x = (int)std::floor(static_cast<float>(sampler.w) * texCoord.x);
+    int y = (int)std::floor(static_cast<float>(sampler.h) * texCoord.y);
+    int z = (int)std::floor(static_cast<float>(sampler.d) * texCoord.z);
+
+    x = x < 0 ? 0 : (x >= sampler.w ? sampler.w-1 : x);
+    y = y < 0 ? 0 : (y >= sampler.h ? sampler.h-1 : y);
+    z = z < 0 ? 0 : (z >= sampler.d ? sampler.d-1 : z);
+
+    return sampler.data[(z * sampler.w * sampler.h) 
+                         + (y * sampler.w) 
+                         + x];
+}
+
 static glm::vec4 textureOffset(sampler3D& sampler,
                                const glm::vec3& texCoord,
                                const glm::ivec3& offset)
@@ -215,6 +208,7 @@ uniform int MaxTreeTraversals;//max number of tree traversals allowed per ray
 uniform int MaxNodesToPushThisFrame;//max number of nodes to push onto the node usage list this frame
 uniform bool RootNodeIsConstant;
 uniform bool GradientsAreUnsigned;
+uniform bool GradientsAreOctEncoded;
 
 const float k_AlmostZero = 0.000001f;
 const float k_TreeN = 2.0f;//Our tree is 2^3 (i.e. OctTree)
@@ -228,7 +222,7 @@ const int k_RightPlane = 3;
 const int k_TopPlane = 4;
 const int k_BackPlane = 5;
 //unit cube planes
-vec4 NodePlanes[6] = //vec4[](
+const vec4 NodePlanes[6] = //vec4[](
 {
     //left
     vec4(-1.0f, 0.0f, 0.0f, 0.0f),
@@ -343,14 +337,19 @@ float ComputeMinRayBoxIntersection(vec3 rayPos,
                                 vec3 nodeExtentMin,
                                 vec3 nodeExtentMax)
 {
-    //update the plane D on each node's plane
-    NodePlanes[k_LeftPlane][k_PlaneD] = nodeExtentMin.x;
-    NodePlanes[k_BottomPlane][k_PlaneD] = nodeExtentMin.y;
-    NodePlanes[k_FrontPlane][k_PlaneD] = nodeExtentMin.z;
+    //update the plane D on each node's plane, the planes are copied
+    //so that rays can be traversed on several threads at once
+    vec4 nodePlanes[6];
+    for(int i = 0; i < 6; ++i)
+        nodePlanes[i] = NodePlanes[i];
 
-    NodePlanes[k_RightPlane][k_PlaneD] = -nodeExtentMax.x;
-    NodePlanes[k_TopPlane][k_PlaneD] = -nodeExtentMax.y;
-    NodePlanes[k_BackPlane][k_PlaneD] = -nodeExtentMax.z;
+    nodePlanes[k_LeftPlane][k_PlaneD] = nodeExtentMin.x;
+    nodePlanes[k_BottomPlane][k_PlaneD] = nodeExtentMin.y;
+    nodePlanes[k_FrontPlane][k_PlaneD] = nodeExtentMin.z;
+
+    nodePlanes[k_RightPlane][k_PlaneD] = -nodeExtentMax.x;
+    nodePlanes[k_TopPlane][k_PlaneD] = -nodeExtentMax.y;
+    nodePlanes[k_BackPlane][k_PlaneD] = -nodeExtentMax.z;
 
     float tMin = 4.0;//volume should be a unit cube so no time greater than sqrt(3)
 
@@ -361,7 +360,7 @@ float ComputeMinRayBoxIntersection(vec3 rayPos,
         ComputeMinRayPlaneIntersection(rayPos, 
                                        rayDir,
                                        i < 3 ? nodeExtentMin : nodeExtentMax,
-                                       NodePlanes[i],
+                                       nodePlanes[i],
                                        tMin);
     }
 
@@ -500,8 +499,34 @@ vec3 shading(vec3 rgb, vec3 normal, vec3 toCamera, vec3 toLight)
     return ambient + diffuse + specular;
 }
 
+vec3 DecodeOctNormal(vec2 octNormal)
+{
+    //(0, 0) is reserved for voxels without a gradient
+    if(octNormal.x == 0.0f && octNormal.y == 0.0f)
+        return vec3(0.0f);
+
+    octNormal = (octNormal * 2.0f) - 1.0f;
+
+    vec3 normal(octNormal.x, octNormal.y, 1.0f - std::abs(octNormal.x) - std::abs(octNormal.y));
+    if(normal.z < 0.0f)
+    {
+        normal.x = (1.0f - std::abs(octNormal.y)) * (octNormal.x >= 0.0f ? 1.0f : -1.0f);
+        normal.y = (1.0f - std::abs(octNormal.x)) * (octNormal.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    return normalize(normal);
+}
+
 vec3 LookupGradient(vec3 curBrickRayPos)
 {
+    if(GradientsAreOctEncoded)
+    {
+        //the brick pool does not filter oct encoded gradients (see BrickPool's
+        //UseGradientInterpolation) so this must pick the same texel the GPU does
+        vec4 octNormal = textureNearest(BrickGradientsSampler, curBrickRayPos);
+        return DecodeOctNormal(vec2(octNormal.x, octNormal.y));
+    }
+
     vec3 normal = texture(BrickGradientsSampler, curBrickRayPos).rgb;
     
     if(GradientsAreUnsigned)
@@ -659,15 +684,15 @@ float ComputeVoxelSize(vec3 rayPosition, float voxelHalfSize)
 
 //layout(pixel_center_integer) in ivec4 gl_FragCoord;
 
-in vec4 RayPosition;
-out vec4 FragColor;
-out uvec4 NodeUsageList[3];
+//the outputs FragColor and NodeUsageList[3] are passed to the fragment
+//shader rather than being globals so that it can run on several threads
 
 const int k_NumNodeLists = 3;
 const int k_NumComponentsPerList = 4;
 const int k_MaxNodesPerPixel = 12;//3 lists times 4 components (rgba)
 
-void AddToNodeUsageList(inout int& curListIndex, 
+void AddToNodeUsageList(inout uvec4* NodeUsageList,
+                        inout int& curListIndex, 
                         inout int& curComponentIndex,
                         uvec4 nodeUsage)
 {
@@ -702,7 +727,9 @@ void AddToNodeUsageList(inout int& curListIndex,
 //layout(pixel_center_integer) in ivec4 gl_FragCoord;
 
 static void GigaVoxelsFragmentShader(const in ivec4& gl_FragCoord,
-                                     const in vec4& RayPosition)
+                                     const in vec4& RayPosition,
+                                     out vec4& FragColor,
+                                     out uvec4* NodeUsageList)
 {
     NodeUsageList[0] = uvec4(0u, 0u, 0u, 0u);
     NodeUsageList[1] = uvec4(0u, 0u, 0u, 0u);
@@ -813,8 +840,7 @@ static void GigaVoxelsFragmentShader(const in ivec4& gl_FragCoord,
             projVoxelSize = ComputeVoxelSize(rayWorldPosition, //distToNearPlane,
                                              voxelHalfSize);
     
-            if(//PixelSize > projVoxelSize //projected voxel size is less than pixel size
-                curDepth == 0
+            if(PixelSize > projVoxelSize //projected voxel size is less than pixel size
                || (childNodePtr = GetChildNodePointer(octTreeNode)) == uvec3(0))//no children means its leaf
             {
                 //mark this node as being used for rendering
@@ -927,7 +953,7 @@ static void GigaVoxelsFragmentShader(const in ivec4& gl_FragCoord,
                 {
                     ++pushedNodeCount;
 
-                    AddToNodeUsageList(curListIndex, curComponentIndex, nodeUsage);
+                    AddToNodeUsageList(NodeUsageList, curListIndex, curComponentIndex, nodeUsage);
                 }
 
                 /*if(traversalCount > MaxTreeTraversals)
@@ -978,91 +1004,70 @@ static void GigaVoxelsFragmentShader(const in ivec4& gl_FragCoord,
     FragColor = dst;
 }
 
-void gv::GigaVoxelsShaderCodeTester::drawVolume(voxOpenGL::ShaderProgram* pShaderProgram,
-                                                GigaVoxelsOctTree* pOctTree,
-                                                const vox::FloatArray& vertexArray,
-                                                float lookX,
-                                                float lookY,
-                                                float lookZ)
+template<typename Sampler>
+static void FreeSampler(Sampler& sampler)
 {
-    pShaderProgram->getUniformValue("ProjectionMatrix", &ProjectionMatrix[0][0]);
-    
-    pShaderProgram->getUniformValue("VolTranslation", &VolTranslation[0]);
-    //std::cout << VolTranslation.x << ", " << VolTranslation.y << ", " << VolTranslation.z << std::endl;
+    //sampler texels are allocated as bytes by LoadImageFromCurrentTexture and ReadSampler
+    delete [] reinterpret_cast<unsigned char*>(sampler.data);
+    sampler.data = NULL;
+    sampler.w = sampler.h = sampler.d = 0;
+}
 
-    pShaderProgram->getUniformValue("VolScale", &VolScale[0]);
+static void CaptureTextures(gv::GigaVoxelsOctTree* pOctTree)
+{
+    FreeSampler(OctTreeSampler);
+    FreeSampler(BrickSampler);
+    FreeSampler(BrickGradientsSampler);
 
-    std::vector<glm::vec4> rayPositions;
-    for(vox::FloatArray::const_iterator vertItr = vertexArray.begin();
-        vertItr != vertexArray.end();
-        ++vertItr)
-    {
-        float x = *vertItr;
-        ++vertItr;
-        float y = *vertItr;
-        ++vertItr;
-        float z = *vertItr;
+    glActiveTexture(GL_TEXTURE0);
 
-        glm::vec4 glVertex(x, y, z, 1.0f); 
-        rayPositions.resize(rayPositions.size()+1);
+    glBindTexture(GL_TEXTURE_3D, pOctTree->getBrickTextureID());
 
-        GigaVoxelsVertexShader(glVertex, rayPositions.back());
-    }
+    BrickSampler.data = 
+        (glm::vec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_3D,
+                                                                    BrickSampler.w,
+                                                                    BrickSampler.h,
+                                                                    BrickSampler.d,
+                                                                    GL_RGBA, GL_FLOAT);
 
-    glActiveTexture(GL_TEXTURE0);
-    
-    if(OctTreeSampler.data == NULL)
+    if(pOctTree->getBrickGradientTextureID() != 0)
     {
-        glBindTexture(GL_TEXTURE_3D, pOctTree->getTreeTextureID());
-    
-        OctTreeSampler.data = (glm::uvec4*)
-            voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_3D,
-                                                            OctTreeSampler.w,
-                                                            OctTreeSampler.h,
-                                                            OctTreeSampler.d,
-                                                            GL_RGBA_INTEGER, 
-                                                            GL_UNSIGNED_INT);
-
-        //static glm::vec4 brickData[1] = { glm::vec4(1.0, 0.0, 0.0, 1.0) };
-        //BrickSampler.data = &brickData[0];
-        //BrickSampler.w = BrickSampler.h = BrickSampler.d = 1;
-        glBindTexture(GL_TEXTURE_3D, pOctTree->getBrickTextureID());
-
-        BrickSampler.data = 
+        //octahedral encoded gradients come back as (u, v, 0, 1)
+        glBindTexture(GL_TEXTURE_3D, pOctTree->getBrickGradientTextureID());
+
+        BrickGradientsSampler.data = 
             (glm::vec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_3D,
-                                                                        BrickSampler.w,
-                                                                        BrickSampler.h,
-                                                                        BrickSampler.d,
+                                                                        BrickGradientsSampler.w,
+                                                                        BrickGradientsSampler.h,
+                                                                        BrickGradientsSampler.d,
                                                                         GL_RGBA, GL_FLOAT);
-
-        struct rgba
-        {
-            float r;
-            float g;
-            float b;
-            float a;
-        };
-        rgba* bricks = new rgba[BrickSampler.w * BrickSampler.h * BrickSampler.d];
-        memcpy(bricks, BrickSampler.data, sizeof(rgba) * BrickSampler.w * BrickSampler.h * BrickSampler.d);
-        //glBindTexture(GL_TEXTURE_3D, pOctTree->getBrickGradientTextureID());
-
-        static glm::vec4 brickGradData[1] = { glm::vec4(0.0, 0.0, 0.0, 0.0f) };
-        BrickGradientsSampler.data = &brickGradData[0];
+    }
+    else
+    {
+        unsigned char* pBrickGradData = new unsigned char[sizeof(glm::vec4)];
+        memset(pBrickGradData, 0, sizeof(glm::vec4));
+        BrickGradientsSampler.data = (glm::vec4*)pBrickGradData;
         BrickGradientsSampler.w = BrickGradientsSampler.h = BrickGradientsSampler.d = 1;
-        //BrickGradientsSampler.data = 
-        //    (glm::vec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_3D,
-        //                                                                BrickGradientsSampler.w,
-        //                                                                BrickGradientsSampler.h,
-        //                                                                BrickGradientsSampler.d,
-        //                                                                GL_RGBA, GL_FLOAT);
-
-        /*rgba* brickGrads = new rgba[BrickGradientsSampler.w * BrickGradientsSampler.h * BrickGradientsSampler.d];
-        memcpy(brickGrads, BrickGradientsSampler.data, sizeof(rgba) * BrickGradientsSampler.w * BrickGradientsSampler.h * BrickGradientsSampler.d);*/
-
-        delete bricks;
-        //delete brickGrads;
     }
 
+    //read the tree last so that it is left bound to unit 0 like the renderer binds it
+    glBindTexture(GL_TEXTURE_3D, pOctTree->getTreeTextureID());
+
+    OctTreeSampler.data = (glm::uvec4*)
+        voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_3D,
+                                                        OctTreeSampler.w,
+                                                        OctTreeSampler.h,
+                                                        OctTreeSampler.d,
+                                                        GL_RGBA_INTEGER, 
+                                                        GL_UNSIGNED_INT);
+}
+
+static void CaptureUniforms(voxOpenGL::ShaderProgram* pShaderProgram)
+{
+    pShaderProgram->getUniformValue("ProjectionMatrix", &ProjectionMatrix[0][0]);
+    pShaderProgram->getUniformValue("ModelViewMatrix", &ModelViewMatrix[0][0]);
+    pShaderProgram->getUniformValue("VolTranslation", &VolTranslation[0]);
+    pShaderProgram->getUniformValue("VolScale", &VolScale[0]);
     pShaderProgram->getUniformValue("RayStepSize", &RayStepSize);
     pShaderProgram->getUniformValue("BrickStepVector", &BrickStepVector[0]);
     pShaderProgram->getUniformValue("OctTreeDepthMinusOne", &OctTreeDepthMinusOne);
@@ -1085,819 +1090,1323 @@ void gv::GigaVoxelsShaderCodeTester::drawVolume(voxOpenGL::ShaderProgram* pShade
     pShaderProgram->getUniformValue("MaxNodesToPushThisFrame", &MaxNodesToPushThisFrame);
     pShaderProgram->getUniformValue("RootNodeIsConstant", RootNodeIsConstant);
     pShaderProgram->getUniformValue("GradientsAreUnsigned", GradientsAreUnsigned);
+    pShaderProgram->getUniformValue("GradientsAreOctEncoded", GradientsAreOctEncoded);
     //pShaderProgram->getUniformValue("OctTreeDepth", &OctTreeDepth);
+}
+
+void gv::GigaVoxelsShaderCodeTester::captureOctTree(voxOpenGL::ShaderProgram* pShaderProgram,
+                                                    GigaVoxelsOctTree* pOctTree)
+{
+    CaptureUniforms(pShaderProgram);
+    CaptureTextures(pOctTree);
+}
+
+struct CapturedUniform
+{
+    void* pValue;
+    size_t size;
+};
 
-    float scale = 1.0f/44.0f;
-    int pX = 224;
-    for(float x = 0.49f; x >= 0.0f; x -= 0.01f, pX -= 1)
+//every uniform the vertex and fragment shaders read, in capture file order
+static const CapturedUniform k_CapturedUniforms[] =
+{
+    { &ProjectionMatrix, sizeof(ProjectionMatrix) },
+    { &ModelViewMatrix, sizeof(ModelViewMatrix) },
+    { &VolTranslation, sizeof(VolTranslation) },
+    { &VolScale, sizeof(VolScale) },
+    { &RayStepSize, sizeof(RayStepSize) },
+    { &BrickStepVector, sizeof(BrickStepVector) },
+    { &CameraPosition, sizeof(CameraPosition) },
+    { &CameraUp, sizeof(CameraUp) },
+    { &CameraLeft, sizeof(CameraLeft) },
+    { &LightPosition, sizeof(LightPosition) },
+    { &VolExtentMin, sizeof(VolExtentMin) },
+    { &VolExtentMax, sizeof(VolExtentMax) },
+    { &BrickDimension, sizeof(BrickDimension) },
+    { &RootVoxelHalfSize, sizeof(RootVoxelHalfSize) },
+    { &BrickPoolDimension, sizeof(BrickPoolDimension) },
+    { &PixelSize, sizeof(PixelSize) },
+    { &OctTreeDepthMinusOne, sizeof(OctTreeDepthMinusOne) },
+    { &MaxTreeTraversals, sizeof(MaxTreeTraversals) },
+    { &MaxNodesToPushThisFrame, sizeof(MaxNodesToPushThisFrame) },
+    { &RootNodeIsConstant, sizeof(RootNodeIsConstant) },
+    { &GradientsAreUnsigned, sizeof(GradientsAreUnsigned) },
+    { &GradientsAreOctEncoded, sizeof(GradientsAreOctEncoded) }
+};
+
+static const size_t k_CapturedUniformCount = sizeof(k_CapturedUniforms) / sizeof(CapturedUniform);
+
+//bump this whenever the capture file layout changes
+static const int k_CaptureVersion = 1;
+static const char k_CaptureMagic[8] = { 'V', 'O', 'X', 'G', 'V', 'C', '\n', '\0' };
+
+struct CaptureHeader
+{
+    char magic[8];
+    int version;
+    //total size of the uniforms, captures are only read by builds with the same layout
+    int uniformsSize;
+};
+
+static int CapturedUniformsSize()
+{
+    size_t uniformsSize = 0;
+    for(size_t i = 0; i < k_CapturedUniformCount; ++i)
+        uniformsSize += k_CapturedUniforms[i].size;
+
+    return static_cast<int>(uniformsSize);
+}
+
+template<typename Sampler>
+static bool WriteSampler(QFile& file, const Sampler& sampler)
+{
+    int dims[3] = { sampler.w, sampler.h, sampler.d };
+    if(file.write(reinterpret_cast<const char*>(dims), sizeof(dims)) != sizeof(dims))
+        return false;
+
+    qint64 dataSize = static_cast<qint64>(sampler.w) * sampler.h * sampler.d * sizeof(*sampler.data);
+    return file.write(reinterpret_cast<const char*>(sampler.data), dataSize) == dataSize;
+}
+
+template<typename Texel>
+static bool ReadTexels(QFile& file, int& w, int& h, int& d, Texel*& pTexels)
+{
+    int dims[3];
+    if(file.read(reinterpret_cast<char*>(dims), sizeof(dims)) != sizeof(dims)
+       || dims[0] <= 0 || dims[1] <= 0 || dims[2] <= 0)
+        return false;
+
+    qint64 dataSize = static_cast<qint64>(dims[0]) * dims[1] * dims[2] * sizeof(Texel);
+    if(dataSize > file.size() - file.pos())
+        return false;
+
+    unsigned char* pData = new unsigned char[static_cast<size_t>(dataSize)];
+    if(file.read(reinterpret_cast<char*>(pData), dataSize) != dataSize)
     {
-        int pY = 224;
-        for(float y = 0.49f; y > 0.20f; y -= 0.01f, pY -= 1)
-        {
-            GigaVoxelsFragmentShader(ivec4(pX, pY, 0, 0),  /*vec4(x, y, 0.0, 1.0)*/vec4(CameraPosition.x + (lookX * scale), 
-                                                                CameraPosition.y + (lookY * scale),  
-                                                                CameraPosition.z + (lookZ * scale), 1.0));
-        }
+        delete [] pData;
+        return false;
     }
+
+    w = dims[0];
+    h = dims[1];
+    d = dims[2];
+    pTexels = reinterpret_cast<Texel*>(pData);
+
+    return true;
 }
 
-uniform usampler2DArray NodeUsageListSampler;
-uniform vec2 NodeUsageListDimMinusTwo;
+template<typename Sampler>
+static bool ReadSampler(QFile& file, Sampler& sampler)
+{
+    FreeSampler(sampler);
 
-//const int k_NumNodeLists = 3;
-//const int k_NumComponentsPerList = 4;
-const int k_NumNodeListItems = 12;
+    return ReadTexels(file, sampler.w, sampler.h, sampler.d, sampler.data);
+}
 
-static void GenerateSelectionMask(const in ivec4& gl_FragCoord,
-                                  out uvec4& Output)
+bool gv::GigaVoxelsShaderCodeTester::writeCapture(const std::string& filename)
 {
-    //convert tex coord to 2D array integer indices
-    //ivec2 texel = ivec2(TexCoord * NodeUsageListDimMinusTwo);
-    ivec3 texel = ivec3(gl_FragCoord.xy, 0);
- 
-    //save the pixel/texel position, store 0 at red for now
-    Output = uvec4(0u, texel.x, texel.y, 1u);
-
-    //offsets for lists 2 and 3 
-    const ivec3 list1 = ivec3(0, 0, 1);
-    const ivec3 list2 = ivec3(0, 0, 2);
-
-    uvec4 nodeUsageList[k_NumNodeLists] = {//uvec4[k_NumNodeLists](
-        texelFetch(NodeUsageListSampler, texel, 0),
-        texelFetch(NodeUsageListSampler, texel + list1, 0),
-        texelFetch(NodeUsageListSampler, texel + list2, 0)
-    };//);
-
-    if(nodeUsageList[0][0] == 0u)
-        return;//if first item in my list is zero then this is an empty node usage list
-      
-    //we sample the neighbors two pixels away because each 2x2 block
-    //of pixels record a different range encountered nodes so the pixel
-    //that is two pixels away records the same range of pixels as our
-    //current pixel and is thus most likely to contain duplicates
-    uvec4 topNodeUsageList[k_NumNodeLists];
-    uvec4 topRightNodeUsageList[k_NumNodeLists];
-    uvec4 rightNodeUsageList[k_NumNodeLists];
-    if(texel.y < NodeUsageListDimMinusTwo.y)
+    if(OctTreeSampler.data == NULL)
     {
-        ivec3 neighbor = ivec3(texel.x, texel.y + 2, 0);
+        std::cerr << "ERROR: No oct tree has been captured to write to " << filename << std::endl;
+        return false;
+    }
 
-        uvec4 _topNodeUsageList[] = {//uvec4[k_NumNodeLists](
-            texelFetch(NodeUsageListSampler, neighbor, 0),
-            texelFetch(NodeUsageListSampler, neighbor + list1, 0),
-            texelFetch(NodeUsageListSampler, neighbor + list2, 0)
-        };//);
-        memcpy(topNodeUsageList, _topNodeUsageList, sizeof(topNodeUsageList));
+    QFile file(QString(filename.c_str()));
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        std::cerr << "ERROR: Failed to open " << filename << " for writing." << std::endl;
+        return false;
+    }
 
-        if(texel.x < NodeUsageListDimMinusTwo.x)
-        {
-            //sample to right
-            neighbor.x += 2;
-
-            uvec4 _topRightNodeUsageList[] = {//uvec4[k_NumNodeLists](
-                texelFetch(NodeUsageListSampler, neighbor, 0),
-                texelFetch(NodeUsageListSampler, neighbor + list1, 0),
-                texelFetch(NodeUsageListSampler, neighbor + list2, 0)
-            };//);
-            memcpy(topRightNodeUsageList, _topRightNodeUsageList, sizeof(topRightNodeUsageList));
-    
-            neighbor.y = texel.y;
-
-            uvec4 _rightNodeUsageList[] = {//uvec4[k_NumNodeLists](
-                texelFetch(NodeUsageListSampler, neighbor, 0),
-                texelFetch(NodeUsageListSampler, neighbor + list1, 0),
-                texelFetch(NodeUsageListSampler, neighbor + list2, 0)
-            };//);
-            memcpy(rightNodeUsageList, _rightNodeUsageList, sizeof(rightNodeUsageList));
-        }
-        else
-        {
-            memset(topRightNodeUsageList, 0, sizeof(topRightNodeUsageList));// = uvec4[k_NumNodeLists]( uvec4(0u), uvec4(0u), uvec4(0u) );
-            memset(rightNodeUsageList, 0, sizeof(rightNodeUsageList));// = uvec4[k_NumNodeLists]( uvec4(0u), uvec4(0u), uvec4(0u) );
-        }
+    CaptureHeader header;
+    memcpy(header.magic, k_CaptureMagic, sizeof(header.magic));
+    header.version = k_CaptureVersion;
+    header.uniformsSize = CapturedUniformsSize();
+
+    bool written = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+
+    for(size_t i = 0; written && i < k_CapturedUniformCount; ++i)
+    {
+        qint64 size = static_cast<qint64>(k_CapturedUniforms[i].size);
+        written = file.write(reinterpret_cast<const char*>(k_CapturedUniforms[i].pValue), size) == size;
     }
-    else
+
+    written = written 
+              && WriteSampler(file, OctTreeSampler)
+              && WriteSampler(file, BrickSampler)
+              && WriteSampler(file, BrickGradientsSampler);
+
+    if(!written)
     {
-        memset(topNodeUsageList, 0, sizeof(topNodeUsageList));// = uvec4[k_NumNodeLists]( uvec4(0u), uvec4(0u), uvec4(0u) );
-        memset(topRightNodeUsageList, 0, sizeof(topRightNodeUsageList));// = uvec4[k_NumNodeLists]( uvec4(0u), uvec4(0u), uvec4(0u) );
-        if(texel.x < NodeUsageListDimMinusTwo.x)
-        {
-            ivec3 neighbor = ivec3(texel.x + 2, texel.y, 0);
-
-            uvec4 _rightNodeUsageList[] = {//uvec4[k_NumNodeLists](
-                texelFetch(NodeUsageListSampler, neighbor, 0),
-                texelFetch(NodeUsageListSampler, neighbor + list1, 0),
-                texelFetch(NodeUsageListSampler, neighbor + list2, 0)
-            };//);
-            memcpy(rightNodeUsageList, _rightNodeUsageList, sizeof(rightNodeUsageList));
-        }
-        else
-            memset(rightNodeUsageList, 0, sizeof(rightNodeUsageList));// = uvec4[k_NumNodeLists]( uvec4(0u), uvec4(0u), uvec4(0u) );
+        std::cerr << "ERROR: Failed to write oct tree capture " << filename << std::endl;
+        file.close();
+        QFile::remove(QString(filename.c_str()));
+        return false;
     }
 
-    int prevListIndex;
-    int curListIndex = k_NumNodeLists-1;
-    int nextListIndex = 0;
+    return true;
+}
 
-    int prevCompIndex;
-    int curCompIndex = k_NumComponentsPerList-1;
-    int nextCompIndex = 0;
+bool gv::GigaVoxelsShaderCodeTester::readCapture(const std::string& filename)
+{
+    QFile file(QString(filename.c_str()));
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        std::cerr << "ERROR: Failed to open oct tree capture " << filename << std::endl;
+        return false;
+    }
 
-    glm::uint nodeUsage;
-    for(int nodeListIndex = 0; nodeListIndex < k_NumNodeListItems; ++nodeListIndex)
+    CaptureHeader header;
+    if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header)
+       || memcmp(header.magic, k_CaptureMagic, sizeof(header.magic)) != 0
+       || header.version != k_CaptureVersion
+       || header.uniformsSize != CapturedUniformsSize())
     {
-        prevListIndex = curListIndex;
-        prevCompIndex = curCompIndex;
+        std::cerr << "ERROR: " << filename << " is not an oct tree capture of this build." << std::endl;
+        return false;
+    }
 
-        curListIndex = nextListIndex;
-        curCompIndex = nextCompIndex,
+    bool read = true;
+    for(size_t i = 0; read && i < k_CapturedUniformCount; ++i)
+    {
+        qint64 size = static_cast<qint64>(k_CapturedUniforms[i].size);
+        read = file.read(reinterpret_cast<char*>(k_CapturedUniforms[i].pValue), size) == size;
+    }
 
-        ++nextCompIndex;
+    read = read
+           && ReadSampler(file, OctTreeSampler)
+           && ReadSampler(file, BrickSampler)
+           && ReadSampler(file, BrickGradientsSampler);
 
-        if(nextCompIndex == k_NumComponentsPerList)
-        {
-            nextCompIndex = 0;
-            ++nextListIndex;
-            if(nextListIndex == k_NumNodeLists)
-            {
-                nextListIndex = 0;
-            }
-        }
+    if(!read)
+    {
+        std::cerr << "ERROR: Oct tree capture " << filename << " is truncated." << std::endl;
+        FreeSampler(OctTreeSampler);
+        FreeSampler(BrickSampler);
+        FreeSampler(BrickGradientsSampler);
+        return false;
+    }
 
-        nodeUsage = nodeUsageList[curListIndex][curCompIndex];
-            
-        if(nodeUsage == 0u)
-            return;//if zero then we've hit the end of this list, so we can quit
-
-        size_t x, y, z;
-
-        x = (nodeUsage >> 20u) & 0x000003FFu;
-        y = (nodeUsage >> 10u) & 0x000003FFu;
-        z = nodeUsage & 0x000003FFu;
-        //now look at i-1, i, and i+1 items
-        //in the neighbor lists (top, top-right, and right)
-        //if my neighbor contains the same node as me then
-        //don't keep my item
-        //if(texel.y < NodeUsageListDimMinusTwo.y)
-        {
-            //sample same item in list
-            if(nodeUsage == topNodeUsageList[curListIndex][curCompIndex])
-                continue;
+    return true;
+}
 
-            //sample prev item in list
-            if(nodeUsage == topNodeUsageList[prevListIndex][prevCompIndex])
-                continue;
-            
-            //sample next item in list
-            if(nodeUsage == topNodeUsageList[nextListIndex][nextCompIndex])
-                continue;
+static mat4 ToMat4(const double* pMtx)
+{
+    mat4 mtx;
+    vox::ScreenRays::ToFloatMatrix(pMtx, &mtx[0][0]);
+    return mtx;
+}
 
-            //if(texel.x < NodeUsageListDimMinusTwo.x)
-            {
-                //sample to top-right
-                //sample same item in list
-                if(nodeUsage == topRightNodeUsageList[curListIndex][curCompIndex])
-                    continue;
-                
-                //sample prev item in list
-                if(nodeUsage == topRightNodeUsageList[prevListIndex][prevCompIndex])
-                    continue;
-                
-                //sample next item in list
-                if(nodeUsage == topRightNodeUsageList[nextListIndex][nextCompIndex])
-                    continue;
-            }
-        }
+static vec3 WorldToVolume(const vec3& worldPosition)
+{
+    vec3 volumePosition;
+    vox::ScreenRays::WorldToVolume(&worldPosition[0], &VolTranslation[0], &VolScale[0], &volumePosition[0]);
+    return volumePosition;
+}
 
-        //if(texel.x < NodeUsageListDimMinusTwo.x)
-        {
-            //sample to right
-            //sample same item in list
-            if(nodeUsage == rightNodeUsageList[curListIndex][curCompIndex])
-                continue;
-            
-            //sample prev item in list
-            if(nodeUsage == rightNodeUsageList[prevListIndex][prevCompIndex])
-                continue;
+//sets the uniforms GigaVoxelsRenderer derives from the camera
+static void SetCameraUniforms(const vox::Camera& camera)
+{
+    ProjectionMatrix = ToMat4(camera.getProjectionMatrixPtr());
+    ModelViewMatrix = ToMat4(camera.getViewMatrixPtr());
 
-            //sample next item in list
-            if(nodeUsage == rightNodeUsageList[nextListIndex][nextCompIndex])
-                continue;
-        }
+    QVector3D position = camera.getPosition();
+    CameraPosition = WorldToVolume(vec3(position.x(), position.y(), position.z()));
 
-        //if we get here then the node in the current list does
-        //not match any of the other lists, so save it in the output
-        //keep this node
-        Output.r |= (1u << glm::uint(nodeListIndex));
-    }
+    const QVector3D& up = camera.getUp();
+    CameraUp = vec3(up.x(), up.y(), up.z());
+
+    const QVector3D& left = camera.getLeft();
+    CameraLeft = vec3(left.x(), left.y(), left.z());
+
+    PixelSize = camera.getPixelSize();
+    MaxNodesToPushThisFrame = k_MaxNodesPerPixel * static_cast<int>((camera.getFrameCount() % 2)+1);
 }
 
-void gv::GigaVoxelsShaderCodeTester::generateNodeUsageSelectionMask(voxOpenGL::ShaderProgram* pShaderProgram,
-                                                                    unsigned int nodeUsageTexture)
+//the rays through the pixels of a frame, they start on the near plane like
+//they do with the camera near plane shader when the camera is inside the volume
+static vox::ScreenRays CreateScreenRays(int width, int height)
 {
-    pShaderProgram->getUniformValue("NodeUsageListDimMinusTwo", &NodeUsageListDimMinusTwo[0]);
+    mat4 invViewProjMtx = inverse(ProjectionMatrix * ModelViewMatrix);
+    return vox::ScreenRays(&invViewProjMtx[0][0],
+                           width, height,
+                           &VolTranslation[0], &VolScale[0],
+                           &VolExtentMin[0], &VolExtentMax[0]);
+}
 
-    glActiveTexture(GL_TEXTURE0);
+//computes where the ray through the center of pixel (x, y) enters the volume,
+//returns false if the ray misses
+static bool ComputeRayPosition(const vox::ScreenRays& rays, int x, int y, vec4& rayPosition)
+{
+    vec3 position;
+    if(!rays.computeRayPosition(x, y, &position[0]))
+        return false;
+
+    rayPosition = vec4(position, 1.0f);
+    return true;
+}
 
-    if(NodeUsageListSampler.data != NULL)
-        delete [] NodeUsageListSampler.data;
+//number of rays traced together, 1 runs the fragment shader on each ray
+static int s_rayPacketWidth = 8;
+//RenderTilesTask's width for running the fragment shader on each ray, so
+//that packets of 1 ray can be checked against it
+const int k_ScalarRays = 0;
+
+//how a ray in a packet is marching through the leaf node it reached
+const int k_MarchConstant = 0;
+const int k_MarchBrick = 1;
+const int k_MarchBrickInterp = 2;
+
+//the fragment shader's variables for one ray of a packet. The ray runs the
+//shader's traversal on its own until it reaches a leaf it has to march
+//through, the march is then stepped along with the rest of the packet.
+struct PacketRay
+{
+    int x;
+    int y;
+    vec4 dst;
+    uvec4 nodeUsageList[k_NumNodeLists];
+
+    vec3 rayWorldPosition;
+    vec3 rayDir;
+    vec3 brickRayStep;
+    vec3 prevBrickRayStep;
+
+    int curListIndex;
+    int curComponentIndex;
+    uvec4 nodeUsage;
+    int startPushingNodes;
+    int stopPushingNodes;
+
+    ivec3 octTreeNodePtr;
+    uvec4 rootOctTreeNode;
+    uvec4 octTreeNode;
+    vec3 nodeExtentMin;
+    vec3 nodeExtentMax;
+    float nodeSize;
+    float voxelHalfSize;
+
+    vec3 rayBrickPosition;
+    vec3 curBrickRayPosition;
+    vec3 prevBrickRayPosition;
+
+    uvec4 curBrickPtr;
+    uvec4 prevBrickPtr;
+    vec4 curConstValue;
+    bool brickIsLoaded;
+    bool curNodeIsConstant;
+    bool prevNodeIsConstant;
+    float projVoxelSize;
+    int curDepth;
+    int curBrickDepth;
+    uvec3 childNodePtr;
+
+    int nodeListTraversalCount;
+    int pushedNodeCount;
+
+    //the leaf being marched through
+    int marchType;
+    vec3 worldRayStep;
+    vec3 curBrickRayPos;
+    vec3 prevBrickRayPos;
+    vec4 constSrc;
+    vec3 lightDir;
+    float interpolation;
+    float sampleRatio;
+};
 
+//the shader's leaf bookkeeping after a march, returns false when the ray is done
+static bool FinishPacketRayLeaf(PacketRay& ray)
+{
+    if(ray.dst.a > 0.995f && (ray.curNodeIsConstant || ray.brickIsLoaded))
+        return false;
+
+    ray.octTreeNode = ray.rootOctTreeNode;
+    ray.nodeExtentMin = VolExtentMin;
+    ray.nodeExtentMax = VolExtentMax;
+    ray.nodeSize = 1.0f;
+    ray.voxelHalfSize = RootVoxelHalfSize;
+
+    ray.rayBrickPosition = ray.rayWorldPosition;
+    ray.curBrickRayPosition = ray.rayWorldPosition;
+    ray.prevBrickRayPosition = ray.rayWorldPosition;
+
+    ray.curBrickPtr = ray.octTreeNode;
+    ray.prevBrickPtr = ray.curBrickPtr;
+    ray.curConstValue = vec4(0.0f);
+    ray.brickIsLoaded = false;
+    ray.curNodeIsConstant = RootNodeIsConstant;
+    ray.prevNodeIsConstant = false;
+    ray.projVoxelSize = 0.0f;
+    ray.curDepth = 0;
+    ray.curBrickDepth = 0;
+    ray.childNodePtr = uvec3(0u);
+
+    if(ray.nodeListTraversalCount >= ray.startPushingNodes
+       && ray.nodeListTraversalCount < ray.stopPushingNodes
+       && ray.pushedNodeCount < MaxNodesToPushThisFrame)
     {
-        glBindTexture(GL_TEXTURE_2D_ARRAY, nodeUsageTexture);
-
-        NodeUsageListSampler.data = (glm::uvec4*)
-            voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D_ARRAY,
-                                                            NodeUsageListSampler.w,
-                                                            NodeUsageListSampler.h,
-                                                            NodeUsageListSampler.d,
-                                                            GL_RGBA_INTEGER, 
-                                                            GL_UNSIGNED_INT);
-
-        GLint y = NodeUsageListSampler.h >> 1;
-        GLint x = NodeUsageListSampler.w >> 1;
-        GLint endY = (NodeUsageListSampler.h >> 1)+1;
-        GLint endX = (NodeUsageListSampler.w >> 1)+5;
-
-        for( ; y < endY; ++y)
-        {
-            for( ; x < endX; ++x)
-            {
-                std::cout << "NodeUsage at " << x << " " << y << std::endl;
-                for(GLint z = 0; z < NodeUsageListSampler.d; ++z)
-                {
-                    glm::uvec4 nodeUsage = 
-                        NodeUsageListSampler.data[(z * NodeUsageListSampler.h * NodeUsageListSampler.w) + (y * NodeUsageListSampler.w) + x];
-                    for(GLint i = 0; i < 4; ++i)
-                    {
-                        unsigned int nodeID = nodeUsage[i];
-                        if(nodeID != 0)
-                        {
-                            size_t x, y, z;
+        ++ray.pushedNodeCount;
 
-                            x = (nodeID >> 20u) & 0x000003FFu;
-                            y = (nodeID >> 10u) & 0x000003FFu;
-                            z = nodeID & 0x000003FFu;
+        AddToNodeUsageList(ray.nodeUsageList, ray.curListIndex, ray.curComponentIndex, ray.nodeUsage);
+    }
 
-                            std::cout << x << " " << y << " " << z << std::endl;
-                        }
-                    }
-                }
-                std::cout << std::endl;
-            }
-        }
+    vec3 test1 = sign(ray.rayWorldPosition - VolExtentMin);
+    vec3 test2 = sign(VolExtentMax - ray.rayWorldPosition);
+    float inside = dot(test1, test2);
 
-        struct urgba
-        {
-            unsigned r;
-            unsigned g;
-            unsigned b;
-            unsigned a;
-        };
+    ++ray.nodeListTraversalCount;
 
-        urgba* test = new urgba[NodeUsageListSampler.w * NodeUsageListSampler.h * NodeUsageListSampler.d];
-        memcpy(test, NodeUsageListSampler.data, sizeof(urgba) * NodeUsageListSampler.w * NodeUsageListSampler.h * NodeUsageListSampler.d);
+    if(ray.nodeListTraversalCount >= k_MaxNodesPerPixel * 2 * 2)
+        ray.nodeListTraversalCount = 0;
 
-        urgba* test2 = new urgba[NodeUsageListSampler.w * NodeUsageListSampler.h];
-        memcpy(test2, NodeUsageListSampler.data, sizeof(urgba) * NodeUsageListSampler.w * NodeUsageListSampler.h);
+    return inside >= 3.0f;
+}
 
-        urgba* test3 = new urgba[NodeUsageListSampler.w * NodeUsageListSampler.h];
-        memcpy(test3, 
-               &NodeUsageListSampler.data[(1 * NodeUsageListSampler.h * NodeUsageListSampler.w)], 
-               sizeof(urgba) * NodeUsageListSampler.w * NodeUsageListSampler.h);
+//where a packet ray is after a descent step
+const int k_RayIsDone = 0;
+const int k_RayIsAtLeaf = 1;
+const int k_RayIsDescending = 2;
 
-        urgba* test4 = new urgba[NodeUsageListSampler.w * NodeUsageListSampler.h];
-        memcpy(test4, 
-               &NodeUsageListSampler.data[(2 * NodeUsageListSampler.h * NodeUsageListSampler.w)], 
-               sizeof(urgba) * NodeUsageListSampler.w * NodeUsageListSampler.h);
+//one step of the shader's oct tree descent, so the rays of a packet can go
+//down the tree together a level at a time. A leaf that has to be marched
+//through gets its march set up, transparent constant leaves are skipped
+//over and the ray starts again from the root.
+static int DescendPacketRay(PacketRay& ray)
+{
+    ray.curNodeIsConstant = NodeIsConstant(ray.octTreeNode);
+    if(ray.curNodeIsConstant)
+    {
+        ray.curConstValue = GetConstantValue(ray.octTreeNode);
+    }
+    else
+    {
+        ray.prevNodeIsConstant = ray.curNodeIsConstant;
 
+        ray.brickIsLoaded = BrickIsLoaded(ray.octTreeNode);
 
-        delete [] test;
-        delete [] test2;
-        delete [] test3;
-        delete [] test4;
+        if(ray.brickIsLoaded)
+        {
+            ray.prevBrickPtr = ray.curBrickPtr;
+            ray.curBrickPtr = ray.octTreeNode;
+            ray.prevBrickRayPosition = ray.curBrickRayPosition;
+            ray.curBrickRayPosition = ray.rayBrickPosition;
+            ray.curBrickDepth = ray.curDepth;
+        }
     }
 
-    uvec4* output = new uvec4[NodeUsageListSampler.w * NodeUsageListSampler.h];
+    float parentVoxelSize = ray.projVoxelSize;
+    ray.projVoxelSize = ComputeVoxelSize(ray.rayWorldPosition, ray.voxelHalfSize);
 
-    for(int y = 0; y < NodeUsageListSampler.h; ++y)
+    if(PixelSize > ray.projVoxelSize
+       || (ray.childNodePtr = GetChildNodePointer(ray.octTreeNode)) == uvec3(0))
     {
-        for(int x = 0; x < NodeUsageListSampler.w; ++x)
+        ray.nodeUsage = uvec4(ray.octTreeNodePtr, glm::uint(ray.brickIsLoaded));
+
+        if(ray.curNodeIsConstant)
         {
-            ivec4 pixel(x, y, 0, 0);
-            uvec4& outputPixel = output[(y * NodeUsageListSampler.w) + x];
-            
-            if(x == 400 && y == 300)
-                x = 400;
-            GenerateSelectionMask(pixel,
-                                  outputPixel);
+            float sampleRatio = pow(k_BrickStepSizeScalar,
+                                    OctTreeDepthMinusOne - ray.curDepth);
+            float rayStepSize = RayStepSize * sampleRatio;
+
+            if(ray.curConstValue.a < 0.005f)
+            {
+                float timeToExit = ComputeMinRayBoxIntersection(ray.rayWorldPosition, ray.rayDir,
+                                                                ray.nodeExtentMin, ray.nodeExtentMax);
+                AdvanceRay(ray.rayWorldPosition, ray.rayDir, timeToExit, rayStepSize);
+
+                if(!FinishPacketRayLeaf(ray))
+                    return k_RayIsDone;
+                return k_RayIsDescending;
+            }
+
+            //every step composites the same sample
+            vec4 src = ray.curConstValue;
+            src.a = 1.0f - pow((1.0f - src.a), sampleRatio);
+            src.rgb *= glm::vec3(sampleRatio);
+
+            ray.marchType = k_MarchConstant;
+            ray.worldRayStep = ray.rayDir * rayStepSize;
+            ray.constSrc = src;
+            ray.curBrickRayPos = vec3(0.0f);
+            ray.prevBrickRayPos = vec3(0.0f);
+            return k_RayIsAtLeaf;
         }
+
+        ray.curBrickRayPos = GetBrickPointer(ray.curBrickPtr)
+                                + ((ray.curBrickRayPosition * BrickDimension)
+                                / BrickPoolDimension);
+        ray.sampleRatio = pow(k_BrickStepSizeScalar,
+                              OctTreeDepthMinusOne - ray.curBrickDepth);
+        ray.worldRayStep = ray.rayDir;
+        ray.worldRayStep *= RayStepSize;
+        ray.worldRayStep *= ray.sampleRatio;
+        ray.prevBrickRayPos = vec3(0.0f);
+
+        float interpolation = 1.0f;
+        if(PixelSize > ray.projVoxelSize &&
+           ray.curDepth != 0 &&
+           ((interpolation = clamp(((PixelSize - ray.projVoxelSize) / (parentVoxelSize - ray.projVoxelSize)), 0.0f, 1.0f)) > 0.001f))
+        {
+            ray.prevBrickRayPos = GetBrickPointer(ray.prevBrickPtr)
+                                    + ((ray.prevBrickRayPosition * BrickDimension)
+                                       / BrickPoolDimension);
+            ray.lightDir = normalize(LightPosition - ray.rayWorldPosition);
+            ray.interpolation = interpolation;
+            ray.marchType = k_MarchBrickInterp;
+        }
+        else
+            ray.marchType = k_MarchBrick;
+
+        return k_RayIsAtLeaf;
     }
 
-    delete [] output;
-}
+    vec3 brickOffset = ray.rayBrickPosition * k_TreeN;
 
-uniform usampler2D SelectionMaskSampler;
+    uvec3 childOffset = clamp(uvec3(brickOffset), 0u, 1u);
 
-static void ComputeActiveTexels(const in ivec4& gl_FragCoord,
-                                out uvec4& Output)
-{
-    ivec2 texCoord = ivec2(gl_FragCoord.xy);
-
-    //red component contains a bit vector, set bits indicate
-    //that an item in the corresponding node list should be kept
-    //if there are not set bits then this pixel is not active
-    //this will be true for any pixels/rays that did not hit the volume
-    //or for pixels that had the same nodes in their list as its neighbor
-    //pixels (see GenerateSelectionMask.frag)
-    glm::uint selectionBits = texelFetch(SelectionMaskSampler, texCoord, 0).r;
-
-    if(selectionBits == 0u)
-        Output = uvec4(0u, 0u, 0u, 0u);
-    else
-        Output = uvec4(1u, 0u, 0u, 1u);
+    ray.rayBrickPosition = brickOffset - vec3(childOffset);
+
+    ray.octTreeNodePtr = ivec3(ray.childNodePtr + childOffset);
+
+    ++ray.curDepth;
+    ray.nodeSize *= k_ChildNodeSizeScalar;
+    ray.nodeExtentMin += (vec3(childOffset) * ray.nodeSize);
+    ray.nodeExtentMax -= ((vec3(1.0f) - vec3(childOffset)) * ray.nodeSize);
+
+    ray.voxelHalfSize *= k_ChildNodeSizeScalar;
+
+    ray.octTreeNode = texelFetch(OctTreeSampler, ray.octTreeNodePtr, 0);
+
+    return k_RayIsDescending;
 }
 
-void gv::GigaVoxelsShaderCodeTester::computeActiveTexels(unsigned int selectionMaskTextureID)
+//the fragment shader's setup for the ray starting at RayPosition, returns
+//false if the ray misses the volume
+static bool StartPacketRay(PacketRay& ray, int x, int y, const vec4& RayPosition)
 {
-    glActiveTexture(GL_TEXTURE0);
-
-    if(SelectionMaskSampler.data == NULL)
-    {
-        glBindTexture(GL_TEXTURE_2D,
-                      selectionMaskTextureID);
-
-        GLint depth;
-        SelectionMaskSampler.data = 
-            (glm::uvec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D,
-                                                                         SelectionMaskSampler.w,
-                                                                         SelectionMaskSampler.h,
-                                                                         depth,
-                                                                         GL_RGBA_INTEGER, 
-                                                                         GL_UNSIGNED_INT);
-
-        struct urgba
-        {
-            unsigned r;
-            unsigned g;
-            unsigned b;
-            unsigned a;
-        };
+    ray.x = x;
+    ray.y = y;
+    ray.dst = vec4(0.0f);
+    for(int i = 0; i < k_NumNodeLists; ++i)
+        ray.nodeUsageList[i] = uvec4(0u);
 
-        urgba* test = new urgba[SelectionMaskSampler.w * SelectionMaskSampler.h];
+    ray.rayWorldPosition = RayPosition.xyz;
+    ray.rayDir = normalize(ray.rayWorldPosition - CameraPosition);
 
-        memcpy(test, SelectionMaskSampler.data, 
-               sizeof(urgba) * SelectionMaskSampler.w * SelectionMaskSampler.h);
+    vec3 nextPosition = ray.rayWorldPosition + (ray.rayDir * RayStepSize * 0.01f);
+    vec3 test1 = sign(nextPosition - VolExtentMin);
+    vec3 test2 = sign(VolExtentMax - nextPosition);
+    if(dot(test1, test2) < 3.0f)
+        return false;
 
-        delete [] test;
-    }
+    ray.curListIndex = 0;
+    ray.curComponentIndex = 0;
+    ray.nodeUsage = uvec4(0u);
+
+    ivec2 pixelCoord = ivec2(x, y);
+    pixelCoord %= 2;
+    ray.startPushingNodes = (pixelCoord.x * k_MaxNodesPerPixel)
+                             + (pixelCoord.y * k_MaxNodesPerPixel * 2);
+    ray.stopPushingNodes = ray.startPushingNodes + k_MaxNodesPerPixel;
+
+    ray.brickRayStep = ray.rayDir;
+    ray.brickRayStep *= BrickStepVector;
+    ray.prevBrickRayStep = ray.brickRayStep;
+    ray.prevBrickRayStep *= 0.5f;
+
+    ray.octTreeNodePtr = ivec3(0);
+    ray.rootOctTreeNode = texelFetch(OctTreeSampler, ray.octTreeNodePtr, 0);
+    ray.octTreeNode = ray.rootOctTreeNode;
+
+    ray.nodeExtentMin = VolExtentMin;
+    ray.nodeExtentMax = VolExtentMax;
+    ray.nodeSize = 1.0f;
+    ray.voxelHalfSize = RootVoxelHalfSize;
+
+    ray.rayBrickPosition = ray.rayWorldPosition;
+    ray.curBrickRayPosition = ray.rayWorldPosition;
+    ray.prevBrickRayPosition = ray.rayWorldPosition;
+
+    ray.curBrickPtr = ray.rootOctTreeNode;
+    ray.prevBrickPtr = ray.curBrickPtr;
+    ray.curConstValue = vec4(0.0f);
+    ray.brickIsLoaded = false;
+    ray.curNodeIsConstant = RootNodeIsConstant;
+    ray.prevNodeIsConstant = false;
+    ray.projVoxelSize = 0.0f;
+    ray.curDepth = 0;
+    ray.curBrickDepth = 0;
+    ray.childNodePtr = uvec3(0u);
+
+    ray.nodeListTraversalCount = 0;
+    ray.pushedNodeCount = 0;
 
-    uvec4* output = new uvec4[SelectionMaskSampler.w * SelectionMaskSampler.h];
+    return true;
+}
 
-    for(int y = 0; y < SelectionMaskSampler.h; ++y)
+//texel indices that texture() reads for N coordinates, computed for the whole
+//packet at once so the loop can be vectorized
+template<int N>
+static void ComputeTexelIndices(const sampler3D& sampler,
+                                const float* pX, const float* pY, const float* pZ,
+                                int* pIndices)
+{
+    float scaleX = static_cast<float>(sampler.w-1);
+    float scaleY = static_cast<float>(sampler.h-1);
+    float scaleZ = static_cast<float>(sampler.d-1);
+    for(int lane = 0; lane < N; ++lane)
     {
-        for(int x = 0; x < SelectionMaskSampler.w; ++x)
-        {
-            ivec4 pixel(x, y, 0, 0);
-            
-            uvec4& outputPixel = output[(y * SelectionMaskSampler.w) + x];
-            
-            if(x == 400 && y == 300)
-                x = 400;
-            ComputeActiveTexels(pixel,
-                                outputPixel);
-        }
-    }
+        int x = (int)(std::floor((scaleX * pX[lane]) + 0.5f));
+        int y = (int)(std::floor((scaleY * pY[lane]) + 0.5f));
+        int z = (int)(std::floor((scaleZ * pZ[lane]) + 0.5f));
 
-    delete [] output;
-}
+        x = x < sampler.w ? x : sampler.w-1;
+        y = y < sampler.h ? y : sampler.h-1;
+        z = z < sampler.d ? z : sampler.d-1;
 
-uniform usampler2D InputTextureSampler;
+        pIndices[lane] = (z * sampler.w * sampler.h) + (y * sampler.w) + x;
+    }
+}
 
-static void GenerateSelectionMaskHistoPyramid(const in ivec4& gl_FragCoord,
-                                              out uvec4& Output)
+//the leaf marches of N rays stepped together. The positions, colors and
+//texel addresses are kept as arrays of each component so the loops in
+//sample() and step() can be vectorized, only the texel fetches and the
+//lighting of interpolated bricks go lane by lane. Lanes without a ray still
+//go through step() but nothing reads their results.
+//
+//Measured with compareRayPacketWidths on one core (g++ 12 -O2), packets of 4
+//and 8 render the test scenes 1.3x-2.0x faster than one ray at a time and 16
+//is no faster than 8. Packets of 1 are already 1.0x-1.6x faster, so most of
+//the gain comes from marching whole leaves in tight loops, not from SIMD.
+//-fopt-info-vec reports the loops of step() and ComputeTexelIndices vectorized
+//with 16 byte vectors. The descent stays lane by lane since the lanes' paths
+//down the oct tree diverge.
+template<int N>
+class RayPacket
 {
-    //the viewport for this fragment shader should be 
-    //half the size of the InputTextureSampler's texture
-    ivec2 texCoord = ivec2(gl_FragCoord.xy * 2);
-    
-    //for each pixel in the output image we
-    //compute the sum of the four texels in 
-    //the higher res mipmap image
-    glm::uint texelValue = texelFetch(InputTextureSampler, texCoord, 0).r;
-
-    texCoord.x += 1;
-    texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-
-    texCoord.y += 1;
-    texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-   
-    texCoord.x -= 1;
-    texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-
-    texCoord.y += 1;
-    if(texCoord.y == InputTextureSampler.h-1)
+private:
+    float m_posX[N], m_posY[N], m_posZ[N];
+    float m_worldStepX[N], m_worldStepY[N], m_worldStepZ[N];
+    float m_curX[N], m_curY[N], m_curZ[N];
+    float m_curStepX[N], m_curStepY[N], m_curStepZ[N];
+    float m_prevX[N], m_prevY[N], m_prevZ[N];
+    float m_prevStepX[N], m_prevStepY[N], m_prevStepZ[N];
+    float m_minX[N], m_minY[N], m_minZ[N];
+    float m_maxX[N], m_maxY[N], m_maxZ[N];
+    float m_srcR[N], m_srcG[N], m_srcB[N], m_srcA[N];
+    float m_dstR[N], m_dstG[N], m_dstB[N], m_dstA[N];
+    float m_sampleRatio[N];
+    //non zero if the lane samples a brick each step, zero for constant
+    //leaves and lanes without a ray
+    int m_sampleBrick[N];
+    //non zero if the lane blends in its parent brick
+    int m_interpolate[N];
+    int m_interpolateCount;
+    //non zero if the lane's march stops once dst is opaque
+    int m_stopWhenOpaque[N];
+    int m_inside[N];
+
+    RayPacket(const RayPacket&);
+    RayPacket& operator=(const RayPacket&);
+public:
+    RayPacket()
     {
-        texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-        texCoord.x += 1;
-        texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-        texCoord.x += 1;
-        if(texCoord.x == InputTextureSampler.w-1)
+        //lanes that never get a ray are still stepped
+        std::memset(this, 0, sizeof(RayPacket));
+    }
+
+    //starts marching ray in lane
+    void load(int lane, const PacketRay& ray)
+    {
+        m_posX[lane] = ray.rayWorldPosition.x;
+        m_posY[lane] = ray.rayWorldPosition.y;
+        m_posZ[lane] = ray.rayWorldPosition.z;
+        m_worldStepX[lane] = ray.worldRayStep.x;
+        m_worldStepY[lane] = ray.worldRayStep.y;
+        m_worldStepZ[lane] = ray.worldRayStep.z;
+        m_curX[lane] = ray.curBrickRayPos.x;
+        m_curY[lane] = ray.curBrickRayPos.y;
+        m_curZ[lane] = ray.curBrickRayPos.z;
+        m_curStepX[lane] = ray.brickRayStep.x;
+        m_curStepY[lane] = ray.brickRayStep.y;
+        m_curStepZ[lane] = ray.brickRayStep.z;
+        m_prevX[lane] = ray.prevBrickRayPos.x;
+        m_prevY[lane] = ray.prevBrickRayPos.y;
+        m_prevZ[lane] = ray.prevBrickRayPos.z;
+        m_prevStepX[lane] = ray.prevBrickRayStep.x;
+        m_prevStepY[lane] = ray.prevBrickRayStep.y;
+        m_prevStepZ[lane] = ray.prevBrickRayStep.z;
+        m_minX[lane] = ray.nodeExtentMin.x;
+        m_minY[lane] = ray.nodeExtentMin.y;
+        m_minZ[lane] = ray.nodeExtentMin.z;
+        m_maxX[lane] = ray.nodeExtentMax.x;
+        m_maxY[lane] = ray.nodeExtentMax.y;
+        m_maxZ[lane] = ray.nodeExtentMax.z;
+        if(ray.marchType == k_MarchConstant)
         {
-            texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-            texCoord.y -= 1;
-            texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-            texCoord.y -= 1;
-            texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
+            m_srcR[lane] = ray.constSrc.r;
+            m_srcG[lane] = ray.constSrc.g;
+            m_srcB[lane] = ray.constSrc.b;
+            m_srcA[lane] = ray.constSrc.a;
         }
+        m_dstR[lane] = ray.dst.r;
+        m_dstG[lane] = ray.dst.g;
+        m_dstB[lane] = ray.dst.b;
+        m_dstA[lane] = ray.dst.a;
+        m_sampleRatio[lane] = ray.sampleRatio;
+
+        m_interpolateCount -= m_interpolate[lane];
+        m_sampleBrick[lane] = ray.marchType != k_MarchConstant;
+        m_interpolate[lane] = ray.marchType == k_MarchBrickInterp;
+        m_interpolateCount += m_interpolate[lane];
+        m_stopWhenOpaque[lane] = ray.marchType == k_MarchBrick;
     }
-    else if((texCoord.x += 2) == InputTextureSampler.w-1)
+
+    //stops sampling for a lane that has no ray to march
+    void unload(int lane)
     {
-        texCoord.y -= 1;
-        texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
-        texCoord.y -= 1;
-        texelValue += texelFetch(InputTextureSampler, texCoord, 0).r;
+        m_interpolateCount -= m_interpolate[lane];
+        m_sampleBrick[lane] = 0;
+        m_interpolate[lane] = 0;
     }
-    
-    Output = uvec4(texelValue, 0u, 0u, 1u);
-}
 
-void gv::GigaVoxelsShaderCodeTester::generateSelectionMaskHistoPyramid(int renderTargetWidth,
-                                                                       int renderTargetHeight,
-                                                                       unsigned int histoPyramidTextureID,
-                                                                       int histoPyramidTextureLevel)
-{
-    glActiveTexture(GL_TEXTURE0);
-
-    if(InputTextureSampler.data == NULL)
+    //computes the samples the lanes composite on their next step, like the
+    //loops of TraverseBrick and TraverseBrickInterp
+    void sample(const PacketRay* pRays)
     {
-        glBindTexture(GL_TEXTURE_2D,
-                      histoPyramidTextureID);
-
-        GLint depth;
-        InputTextureSampler.data = 
-            (glm::uvec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D,
-                                                                         InputTextureSampler.w,
-                                                                         InputTextureSampler.h,
-                                                                         depth,
-                                                                         GL_RGBA_INTEGER, 
-                                                                         GL_UNSIGNED_INT,
-                                                                         histoPyramidTextureLevel);
-
-        struct urgba
+        int curTexels[N];
+        ComputeTexelIndices<N>(BrickSampler, m_curX, m_curY, m_curZ, curTexels);
+
+        for(int lane = 0; lane < N; ++lane)
+        {
+            if(m_sampleBrick[lane])
+            {
+                const vec4& src = BrickSampler.data[curTexels[lane]];
+                m_srcR[lane] = src.r;
+                m_srcG[lane] = src.g;
+                m_srcB[lane] = src.b;
+                m_srcA[lane] = src.a;
+            }
+        }
+
+        vec3 normals[N];
+        if(m_interpolateCount > 0)
+            blendParentBricks(pRays, curTexels, normals);
+
+        for(int lane = 0; lane < N; ++lane)
         {
-            unsigned r;
-            unsigned g;
-            unsigned b;
-            unsigned a;
-        };
+            if(m_sampleBrick[lane])
+            {
+                float sampleRatio = m_sampleRatio[lane];
+                m_srcA[lane] = 1.0f - pow((1.0f - m_srcA[lane]), sampleRatio);
+                m_srcR[lane] *= sampleRatio;
+                m_srcG[lane] *= sampleRatio;
+                m_srcB[lane] *= sampleRatio;
+            }
+        }
 
-        urgba* test = new urgba[InputTextureSampler.w * InputTextureSampler.h];
+        if(m_interpolateCount == 0)
+            return;
 
-        memcpy(test, InputTextureSampler.data, 
-               sizeof(urgba) * InputTextureSampler.w * InputTextureSampler.h);
+        for(int lane = 0; lane < N; ++lane)
+        {
+            if(!m_interpolate[lane])
+                continue;
 
-        delete [] test;
+            const PacketRay& ray = pRays[lane];
+            vec3 src(m_srcR[lane], m_srcG[lane], m_srcB[lane]);
+            src += shading(src,
+                           normalize(normals[lane]),
+                           -ray.rayDir,
+                           ray.lightDir);
+            m_srcR[lane] = src.r;
+            m_srcG[lane] = src.g;
+            m_srcB[lane] = src.b;
+        }
     }
 
-    uvec4* output = new uvec4[renderTargetWidth * renderTargetHeight];
+    //advances every lane one step and composites its sample
+    void step()
+    {
+        for(int lane = 0; lane < N; ++lane)
+        {
+            m_curX[lane] += m_curStepX[lane];
+            m_curY[lane] += m_curStepY[lane];
+            m_curZ[lane] += m_curStepZ[lane];
+
+            //only read back by lanes whose previous brick isn't constant
+            m_prevX[lane] += m_prevStepX[lane];
+            m_prevY[lane] += m_prevStepY[lane];
+            m_prevZ[lane] += m_prevStepZ[lane];
+
+            float posX = m_posX[lane] + m_worldStepX[lane];
+            float posY = m_posY[lane] + m_worldStepY[lane];
+            float posZ = m_posZ[lane] + m_worldStepZ[lane];
+            m_posX[lane] = posX;
+            m_posY[lane] = posY;
+            m_posZ[lane] = posZ;
+
+            //same as the sign test of the shader as the extents aren't empty
+            m_inside[lane] = (posX > m_minX[lane]) & (m_maxX[lane] > posX)
+                             & (posY > m_minY[lane]) & (m_maxY[lane] > posY)
+                             & (posZ > m_minZ[lane]) & (m_maxZ[lane] > posZ);
+
+            float oneMinusDstA = 1.0f - m_dstA[lane];
+            m_dstR[lane] = (oneMinusDstA * m_srcR[lane]) + m_dstR[lane];
+            m_dstG[lane] = (oneMinusDstA * m_srcG[lane]) + m_dstG[lane];
+            m_dstB[lane] = (oneMinusDstA * m_srcB[lane]) + m_dstB[lane];
+            m_dstA[lane] = (oneMinusDstA * m_srcA[lane]) + m_dstA[lane];
+        }
+    }
 
-    for(int y = 0; y < renderTargetHeight; ++y)
+    //copies the lane's position and color back to ray if its march is over
+    bool finishMarch(int lane, PacketRay& ray) const
     {
-        for(int x = 0; x < renderTargetWidth; ++x)
+        if(m_inside[lane] && !(m_stopWhenOpaque[lane] && m_dstA[lane] > 0.995f))
+            return false;
+
+        ray.rayWorldPosition = vec3(m_posX[lane], m_posY[lane], m_posZ[lane]);
+        ray.dst = vec4(m_dstR[lane], m_dstG[lane], m_dstB[lane], m_dstA[lane]);
+
+        if(ray.marchType == k_MarchBrick && ray.dst.a > 1.0f)
         {
-            ivec4 pixel(x, y, 0, 0);
-            uvec4& outputPixel = output[(y * renderTargetWidth) + x];
-            if(x == 200 && y == 150)
-                x = 200;
-            GenerateSelectionMaskHistoPyramid(pixel,
-                                              outputPixel);
+            float scalar = 1.0f / ray.dst.a;
+            ray.dst *= scalar;
         }
+        return true;
     }
+private:
+    //mixes the parent brick's sample and the gradients into the samples of
+    //the interpolated lanes like TraverseBrickInterp
+    void blendParentBricks(const PacketRay* pRays, const int* pCurTexels, vec3* pNormals)
+    {
+        int prevTexels[N];
+        ComputeTexelIndices<N>(BrickSampler, m_prevX, m_prevY, m_prevZ, prevTexels);
 
-    delete [] output;
+        //oct encoded gradients pick their texel like GL_NEAREST, see LookupGradient
+        int curGradientTexels[N];
+        int prevGradientTexels[N];
+        if(!GradientsAreOctEncoded)
+        {
+            ComputeTexelIndices<N>(BrickGradientsSampler, m_curX, m_curY, m_curZ, curGradientTexels);
+            ComputeTexelIndices<N>(BrickGradientsSampler, m_prevX, m_prevY, m_prevZ, prevGradientTexels);
+        }
 
-    delete [] InputTextureSampler.data;
-    InputTextureSampler.data = NULL;
-}
+        for(int lane = 0; lane < N; ++lane)
+        {
+            if(!m_interpolate[lane])
+                continue;
 
-uniform usamplerPyramid2D SelectionMaskHistoPyramidSampler;
-uniform int SelectionMaskHistoPyramidLevelCount;
-uniform int CompressedSelectionMaskWidth;
-uniform glm::uint CompressedSelectionMaskMaxIndex;
-uniform int MaxUNodesToPushThisFrame;
+            const PacketRay& ray = pRays[lane];
+            float oneMinusInterp = 1.0f - ray.interpolation;
 
-const ivec2 k_SameLevelTraversalIncr[9] = //ivec2[](
-{
-    //defines how to walk through a 4x4 block of texels starting at (x,y)
-    ivec2(1, 0), //go to (x+1, y)
-    ivec2(-1, 1),//next go to (x, y+1)
-    ivec2(1, 0),//go to(x+1, y+1)
-    //for odd dimensions keep going
-    ivec2(-1, 1),//go to(x, y+2)
-    ivec2(1, 0),//go to(x+1, y+2)
-    ivec2(1, 0),//go to(x+2, y+2)
-    ivec2(0, -1),//go to(x+2, y+1)
-    ivec2(0, -1),//go to(x+2, y)
-    ivec2(0, 0)
-};
-//);
+            vec4 src = BrickSampler.data[pCurTexels[lane]];
+            vec3 normal = GradientsAreOctEncoded 
+                            ? LookupGradient(vec3(m_curX[lane], m_curY[lane], m_curZ[lane]))
+                            : lookupGradient(curGradientTexels[lane]);
+            src *= oneMinusInterp;
+            normal *= oneMinusInterp;
+            if(!ray.prevNodeIsConstant)
+            {
+                vec4 prevVoxel = BrickSampler.data[prevTexels[lane]];
+                src += (prevVoxel * ray.interpolation);
 
-//uniform usampler2DArray NodeUsageListSampler;
-//uniform usampler2D SelectionMaskSampler;
-
-//const int k_NumNodeLists = 3;
-//const int k_NumComponentsPerList = 4;
-const int k_NumSelectionMaskBits = 12; //k_NumNodeLists * k_NumComponentsPerList;
-const ivec2 k_NodeListIndices[12] = {//ivec2[12](
-    ivec2(0, 0), ivec2(0, 1), ivec2(0, 2), ivec2(0, 3),
-    ivec2(1, 0), ivec2(1, 1), ivec2(1, 2), ivec2(1, 3),
-    ivec2(2, 0), ivec2(2, 1), ivec2(2, 2), ivec2(2, 3)
-};//);
-const int k_OutputIndices[12] = {//int[12](
-    0, 1, 2, 3, 
-    0, 1, 2, 3,
-    0, 1, 2, 3
-};//);
-//out uvec4 UniqueNodeUsage;
-
-void CompressNodeUsageList(const in ivec4& gl_FragCoord,
-                           out uvec4& UniqueNodeUsage)
-{
-    glm::uint key = (gl_FragCoord.y * CompressedSelectionMaskWidth) + gl_FragCoord.x;
+                vec3 prevGrad = GradientsAreOctEncoded
+                                  ? LookupGradient(vec3(m_prevX[lane], m_prevY[lane], m_prevZ[lane]))
+                                  : lookupGradient(prevGradientTexels[lane]);
+                normal += (prevGrad * ray.interpolation);
+            }
+            else
+                src += (ray.curConstValue * ray.interpolation);
 
-    if(key > CompressedSelectionMaskMaxIndex)
-    {
-        //UniqueNodeUsage = uvec4(0u, 0u, 0u, 0u);
-        //return;
-        discard;
+            m_srcR[lane] = src.r;
+            m_srcG[lane] = src.g;
+            m_srcB[lane] = src.b;
+            m_srcA[lane] = src.a;
+            pNormals[lane] = normal;
+        }
     }
-    
-    glm::uint start = 0u;
-    ivec2 texCoord = ivec2(0, 0);
-    ivec2 texSize = ivec2(1, 1);
-    //start at lowest detail mip map level
-    int pyramidLevel = SelectionMaskHistoPyramidLevelCount - 1;
-    int curLevelLoopCount = 0;
-
-    glm::uint end = 0u;
-    while(pyramidLevel >= 0)
+
+    //LookupGradient for gradients that aren't oct encoded
+    static vec3 lookupGradient(int texel)
     {
-        end = start + texelFetch(SelectionMaskHistoPyramidSampler, texCoord, pyramidLevel).r;
+        vec3 normal = BrickGradientsSampler.data[texel].rgb;
 
-        if(key >= start && key < end)
+        if(GradientsAreUnsigned)
         {
-            --pyramidLevel;//descend a level
-            curLevelLoopCount = 0;
-            texCoord <<= 1;
-            if(pyramidLevel >= 0)
-                texSize = ivec2(SelectionMaskHistoPyramidSampler.mipMaps.at(pyramidLevel).w, 
-                                SelectionMaskHistoPyramidSampler.mipMaps.at(pyramidLevel).h);
+            normal *= 2.0f;
+            normal -= 1.0f;
         }
-        else
+
+        return normal;
+    }
+};
+
+namespace
+{
+    class RenderTilesTask : public vox::ScreenTileTask
+    {
+    private:
+        vox::ScreenRays m_rays;
+        int m_rayPacketWidth;
+        unsigned char* m_pRGBA;
+        unsigned int* m_pNodeUsageLists;
+    public:
+        RenderTilesTask(const vox::ScreenRays& rays,
+                        int width, int height,
+                        int rayPacketWidth,
+                        unsigned char* pRGBA,
+                        unsigned int* pNodeUsageLists) :
+            vox::ScreenTileTask(width, height),
+            m_rays(rays),
+            m_rayPacketWidth(rayPacketWidth),
+            m_pRGBA(pRGBA),
+            m_pNodeUsageLists(pNodeUsageLists)
+        {
+        }
+    protected:
+        virtual void renderTile(int startX, int startY, int endX, int endY)
         {
-            texCoord += k_SameLevelTraversalIncr[curLevelLoopCount];
-            ++curLevelLoopCount;
-            if(curLevelLoopCount == 4 && texCoord.y != texSize.y-1)
+            switch(m_rayPacketWidth)
             {
-                //y+2 is not the last row so jump to 
-                //x+2 column
-                curLevelLoopCount = 7;
-                texCoord.x += 2;
-                texCoord.y -= 1;
+            case 1:
+                renderPackets<1>(startX, startY, endX, endY);
+                break;
+            case 4:
+                renderPackets<4>(startX, startY, endX, endY);
+                break;
+            case 8:
+                renderPackets<8>(startX, startY, endX, endY);
+                break;
+            case 16:
+                renderPackets<16>(startX, startY, endX, endY);
+                break;
+            default:
+                renderRays(startX, startY, endX, endY);
+                break;
             }
-            
-            if(curLevelLoopCount >= 6 && texCoord.x != texSize.x-1)
+        }
+    private:
+        void renderRays(int startX, int startY, int endX, int endY)
+        {
+            for(int y = startY; y < endY; ++y)
             {
-                //x+2 is not last column so exit
-                curLevelLoopCount = 9;
-            }
+                for(int x = startX; x < endX; ++x)
+                {
+                    vec4 fragColor(0.0f);
+                    uvec4 nodeUsageList[k_NumNodeLists];
+                    for(int i = 0; i < k_NumNodeLists; ++i)
+                        nodeUsageList[i] = uvec4(0u);
 
-            start = end;
-            if(curLevelLoopCount == 9)
-            {
-                //i'm pretty sure this should never happen, but need way out to
-                //prevent endless loop
-                UniqueNodeUsage = uvec4(0u, 0u, 0u, 1u);
-                return;
+                    vec4 rayPosition;
+                    if(ComputeRayPosition(m_rays, x, y, rayPosition))
+                    {
+                        GigaVoxelsFragmentShader(ivec4(x, y, 0, 0),
+                                                 rayPosition,
+                                                 fragColor,
+                                                 nodeUsageList);
+                    }
+
+                    writePixel(x, y, fragColor, nodeUsageList);
+                }
             }
         }
-    }
 
-    texCoord >>= 1;
-    if(texCoord.x == 400 && texCoord.y == 300)
-        std::cout << "here" << std::endl;
-    //use the final tex coord computed in the loop above to
-    //lookup the selection mask bits
-    uvec4 selectionMaskTexel = texelFetch(SelectionMaskSampler, texCoord, 0);
-
-    glm::uint selectionMaskBits = selectionMaskTexel.r;
-    ivec3 nodeUsageListTexCoord = ivec3(selectionMaskTexel.g, selectionMaskTexel.b, 0);
-
-    //offsets for lists 2 and 3 
-    const ivec3 list1 = ivec3(0, 0, 1);
-    const ivec3 list2 = ivec3(0, 0, 2);
-    uvec4 nodeUsageList[3] = {//uvec4[](
-        texelFetch(NodeUsageListSampler, nodeUsageListTexCoord, 0),
-        texelFetch(NodeUsageListSampler, nodeUsageListTexCoord + list1, 0),
-        texelFetch(NodeUsageListSampler, nodeUsageListTexCoord + list2, 0)
-    };//);
-
-    uvec4 nodeListItems = uvec4(0u, 0u, 0u, 0u);
-    int pushedNodes = 0;
-    //for each set bit in the selection mask grab the corresponding
-    //item from the node usage list and store in the unique node usage output
-    for(int itemIndex = 0; 
-        itemIndex < k_NumSelectionMaskBits 
-        && selectionMaskBits != 0u
-        && pushedNodes < MaxUNodesToPushThisFrame;//k_NumComponentsPerList;//as soon as we have stored 4 then quit
-        ++itemIndex, selectionMaskBits >>= 1u)
-    {
-        glm::uint testBit = selectionMaskBits & 1u;
-        if(testBit != 0u)
+        //the lanes of a packet take the tile's pixels 2x2 block by 2x2 block, a
+        //lane whose ray is done takes the next pixel so the lanes stay busy. The
+        //lanes that need a new leaf go down the oct tree together a level at a
+        //time, then the whole packet marches a step.
+        template<int N>
+        void renderPackets(int startX, int startY, int endX, int endY)
         {
-            ivec2 indices = k_NodeListIndices[itemIndex];
-            glm::uint nodeListItem = nodeUsageList[indices.x][indices.y];
+            RayPacket<N> packet;
+            PacketRay rays[N];
+            bool laneIsMarching[N];
+            bool laneIsDescending[N];
+            int activeLaneCount = 0;
+            int nextPixel = 0;
+
+            for(int lane = 0; lane < N; ++lane)
+            {
+                laneIsMarching[lane] = false;
+                laneIsDescending[lane] = startRay(rays[lane], nextPixel, startX, startY, endX, endY);
+                if(laneIsDescending[lane])
+                    ++activeLaneCount;
+            }
 
-            nodeListItems[k_OutputIndices[pushedNodes]] = nodeListItem;
+            while(activeLaneCount > 0)
+            {
+                bool descending = true;
+                while(descending)
+                {
+                    descending = false;
+                    for(int lane = 0; lane < N; ++lane)
+                    {
+                        if(!laneIsDescending[lane])
+                            continue;
 
-            ++pushedNodes;
-        }
-    }
+                        PacketRay& ray = rays[lane];
+                        int rayState = DescendPacketRay(ray);
+                        if(rayState == k_RayIsDescending)
+                        {
+                            descending = true;
+                            continue;
+                        }
 
-    UniqueNodeUsage = nodeListItems;
-}
+                        if(rayState == k_RayIsAtLeaf)
+                        {
+                            packet.load(lane, ray);
+                            laneIsDescending[lane] = false;
+                            laneIsMarching[lane] = true;
+                            continue;
+                        }
 
-bool VerifyHistoPyramid(int pyramidLevel, const glm::ivec2& texCoord)
-{
-    if(pyramidLevel == 0)
-        return true;
+                        writePixel(ray.x, ray.y, ray.dst, ray.nodeUsageList);
 
-    glm::uint texelValue = texelFetch(SelectionMaskHistoPyramidSampler, texCoord, pyramidLevel).r;
+                        laneIsDescending[lane] = startRay(ray, nextPixel, startX, startY, endX, endY);
+                        if(laneIsDescending[lane])
+                            descending = true;
+                        else
+                            --activeLaneCount;
+                    }
+                }
 
-    glm::ivec2 nextLevelUV1 = texCoord << 1;
-    --pyramidLevel;
+                if(activeLaneCount == 0)
+                    break;
 
-    glm::uint texelSum = texelFetch(SelectionMaskHistoPyramidSampler, nextLevelUV1, pyramidLevel).r;
-   
-    ivec2 nextLevelUV2 = nextLevelUV1;
-    nextLevelUV2.x += 1;
-    texelSum += texelFetch(SelectionMaskHistoPyramidSampler, nextLevelUV2, pyramidLevel).r;
-    
-    ivec2 nextLevelUV3 = nextLevelUV2;
-    nextLevelUV3.y += 1;
-    texelSum += texelFetch(SelectionMaskHistoPyramidSampler, nextLevelUV3, pyramidLevel).r;
+                packet.sample(rays);
 
-    ivec2 nextLevelUV4 = nextLevelUV3;
-    nextLevelUV4.x -= 1;
-    texelSum += texelFetch(SelectionMaskHistoPyramidSampler, nextLevelUV4, pyramidLevel).r;
+                packet.step();
 
-    ivec2 extraCoord = nextLevelUV4;
-    extraCoord.y += 1;
-    if(extraCoord.y == SelectionMaskHistoPyramidSampler.mipMaps.at(pyramidLevel).h-1)
-    {
-        texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
-        extraCoord.x += 1;
-        texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
-        extraCoord.x += 1;
-        if(extraCoord.x == SelectionMaskHistoPyramidSampler.mipMaps.at(pyramidLevel).w-1)
+                for(int lane = 0; lane < N; ++lane)
+                {
+                    PacketRay& ray = rays[lane];
+                    if(!laneIsMarching[lane] || !packet.finishMarch(lane, ray))
+                        continue;
+
+                    laneIsMarching[lane] = false;
+                    packet.unload(lane);
+
+                    if(FinishPacketRayLeaf(ray))
+                    {
+                        laneIsDescending[lane] = true;
+                        continue;
+                    }
+
+                    writePixel(ray.x, ray.y, ray.dst, ray.nodeUsageList);
+
+                    laneIsDescending[lane] = startRay(ray, nextPixel, startX, startY, endX, endY);
+                    if(!laneIsDescending[lane])
+                        --activeLaneCount;
+                }
+            }
+        }
+
+        //starts ray on the tile's next pixel that hits the volume, the pixels
+        //skipped over are written. Returns false once the tile's pixels run out.
+        bool startRay(PacketRay& ray, int& nextPixel,
+                      int startX, int startY, int endX, int endY)
+        {
+            while(nextPixel < k_TileSize * k_TileSize)
+            {
+                int block = nextPixel / 4;
+                int x = startX + ((block % (k_TileSize / 2)) * 2) + (nextPixel % 2);
+                int y = startY + ((block / (k_TileSize / 2)) * 2) + ((nextPixel / 2) % 2);
+                ++nextPixel;
+
+                if(x >= endX || y >= endY)
+                    continue;
+
+                vec4 rayPosition;
+                if(ComputeRayPosition(m_rays, x, y, rayPosition))
+                {
+                    if(StartPacketRay(ray, x, y, rayPosition))
+                        return true;
+                }
+                else
+                {
+                    ray.dst = vec4(0.0f);
+                    for(int i = 0; i < k_NumNodeLists; ++i)
+                        ray.nodeUsageList[i] = uvec4(0u);
+                }
+
+                writePixel(x, y, ray.dst, ray.nodeUsageList);
+            }
+            return false;
+        }
+
+        void writePixel(int x, int y, vec4 fragColor, const uvec4* nodeUsageList)
         {
-            texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
-            extraCoord.y -= 1;
-            texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
-            extraCoord.y -= 1;
-            texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
+            size_t pixel = (static_cast<size_t>(y) * m_width) + x;
+
+            fragColor = clamp(fragColor, 0.0f, 1.0f);
+            unsigned char* pColor = m_pRGBA + (pixel * 4);
+            for(int i = 0; i < 4; ++i)
+                pColor[i] = static_cast<unsigned char>((fragColor[i] * 255.0f) + 0.5f);
+
+            if(m_pNodeUsageLists != NULL)
+            {
+                size_t layerSize = static_cast<size_t>(m_width) * m_height;
+                for(int list = 0; list < k_NumNodeLists; ++list)
+                {
+                    unsigned int* pNodeUsage = m_pNodeUsageLists + (((list * layerSize) + pixel) * 4);
+                    for(int i = 0; i < 4; ++i)
+                        pNodeUsage[i] = nodeUsageList[list][i];
+                }
+            }
         }
-    }
-    else if((extraCoord.x += 2) == SelectionMaskHistoPyramidSampler.mipMaps.at(pyramidLevel).w-1)
+    };
+}
+
+static bool RenderFrame(const vox::Camera& camera,
+                        int rayPacketWidth,
+                        unsigned char* pRGBA,
+                        unsigned int* pNodeUsageLists)
+{
+    if(OctTreeSampler.data == NULL || BrickSampler.data == NULL)
     {
-        extraCoord.y -= 1;
-        texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
-        extraCoord.y -= 1;
-        texelSum += texelFetch(SelectionMaskHistoPyramidSampler, extraCoord, pyramidLevel).r;
+        std::cerr << "ERROR: An oct tree must be captured or read before rendering a frame." << std::endl;
+        return false;
     }
-    
-    VerifyHistoPyramid(pyramidLevel, nextLevelUV1);
-    VerifyHistoPyramid(pyramidLevel, nextLevelUV2);
-    VerifyHistoPyramid(pyramidLevel, nextLevelUV3);
-    VerifyHistoPyramid(pyramidLevel, nextLevelUV4);
 
-    if(texelValue != texelSum)
+    int width, height;
+    camera.getViewportWidthHeight(width, height);
+    if(width <= 0 || height <= 0)
         return false;
 
+    SetCameraUniforms(camera);
+
+    RenderTilesTask task(CreateScreenRays(width, height),
+                         width, height,
+                         rayPacketWidth,
+                         pRGBA,
+                         pNodeUsageLists);
+
+    vox::SlabThreads::Run(task, vox::SlabThreads::GetThreadCount());
+
     return true;
 }
 
-void gv::GigaVoxelsShaderCodeTester::compressNodeUsageList(voxOpenGL::ShaderProgram* pShaderProgram,
-                                                           int renderTargetWidth,
-                                                           int renderTargetHeight,
-                                                           unsigned int histoPyramidTextureID,
-                                                           unsigned int nodeUsageTexture,
-                                                           unsigned int selectionMaskTexture)
+bool gv::GigaVoxelsShaderCodeTester::renderFrame(const vox::Camera& camera,
+                                                 unsigned char* pRGBA,
+                                                 unsigned int* pNodeUsageLists)
 {
-    pShaderProgram->getUniformValue("SelectionMaskHistoPyramidLevelCount",
-                                    &SelectionMaskHistoPyramidLevelCount);
-    pShaderProgram->getUniformValue("CompressedSelectionMaskWidth",
-                                    &CompressedSelectionMaskWidth);
-    pShaderProgram->getUniformValue("CompressedSelectionMaskMaxIndex",
-                                    &CompressedSelectionMaskMaxIndex);
-    pShaderProgram->getUniformValue("MaxNodesToPushThisFrame",
-                                    &MaxUNodesToPushThisFrame);
+    return RenderFrame(camera,
+                       s_rayPacketWidth == 1 ? k_ScalarRays : s_rayPacketWidth,
+                       pRGBA,
+                       pNodeUsageLists);
+}
 
-    glActiveTexture(GL_TEXTURE0);
+bool gv::GigaVoxelsShaderCodeTester::setRayPacketWidth(int width)
+{
+    if(width != 1 && width != 4 && width != 8 && width != 16)
+    {
+        std::cerr << "WARNING: Ray packets must be 1, 4, 8 or 16 rays wide, not " << width << "." << std::endl;
+        return false;
+    }
+    s_rayPacketWidth = width;
+    return true;
+}
 
-    
-    if(SelectionMaskHistoPyramidSampler.mipMaps.size() == 0)
+int gv::GigaVoxelsShaderCodeTester::getRayPacketWidth()
+{
+    return s_rayPacketWidth;
+}
+
+bool gv::GigaVoxelsShaderCodeTester::compareRayPacketWidths(const vox::Camera& camera)
+{
+    int width, height;
+    camera.getViewportWidthHeight(width, height);
+    if(width <= 0 || height <= 0)
+        return false;
+
+    size_t pixelCount = static_cast<size_t>(width) * height;
+    std::vector<unsigned char> scalarRGBA(pixelCount * 4);
+    std::vector<unsigned int> scalarNodeUsageLists(pixelCount * k_NumNodeLists * 4);
+    std::vector<unsigned char> rgba(scalarRGBA.size());
+    std::vector<unsigned int> nodeUsageLists(scalarNodeUsageLists.size());
+
+    const int rayPacketWidths[] = { k_ScalarRays, 1, 4, 8, 16 };
+    const int rayPacketWidthCount = sizeof(rayPacketWidths) / sizeof(int);
+
+    bool matches = true;
+    double scalarMilliseconds = 0.0;
+    for(int i = 0; i < rayPacketWidthCount; ++i)
     {
-        glBindTexture(GL_TEXTURE_2D,
-                      histoPyramidTextureID);
+        int rayPacketWidth = rayPacketWidths[i];
+        bool isScalar = rayPacketWidth == k_ScalarRays;
+
+        QElapsedTimer timer;
+        timer.start();
+        if(!RenderFrame(camera, rayPacketWidth,
+                        isScalar ? &scalarRGBA[0] : &rgba[0],
+                        isScalar ? &scalarNodeUsageLists[0] : &nodeUsageLists[0]))
+        {
+            return false;
+        }
+        double milliseconds = static_cast<double>(timer.nsecsElapsed()) / 1000000.0;
 
-        GLint depth;
+        if(isScalar)
+        {
+            scalarMilliseconds = milliseconds;
+            std::cout << "Rays one at a time " << milliseconds << " ms" << std::endl;
+            continue;
+        }
 
-        SelectionMaskHistoPyramidSampler.mipMaps.resize(SelectionMaskHistoPyramidLevelCount);
+        std::cout << "Ray packets of " << rayPacketWidth << " " << milliseconds << " ms";
+        if(milliseconds > 0.0)
+            std::cout << " (" << (scalarMilliseconds / milliseconds) << "x)";
+        std::cout << std::endl;
 
-        for(int i = 0; i < SelectionMaskHistoPyramidLevelCount; ++i)
+        if(rgba != scalarRGBA || nodeUsageLists != scalarNodeUsageLists)
         {
-            SelectionMaskHistoPyramidSampler.mipMaps[i].data = 
-                (glm::uvec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D,
-                                                                             SelectionMaskHistoPyramidSampler.mipMaps[i].w,
-                                                                             SelectionMaskHistoPyramidSampler.mipMaps[i].h,
-                                                                             depth,
-                                                                             GL_RGBA_INTEGER, 
-                                                                             GL_UNSIGNED_INT,
-                                                                             i);
+            std::cerr << "ERROR: Ray packets of " << rayPacketWidth 
+                      << " render different pixels than rays traced one at a time." << std::endl;
+            matches = false;
         }
+    }
 
-        glm::ivec2 texCoord(0, 0);
-        VerifyHistoPyramid(SelectionMaskHistoPyramidLevelCount-1, texCoord);
+    return matches;
+}
+
+//one rgba texel of a compressed node usage list
+struct CompressedNodeUsage
+{
+    glm::uint items[k_NumComponentsPerList];
+
+    bool operator<(const CompressedNodeUsage& rhs) const
+    {
+        return std::lexicographical_compare(items, items + k_NumComponentsPerList,
+                                            rhs.items, rhs.items + k_NumComponentsPerList);
     }
 
-    if(NodeUsageListSampler.data == NULL)
+    bool operator==(const CompressedNodeUsage& rhs) const
     {
-        glBindTexture(GL_TEXTURE_2D_ARRAY, nodeUsageTexture);
+        return std::equal(items, items + k_NumComponentsPerList, rhs.items);
+    }
+};
 
-        NodeUsageListSampler.data = (glm::uvec4*)
-            voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D_ARRAY,
-                                                            NodeUsageListSampler.w,
-                                                            NodeUsageListSampler.h,
-                                                            NodeUsageListSampler.d,
-                                                            GL_RGBA_INTEGER, 
-                                                            GL_UNSIGNED_INT);
+static glm::uint GetNodeUsage(const unsigned int* pNodeUsageLists,
+                              int width, int height,
+                              int x, int y, int item)
+{
+    //neighbors past the edge read as empty lists like the shader's
+    if(x >= width || y >= height)
+        return 0u;
+
+    size_t layerSize = static_cast<size_t>(width) * height;
+    size_t pixel = (static_cast<size_t>(y) * width) + x;
+    int list = item / k_NumComponentsPerList;
+    return pNodeUsageLists[(((list * layerSize) + pixel) * k_NumComponentsPerList)
+                           + (item % k_NumComponentsPerList)];
+}
 
-        struct urgba
-        {
-            unsigned r;
-            unsigned g;
-            unsigned b;
-            unsigned a;
-        };
+bool gv::GigaVoxelsShaderCodeTester::checkNodeUsageListCompressor(const unsigned int* pNodeUsageLists,
+                                                                  int width,
+                                                                  int height,
+                                                                  int maxNodesToPush)
+{
+    if(pNodeUsageLists == NULL || width <= 0 || height <= 0)
+        return false;
 
-        urgba* test = new urgba[NodeUsageListSampler.w * NodeUsageListSampler.h * NodeUsageListSampler.d];
-        memcpy(test, NodeUsageListSampler.data, sizeof(urgba) * NodeUsageListSampler.w * NodeUsageListSampler.h * NodeUsageListSampler.d);
+    NodeUsageListCompressor compressor;
+    unsigned int listLength = compressor.compress(pNodeUsageLists, width, height, maxNodesToPush);
 
-        delete [] test;
-    }
+    const unsigned int* pSelectionMask = compressor.getSelectionMask();
 
-    if(SelectionMaskSampler.data == NULL)
+    //walk the lists with the rules of GenerateSelectionMask.frag and
+    //CompressNodeUsageList.frag, each pixel keeps the items that its top,
+    //top right and right neighbors two pixels away don't hold at the
+    //same, previous or next index
+    std::vector<CompressedNodeUsage> expected;
+    for(int y = 0; y < height; ++y)
     {
-        glBindTexture(GL_TEXTURE_2D,
-                      selectionMaskTexture);
-
-        GLint depth;
-        SelectionMaskSampler.data = 
-            (glm::uvec4*)voxOpenGL::GLUtils::LoadImageFromCurrentTexture(GL_TEXTURE_2D,
-                                                                         SelectionMaskSampler.w,
-                                                                         SelectionMaskSampler.h,
-                                                                         depth,
-                                                                         GL_RGBA_INTEGER, 
-                                                                         GL_UNSIGNED_INT);
-       
-        //urgba* test = new urgba[SelectionMaskSampler.w * SelectionMaskSampler.h];
-
-        //memcpy(test, SelectionMaskSampler.data, 
-        //       sizeof(urgba) * SelectionMaskSampler.w * SelectionMaskSampler.h);
-
-        //delete [] test;
+        for(int x = 0; x < width; ++x)
+        {
+            glm::uint selectionBits = 0u;
+            for(int item = 0; item < k_MaxNodesPerPixel; ++item)
+            {
+                glm::uint nodeUsage = GetNodeUsage(pNodeUsageLists, width, height, x, y, item);
+                if(nodeUsage == 0u)
+                    break;
+
+                int neighborItems[3] = { (item + k_MaxNodesPerPixel - 1) % k_MaxNodesPerPixel,
+                                         item,
+                                         (item + 1) % k_MaxNodesPerPixel };
+                bool hasTop = y < height - 2;
+                bool hasRight = x < width - 2;
+                bool keep = true;
+                for(int i = 0; i < 3 && keep; ++i)
+                {
+                    if((hasTop && GetNodeUsage(pNodeUsageLists, width, height, x, y + 2, neighborItems[i]) == nodeUsage)
+                       || (hasTop && hasRight && GetNodeUsage(pNodeUsageLists, width, height, x + 2, y + 2, neighborItems[i]) == nodeUsage)
+                       || (hasRight && GetNodeUsage(pNodeUsageLists, width, height, x + 2, y, neighborItems[i]) == nodeUsage))
+                    {
+                        keep = false;
+                    }
+                }
+
+                if(keep)
+                    selectionBits |= (1u << glm::uint(item));
+            }
+
+            size_t pixel = (static_cast<size_t>(y) * width) + x;
+            if(pSelectionMask[pixel * 4] != selectionBits)
+            {
+                std::cerr << "ERROR: NodeUsageListCompressor selection mask at " << x << " " << y 
+                          << " is " << pSelectionMask[pixel * 4] << " not " << selectionBits << "." << std::endl;
+                return false;
+            }
+
+            if(selectionBits == 0u)
+                continue;
+
+            CompressedNodeUsage compressedNodeUsage = { { 0u, 0u, 0u, 0u } };
+            int pushedNodes = 0;
+            for(int item = 0; item < k_MaxNodesPerPixel && pushedNodes < maxNodesToPush; ++item)
+            {
+                if((selectionBits & (1u << glm::uint(item))) != 0u)
+                {
+                    compressedNodeUsage.items[pushedNodes % k_NumComponentsPerList] = 
+                        GetNodeUsage(pNodeUsageLists, width, height, x, y, item);
+                    ++pushedNodes;
+                }
+            }
+            expected.push_back(compressedNodeUsage);
+        }
     }
 
-    struct URGBA
+    size_t expectedLength = expected.size();
+    if(expectedLength > NodeUsageListCompressor::k_MaxListLength)
+        expectedLength = NodeUsageListCompressor::k_MaxListLength;
+
+    if(listLength != expectedLength)
     {
-        unsigned r;
-        unsigned g;
-        unsigned b;
-        unsigned a;
-    };
-    URGBA* output = new URGBA[renderTargetWidth * renderTargetHeight];
+        std::cerr << "ERROR: NodeUsageListCompressor list length is " << listLength 
+                  << " not " << expectedLength << "." << std::endl;
+        return false;
+    }
 
-    for(int y = 0; y < renderTargetHeight; ++y)
+    //the histopyramid orders the list, so compare them sorted, a list cut
+    //at the max length only has to be part of the expected one
+    const unsigned int* pCompressedList = compressor.getCompressedList();
+    std::vector<CompressedNodeUsage> compressed(listLength);
+    for(unsigned int i = 0; i < listLength; ++i)
+        std::copy(pCompressedList + (i * 4), pCompressedList + (i * 4) + 4, compressed[i].items);
+
+    std::sort(expected.begin(), expected.end());
+    std::sort(compressed.begin(), compressed.end());
+
+    bool matches = compressed.size() == expected.size()
+                        ? compressed == expected
+                        : std::includes(expected.begin(), expected.end(),
+                                        compressed.begin(), compressed.end());
+    if(!matches)
     {
-        for(int x = 0; x < renderTargetWidth; ++x)
-        {
-            ivec4 pixel(x, y, 0, 0);
-            uvec4& outputPixel = *reinterpret_cast<uvec4*>(&output[(y * renderTargetWidth) + x]);
-            CompressNodeUsageList(pixel,
-                                  outputPixel);
-        }
+        std::cerr << "ERROR: NodeUsageListCompressor list does not hold the node usages of the frame." << std::endl;
+        return false;
     }
 
-    delete [] output;
+    return true;
 }
@@ -4,35 +4,54 @@
 #include "VoxVizOpenGL/GLShaderProgramManager.h"
 #include "GigaVoxels/GigaVoxelsOctTree.h"
 #include "VoxVizCore/Array.h"
+#include "VoxVizCore/Camera.h"
+
+#include <string>
 
 namespace gv
 {
     class GigaVoxelsShaderCodeTester
     {
     public:
-        static void drawVolume(voxOpenGL::ShaderProgram* pShaderProgram,
-                               GigaVoxelsOctTree* pOctTree,
-                               const vox::FloatArray& vertexArray,
-                               float lookX,
-                               float lookY,
-                               float lookZ);
-
-        static void generateNodeUsageSelectionMask(voxOpenGL::ShaderProgram* pShaderProgram,
-                                                   unsigned int nodeUsageTexture);
-
-        static void computeActiveTexels(unsigned int selectionMaskTextureID);
-
-        static void generateSelectionMaskHistoPyramid(int renderTargetWidth,
-                                                      int renderTargetHeight,
-                                                      unsigned int histoPyramidTextureID,
-                                                      int histoPyramidTextureLevel);
-
-        static void compressNodeUsageList(voxOpenGL::ShaderProgram* pShaderProgram,
-                                          int renderTargetWidth,
-                                          int renderTargetHeight,
-                                          unsigned int histoPyramidTextureID,
-                                          unsigned int nodeUsageTexture,
-                                          unsigned int selectionMaskTexture);
+        //copies the node pool and brick pool textures of pOctTree and the uniforms
+        //of the bound GigaVoxels shader so that frames can be rendered on the CPU
+        static void captureOctTree(voxOpenGL::ShaderProgram* pShaderProgram,
+                                   GigaVoxelsOctTree* pOctTree);
+
+        //captures written to disk can be read and rendered on hosts without a GPU,
+        //but only by builds with the same uniform layout
+        static bool writeCapture(const std::string& filename);
+        static bool readCapture(const std::string& filename);
+
+        //ray casts the captured oct tree from camera in screen tiles spread over
+        //all cores. pRGBA receives the viewport's width*height premultiplied RGBA
+        //pixels, bottom row first like glReadPixels. If pNodeUsageLists is not
+        //NULL it receives the 3 layers of width*height uvec4 node usage lists.
+        //Only one frame can be rendered at a time.
+        static bool renderFrame(const vox::Camera& camera,
+                                unsigned char* pRGBA,
+                                unsigned int* pNodeUsageLists=NULL);
+
+        //renderFrame marches 4, 8 or 16 rays at once through the leaves they
+        //reach so the steps can be vectorized, 1 traces each ray on its own.
+        //Every width renders the same pixels. Defaults to 8.
+        static bool setRayPacketWidth(int width);
+        static int getRayPacketWidth();
+
+        //renders camera's frame tracing one ray at a time and with packets of
+        //1, 4, 8 and 16 rays and prints how long each took. Returns false if
+        //a packet width renders different pixels or node usage lists.
+        static bool compareRayPacketWidths(const vox::Camera& camera);
+
+        //compresses renderFrame's pNodeUsageLists with NodeUsageListCompressor
+        //and checks the selection mask and the compressed list against the
+        //rules of the GenerateSelectionMask and CompressNodeUsageList shaders
+        //applied to the same lists. Returns false and reports the first
+        //difference if they don't match.
+        static bool checkNodeUsageListCompressor(const unsigned int* pNodeUsageLists,
+                                                 int width,
+                                                 int height,
+                                                 int maxNodesToPush);
     };
 };
 
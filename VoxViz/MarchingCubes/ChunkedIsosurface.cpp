@@ -0,0 +1,420 @@
+#include "ChunkedIsosurface.h"
+#include "MarchingCubesRenderer.h"
+
+#include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/MinMaxBlocks.h"
+#include "VoxVizCore/SpanSpaceIndex.h"
+#include "VoxVizCore/SlabThreads.h"
+
+#include <QtCore/QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using namespace mc;
+
+namespace
+{
+    //tells if a world position is on a face of the whole volume, where a
+    //border of the isosurface is a real hole and gets no skirt
+    class VolumeFaces
+    {
+    private:
+        QVector3D m_origin;
+        QVector3D m_axes[3];
+        float m_dims[3];
+    public:
+        //dataSet is placed volumeOffset voxels into a volume of volumeDims
+        VolumeFaces(const vox::VolumeDataSet& dataSet,
+                    const size_t volumeOffset[3],
+                    const size_t volumeDims[3])
+        {
+            QVector3D origin = dataSet.xyz(0, 0, 0);
+            m_axes[0] = dataSet.xyz(1, 0, 0) - origin;
+            m_axes[1] = dataSet.xyz(0, 1, 0) - origin;
+            m_axes[2] = dataSet.xyz(0, 0, 1) - origin;
+            m_origin = origin;
+            for(size_t i = 0; i < 3; ++i)
+            {
+                m_origin -= m_axes[i] * volumeOffset[i];
+                m_dims[i] = static_cast<float>(volumeDims[i] - 1);
+            }
+        }
+
+        bool onFace(const float position[3]) const
+        {
+            static const float k_Tolerance = 0.001f;
+
+            QVector3D offset = QVector3D(position[0], position[1], position[2]) - m_origin;
+            for(size_t i = 0; i < 3; ++i)
+            {
+                //the axes are orthogonal, a projection gives the voxel coordinate
+                float coord = QVector3D::dotProduct(offset, m_axes[i]) / m_axes[i].lengthSquared();
+                if(coord < k_Tolerance || coord > m_dims[i] - k_Tolerance)
+                    return true;
+            }
+            return false;
+        }
+    };
+}
+
+size_t ChunkedIsosurface::LodLevelCount(size_t chunkDim)
+{
+    //the chunk boxes of every level have to be aligned to its stride
+    size_t levelCount = 1;
+    while(levelCount < k_MaxLodLevels && (chunkDim % (1 << levelCount)) == 0)
+        ++levelCount;
+    return levelCount;
+}
+
+bool ChunkedIsosurface::ExtractChunk(const MarchingCubesRenderer& renderer,
+                                     const vox::VolumeDataSet& dataSet,
+                                     float isoLevel,
+                                     const size_t cellStart[3],
+                                     const size_t cellEnd[3],
+                                     size_t lodLevelCount,
+                                     const size_t volumeOffset[3],
+                                     const size_t volumeDims[3],
+                                     const std::vector<size_t>* pActiveBlocks,
+                                     bool parallel,
+                                     Chunk& chunk)
+{
+    VolumeFaces volumeFaces(dataSet, volumeOffset, volumeDims);
+
+    chunk.cellSize = std::max(std::max((dataSet.xyz(1, 0, 0) - dataSet.xyz(0, 0, 0)).length(),
+                                       (dataSet.xyz(0, 1, 0) - dataSet.xyz(0, 0, 0)).length()),
+                              (dataSet.xyz(0, 0, 1) - dataSet.xyz(0, 0, 0)).length());
+    //deep enough to cover the error of the coarsest neighbor
+    float skirtDepth = chunk.cellSize * (1 << (lodLevelCount - 1));
+
+    for(size_t level = 0; level < lodLevelCount; ++level)
+    {
+        size_t stride = 1 << level;
+        size_t levelStart[3];
+        size_t levelEnd[3];
+        for(size_t i = 0; i < 3; ++i)
+        {
+            levelStart[i] = cellStart[i] / stride;
+            levelEnd[i] = (cellEnd[i] + stride - 1) / stride;
+        }
+
+        vox::SmartPtr<MarchingCubesMesh> spMesh =
+            renderer.extractIsosurface(dataSet, isoLevel, stride, levelStart, levelEnd,
+                                       level == 0 ? pActiveBlocks : NULL, parallel);
+        if(level == 0 && spMesh->triangleCount() == 0)
+            return false;
+
+        const MarchingCubesMesh::VertexArray& vertices = spMesh->getVertices();
+        std::vector<bool> skirtVertices(vertices.size());
+        for(size_t i = 0; i < vertices.size(); ++i)
+            skirtVertices[i] = !volumeFaces.onFace(vertices[i].position);
+        spMesh->addSkirts(skirtDepth, skirtVertices);
+
+        for(size_t i = 0; i < vertices.size(); ++i)
+        {
+            chunk.boundingBox.expandBy(vertices[i].position[0],
+                                       vertices[i].position[1],
+                                       vertices[i].position[2]);
+        }
+
+        chunk.lodMeshes.push_back(spMesh.get());
+    }
+
+    chunk.boundingSphere.setCenter(chunk.boundingBox.center());
+    chunk.boundingSphere.setRadius(chunk.boundingBox.radius());
+
+    return true;
+}
+
+namespace mc
+{
+    //extracts a range of the chunks of an in memory volume, each on the
+    //calling thread so the chunks rather than their block layers are spread
+    //over the threads
+    class ExtractChunksSlabTask : public vox::SlabTask
+    {
+    private:
+        const MarchingCubesRenderer& m_renderer;
+        const vox::VolumeDataSet& m_dataSet;
+        float m_isoLevel;
+        size_t m_chunkDim;
+        size_t m_lodLevelCount;
+        const size_t* m_chunks;
+        const size_t* m_cellCounts;
+        //chunks to extract and their active blocks, NULL if not bucketed
+        const std::vector<size_t>& m_chunkIndices;
+        const std::vector< std::vector<size_t> >* m_pChunkBlocks;
+        std::vector<ChunkedIsosurface::Chunk>& m_extracted;
+        std::vector<bool>& m_hasTriangles;
+    public:
+        ExtractChunksSlabTask(const MarchingCubesRenderer& renderer,
+                              const vox::VolumeDataSet& dataSet,
+                              float isoLevel,
+                              size_t chunkDim,
+                              size_t lodLevelCount,
+                              const size_t chunks[3],
+                              const size_t cellCounts[3],
+                              const std::vector<size_t>& chunkIndices,
+                              const std::vector< std::vector<size_t> >* pChunkBlocks,
+                              std::vector<ChunkedIsosurface::Chunk>& extracted,
+                              std::vector<bool>& hasTriangles) :
+            m_renderer(renderer),
+            m_dataSet(dataSet),
+            m_isoLevel(isoLevel),
+            m_chunkDim(chunkDim),
+            m_lodLevelCount(lodLevelCount),
+            m_chunks(chunks),
+            m_cellCounts(cellCounts),
+            m_chunkIndices(chunkIndices),
+            m_pChunkBlocks(pChunkBlocks),
+            m_extracted(extracted),
+            m_hasTriangles(hasTriangles)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            size_t volumeOffset[3] = { 0, 0, 0 };
+            size_t volumeDims[3] = { m_dataSet.dimX(), m_dataSet.dimY(), m_dataSet.dimZ() };
+            for(size_t i = start; i < end; ++i)
+            {
+                size_t chunk = m_chunkIndices[i];
+                size_t chunkIndex[3] = { chunk % m_chunks[0], 
+                                         (chunk / m_chunks[0]) % m_chunks[1], 
+                                         chunk / (m_chunks[0] * m_chunks[1]) };
+                size_t cellStart[3];
+                size_t cellEnd[3];
+                for(size_t j = 0; j < 3; ++j)
+                {
+                    cellStart[j] = chunkIndex[j] * m_chunkDim;
+                    cellEnd[j] = std::min(cellStart[j] + m_chunkDim, m_cellCounts[j]);
+                }
+
+                const std::vector<size_t>* pActiveBlocks = m_pChunkBlocks != NULL ? &(*m_pChunkBlocks)[chunk] : NULL;
+                m_hasTriangles[i] = ChunkedIsosurface::ExtractChunk(m_renderer, m_dataSet, m_isoLevel,
+                                                                    cellStart, cellEnd, m_lodLevelCount,
+                                                                    volumeOffset, volumeDims,
+                                                                    pActiveBlocks, false,
+                                                                    m_extracted[i]);
+            }
+        }
+    };
+}
+
+ChunkedIsosurface* ChunkedIsosurface::Extract(const MarchingCubesRenderer& renderer,
+                                              const vox::VolumeDataSet& dataSet,
+                                              float isoLevel,
+                                              size_t chunkDim)
+{
+    const size_t blockDim = vox::MinMaxBlocks::k_BlockDim;
+
+    //e.g. color volumes or chunk file headers whose chunks are streamed
+    if(dataSet.getRawData() == NULL)
+    {
+        std::cerr << "ERROR: " << dataSet.getInputFile() 
+                  << " has no scalar voxels to extract an isosurface from." << std::endl;
+        return NULL;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    vox::SmartPtr<ChunkedIsosurface> spIsosurface = new ChunkedIsosurface();
+
+    size_t lodLevelCount = LodLevelCount(chunkDim);
+    size_t volumeDims[3] = { dataSet.dimX(), dataSet.dimY(), dataSet.dimZ() };
+
+    size_t cellCounts[3];
+    size_t chunks[3];
+    for(size_t i = 0; i < 3; ++i)
+    {
+        cellCounts[i] = volumeDims[i] > 1 ? volumeDims[i] - 1 : 0;
+        chunks[i] = (cellCounts[i] + chunkDim - 1) / chunkDim;
+    }
+    size_t chunkCount = chunks[0] * chunks[1] * chunks[2];
+
+    //one span space query for the whole volume, its blocks are bucketed by
+    //the chunk they are in and chunks without any are skipped. Volumes without
+    //scalars have no index and every chunk is extracted.
+    const vox::MinMaxBlocks* pMinMaxBlocks = dataSet.getMinMaxBlocks();
+    const vox::SpanSpaceIndex* pSpanSpaceIndex = dataSet.getSpanSpaceIndex();
+    std::vector< std::vector<size_t> > chunkBlocks;
+    if(pMinMaxBlocks != NULL && pSpanSpaceIndex != NULL && (chunkDim % blockDim) == 0)
+    {
+        size_t blocksX = pMinMaxBlocks->blockCountX();
+        size_t blocksY = pMinMaxBlocks->blockCountY();
+        size_t blocksPerChunk = chunkDim / blockDim;
+
+        std::vector<size_t> blocks;
+        pSpanSpaceIndex->findBlocks(isoLevel, blocks);
+
+        //the blocks are sorted so each bucket stays in z, y, x order
+        chunkBlocks.resize(chunkCount);
+        for(size_t i = 0; i < blocks.size(); ++i)
+        {
+            size_t blockX = blocks[i] % blocksX;
+            size_t blockY = (blocks[i] / blocksX) % blocksY;
+            size_t blockZ = blocks[i] / (blocksX * blocksY);
+            size_t chunk = ((((blockZ / blocksPerChunk) * chunks[1]) + (blockY / blocksPerChunk)) * chunks[0])
+                            + (blockX / blocksPerChunk);
+            chunkBlocks[chunk].push_back(blocks[i]);
+        }
+    }
+
+    std::vector<size_t> chunkIndices;
+    for(size_t chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        if(chunkBlocks.empty() || !chunkBlocks[chunk].empty())
+            chunkIndices.push_back(chunk);
+    }
+
+    std::vector<Chunk> extracted(chunkIndices.size());
+    std::vector<bool> hasTriangles(chunkIndices.size(), false);
+    ExtractChunksSlabTask task(renderer, dataSet, isoLevel, chunkDim, lodLevelCount,
+                               chunks, cellCounts, chunkIndices,
+                               chunkBlocks.empty() ? NULL : &chunkBlocks,
+                               extracted, hasTriangles);
+    vox::SlabThreads::Run(task, chunkIndices.size());
+
+    for(size_t i = 0; i < extracted.size(); ++i)
+    {
+        if(hasTriangles[i])
+            spIsosurface->m_chunks.push_back(extracted[i]);
+    }
+
+    std::cout << "Extracted the isosurface of " << spIsosurface->m_chunks.size() << " of "
+              << chunkCount << " chunks with "
+              << lodLevelCount << " levels in " << timer.elapsed() << " ms." << std::endl;
+
+    return spIsosurface.release();
+}
+
+ChunkedIsosurface* ChunkedIsosurface::Extract(const MarchingCubesRenderer& renderer,
+                                              vox::VoxelChunkFile& chunkFile,
+                                              float isoLevel)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    vox::SmartPtr<ChunkedIsosurface> spIsosurface = new ChunkedIsosurface();
+
+    size_t chunkDim = chunkFile.chunkDim();
+    size_t lodLevelCount = LodLevelCount(chunkDim);
+    size_t coarsestStride = 1 << (lodLevelCount - 1);
+    size_t volumeDims[3] = { chunkFile.dimX(), chunkFile.dimY(), chunkFile.dimZ() };
+
+    size_t chunksX = (chunkFile.dimX() + chunkDim - 1) / chunkDim;
+    size_t chunksY = (chunkFile.dimY() + chunkDim - 1) / chunkDim;
+    size_t chunksZ = (chunkFile.dimZ() + chunkDim - 1) / chunkDim;
+    for(size_t chunkZ = 0; chunkZ < chunksZ; ++chunkZ)
+    {
+        for(size_t chunkY = 0; chunkY < chunksY; ++chunkY)
+        {
+            for(size_t chunkX = 0; chunkX < chunksX; ++chunkX)
+            {
+                size_t origin[3] = { chunkX * chunkDim, chunkY * chunkDim, chunkZ * chunkDim };
+                size_t size[3];
+                chunkFile.chunkSize(chunkX, chunkY, chunkZ, size[0], size[1], size[2]);
+
+                //the cells of the chunk need the voxel past its far faces and
+                //one more voxel around them for the gradients. The read starts
+                //a coarsest stride before the chunk so the strided samples of
+                //the sub volume fall on the ones of the whole volume.
+                size_t readStart[3];
+                size_t readEnd[3];
+                size_t cellStart[3];
+                size_t cellEnd[3];
+                for(size_t i = 0; i < 3; ++i)
+                {
+                    readStart[i] = origin[i] > 0 ? origin[i] - coarsestStride : 0;
+                    readEnd[i] = origin[i] + size[i] + 2;
+                    cellStart[i] = origin[i] - readStart[i];
+                    cellEnd[i] = cellStart[i] + size[i];
+                }
+
+                vox::SmartPtr<vox::VolumeDataSet> spData =
+                    chunkFile.readSubVolume(readStart[0], readStart[1], readStart[2],
+                                            readEnd[0], readEnd[1], readEnd[2]);
+                if(!spData.valid())
+                {
+                    std::cerr << "ERROR: unable to read chunk "
+                              << chunkX << ", " << chunkY << ", " << chunkZ
+                              << " for the isosurface." << std::endl;
+                    return NULL;
+                }
+
+                Chunk chunk;
+                if(ExtractChunk(renderer, *spData, isoLevel, cellStart, cellEnd,
+                                lodLevelCount, readStart, volumeDims, NULL, true, chunk))
+                    spIsosurface->m_chunks.push_back(chunk);
+            }
+        }
+    }
+
+    std::cout << "Extracted the isosurface of " << spIsosurface->m_chunks.size() << " of "
+              << chunksX * chunksY * chunksZ << " chunks with "
+              << lodLevelCount << " levels in " << timer.elapsed() << " ms." << std::endl;
+
+    return spIsosurface.release();
+}
+
+size_t ChunkedIsosurface::triangleCount(size_t lodLevel) const
+{
+    size_t count = 0;
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        const Chunk& chunk = m_chunks[i];
+        count += chunk.lodMeshes[std::min(lodLevel, chunk.lodMeshes.size() - 1)]->triangleCount();
+    }
+    return count;
+}
+
+size_t ChunkedIsosurface::vertexCount(size_t lodLevel) const
+{
+    size_t count = 0;
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        const Chunk& chunk = m_chunks[i];
+        count += chunk.lodMeshes[std::min(lodLevel, chunk.lodMeshes.size() - 1)]->vertexCount();
+    }
+    return count;
+}
+
+size_t ChunkedIsosurface::draw(const vox::Camera& camera, float maxPixelError)
+{
+    m_frustum.setFromCamera(camera);
+
+    //pixels covered by one world unit at a distance of one
+    static const float k_DegToRad = 3.14159265f / 180.0f;
+    float pixelsPerUnit = camera.getViewportHeight()
+                            / (2.0f * std::tan(camera.getFieldOfView() * 0.5f * k_DegToRad));
+
+    QVector3D eye = camera.getPosition();
+
+    size_t drawCount = 0;
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        const Chunk& chunk = m_chunks[i];
+        const vox::BoundingSphere& sphere = chunk.boundingSphere;
+        float distance = 0.0f;
+        if(m_frustum.sphereInFrustum(sphere.center(), sphere.radius(), distance) == vox::Frustum::OUTSIDE)
+            continue;
+
+        //the error of a level is the screen size of its cells at the
+        //nearest point of the chunk
+        float nearest = std::max(static_cast<float>((sphere.center() - eye).length() - sphere.radius()),
+                                 camera.getNearPlaneDist());
+        float pixelsPerCell = (chunk.cellSize * pixelsPerUnit) / nearest;
+
+        size_t level = 0;
+        while(level + 1 < chunk.lodMeshes.size() &&
+              pixelsPerCell * (1 << (level + 1)) <= maxPixelError)
+            ++level;
+
+        chunk.lodMeshes[level]->draw();
+        ++drawCount;
+    }
+
+    return drawCount;
+}
@@ -0,0 +1,93 @@
+#ifndef MC_CHUNKED_ISOSURFACE_H
+#define MC_CHUNKED_ISOSURFACE_H
+
+#include "VoxVizCore/Referenced.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/BoundingVolumes.h"
+#include "VoxVizCore/Frustum.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+#include "MarchingCubesMesh.h"
+
+#include <vector>
+
+namespace mc
+{
+    class MarchingCubesRenderer;
+    class ExtractChunksSlabTask;
+
+    //isosurface split into chunks of cells, every chunk the surface passes
+    //through gets its own meshes and bounds and only the chunks in the view are
+    //drawn. Each chunk has level of detail meshes sampled with strides 1, 2, 4...
+    //and draws the coarsest one whose cells are small enough on the screen.
+    //Chunk files are extracted one chunk at a time so the volume never has to
+    //be in memory.
+    class ChunkedIsosurface : public vox::Referenced
+    {
+    public:
+        static const size_t k_MaxLodLevels = 4;
+
+        struct Chunk
+        {
+            //level i is sampled with a stride of 2^i
+            std::vector< vox::SmartPtr<MarchingCubesMesh> > lodMeshes;
+            //world size of a level 0 cell
+            float cellSize;
+            vox::BoundingBox boundingBox;
+            vox::BoundingSphere boundingSphere;
+        };
+    private:
+        std::vector<Chunk> m_chunks;
+        vox::Frustum m_frustum;
+
+        friend class IsosurfaceCache;
+        friend class ExtractChunksSlabTask;
+
+        ChunkedIsosurface() {}
+        ChunkedIsosurface(const ChunkedIsosurface&);
+        ChunkedIsosurface& operator=(const ChunkedIsosurface&);
+
+        static size_t LodLevelCount(size_t chunkDim);
+
+        //extracts every level of the cells [cellStart, cellEnd) of dataSet, the
+        //box must be aligned to the coarsest stride. pActiveBlocks and parallel
+        //are passed on to the level 0 extraction. Returns false if the chunk
+        //has no triangles.
+        static bool ExtractChunk(const MarchingCubesRenderer& renderer,
+                                 const vox::VolumeDataSet& dataSet,
+                                 float isoLevel,
+                                 const size_t cellStart[3],
+                                 const size_t cellEnd[3],
+                                 size_t lodLevelCount,
+                                 const size_t volumeOffset[3],
+                                 const size_t volumeDims[3],
+                                 const std::vector<size_t>* pActiveBlocks,
+                                 bool parallel,
+                                 Chunk& chunk);
+    protected:
+        virtual ~ChunkedIsosurface() {}
+    public:
+        //the data set's span space index must already be built, returns
+        //NULL if the data set has no scalar voxels
+        static ChunkedIsosurface* Extract(const MarchingCubesRenderer& renderer,
+                                          const vox::VolumeDataSet& dataSet,
+                                          float isoLevel,
+                                          size_t chunkDim=vox::VoxelChunkFile::k_DefaultChunkDim);
+
+        //returns NULL if a chunk can not be read
+        static ChunkedIsosurface* Extract(const MarchingCubesRenderer& renderer,
+                                          vox::VoxelChunkFile& chunkFile,
+                                          float isoLevel);
+
+        size_t chunkCount() const { return m_chunks.size(); }
+        const Chunk& getChunk(size_t index) const { return m_chunks[index]; }
+
+        //counts of the finest meshes, or of lodLevel where a chunk has it
+        size_t triangleCount(size_t lodLevel=0) const;
+        size_t vertexCount(size_t lodLevel=0) const;
+
+        //draws the chunks that intersect the camera frustum with the coarsest
+        //level whose cells cover at most maxPixelError pixels, returns how many
+        size_t draw(const vox::Camera& camera, float maxPixelError);
+    };
+};
+#endif
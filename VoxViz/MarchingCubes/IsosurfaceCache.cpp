@@ -0,0 +1,338 @@
+#include "IsosurfaceCache.h"
+#include "ChunkedIsosurface.h"
+
+#include "VoxVizCore/DiskCache.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/MappedFile.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QElapsedTimer>
+
+#include <cstring>
+#include <iostream>
+
+using namespace mc;
+
+//bump this whenever the extraction or the cache file layout changes
+//so that stale cache entries are not loaded
+static const quint32 k_CacheVersion = 2;
+//every iso level gets its own entry, the least recently used entries of an
+//input file are evicted beyond this
+static const quint64 k_MaxCacheBytes = 2ull * 1024 * 1024 * 1024;
+
+static bool s_cacheEnabled = true;
+
+static const char k_CacheMagic[8] = { 'V', 'O', 'X', 'M', 'C', 'M', '\n', '\0' };
+
+//all fields are 4 or 8 byte aligned so the structs have no padding
+struct CacheHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 chunkCount;
+};
+
+//followed by the chunk's vertices and indices of each level in level order
+struct CacheChunk
+{
+    float cellSize;
+    quint32 levelCount;
+    float boxMin[3];
+    float boxMax[3];
+    quint64 vertexCounts[ChunkedIsosurface::k_MaxLodLevels];
+    quint64 indexCounts[ChunkedIsosurface::k_MaxLodLevels];
+};
+
+void IsosurfaceCache::SetEnabled(bool flag)
+{
+    s_cacheEnabled = flag;
+}
+
+bool IsosurfaceCache::GetEnabled()
+{
+    return s_cacheEnabled;
+}
+
+template<typename T>
+static void AddToHash(QCryptographicHash& hash, const T& value)
+{
+    hash.addData(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+std::string IsosurfaceCache::GetCacheFile(const vox::VolumeDataSet* pVoxels,
+                                          float isoLevel)
+{
+    if(!s_cacheEnabled)
+        return std::string();
+
+    bool chunkFile = pVoxels->getRawData() == NULL;
+    if(chunkFile && pVoxels->getInputFileExtension() != "voxc")
+        return std::string();
+
+    //hashing the voxels would take longer than some extractions and would mean
+    //reading the whole of a chunk file, the input file's size and time stamp
+    //change whenever its voxels do
+    unsigned long long fileSize = 0;
+    unsigned long long fileModified = 0;
+    if(!vox::DiskCache::GetFileStamp(pVoxels->getInputFile(), fileSize, fileModified))
+        return std::string();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+
+    AddToHash(hash, k_CacheVersion);
+    AddToHash(hash, isoLevel);
+    quint32 maxLodLevels = ChunkedIsosurface::k_MaxLodLevels;
+    AddToHash(hash, maxLodLevels);
+    AddToHash(hash, fileSize);
+    AddToHash(hash, fileModified);
+
+    quint64 dimX = pVoxels->dimX();
+    quint64 dimY = pVoxels->dimY();
+    quint64 dimZ = pVoxels->dimZ();
+    AddToHash(hash, dimX);
+    AddToHash(hash, dimY);
+    AddToHash(hash, dimZ);
+
+    //the meshes are in world space
+    const vox::BoundingBox& bbox = pVoxels->getBoundingBox();
+    double extents[] = { bbox.xMin(), bbox.yMin(), bbox.zMin(),
+                         bbox.xMax(), bbox.yMax(), bbox.zMax() };
+    hash.addData(reinterpret_cast<const char*>(extents), sizeof(extents));
+
+    if(!chunkFile)
+    {
+        //in core volumes are extracted in chunks of the default size
+        quint64 chunkDim = vox::VoxelChunkFile::k_DefaultChunkDim;
+        AddToHash(hash, chunkDim);
+
+        //16 bit volumes are classified through their value range
+        int voxelFormat = pVoxels->getVoxelFormat();
+        int voxelLayout = pVoxels->getVoxelLayout();
+        unsigned int valueMin = 0;
+        unsigned int valueMax = 0;
+        pVoxels->getVoxelValueRange(valueMin, valueMax);
+        AddToHash(hash, voxelFormat);
+        AddToHash(hash, voxelLayout);
+        AddToHash(hash, valueMin);
+        AddToHash(hash, valueMax);
+    }
+
+    QFileInfo inputFileInfo(QString(pVoxels->getInputFile().c_str()));
+    QString key(hash.result().toHex());
+    QString cacheFile = inputFileInfo.absoluteFilePath() + ".mccache/" + key + ".mcm";
+
+    return std::string(cacheFile.toAscii().data());
+}
+
+ChunkedIsosurface* IsosurfaceCache::Read(const std::string& cacheFile)
+{
+    if(cacheFile.empty())
+        return NULL;
+
+    QFile file(QString(cacheFile.c_str()));
+    if(!file.exists() || !file.open(QIODevice::ReadOnly))
+        return NULL;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    CacheHeader header;
+    if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+       memcmp(header.magic, k_CacheMagic, sizeof(k_CacheMagic)) != 0 ||
+       header.version != k_CacheVersion)
+        return NULL;
+
+    std::vector<CacheChunk> cacheChunks(header.chunkCount);
+    qint64 tableSize = static_cast<qint64>(sizeof(CacheChunk) * cacheChunks.size());
+    if(tableSize > 0 &&
+       file.read(reinterpret_cast<char*>(&cacheChunks.front()), tableSize) != tableSize)
+        return NULL;
+
+    quint64 fileSize = sizeof(header) + tableSize;
+    for(size_t i = 0; i < cacheChunks.size(); ++i)
+    {
+        const CacheChunk& cacheChunk = cacheChunks[i];
+        if(cacheChunk.levelCount == 0 || cacheChunk.levelCount > ChunkedIsosurface::k_MaxLodLevels)
+            return NULL;
+
+        for(size_t level = 0; level < cacheChunk.levelCount; ++level)
+        {
+            fileSize += cacheChunk.vertexCounts[level] * sizeof(MarchingCubesMesh::Vertex);
+            fileSize += cacheChunk.indexCounts[level] * sizeof(unsigned int);
+        }
+    }
+    if(static_cast<quint64>(file.size()) != fileSize)
+        return NULL;
+
+    //map the arrays straight from the file so the buffer objects are
+    //filled from the page cache
+    vox::SmartPtr<vox::MappedFile> spMappedFile =
+        vox::MappedFile::Map(cacheFile, 0, static_cast<size_t>(fileSize));
+
+    vox::SmartPtr<ChunkedIsosurface> spIsosurface = new ChunkedIsosurface();
+    spIsosurface->m_chunks.resize(cacheChunks.size());
+
+    size_t offset = sizeof(header) + static_cast<size_t>(tableSize);
+    for(size_t i = 0; i < cacheChunks.size(); ++i)
+    {
+        const CacheChunk& cacheChunk = cacheChunks[i];
+        ChunkedIsosurface::Chunk& chunk = spIsosurface->m_chunks[i];
+
+        chunk.cellSize = cacheChunk.cellSize;
+        chunk.boundingBox.expandBy(cacheChunk.boxMin[0], cacheChunk.boxMin[1], cacheChunk.boxMin[2]);
+        chunk.boundingBox.expandBy(cacheChunk.boxMax[0], cacheChunk.boxMax[1], cacheChunk.boxMax[2]);
+        chunk.boundingSphere.setCenter(chunk.boundingBox.center());
+        chunk.boundingSphere.setRadius(chunk.boundingBox.radius());
+
+        for(size_t level = 0; level < cacheChunk.levelCount; ++level)
+        {
+            size_t vertexCount = static_cast<size_t>(cacheChunk.vertexCounts[level]);
+            size_t indexCount = static_cast<size_t>(cacheChunk.indexCounts[level]);
+            size_t vertexOffset = offset;
+            size_t indexOffset = vertexOffset + (vertexCount * sizeof(MarchingCubesMesh::Vertex));
+            offset = indexOffset + (indexCount * sizeof(unsigned int));
+
+            vox::SmartPtr<MarchingCubesMesh> spMesh = new MarchingCubesMesh();
+            if(spMappedFile.valid())
+            {
+                spMesh->setMappedArrays(spMappedFile.get(),
+                                        vertexOffset, vertexCount,
+                                        indexOffset, indexCount);
+            }
+            else
+            {
+                //fall back to plain reads if the file can not be mapped
+                MarchingCubesMesh::VertexArray& vertices = spMesh->getVertices();
+                MarchingCubesMesh::IndexArray& indices = spMesh->getIndices();
+                vertices.resize(vertexCount);
+                indices.resize(indexCount);
+                qint64 vertexSize = static_cast<qint64>(vertexCount * sizeof(MarchingCubesMesh::Vertex));
+                qint64 indexSize = static_cast<qint64>(indexCount * sizeof(unsigned int));
+                if((vertexSize > 0 &&
+                    file.read(reinterpret_cast<char*>(&vertices.front()), vertexSize) != vertexSize) ||
+                   (indexSize > 0 &&
+                    file.read(reinterpret_cast<char*>(&indices.front()), indexSize) != indexSize))
+                {
+                    std::cerr << "WARNING: failed to read isosurface cache "
+                              << cacheFile << std::endl;
+                    return NULL;
+                }
+            }
+
+            chunk.lodMeshes.push_back(spMesh.get());
+        }
+    }
+
+    vox::DiskCache::Touch(cacheFile);
+
+    std::cout << "Loaded isosurface cache " << cacheFile
+              << " in " << timer.elapsed() << " ms." << std::endl;
+
+    return spIsosurface.release();
+}
+
+bool IsosurfaceCache::Write(const ChunkedIsosurface* pIsosurface,
+                            const std::string& cacheFile)
+{
+    if(cacheFile.empty())
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QFileInfo cacheFileInfo(QString(cacheFile.c_str()));
+    if(!QDir().mkpath(cacheFileInfo.absolutePath()))
+    {
+        std::cerr << "WARNING: failed to create isosurface cache directory "
+                  << cacheFileInfo.absolutePath().toAscii().data() << std::endl;
+        return false;
+    }
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, k_CacheMagic, sizeof(k_CacheMagic));
+    header.version = k_CacheVersion;
+    header.chunkCount = static_cast<quint32>(pIsosurface->chunkCount());
+
+    std::vector<CacheChunk> cacheChunks(pIsosurface->chunkCount());
+    for(size_t i = 0; i < cacheChunks.size(); ++i)
+    {
+        const ChunkedIsosurface::Chunk& chunk = pIsosurface->getChunk(i);
+        CacheChunk& cacheChunk = cacheChunks[i];
+        memset(&cacheChunk, 0, sizeof(cacheChunk));
+
+        cacheChunk.cellSize = chunk.cellSize;
+        cacheChunk.levelCount = static_cast<quint32>(chunk.lodMeshes.size());
+        cacheChunk.boxMin[0] = static_cast<float>(chunk.boundingBox.xMin());
+        cacheChunk.boxMin[1] = static_cast<float>(chunk.boundingBox.yMin());
+        cacheChunk.boxMin[2] = static_cast<float>(chunk.boundingBox.zMin());
+        cacheChunk.boxMax[0] = static_cast<float>(chunk.boundingBox.xMax());
+        cacheChunk.boxMax[1] = static_cast<float>(chunk.boundingBox.yMax());
+        cacheChunk.boxMax[2] = static_cast<float>(chunk.boundingBox.zMax());
+        for(size_t level = 0; level < chunk.lodMeshes.size(); ++level)
+        {
+            cacheChunk.vertexCounts[level] = chunk.lodMeshes[level]->getVertices().size();
+            cacheChunk.indexCounts[level] = chunk.lodMeshes[level]->getIndices().size();
+        }
+    }
+
+    //write to a temporary file first so that an interrupted write
+    //never leaves behind a cache file that looks valid
+    QString tmpFileName = cacheFileInfo.absoluteFilePath() + ".tmp";
+    QFile tmpFile(tmpFileName);
+    if(!tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        std::cerr << "WARNING: failed to create isosurface cache "
+                  << tmpFileName.toAscii().data() << std::endl;
+        return false;
+    }
+
+    qint64 tableSize = static_cast<qint64>(sizeof(CacheChunk) * cacheChunks.size());
+    bool success =
+        tmpFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+        (tableSize == 0 ||
+         tmpFile.write(reinterpret_cast<const char*>(&cacheChunks.front()), tableSize) == tableSize);
+    for(size_t i = 0; success && i < cacheChunks.size(); ++i)
+    {
+        const ChunkedIsosurface::Chunk& chunk = pIsosurface->getChunk(i);
+        for(size_t level = 0; success && level < chunk.lodMeshes.size(); ++level)
+        {
+            const MarchingCubesMesh::VertexArray& vertices = chunk.lodMeshes[level]->getVertices();
+            const MarchingCubesMesh::IndexArray& indices = chunk.lodMeshes[level]->getIndices();
+            qint64 vertexSize = static_cast<qint64>(vertices.size() * sizeof(MarchingCubesMesh::Vertex));
+            qint64 indexSize = static_cast<qint64>(indices.size() * sizeof(unsigned int));
+            success =
+                (vertexSize == 0 ||
+                 tmpFile.write(reinterpret_cast<const char*>(&vertices.front()), vertexSize) == vertexSize) &&
+                (indexSize == 0 ||
+                 tmpFile.write(reinterpret_cast<const char*>(&indices.front()), indexSize) == indexSize);
+        }
+    }
+    tmpFile.close();
+
+    if(!success)
+    {
+        std::cerr << "WARNING: failed to write isosurface cache "
+                  << tmpFileName.toAscii().data() << std::endl;
+        QFile::remove(tmpFileName);
+        return false;
+    }
+
+    QFile::remove(cacheFileInfo.absoluteFilePath());
+    if(!QFile::rename(tmpFileName, cacheFileInfo.absoluteFilePath()))
+    {
+        std::cerr << "WARNING: failed to rename isosurface cache " << cacheFile << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote isosurface cache " << cacheFile
+              << " in " << timer.elapsed() << " ms." << std::endl;
+
+    vox::DiskCache::Trim(cacheFile, k_MaxCacheBytes);
+
+    return true;
+}
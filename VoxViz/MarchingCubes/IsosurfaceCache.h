@@ -0,0 +1,36 @@
+#ifndef MC_ISOSURFACE_CACHE_H
+#define MC_ISOSURFACE_CACHE_H
+
+#include "VoxVizCore/VolumeDataSet.h"
+
+#include <string>
+
+namespace mc
+{
+    class ChunkedIsosurface;
+
+    //on disk cache of chunked isosurfaces. Each entry is one file holding the
+    //meshes of every chunk and level, named by a hash of the input file's size
+    //and time stamp, the volume's dimensions and the iso level, see
+    //vox::DiskCache for how entries are evicted. Entries are memory mapped and
+    //their arrays uploaded to the buffer objects straight from the mapped pages.
+    class IsosurfaceCache
+    {
+    public:
+        static void SetEnabled(bool flag);
+        static bool GetEnabled();
+
+        //returns the file that the isosurface of pVoxels at isoLevel is cached
+        //in, or an empty string if the data set can not be cached. Does not read
+        //the voxels so it is cheap enough to call for every requested iso level.
+        static std::string GetCacheFile(const vox::VolumeDataSet* pVoxels,
+                                        float isoLevel);
+
+        //returns NULL if there is no valid cache file
+        static ChunkedIsosurface* Read(const std::string& cacheFile);
+
+        static bool Write(const ChunkedIsosurface* pIsosurface,
+                          const std::string& cacheFile);
+    };
+};
+#endif
@@ -0,0 +1,113 @@
+#include "IsosurfaceThread.h"
+#include "IsosurfaceCache.h"
+#include "MarchingCubesRenderer.h"
+
+#include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+
+#include <QtCore/QElapsedTimer>
+
+#include <iostream>
+
+using namespace mc;
+
+IsosurfaceThread::IsosurfaceThread(const MarchingCubesRenderer& renderer,
+                                   const vox::VolumeDataSet& dataSet) :
+    m_renderer(renderer),
+    m_pDataSet(&dataSet),
+    m_done(false),
+    m_hasRequest(false),
+    m_requestedIsoLevel(0.0f),
+    m_isosurfaceIsoLevel(0.0f)
+{
+}
+
+IsosurfaceThread::IsosurfaceThread(const MarchingCubesRenderer& renderer,
+                                   const vox::VolumeDataSet& dataSet,
+                                   vox::VoxelChunkFile& chunkFile) :
+    m_renderer(renderer),
+    m_pDataSet(&dataSet),
+    m_spChunkFile(&chunkFile),
+    m_done(false),
+    m_hasRequest(false),
+    m_requestedIsoLevel(0.0f),
+    m_isosurfaceIsoLevel(0.0f)
+{
+}
+
+IsosurfaceThread::~IsosurfaceThread()
+{
+    stop();
+}
+
+void IsosurfaceThread::requestIsoLevel(float isoLevel)
+{
+    QMutexLocker lock(&m_mutex);
+    m_requestedIsoLevel = isoLevel;
+    m_hasRequest = true;
+    m_waitForRequest.wakeAll();
+}
+
+ChunkedIsosurface* IsosurfaceThread::takeIsosurface(float& isoLevel)
+{
+    QMutexLocker lock(&m_mutex);
+    isoLevel = m_isosurfaceIsoLevel;
+    return m_spIsosurface.release();
+}
+
+void IsosurfaceThread::stop()
+{
+    m_mutex.lock();
+    m_done = true;
+    m_waitForRequest.wakeAll();
+    m_mutex.unlock();
+
+    wait();
+}
+
+void IsosurfaceThread::run()
+{
+    for(;;)
+    {
+        m_mutex.lock();
+        while(!m_done && !m_hasRequest)
+            m_waitForRequest.wait(&m_mutex);
+        if(m_done)
+        {
+            m_mutex.unlock();
+            break;
+        }
+        float isoLevel = m_requestedIsoLevel;
+        m_hasRequest = false;
+        m_mutex.unlock();
+
+        std::string cacheFile = IsosurfaceCache::GetCacheFile(m_pDataSet, isoLevel);
+        vox::SmartPtr<ChunkedIsosurface> spIsosurface = IsosurfaceCache::Read(cacheFile);
+        if(!spIsosurface.valid())
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            if(m_spChunkFile.valid())
+                spIsosurface = ChunkedIsosurface::Extract(m_renderer, *m_spChunkFile, isoLevel);
+            else
+                spIsosurface = ChunkedIsosurface::Extract(m_renderer, *m_pDataSet, isoLevel);
+
+            if(!spIsosurface.valid())
+                continue;
+
+            std::cout << "Extracted " << spIsosurface->triangleCount() << " triangles at iso level "
+                      << isoLevel << " in " << timer.elapsed() << " ms." << std::endl;
+
+            //written before it is handed over, the rendering thread may drop
+            //it as soon as it has taken it
+            IsosurfaceCache::Write(spIsosurface.get(), cacheFile);
+        }
+
+        //an unclaimed older isosurface is dropped
+        m_mutex.lock();
+        m_spIsosurface = spIsosurface.get();
+        m_isosurfaceIsoLevel = isoLevel;
+        m_mutex.unlock();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef MC_ISOSURFACE_THREAD_H
+#define MC_ISOSURFACE_THREAD_H
+
+#include "VoxVizCore/SmartPtr.h"
+#include "ChunkedIsosurface.h"
+
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+namespace vox
+{
+    class VolumeDataSet;
+    class VoxelChunkFile;
+};
+
+namespace mc
+{
+    class MarchingCubesRenderer;
+
+    //extracts the ChunkedIsosurface of a data set or of a chunk file on a
+    //background thread. Only the latest requested iso level is extracted,
+    //requests made while one is running replace each other. Isosurfaces are
+    //read from and written to the IsosurfaceCache like the first one.
+    //Finished isosurfaces wait to be taken by the rendering thread, they are
+    //never drawn before that so dropping one here needs no GL context.
+    class IsosurfaceThread : public QThread
+    {
+    private:
+        const MarchingCubesRenderer& m_renderer;
+        const vox::VolumeDataSet* m_pDataSet;
+        vox::SmartPtr<vox::VoxelChunkFile> m_spChunkFile;
+
+        QMutex m_mutex;
+        QWaitCondition m_waitForRequest;
+        bool m_done;
+        bool m_hasRequest;
+        float m_requestedIsoLevel;
+        vox::SmartPtr<ChunkedIsosurface> m_spIsosurface;
+        float m_isosurfaceIsoLevel;
+    public:
+        //the data set's min max blocks and span space index must already be built
+        IsosurfaceThread(const MarchingCubesRenderer& renderer,
+                         const vox::VolumeDataSet& dataSet);
+        //dataSet is the chunk file's data set, it only keys the cache
+        IsosurfaceThread(const MarchingCubesRenderer& renderer,
+                         const vox::VolumeDataSet& dataSet,
+                         vox::VoxelChunkFile& chunkFile);
+        virtual ~IsosurfaceThread();
+
+        void requestIsoLevel(float isoLevel);
+
+        //the last finished isosurface, NULL if there is none since the last call
+        ChunkedIsosurface* takeIsosurface(float& isoLevel);
+
+        //stops after the extraction in progress and waits for the thread to exit
+        void stop();
+    protected:
+        virtual void run();
+    };
+};
+#endif
@@ -0,0 +1,192 @@
+#include "MarchingCubesMesh.h"
+
+#include "VoxVizOpenGL/GLExtensions.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+
+using namespace mc;
+
+MarchingCubesMesh::MarchingCubesMesh() :
+    m_pMappedVertices(NULL),
+    m_mappedVertexCount(0),
+    m_pMappedIndices(NULL),
+    m_mappedIndexCount(0),
+    m_vertexBufferID(0),
+    m_indexBufferID(0),
+    m_bufferIndexCount(0)
+{
+}
+
+MarchingCubesMesh::~MarchingCubesMesh()
+{
+    releaseBuffers();
+}
+
+void MarchingCubesMesh::setMappedArrays(vox::MappedFile* pMappedFile,
+                                        size_t vertexOffset, size_t vertexCount,
+                                        size_t indexOffset, size_t indexCount)
+{
+    const unsigned char* pData = static_cast<const unsigned char*>(pMappedFile->data());
+
+    m_spMappedFile = pMappedFile;
+    m_pMappedVertices = reinterpret_cast<const Vertex*>(pData + vertexOffset);
+    m_mappedVertexCount = vertexCount;
+    m_pMappedIndices = reinterpret_cast<const unsigned int*>(pData + indexOffset);
+    m_mappedIndexCount = indexCount;
+
+    VertexArray().swap(m_vertices);
+    IndexArray().swap(m_indices);
+}
+
+void MarchingCubesMesh::append(const VertexArray& vertices, const IndexArray& indices)
+{
+    unsigned int indexOffset = static_cast<unsigned int>(m_vertices.size());
+
+    m_vertices.insert(m_vertices.end(), vertices.begin(), vertices.end());
+
+    m_indices.reserve(m_indices.size() + indices.size());
+    for(size_t i = 0; i < indices.size(); ++i)
+        m_indices.push_back(indices[i] + indexOffset);
+}
+
+void MarchingCubesMesh::addSkirts(float depth, const std::vector<bool>& skirtVertices)
+{
+    //vertices duplicated between the slabs of the extraction are matched by
+    //position, or the slab borders would look like borders of the mesh
+    typedef std::pair<float, std::pair<float, float> > Position;
+    std::map<Position, unsigned int> positions;
+    std::vector<unsigned int> welded(m_vertices.size());
+    for(size_t i = 0; i < m_vertices.size(); ++i)
+    {
+        const float* pPosition = m_vertices[i].position;
+        Position position(pPosition[0], std::make_pair(pPosition[1], pPosition[2]));
+        welded[i] = positions.insert(std::make_pair(position, static_cast<unsigned int>(i))).first->second;
+    }
+
+    //edges used by a single triangle are on the border, they are kept
+    //in the direction their triangle walks them to keep the winding
+    typedef std::pair<unsigned int, unsigned int> Edge;
+    std::map<Edge, Edge> borderEdges;
+    for(size_t i = 0; i < m_indices.size(); i += 3)
+    {
+        for(size_t j = 0; j < 3; ++j)
+        {
+            unsigned int v0 = m_indices[i + j];
+            unsigned int v1 = m_indices[i + ((j + 1) % 3)];
+            Edge key(std::min(welded[v0], welded[v1]), std::max(welded[v0], welded[v1]));
+            std::map<Edge, Edge>::iterator findIt = borderEdges.find(key);
+            if(findIt == borderEdges.end())
+                borderEdges.insert(std::make_pair(key, Edge(v0, v1)));
+            else
+                borderEdges.erase(findIt);
+        }
+    }
+
+    std::map<unsigned int, unsigned int> skirts;
+    for(std::map<Edge, Edge>::const_iterator itr = borderEdges.begin();
+        itr != borderEdges.end();
+        ++itr)
+    {
+        unsigned int edge[2] = { itr->second.first, itr->second.second };
+        if(!skirtVertices[edge[0]] || !skirtVertices[edge[1]])
+            continue;
+
+        unsigned int skirt[2];
+        for(size_t i = 0; i < 2; ++i)
+        {
+            std::map<unsigned int, unsigned int>::iterator findIt = skirts.find(edge[i]);
+            if(findIt != skirts.end())
+            {
+                skirt[i] = findIt->second;
+                continue;
+            }
+
+            Vertex vertex = m_vertices[edge[i]];
+            for(size_t j = 0; j < 3; ++j)
+                vertex.position[j] -= vertex.normal[j] * depth;
+            m_vertices.push_back(vertex);
+            skirt[i] = static_cast<unsigned int>(m_vertices.size() - 1);
+            skirts[edge[i]] = skirt[i];
+        }
+
+        m_indices.push_back(edge[1]);
+        m_indices.push_back(edge[0]);
+        m_indices.push_back(skirt[0]);
+        m_indices.push_back(edge[1]);
+        m_indices.push_back(skirt[0]);
+        m_indices.push_back(skirt[1]);
+    }
+}
+
+void MarchingCubesMesh::createBuffers()
+{
+    const Vertex* pVertices = m_spMappedFile.valid() ? m_pMappedVertices : &m_vertices.front();
+    const unsigned int* pIndices = m_spMappedFile.valid() ? m_pMappedIndices : &m_indices.front();
+
+    glGenBuffers(1, &m_vertexBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferID);
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(Vertex) * vertexCount(),
+                 pVertices,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &m_indexBufferID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBufferID);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 sizeof(unsigned int) * indexCount(),
+                 pIndices,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    m_bufferIndexCount = indexCount();
+}
+
+void MarchingCubesMesh::releaseBuffers()
+{
+    if(m_vertexBufferID != 0)
+        glDeleteBuffers(1, &m_vertexBufferID);
+    if(m_indexBufferID != 0)
+        glDeleteBuffers(1, &m_indexBufferID);
+
+    m_vertexBufferID = 0;
+    m_indexBufferID = 0;
+    m_bufferIndexCount = 0;
+}
+
+void MarchingCubesMesh::draw()
+{
+    if(indexCount() == 0)
+        return;
+
+    //the arrays changed since they were uploaded
+    if(m_bufferIndexCount != indexCount())
+        releaseBuffers();
+
+    if(m_vertexBufferID == 0)
+        createBuffers();
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBufferID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBufferID);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+
+    glVertexPointer(3, GL_FLOAT, sizeof(Vertex),
+                    reinterpret_cast<void*>(offsetof(Vertex, position)));
+    glNormalPointer(GL_FLOAT, sizeof(Vertex),
+                    reinterpret_cast<void*>(offsetof(Vertex, normal)));
+
+    glDrawElements(GL_TRIANGLES,
+                   static_cast<GLsizei>(indexCount()),
+                   GL_UNSIGNED_INT,
+                   0);
+
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
@@ -0,0 +1,75 @@
+#ifndef MC_MARCHING_CUBES_MESH_H
+#define MC_MARCHING_CUBES_MESH_H
+
+#include "VoxVizCore/Referenced.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/MappedFile.h"
+
+#include <vector>
+
+namespace mc
+{
+    //indexed isosurface, triangles share the vertices on the cell edges
+    class MarchingCubesMesh : public vox::Referenced
+    {
+    public:
+        struct Vertex
+        {
+            float position[3];
+            float normal[3];
+        };
+
+        typedef std::vector<Vertex> VertexArray;
+        typedef std::vector<unsigned int> IndexArray;
+
+    private:
+        VertexArray m_vertices;
+        IndexArray m_indices;
+
+        //arrays in a mapped cache file, used instead of the vectors
+        vox::SmartPtr<vox::MappedFile> m_spMappedFile;
+        const Vertex* m_pMappedVertices;
+        size_t m_mappedVertexCount;
+        const unsigned int* m_pMappedIndices;
+        size_t m_mappedIndexCount;
+
+        unsigned int m_vertexBufferID;
+        unsigned int m_indexBufferID;
+        size_t m_bufferIndexCount;
+
+        void createBuffers();
+    public:
+        MarchingCubesMesh();
+
+        VertexArray& getVertices() { return m_vertices; }
+        const VertexArray& getVertices() const { return m_vertices; }
+        IndexArray& getIndices() { return m_indices; }
+        const IndexArray& getIndices() const { return m_indices; }
+
+        size_t vertexCount() const { return m_spMappedFile.valid() ? m_mappedVertexCount : m_vertices.size(); }
+        size_t indexCount() const { return m_spMappedFile.valid() ? m_mappedIndexCount : m_indices.size(); }
+        size_t triangleCount() const { return indexCount() / 3; }
+
+        //draws the arrays at the byte offsets of the mapping instead of the
+        //vectors, they are uploaded straight from the mapped pages
+        void setMappedArrays(vox::MappedFile* pMappedFile,
+                             size_t vertexOffset, size_t vertexCount,
+                             size_t indexOffset, size_t indexCount);
+
+        //appends a mesh whose indices start at 0
+        void append(const VertexArray& vertices, const IndexArray& indices);
+
+        //hangs a strip of triangles depth below the border edges whose vertices
+        //are both flagged in skirtVertices, against the vertex normals into the
+        //inside of the surface, so the gaps between neighbor meshes of different
+        //resolution are not see through
+        void addSkirts(float depth, const std::vector<bool>& skirtVertices);
+
+        //uploads the arrays to buffer objects on first use
+        void draw();
+        void releaseBuffers();
+    protected:
+        virtual ~MarchingCubesMesh();
+    };
+};
+#endif
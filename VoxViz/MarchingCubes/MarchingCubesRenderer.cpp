@@ -1,6 +1,14 @@
 #include "MarchingCubesRenderer.h"
+#include "MarchingCubesMesh.h"
+#include "IsosurfaceThread.h"
+#include "ChunkedIsosurface.h"
+#include "IsosurfaceCache.h"
 #include "VoxVizCore/VolumeDataSet.h"
 #include "VoxVizCore/VoxSampler.h"
+#include "VoxVizCore/MinMaxBlocks.h"
+#include "VoxVizCore/SpanSpaceIndex.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+#include "VoxVizCore/SlabThreads.h"
 #include "VoxVizOpenGL/GLShaderProgramManager.h"
 #include "VoxVizOpenGL/GLUtils.h"
 
@@ -307,226 +315,469 @@ static int s_triTable[256][16] =
 {0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
 
-//Interpolate the position where an isosurface cuts
-//an edge between two vertices
-
-QVector3D VertexInterp(float isoLevel,
-                       const QVector3D& p1,
-                       const QVector3D& p2,
-                       float valp1,
-                       float valp2)
+//fraction of the way from val1 to val2 where the isosurface cuts an edge
+static float InterpolationFactor(float isoLevel,
+                                 float val1,
+                                 float val2)
 {
-    float diff1 = isoLevel - valp1;
+    float diff1 = isoLevel - val1;
     if(diff1 < 0.00001f && diff1 > -0.00001f)
-        return p1;
+        return 0.0f;
 
-    float diff2 = isoLevel -  valp2;
+    float diff2 = isoLevel - val2;
     if(diff2 < 0.00001f && diff2 > -0.00001f)
-        return p2;
+        return 1.0f;
 
-    float diff12 = valp2 - valp1;
+    float diff12 = val2 - val1;
     if(diff12 < 0.00001f && diff12 > -0.0000f)
-        return p1;
-
-    double mu = diff1 / diff12;
+        return 0.0f;
 
-    return QVector3D(p1.x() + mu * (p2.x() - p1.x()),
-                     p1.y() + mu * (p2.y() - p1.y()),
-                     p1.z() + mu * (p2.z() - p1.z()));
+    return diff1 / diff12;
 }
 
-
-int MarchingCubesRenderer::polygonalize(const vox::VoxSample& grid,
-                                        vox::FloatArray& vertices,
-                                        vox::FloatArray& normals)
+namespace
 {
-    int cubeIndex = 0;
-
-    if(grid.values[0] > m_isoLevel) 
-        cubeIndex |= 1;
-    if(grid.values[1] > m_isoLevel) 
-        cubeIndex |= 2;
-    if(grid.values[2] > m_isoLevel) 
-        cubeIndex |= 4;
-    if(grid.values[3] > m_isoLevel) 
-        cubeIndex |= 8;
-    if(grid.values[4] > m_isoLevel) 
-        cubeIndex |= 16;
-    if(grid.values[5] > m_isoLevel) 
-        cubeIndex |= 32;
-    if(grid.values[6] > m_isoLevel) 
-        cubeIndex |= 64;
-    if(grid.values[7] > m_isoLevel) 
-        cubeIndex |= 128;
-
-    // Cube is fully inside or outside surface
-    if(s_edgeTable[cubeIndex] == 0)
-        return 0;
-   
-    QVector3D vertList[12];
-
-    if(s_edgeTable[cubeIndex] & 1)
-    {
-        vertList[0] =
-            VertexInterp(m_isoLevel,
-                        grid.positions[0],
-                        grid.positions[1],
-                        grid.values[0],
-                        grid.values[1]);
-    }
+    const unsigned int k_NoVertex = 0xFFFFFFFF;
 
-    if(s_edgeTable[cubeIndex] & 2)
-    {
-        vertList[1] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[1],
-                         grid.positions[2],
-                         grid.values[1],
-                         grid.values[2]);
-    }
+    //cell corner offsets in the order VoxSampler returns them
+    const size_t s_cornerX[8] = { 0, 1, 1, 0, 0, 1, 1, 0 };
+    const size_t s_cornerY[8] = { 0, 0, 1, 1, 0, 0, 1, 1 };
+    const size_t s_cornerZ[8] = { 0, 0, 0, 0, 1, 1, 1, 1 };
 
-    if(s_edgeTable[cubeIndex] & 4)
+    //corners at the ends of each cell edge
+    const int s_edgeCorners[12][2] =
     {
-        vertList[2] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[2],
-                         grid.positions[3],
-                         grid.values[2],
-                         grid.values[3]);
-    }
-
-    if (s_edgeTable[cubeIndex] & 8)
+        { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 },
+        { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 },
+        { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+    };
+
+    //vertices are cached per lattice edge. x and y edges have a cache for even
+    //and for odd lattice z planes, z edges one for the current layer of cells.
+    //Entries are tagged with their lattice z so the caches never need clearing.
+    enum EdgeCache
     {
-        vertList[3] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[3],
-                         grid.positions[0],
-                         grid.values[3],
-                         grid.values[0]);
-    }
+        EDGES_X,
+        EDGES_Y = 2,
+        EDGES_Z = 4,
+        EDGE_CACHE_COUNT
+    };
 
-    if (s_edgeTable[cubeIndex] & 16)
+    struct CachedVertex
     {
-        vertList[4] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[4],
-                         grid.positions[5],
-                         grid.values[4],
-                         grid.values[5]);
-    }
+        unsigned int tag;
+        unsigned int vertex;
+    };
 
-    if (s_edgeTable[cubeIndex] & 32)
+    //cache, lattice x, y offset and z offset of each cell edge
+    const EdgeCache s_edgeCaches[12] =
     {
-        vertList[5] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[5],
-                         grid.positions[6],
-                         grid.values[5],
-                         grid.values[6]);
-    }
-
-    if(s_edgeTable[cubeIndex] & 64)
+        EDGES_X, EDGES_Y, EDGES_X, EDGES_Y,
+        EDGES_X, EDGES_Y, EDGES_X, EDGES_Y,
+        EDGES_Z, EDGES_Z, EDGES_Z, EDGES_Z
+    };
+    const size_t s_edgeOffsets[12][3] =
     {
-        vertList[6] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[6],
-                         grid.positions[7],
-                         grid.values[6],
-                         grid.values[7]);
-    }
+        { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 0 },
+        { 0, 0, 1 }, { 1, 0, 1 }, { 0, 1, 1 }, { 0, 0, 1 },
+        { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }
+    };
+
+    //extracts the welded isosurface of a range of z layers of blocks of cells,
+    //only the cells of the active blocks inside the cell box are visited. Vertices are only
+    //shared within a slab, the few on the planes between slabs are duplicated
+    //so the slabs stay independent.
+    class IsosurfaceSlabTask : public vox::SlabTask
+    {
+    private:
+        const vox::VolumeDataSet& m_dataSet;
+        float m_isoLevel;
+        size_t m_sampleStride;
+        size_t m_cellStart[3];
+        size_t m_cellEnd[3];
+        size_t m_blocksX;
+        size_t m_blocksY;
+        size_t m_firstBlockZ;
+        //active blocks in z, y, x order and where each z layer of blocks starts
+        const std::vector<size_t>& m_activeBlocks;
+        const std::vector<size_t>& m_layerStarts;
+        std::vector<MarchingCubesMesh::VertexArray>& m_slabVertices;
+        std::vector<MarchingCubesMesh::IndexArray>& m_slabIndices;
+
+        //gradient of the voxel values at a voxel in world space, central
+        //differences inside the volume and one sided on its faces
+        QVector3D gradient(size_t x, size_t y, size_t z) const
+        {
+            size_t x0 = x > 0 ? x - 1 : x;
+            size_t x1 = std::min(x + 1, m_dataSet.dimX() - 1);
+            size_t y0 = y > 0 ? y - 1 : y;
+            size_t y1 = std::min(y + 1, m_dataSet.dimY() - 1);
+            size_t z0 = z > 0 ? z - 1 : z;
+            size_t z1 = std::min(z + 1, m_dataSet.dimZ() - 1);
+
+            QVector3D grad;
+            if(x1 > x0)
+                grad.setX((m_dataSet.valueAsFloat(x1, y, z) - m_dataSet.valueAsFloat(x0, y, z)) 
+                            / ((x1 - x0) * m_dataSet.scaleX()));
+            if(y1 > y0)
+                grad.setY((m_dataSet.valueAsFloat(x, y1, z) - m_dataSet.valueAsFloat(x, y0, z)) 
+                            / ((y1 - y0) * m_dataSet.scaleY()));
+            if(z1 > z0)
+                grad.setZ((m_dataSet.valueAsFloat(x, y, z1) - m_dataSet.valueAsFloat(x, y, z0)) 
+                            / ((z1 - z0) * m_dataSet.scaleZ()));
+
+            return m_dataSet.getOrientation().rotatedVector(grad);
+        }
+
+        unsigned int addVertex(const vox::VoxSampler& sampler,
+                               const vox::VoxSample& sample,
+                               int edge,
+                               size_t cellX, size_t cellY, size_t cellZ,
+                               MarchingCubesMesh::VertexArray& vertices) const
+        {
+            int c0 = s_edgeCorners[edge][0];
+            int c1 = s_edgeCorners[edge][1];
+            float mu = InterpolationFactor(m_isoLevel, sample.values[c0], sample.values[c1]);
+
+            QVector3D position = sample.positions[c0] + 
+                                    ((sample.positions[c1] - sample.positions[c0]) * mu);
+
+            QVector3D grad0 = gradient(sampler.sampleCoord(cellX + s_cornerX[c0], m_dataSet.dimX()),
+                                       sampler.sampleCoord(cellY + s_cornerY[c0], m_dataSet.dimY()),
+                                       sampler.sampleCoord(cellZ + s_cornerZ[c0], m_dataSet.dimZ()));
+            QVector3D grad1 = gradient(sampler.sampleCoord(cellX + s_cornerX[c1], m_dataSet.dimX()),
+                                       sampler.sampleCoord(cellY + s_cornerY[c1], m_dataSet.dimY()),
+                                       sampler.sampleCoord(cellZ + s_cornerZ[c1], m_dataSet.dimZ()));
+            //the surface faces the lower values
+            QVector3D normal = -(grad0 + ((grad1 - grad0) * mu)).normalized();
+
+            MarchingCubesMesh::Vertex vertex;
+            vertex.position[0] = position.x();
+            vertex.position[1] = position.y();
+            vertex.position[2] = position.z();
+            vertex.normal[0] = normal.x();
+            vertex.normal[1] = normal.y();
+            vertex.normal[2] = normal.z();
+            vertices.push_back(vertex);
+
+            return static_cast<unsigned int>(vertices.size() - 1);
+        }
+    public:
+        IsosurfaceSlabTask(const vox::VolumeDataSet& dataSet,
+                           float isoLevel,
+                           size_t sampleStride,
+                           const size_t cellStart[3],
+                           const size_t cellEnd[3],
+                           size_t blocksX,
+                           size_t blocksY,
+                           size_t firstBlockZ,
+                           const std::vector<size_t>& activeBlocks,
+                           const std::vector<size_t>& layerStarts,
+                           std::vector<MarchingCubesMesh::VertexArray>& slabVertices,
+                           std::vector<MarchingCubesMesh::IndexArray>& slabIndices) :
+            m_dataSet(dataSet),
+            m_isoLevel(isoLevel),
+            m_sampleStride(sampleStride),
+            m_blocksX(blocksX),
+            m_blocksY(blocksY),
+            m_firstBlockZ(firstBlockZ),
+            m_activeBlocks(activeBlocks),
+            m_layerStarts(layerStarts),
+            m_slabVertices(slabVertices),
+            m_slabIndices(slabIndices)
+        {
+            for(size_t i = 0; i < 3; ++i)
+            {
+                m_cellStart[i] = cellStart[i];
+                m_cellEnd[i] = cellEnd[i];
+            }
+        }
+
+        virtual void runSlab(size_t slabIndex, size_t start, size_t end)
+        {
+            const size_t blockDim = vox::MinMaxBlocks::k_BlockDim;
+
+            vox::VoxSampler sampler(const_cast<vox::VolumeDataSet&>(m_dataSet), m_sampleStride, 2);
+            vox::VoxSample sample(8);
+            //one cell thick block per active block of the layer, advanced a cell
+            //at a time so the planes between cell layers are sampled once
+            std::vector<vox::VoxSampleBlock> blocks;
+            MarchingCubesMesh::VertexArray& vertices = m_slabVertices[slabIndex];
+            MarchingCubesMesh::IndexArray& indices = m_slabIndices[slabIndex];
+
+            //the caches only cover the lattice of the cell box
+            size_t width = m_cellEnd[0] - m_cellStart[0] + 1;
+            size_t planeSize = width * (m_cellEnd[1] - m_cellStart[1] + 1);
+            CachedVertex noVertex = { k_NoVertex, k_NoVertex };
+            std::vector<CachedVertex> edgeCaches[EDGE_CACHE_COUNT];
+            start += m_firstBlockZ;
+            end += m_firstBlockZ;
+            if(m_layerStarts[start] != m_layerStarts[end])
+            {
+                for(size_t i = 0; i < EDGE_CACHE_COUNT; ++i)
+                    edgeCaches[i].assign(planeSize, noVertex);
+            }
+
+            for(size_t blockZ = start; blockZ < end; ++blockZ)
+            {
+                size_t firstBlock = m_layerStarts[blockZ];
+                size_t lastBlock = m_layerStarts[blockZ + 1];
+                if(firstBlock == lastBlock)
+                    continue;
+
+                //one layer of cells at a time through all the active blocks
+                //so the edge caches only need two lattice planes
+                size_t startZ = std::max(blockZ * blockDim, m_cellStart[2]);
+                size_t endZ = std::min((blockZ + 1) * blockDim, m_cellEnd[2]);
+                blocks.resize(lastBlock - firstBlock);
+                for(size_t cellZ = startZ; cellZ < endZ; ++cellZ)
+                {
+                    for(size_t i = firstBlock; i < lastBlock; ++i)
+                    {
+                        vox::VoxSampleBlock& block = blocks[i - firstBlock];
+                        if(cellZ == startZ)
+                        {
+                            size_t blockX = m_activeBlocks[i] % m_blocksX;
+                            size_t blockY = (m_activeBlocks[i] / m_blocksX) % m_blocksY;
+                            size_t startX = std::max(blockX * blockDim, m_cellStart[0]);
+                            size_t startY = std::max(blockY * blockDim, m_cellStart[1]);
+                            size_t endX = std::min((blockX + 1) * blockDim, m_cellEnd[0]);
+                            size_t endY = std::min((blockY + 1) * blockDim, m_cellEnd[1]);
+                            sampler.getBlock(startX, startY, cellZ,
+                                             endX - startX, endY - startY, 1,
+                                             block);
+                        }
+                        else
+                            sampler.nextBlockLayer(block);
+
+                        for(size_t y = 0; y < block.cellsY; ++y)
+                        {
+                            for(size_t x = 0; x < block.cellsX; ++x)
+                            {
+                                block.getCell(x, y, 0, sample);
+                                polygonalizeCell(sampler, sample,
+                                                 block.cellX + x, block.cellY + y, cellZ,
+                                                 width, edgeCaches,
+                                                 vertices, indices);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        void polygonalizeCell(const vox::VoxSampler& sampler,
+                              const vox::VoxSample& sample,
+                              size_t cellX, size_t cellY, size_t cellZ,
+                              size_t width,
+                              std::vector<CachedVertex>* edgeCaches,
+                              MarchingCubesMesh::VertexArray& vertices,
+                              MarchingCubesMesh::IndexArray& indices) const
+        {
+            int cubeIndex = 0;
+            for(int i = 0; i < 8; ++i)
+            {
+                if(sample.values[i] > m_isoLevel)
+                    cubeIndex |= (1 << i);
+            }
+
+            //cell is fully inside or outside the surface
+            int edgeMask = s_edgeTable[cubeIndex];
+            if(edgeMask == 0)
+                return;
+
+            unsigned int cellVertices[12];
+            for(int edge = 0; edge < 12; ++edge)
+            {
+                if((edgeMask & (1 << edge)) == 0)
+                    continue;
+
+                unsigned int latticeZ = static_cast<unsigned int>(cellZ + s_edgeOffsets[edge][2]);
+                size_t cache = s_edgeCaches[edge];
+                if(cache != EDGES_Z)
+                    cache += latticeZ & 1;
+                size_t cacheIndex = ((cellY - m_cellStart[1] + s_edgeOffsets[edge][1]) * width) + 
+                                    cellX - m_cellStart[0] + s_edgeOffsets[edge][0];
+
+                CachedVertex& cached = edgeCaches[cache][cacheIndex];
+                if(cached.tag != latticeZ)
+                {
+                    cached.tag = latticeZ;
+                    cached.vertex = addVertex(sampler, sample, edge, cellX, cellY, cellZ, vertices);
+                }
+                cellVertices[edge] = cached.vertex;
+            }
+
+            //same winding as the unindexed triangles, counter clockwise
+            //seen from the lower values
+            for(size_t i = 0; s_triTable[cubeIndex][i] != -1; i += 3) 
+            {
+                indices.push_back(cellVertices[s_triTable[cubeIndex][i]]);
+                indices.push_back(cellVertices[s_triTable[cubeIndex][i+2]]);
+                indices.push_back(cellVertices[s_triTable[cubeIndex][i+1]]);
+            }
+        }
+    };
+}
+
+MarchingCubesMesh* MarchingCubesRenderer::extractIsosurface(const vox::VolumeDataSet& dataSet,
+                                                            float isoLevel,
+                                                            size_t sampleStride) const
+{
+    vox::VoxSampler sampler(const_cast<vox::VolumeDataSet&>(dataSet), sampleStride, 2);
+    size_t cellStart[3] = { 0, 0, 0 };
+    size_t cellEnd[3] = { sampler.cellCountX(), sampler.cellCountY(), sampler.cellCountZ() };
+
+    return extractIsosurface(dataSet, isoLevel, sampleStride, cellStart, cellEnd);
+}
+
+MarchingCubesMesh* MarchingCubesRenderer::extractIsosurface(const vox::VolumeDataSet& dataSet,
+                                                            float isoLevel,
+                                                            size_t sampleStride,
+                                                            const size_t cellStart[3],
+                                                            const size_t cellEnd[3]) const
+{
+    return extractIsosurface(dataSet, isoLevel, sampleStride, cellStart, cellEnd, NULL, true);
+}
 
-    if(s_edgeTable[cubeIndex] & 128)
+MarchingCubesMesh* MarchingCubesRenderer::extractIsosurface(const vox::VolumeDataSet& dataSet,
+                                                            float isoLevel,
+                                                            size_t sampleStride,
+                                                            const size_t cellStart[3],
+                                                            const size_t cellEnd[3],
+                                                            const std::vector<size_t>* pActiveBlocks,
+                                                            bool parallel) const
+{
+    const size_t blockDim = vox::MinMaxBlocks::k_BlockDim;
+
+    vox::VoxSampler sampler(const_cast<vox::VolumeDataSet&>(dataSet), sampleStride, 2);
+    size_t blocksX = (sampler.cellCountX() + blockDim - 1) / blockDim;
+    size_t blocksY = (sampler.cellCountY() + blockDim - 1) / blockDim;
+    size_t blocksZ = (sampler.cellCountZ() + blockDim - 1) / blockDim;
+
+    //cell box clamped to the cells and the blocks it touches
+    size_t start[3];
+    size_t end[3];
+    size_t cellCounts[3] = { sampler.cellCountX(), sampler.cellCountY(), sampler.cellCountZ() };
+    size_t blockStart[3];
+    size_t blockEnd[3];
+    for(size_t i = 0; i < 3; ++i)
     {
-        vertList[7] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[7],
-                         grid.positions[4],
-                         grid.values[7],
-                         grid.values[4]);
+        end[i] = std::min(cellEnd[i], cellCounts[i]);
+        start[i] = std::min(cellStart[i], end[i]);
+        blockStart[i] = start[i] / blockDim;
+        blockEnd[i] = (end[i] + blockDim - 1) / blockDim;
     }
 
-    if(s_edgeTable[cubeIndex] & 256)
+    //only blocks whose value range spans the iso level can have triangles. The
+    //min max blocks are in voxels, so with a stride every block is visited.
+    std::vector<size_t> activeBlocks;
+    const vox::MinMaxBlocks* pMinMaxBlocks = sampleStride == 1 ? dataSet.getMinMaxBlocks() : NULL;
+    const vox::SpanSpaceIndex* pSpanSpaceIndex = sampleStride == 1 ? dataSet.getSpanSpaceIndex() : NULL;
+    if(pActiveBlocks != NULL && sampleStride == 1)
+        activeBlocks = *pActiveBlocks;
+    else if(pSpanSpaceIndex != NULL &&
+       pMinMaxBlocks->blockCountX() == blocksX &&
+       pMinMaxBlocks->blockCountY() == blocksY &&
+       pMinMaxBlocks->blockCountZ() == blocksZ)
     {
-        vertList[8] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[0],
-                         grid.positions[4],
-                         grid.values[0],
-                         grid.values[4]);
+        std::vector<size_t> blocks;
+        pSpanSpaceIndex->findBlocks(isoLevel, blocks);
+        for(size_t i = 0; i < blocks.size(); ++i)
+        {
+            size_t blockX = blocks[i] % blocksX;
+            size_t blockY = (blocks[i] / blocksX) % blocksY;
+            size_t blockZ = blocks[i] / (blocksX * blocksY);
+            if(blockX >= blockStart[0] && blockX < blockEnd[0] &&
+               blockY >= blockStart[1] && blockY < blockEnd[1] &&
+               blockZ >= blockStart[2] && blockZ < blockEnd[2])
+                activeBlocks.push_back(blocks[i]);
+        }
     }
-
-    if(s_edgeTable[cubeIndex] & 512)
+    else
     {
-        vertList[9] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[1],
-                         grid.positions[5],
-                         grid.values[1],
-                         grid.values[5]);
+        for(size_t blockZ = blockStart[2]; blockZ < blockEnd[2]; ++blockZ)
+        {
+            for(size_t blockY = blockStart[1]; blockY < blockEnd[1]; ++blockY)
+            {
+                for(size_t blockX = blockStart[0]; blockX < blockEnd[0]; ++blockX)
+                    activeBlocks.push_back((((blockZ * blocksY) + blockY) * blocksX) + blockX);
+            }
+        }
     }
 
-    if(s_edgeTable[cubeIndex] & 1024)
+    std::vector<size_t> layerStarts(blocksZ + 1, 0);
+    for(size_t i = 0; i < activeBlocks.size(); ++i)
+        ++layerStarts[(activeBlocks[i] / (blocksX * blocksY)) + 1];
+    for(size_t blockZ = 0; blockZ < blocksZ; ++blockZ)
+        layerStarts[blockZ + 1] += layerStarts[blockZ];
+
+    //each slab of block layers is extracted into its own arrays on its own
+    //thread, the arrays are appended in slab order so the mesh does not depend
+    //on the thread count other than the duplicated vertices between slabs
+    size_t layerCount = blockEnd[2] - blockStart[2];
+    size_t slabCount = parallel ? vox::SlabThreads::GetSlabCount(layerCount) : 1;
+    std::vector<MarchingCubesMesh::VertexArray> slabVertices(slabCount);
+    std::vector<MarchingCubesMesh::IndexArray> slabIndices(slabCount);
+
+    IsosurfaceSlabTask task(dataSet, isoLevel, sampleStride, start, end,
+                            blocksX, blocksY, blockStart[2], activeBlocks, layerStarts,
+                            slabVertices, slabIndices);
+    if(parallel)
+        vox::SlabThreads::Run(task, layerCount);
+    else
+        task.runSlab(0, 0, layerCount);
+
+    vox::SmartPtr<MarchingCubesMesh> spMesh = new MarchingCubesMesh();
+    size_t vertexCount = 0;
+    size_t indexCount = 0;
+    for(size_t i = 0; i < slabCount; ++i)
     {
-        vertList[10] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[2],
-                         grid.positions[6],
-                         grid.values[2],
-                         grid.values[6]);
+        vertexCount += slabVertices[i].size();
+        indexCount += slabIndices[i].size();
     }
-
-    if(s_edgeTable[cubeIndex] & 2048)
+    spMesh->getVertices().reserve(vertexCount);
+    spMesh->getIndices().reserve(indexCount);
+    for(size_t i = 0; i < slabCount; ++i)
     {
-        vertList[11] =
-            VertexInterp(m_isoLevel,
-                         grid.positions[3],
-                         grid.positions[7],
-                         grid.values[3],
-                         grid.values[7]);
+        spMesh->append(slabVertices[i], slabIndices[i]);
+        MarchingCubesMesh::VertexArray().swap(slabVertices[i]);
+        MarchingCubesMesh::IndexArray().swap(slabIndices[i]);
     }
 
-    size_t numTris = 0;
-    for(size_t i=0;
-        s_triTable[cubeIndex][i] != -1;
-        i+=3) 
+    return spMesh.release();
+}
+
+namespace
+{
+    //user data of a scene object drawn with the renderer
+    class IsosurfaceUserData : public vox::Referenced
     {
-        const QVector3D& v0 = vertList[s_triTable[cubeIndex][i]];
-        vertices.push_back(v0.x());
-        vertices.push_back(v0.y());
-        vertices.push_back(v0.z());
-
-        const QVector3D& v2 = vertList[s_triTable[cubeIndex][i+2]];
-        vertices.push_back(v2.x());
-        vertices.push_back(v2.y());
-        vertices.push_back(v2.z());
-
-        const QVector3D& v1 = vertList[s_triTable[cubeIndex][i+1]];
-        vertices.push_back(v1.x());
-        vertices.push_back(v1.y());
-        vertices.push_back(v1.z());
-
-        ++numTris;
-
-        QVector3D normal = QVector3D::normal(v0, v2, v1);
-
-        //per vertex normals with single draw call 
-        //is usually faster
-        //then breaking up into multiple draw calls
-        //and doing per primitive normals
-        normals.push_back(normal.x());
-        normals.push_back(normal.y());
-        normals.push_back(normal.z());
-
-        normals.push_back(normal.x());
-        normals.push_back(normal.y());
-        normals.push_back(normal.z());
-
-        normals.push_back(normal.x());
-        normals.push_back(normal.y());
-        normals.push_back(normal.z());
-    }
+    public:
+        vox::SmartPtr<ChunkedIsosurface> spIsosurface;
+        IsosurfaceThread* pIsosurfaceThread;
+        //iso level last handed to the isosurface thread
+        float requestedIsoLevel;
+
+        IsosurfaceUserData(ChunkedIsosurface* pIsosurface,
+                           IsosurfaceThread* pThread,
+                           float isoLevel) :
+            spIsosurface(pIsosurface),
+            pIsosurfaceThread(pThread),
+            requestedIsoLevel(isoLevel)
+        {
+        }
+    protected:
+        virtual ~IsosurfaceUserData()
+        {
+            delete pIsosurfaceThread;
+        }
+    };
+}
 
-    return numTris;
+MarchingCubesRenderer::MarchingCubesRenderer() :
+    vox::Renderer("mc")
+{
 }
 
 void MarchingCubesRenderer::RegisterRenderer()
@@ -544,6 +795,7 @@ void MarchingCubesRenderer::setup()
 																		"MarchingCubes.frag");
 }
 
+
 void MarchingCubesRenderer::init(vox::Camera& camera,
                                  vox::SceneObject& scene)
 {
@@ -558,26 +810,60 @@ void MarchingCubesRenderer::init(vox::Camera& camera,
     if(pVoxels->subVolumeCount() > 0)
         pVoxels->generateFromSubVolumes();
 
-    size_t sampleCount = 2;
-    size_t sampleStride = 1;
-    vox::VoxSampler sampler(*pVoxels,
-                            sampleStride,
-                            sampleCount);
+    //stops the isosurface thread of a previous init
+    pVoxels->setUserData(NULL);
+    float isoLevel = getIsoLevel();
 
-    vox::VoxSample sample(8);
-    while(sampler.getNextSample(sample))
+    //a chunk file read without its voxels is streamed a chunk at a time
+    vox::SmartPtr<vox::VoxelChunkFile> spChunkFile;
+    if(pVoxels->getRawData() == NULL && pVoxels->getInputFileExtension() == "voxc")
     {
-        polygonalize(sample, 
-                     pVoxels->getFloatVertexArray(), 
-                     pVoxels->getNormalArray());
+        spChunkFile = vox::VoxelChunkFile::Open(pVoxels->getInputFile());
+        if(!spChunkFile.valid())
+        {
+            std::cerr << "ERROR: unable to open " << pVoxels->getInputFile()
+                      << " to stream its chunks." << std::endl;
+            return;
+        }
     }
 
-	qint64 elapsed = timer.elapsed();
-	std::cout << "Generated polygons in " << (elapsed / 1000.0f) << " seconds." << std::endl;
+    //the isosurface of a previous session at the same iso level
+    std::string cacheFile = IsosurfaceCache::GetCacheFile(pVoxels, isoLevel);
+    vox::SmartPtr<ChunkedIsosurface> spIsosurface = IsosurfaceCache::Read(cacheFile);
+    bool cached = spIsosurface.valid();
 
-    glEnableClientState(GL_VERTEX_ARRAY);
-    
-    glEnableClientState(GL_NORMAL_ARRAY);
+    IsosurfaceThread* pIsosurfaceThread = NULL;
+    if(spChunkFile.valid())
+    {
+        if(!cached)
+            spIsosurface = ChunkedIsosurface::Extract(*this, *spChunkFile, isoLevel);
+        if(!spIsosurface.valid())
+            return;
+
+        pIsosurfaceThread = new IsosurfaceThread(*this, *pVoxels, *spChunkFile);
+    }
+    else
+    {
+        //build the indices before the isosurface thread shares the data set
+        pVoxels->getSpanSpaceIndex();
+
+        if(!cached)
+            spIsosurface = ChunkedIsosurface::Extract(*this, *pVoxels, isoLevel);
+        if(!spIsosurface.valid())
+            return;
+
+        pIsosurfaceThread = new IsosurfaceThread(*this, *pVoxels);
+    }
+    pVoxels->setUserData(new IsosurfaceUserData(spIsosurface.get(), pIsosurfaceThread, isoLevel));
+
+    if(!cached)
+        IsosurfaceCache::Write(spIsosurface.get(), cacheFile);
+    pIsosurfaceThread->start();
+
+	qint64 elapsed = timer.elapsed();
+	std::cout << "Generated " << spIsosurface->triangleCount() << " triangles with "
+              << spIsosurface->vertexCount() << " vertices in " 
+              << (elapsed / 1000.0f) << " seconds." << std::endl;
 
     static const GLfloat lightPos[4] = { 0.0f, 100.0f, 0.0f, 1.0f };
     glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
@@ -588,6 +874,11 @@ void MarchingCubesRenderer::init(vox::Camera& camera,
 void MarchingCubesRenderer::draw(vox::Camera& camera,
                                  vox::SceneObject& scene)
 {
+    IsosurfaceUserData* pUserData = dynamic_cast<IsosurfaceUserData*>(scene.getUserData());
+    if(pUserData == NULL || !pUserData->spIsosurface.valid())
+        return;
+    ChunkedIsosurface* pIsosurface = pUserData->spIsosurface.get();
+
 	voxOpenGL::GLUtils::CheckOpenGLError();
 
 	s_pShaderProg->bind();
@@ -600,22 +891,36 @@ void MarchingCubesRenderer::draw(vox::Camera& camera,
 
     glDisable(GL_CULL_FACE);
 
-    GLfloat* verts = &scene.getFloatVertexArray().front();
-    glVertexPointer(3, GL_FLOAT, 0, verts);
-
-    GLfloat* normals = &scene.getNormalArray().front();
-    glNormalPointer(GL_FLOAT, 0, normals);
-
     GLfloat ambAndDiff[] = { 0.0f, 1.0, 0.0, 1.0 };
     glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, 
                  ambAndDiff);
 
 	voxOpenGL::GLUtils::CheckOpenGLError();
 
-    size_t count = scene.getFloatVertexArray().size() / 3;
-    glDrawArrays(GL_TRIANGLES, 0, count);
+    //the lod scalar is the screen error in pixels allowed for the coarser meshes
+    pIsosurface->draw(camera, getLodScalar());
 
 	s_pShaderProg->release();
 
 	voxOpenGL::GLUtils::CheckOpenGLError();
 }
+
+void MarchingCubesRenderer::update(vox::Camera& camera,
+                                   vox::SceneObject& scene)
+{
+    IsosurfaceUserData* pUserData = dynamic_cast<IsosurfaceUserData*>(scene.getUserData());
+    if(pUserData == NULL || pUserData->pIsosurfaceThread == NULL)
+        return;
+
+    if(getIsoLevel() != pUserData->requestedIsoLevel)
+    {
+        pUserData->requestedIsoLevel = getIsoLevel();
+        pUserData->pIsosurfaceThread->requestIsoLevel(pUserData->requestedIsoLevel);
+    }
+
+    //the old isosurface frees its buffers here, with the GL context current
+    float isoLevel = 0.0f;
+    vox::SmartPtr<ChunkedIsosurface> spIsosurface = pUserData->pIsosurfaceThread->takeIsosurface(isoLevel);
+    if(spIsosurface.valid())
+        pUserData->spIsosurface = spIsosurface;
+}
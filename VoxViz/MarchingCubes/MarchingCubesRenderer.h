@@ -4,17 +4,18 @@
 #include "VoxVizCore/Renderer.h"
 #include "VoxVizCore/VoxSampler.h"
 #include "VoxVizCore/Array.h"
+#include "MarchingCubesMesh.h"
 
 namespace mc
 {
+    //the isosurface and the thread re-extracting it are kept in the scene
+    //object's user data, one per object drawn with the renderer
     class MarchingCubesRenderer : public vox::Renderer
     {
-    private:
-        float m_isoLevel;
     public:
 		static void RegisterRenderer();
 
-        MarchingCubesRenderer() : vox::Renderer("mc"), m_isoLevel(0.5f) {}
+        MarchingCubesRenderer();
 
         virtual void setup();
         virtual void init(vox::Camera& camera,
@@ -23,11 +24,38 @@ namespace mc
         virtual void draw(vox::Camera& camera,
                           vox::SceneObject& scene);
 
-    protected:
+        //requests a new mesh when the iso level changed and swaps in the
+        //one the isosurface thread finished
+        virtual void update(vox::Camera& camera,
+                            vox::SceneObject& scene);
 
-        int polygonalize(const vox::VoxSample& gridCell,
-                         vox::FloatArray& vertices,
-                         vox::FloatArray& normals);
+        //welded isosurface at isoLevel with gradient normals, z slabs
+        //of cells are extracted in parallel. Safe to call from any thread
+        //once the data set's span space index is built.
+        MarchingCubesMesh* extractIsosurface(const vox::VolumeDataSet& dataSet,
+                                             float isoLevel,
+                                             size_t sampleStride=1) const;
+
+        //only the cells [cellStart, cellEnd) of the sampled cell grid, the
+        //voxels around the box still give the gradients
+        MarchingCubesMesh* extractIsosurface(const vox::VolumeDataSet& dataSet,
+                                             float isoLevel,
+                                             size_t sampleStride,
+                                             const size_t cellStart[3],
+                                             const size_t cellEnd[3]) const;
+
+        //pActiveBlocks are the level 0 min max blocks of the box to visit,
+        //sorted in z, y, x order, e.g. one span space query bucketed by the
+        //caller. NULL queries the data set's span space index. Callers that
+        //run several boxes in parallel themselves pass parallel false to
+        //extract on the calling thread.
+        MarchingCubesMesh* extractIsosurface(const vox::VolumeDataSet& dataSet,
+                                             float isoLevel,
+                                             size_t sampleStride,
+                                             const size_t cellStart[3],
+                                             const size_t cellEnd[3],
+                                             const std::vector<size_t>* pActiveBlocks,
+                                             bool parallel) const;
     };
 };
 #endif
@@ -0,0 +1,539 @@
+#include "RayCaster/RayCastBrickPool.h"
+
+#include "VoxVizCore/Camera.h"
+#include "VoxVizCore/Frustum.h"
+#include "VoxVizCore/SlabThreads.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+
+#include "VoxVizOpenGL/GLExtensions.h"
+#include "VoxVizOpenGL/GLUtils.h"
+
+#ifdef min
+    #undef min
+#endif
+#ifdef max
+    #undef max
+#endif
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace rc;
+
+//std::min and std::vector take the constants by reference
+const size_t BrickPool::k_BrickDim;
+const size_t BrickPool::k_BorderVoxels;
+const size_t BrickPool::k_StoredBrickDim;
+const size_t BrickPool::k_MaxBricksPerUpdate;
+const size_t BrickPool::k_NoBrick;
+
+//GL 3 implementations allow at least 2048 texels per 3d texture dimension in
+//practice, the page table holds slot coordinates in bytes
+static const size_t k_MaxSlotsPerDim = std::min(static_cast<size_t>(2048) / BrickPool::k_StoredBrickDim,
+                                                static_cast<size_t>(255));
+
+namespace
+{
+    typedef std::pair<float, size_t> BrickDistance;
+    typedef std::vector<BrickDistance> BrickDistances;
+
+    //reads the requested bricks, one brick per item
+    class ReadBricksSlabTask : public vox::SlabTask
+    {
+    private:
+        const BrickPool& m_brickPool;
+        const BrickDistances& m_bricks;
+        std::vector< std::vector<vox::Vec4ub> >& m_colors;
+        std::vector<char>& m_readBricks;
+    public:
+        ReadBricksSlabTask(const BrickPool& brickPool,
+                           const BrickDistances& bricks,
+                           std::vector< std::vector<vox::Vec4ub> >& colors,
+                           std::vector<char>& readBricks) :
+            m_brickPool(brickPool),
+            m_bricks(bricks),
+            m_colors(colors),
+            m_readBricks(readBricks)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            for(size_t i = start; i < end; ++i)
+                m_readBricks[i] = m_brickPool.readBrick(m_bricks[i].second, m_colors[i]) ? 1 : 0;
+        }
+    };
+}
+
+static bool IsTransparentBlack(const std::vector<vox::Vec4ub>& colors)
+{
+    const unsigned char* pValue = &colors[0].r;
+    const unsigned char* pValueEnd = pValue + (colors.size() * 4);
+    for(; pValue != pValueEnd; ++pValue)
+    {
+        if(*pValue != 0)
+            return false;
+    }
+    return true;
+}
+
+static size_t IntegerPower(size_t value, int power)
+{
+    size_t result = 1;
+    for(int i = 0; i < power; ++i)
+        result *= value;
+    return result;
+}
+
+//largest n with n^root <= value, for a value of at least 1
+static size_t FloorRoot(size_t value, int root)
+{
+    //pow can land either side of an exact root
+    size_t n = std::max(static_cast<size_t>(std::pow(static_cast<double>(value), 1.0 / root)),
+                        static_cast<size_t>(1));
+    while(n > 1 && IntegerPower(n, root) > value)
+        --n;
+    while(IntegerPower(n + 1, root) <= value)
+        ++n;
+    return n;
+}
+
+BrickPool::BrickPool() :
+    m_pVoxels(NULL),
+    m_dimX(0), m_dimY(0), m_dimZ(0),
+    m_bricksX(0), m_bricksY(0), m_bricksZ(0),
+    m_slotsX(0), m_slotsY(0), m_slotsZ(0),
+    m_pageTableChanged(false),
+    m_updateCount(0),
+    m_poolTextureID(0),
+    m_pageTableTextureID(0)
+{
+}
+
+BrickPool::~BrickPool()
+{
+    if(m_poolTextureID != 0)
+        glDeleteTextures(1, &m_poolTextureID);
+    if(m_pageTableTextureID != 0)
+        glDeleteTextures(1, &m_pageTableTextureID);
+}
+
+bool BrickPool::NeedsPaging(const vox::VolumeDataSet& voxels, size_t maxPoolBytes)
+{
+    //float colors and sub volumes are uploaded as they are
+    if(voxels.getColorsF() != NULL || voxels.subVolumeCount() > 0)
+        return false;
+
+    if(voxels.getColorsUB() == NULL && voxels.getRawData() == NULL)
+        return voxels.getInputFileExtension() == "voxc";
+
+    size_t colorBytes = voxels.dimX() * voxels.dimY() * voxels.dimZ() * sizeof(vox::Vec4ub);
+    return colorBytes > maxPoolBytes;
+}
+
+BrickPool* BrickPool::Create(vox::VolumeDataSet* pVoxels,
+                             const vox::VolumeDataSet::ColorLUT& colorLUT,
+                             size_t maxPoolBytes)
+{
+    if(pVoxels == NULL || pVoxels->dimX() == 0 || pVoxels->dimY() == 0 || pVoxels->dimZ() == 0)
+        return NULL;
+
+    vox::SmartPtr<BrickPool> spPool = new BrickPool();
+    spPool->m_pVoxels = pVoxels;
+    if(pVoxels->getColorsUB() == NULL && pVoxels->getRawData() == NULL)
+    {
+        spPool->m_spChunkFile = vox::VoxelChunkFile::Open(pVoxels->getInputFile());
+        if(!spPool->m_spChunkFile.valid())
+        {
+            std::cerr << "ERROR: " << pVoxels->getInputFile()
+                      << " has no voxels to page in." << std::endl;
+            return NULL;
+        }
+    }
+
+    spPool->m_colorLUT = colorLUT;
+    spPool->m_bbox = pVoxels->getBoundingBox();
+
+    spPool->m_dimX = pVoxels->dimX();
+    spPool->m_dimY = pVoxels->dimY();
+    spPool->m_dimZ = pVoxels->dimZ();
+    spPool->m_bricksX = (spPool->m_dimX + k_BrickDim - 1) / k_BrickDim;
+    spPool->m_bricksY = (spPool->m_dimY + k_BrickDim - 1) / k_BrickDim;
+    spPool->m_bricksZ = (spPool->m_dimZ + k_BrickDim - 1) / k_BrickDim;
+    size_t brickCount = spPool->m_bricksX * spPool->m_bricksY * spPool->m_bricksZ;
+
+    size_t storedBrickBytes = k_StoredBrickDim * k_StoredBrickDim * k_StoredBrickDim * sizeof(vox::Vec4ub);
+    size_t slotCount = std::min(brickCount, std::max(maxPoolBytes / storedBrickBytes, static_cast<size_t>(1)));
+
+    //as close to a cube as the slot count allows, rounded down to stay in budget
+    spPool->m_slotsX = std::min(k_MaxSlotsPerDim, FloorRoot(slotCount, 3));
+    spPool->m_slotsY = std::min(k_MaxSlotsPerDim, FloorRoot(slotCount / spPool->m_slotsX, 2));
+    spPool->m_slotsZ = std::min(k_MaxSlotsPerDim, slotCount / (spPool->m_slotsX * spPool->m_slotsY));
+    slotCount = spPool->m_slotsX * spPool->m_slotsY * spPool->m_slotsZ;
+
+    spPool->m_pageTable.assign(brickCount, vox::Vec4ub(0, 0, 0, PAGE_UNLOADED));
+    spPool->m_slotBricks.assign(slotCount, k_NoBrick);
+    spPool->m_slotLastUsed.assign(slotCount, 0);
+
+    std::cout << "Paging " << brickCount << " bricks of " << pVoxels->getInputFile()
+              << " through a pool of " << slotCount << " bricks ("
+              << ((slotCount * storedBrickBytes) / (1024 * 1024)) << " MB)." << std::endl;
+
+    return spPool.release();
+}
+
+bool BrickPool::readBrick(size_t brickIndex, std::vector<vox::Vec4ub>& colors) const
+{
+    const size_t storedDim = k_StoredBrickDim;
+    colors.assign(storedDim * storedDim * storedDim, vox::Vec4ub(0, 0, 0, 0));
+
+    size_t brick[3] = { brickIndex % m_bricksX,
+                        (brickIndex / m_bricksX) % m_bricksY,
+                        brickIndex / (m_bricksX * m_bricksY) };
+    size_t dims[3] = { m_dimX, m_dimY, m_dimZ };
+
+    //the voxels of the stored brick that are in the volume are [start, end),
+    //they start at offset in the stored brick
+    size_t start[3];
+    size_t end[3];
+    size_t offset[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        size_t first = brick[i] * k_BrickDim;
+        offset[i] = std::min(first, k_BorderVoxels);
+        start[i] = first - offset[i];
+        end[i] = std::min(first + k_BrickDim + k_BorderVoxels, dims[i]);
+    }
+    size_t boxDimX = end[0] - start[0];
+    size_t boxDimY = end[1] - start[1];
+    size_t boxDimZ = end[2] - start[2];
+
+    const vox::Vec4ub* pColors = m_pVoxels->getColorsUB();
+    std::vector<vox::Vec4ub> boxColors;
+    if(pColors == NULL)
+    {
+        //classify the voxels of the box like the whole volume would be
+        vox::VolumeDataSet::VoxelFormat voxelFormat = m_pVoxels->getVoxelFormat();
+        unsigned int valueMin, valueMax;
+        m_pVoxels->getVoxelValueRange(valueMin, valueMax);
+        if(m_spChunkFile.valid())
+        {
+            voxelFormat = m_spChunkFile->getVoxelFormat();
+            m_spChunkFile->getVoxelValueRange(valueMin, valueMax);
+        }
+
+        vox::SmartPtr<vox::VolumeDataSet> spBox = new vox::VolumeDataSet(m_pVoxels->getInputFile(),
+                                                                          QVector3D(), QQuaternion(),
+                                                                          1.0, 1.0, 1.0,
+                                                                          boxDimX, boxDimY, boxDimZ);
+        size_t count = boxDimX * boxDimY * boxDimZ;
+        unsigned char* pDest = NULL;
+        if(voxelFormat == vox::VolumeDataSet::VOXEL_FORMAT_USHORT)
+        {
+            vox::VolumeDataSet::Voxels16* pVoxels = new vox::VolumeDataSet::Voxels16[count];
+            spBox->setData(pVoxels, valueMin, valueMax);
+            pDest = reinterpret_cast<unsigned char*>(pVoxels);
+        }
+        else
+        {
+            vox::VolumeDataSet::Voxels* pVoxels = new vox::VolumeDataSet::Voxels[count];
+            spBox->setData(pVoxels);
+            pDest = pVoxels;
+        }
+        size_t voxelSize = spBox->getVoxelSize();
+
+        if(m_spChunkFile.valid())
+        {
+            if(!m_spChunkFile->readBox(start[0], start[1], start[2], end[0], end[1], end[2], pDest))
+            {
+                std::cerr << "ERROR: unable to read brick " << brickIndex
+                          << " of " << m_pVoxels->getInputFile() << std::endl;
+                return false;
+            }
+        }
+        else if(m_pVoxels->getVoxelLayout() == vox::VolumeDataSet::VOXEL_LAYOUT_LINEAR)
+        {
+            const unsigned char* pSrc = static_cast<const unsigned char*>(m_pVoxels->getRawData());
+            size_t rowBytes = boxDimX * voxelSize;
+            for(size_t z = start[2]; z < end[2]; ++z)
+            {
+                for(size_t y = start[1]; y < end[1]; ++y)
+                {
+                    memcpy(pDest, pSrc + (m_pVoxels->voxelIndex(start[0], y, z) * voxelSize), rowBytes);
+                    pDest += rowBytes;
+                }
+            }
+        }
+        else
+        {
+            const unsigned char* pSrc = static_cast<const unsigned char*>(m_pVoxels->getRawData());
+            for(size_t z = start[2]; z < end[2]; ++z)
+            {
+                for(size_t y = start[1]; y < end[1]; ++y)
+                {
+                    for(size_t x = start[0]; x < end[0]; ++x)
+                    {
+                        memcpy(pDest, pSrc + (m_pVoxels->voxelIndex(x, y, z) * voxelSize), voxelSize);
+                        pDest += voxelSize;
+                    }
+                }
+            }
+        }
+
+        boxColors.resize(count);
+        spBox->convert(m_colorLUT, &boxColors[0]);
+    }
+
+    for(size_t z = start[2]; z < end[2]; ++z)
+    {
+        for(size_t y = start[1]; y < end[1]; ++y)
+        {
+            const vox::Vec4ub* pRow = pColors != NULL ?
+                                        pColors + (((z * m_dimY) + y) * m_dimX) + start[0] :
+                                        &boxColors[(((z - start[2]) * boxDimY) + (y - start[1])) * boxDimX];
+            size_t storedZ = z - start[2] + (k_BorderVoxels - offset[2]);
+            size_t storedY = y - start[1] + (k_BorderVoxels - offset[1]);
+            size_t storedX = k_BorderVoxels - offset[0];
+            std::copy(pRow, pRow + boxDimX,
+                      colors.begin() + (((storedZ * storedDim) + storedY) * storedDim) + storedX);
+        }
+    }
+
+    return true;
+}
+
+void BrickPool::requestBricks(const unsigned short* pRequests, size_t pixelCount)
+{
+    const unsigned short* pRequestsEnd = pRequests + (pixelCount * 4);
+    for(; pRequests != pRequestsEnd; pRequests += 4)
+    {
+        if(pRequests[3] == 0 ||
+           pRequests[0] >= m_bricksX || pRequests[1] >= m_bricksY || pRequests[2] >= m_bricksZ)
+        {
+            continue;
+        }
+
+        m_requestedBricks.insert(brickIndex(pRequests[0], pRequests[1], pRequests[2]));
+    }
+}
+
+QVector3D BrickPool::brickCenter(size_t brickIndex) const
+{
+    size_t brickX = brickIndex % m_bricksX;
+    size_t brickY = (brickIndex / m_bricksX) % m_bricksY;
+    size_t brickZ = brickIndex / (m_bricksX * m_bricksY);
+
+    //bricks on the far borders can be smaller, the center is close enough
+    QVector3D texCoord((((brickX * k_BrickDim) + (k_BrickDim / 2)) / static_cast<qreal>(m_dimX)),
+                       (((brickY * k_BrickDim) + (k_BrickDim / 2)) / static_cast<qreal>(m_dimY)),
+                       (((brickZ * k_BrickDim) + (k_BrickDim / 2)) / static_cast<qreal>(m_dimZ)));
+
+    return m_bbox.minimum() + (texCoord * (m_bbox.maximum() - m_bbox.minimum()));
+}
+
+size_t BrickPool::allocateSlot(const QVector3D& cameraPosition, float brickDistance)
+{
+    //a free slot, else the slot used least recently before this update, else the
+    //slot of the brick in view that is farthest from the camera and farther
+    //than the new brick
+    size_t lruSlot = k_NoBrick;
+    unsigned int lruUpdate = m_updateCount;
+    size_t farSlot = k_NoBrick;
+    float farDistance = brickDistance;
+    for(size_t slot = 0; slot < m_slotBricks.size(); ++slot)
+    {
+        if(m_slotBricks[slot] == k_NoBrick)
+            return slot;
+
+        if(m_slotLastUsed[slot] < lruUpdate)
+        {
+            lruUpdate = m_slotLastUsed[slot];
+            lruSlot = slot;
+        }
+        else if(lruSlot == k_NoBrick)
+        {
+            float distance = (brickCenter(m_slotBricks[slot]) - cameraPosition).length();
+            if(distance > farDistance)
+            {
+                farDistance = distance;
+                farSlot = slot;
+            }
+        }
+    }
+
+    size_t slot = lruSlot != k_NoBrick ? lruSlot : farSlot;
+    if(slot != k_NoBrick)
+    {
+        m_pageTable[m_slotBricks[slot]] = vox::Vec4ub(0, 0, 0, PAGE_UNLOADED);
+        m_pageTableChanged = true;
+        m_slotBricks[slot] = k_NoBrick;
+    }
+
+    return slot;
+}
+
+void BrickPool::update(const vox::Camera& camera)
+{
+    ++m_updateCount;
+
+    //resident bricks in view count as used
+    vox::Frustum frustum;
+    frustum.setFromCamera(camera);
+
+    QVector3D brickSize = (m_bbox.maximum() - m_bbox.minimum())
+                        * QVector3D(static_cast<qreal>(k_BrickDim) / m_dimX,
+                                    static_cast<qreal>(k_BrickDim) / m_dimY,
+                                    static_cast<qreal>(k_BrickDim) / m_dimZ);
+    float brickRadius = static_cast<float>(brickSize.length() * 0.5);
+    for(size_t slot = 0; slot < m_slotBricks.size(); ++slot)
+    {
+        if(m_slotBricks[slot] == k_NoBrick)
+            continue;
+
+        float distance;
+        if(frustum.sphereInFrustum(brickCenter(m_slotBricks[slot]), brickRadius, distance) != vox::Frustum::OUTSIDE)
+            m_slotLastUsed[slot] = m_updateCount;
+    }
+
+    if(m_requestedBricks.empty())
+        return;
+
+    //the nearest bricks first, the feedback asks again for the ones left out
+    QVector3D cameraPosition = camera.getPosition();
+    BrickDistances bricks;
+    for(std::set<size_t>::const_iterator itr = m_requestedBricks.begin();
+        itr != m_requestedBricks.end();
+        ++itr)
+    {
+        if(m_pageTable[*itr].a != PAGE_UNLOADED)
+            continue;
+
+        float distance = static_cast<float>((brickCenter(*itr) - cameraPosition).length());
+        bricks.push_back(BrickDistance(distance, *itr));
+    }
+    m_requestedBricks.clear();
+
+    std::sort(bricks.begin(), bricks.end());
+    if(bricks.size() > k_MaxBricksPerUpdate)
+        bricks.resize(k_MaxBricksPerUpdate);
+
+    std::vector< std::vector<vox::Vec4ub> > colors(bricks.size());
+    std::vector<char> readBricks(bricks.size(), 0);
+    ReadBricksSlabTask task(*this, bricks, colors, readBricks);
+    vox::SlabThreads::Run(task, bricks.size());
+
+    for(size_t i = 0; i < bricks.size(); ++i)
+    {
+        size_t brick = bricks[i].second;
+
+        //a brick that can't be read is asked for again by the next frames, it
+        //is only left out once it has failed too often
+        if(readBricks[i] == 0)
+        {
+            unsigned int& failures = m_brickReadFailures[brick];
+            if(++failures < k_MaxBrickReadAttempts)
+                continue;
+
+            std::cerr << "ERROR: leaving out brick " << brick << " of " << m_pVoxels->getInputFile()
+                      << " after " << failures << " failed reads." << std::endl;
+            m_brickReadFailures.erase(brick);
+            m_pageTable[brick] = vox::Vec4ub(0, 0, 0, PAGE_EMPTY);
+            m_pageTableChanged = true;
+            continue;
+        }
+        m_brickReadFailures.erase(brick);
+
+        if(IsTransparentBlack(colors[i]))
+        {
+            m_pageTable[brick] = vox::Vec4ub(0, 0, 0, PAGE_EMPTY);
+            m_pageTableChanged = true;
+            continue;
+        }
+
+        size_t slot = allocateSlot(cameraPosition, bricks[i].first);
+        if(slot == k_NoBrick)
+            break;
+
+        m_slotBricks[slot] = brick;
+        m_slotLastUsed[slot] = m_updateCount;
+
+        BrickUpload upload;
+        upload.slotX = slot % m_slotsX;
+        upload.slotY = (slot / m_slotsX) % m_slotsY;
+        upload.slotZ = slot / (m_slotsX * m_slotsY);
+        m_brickUploads.push_back(upload);
+        m_brickUploads.back().colors.swap(colors[i]);
+
+        m_pageTable[brick] = vox::Vec4ub(static_cast<unsigned char>(upload.slotX),
+                                         static_cast<unsigned char>(upload.slotY),
+                                         static_cast<unsigned char>(upload.slotZ),
+                                         PAGE_RESIDENT);
+        m_pageTableChanged = true;
+    }
+}
+
+void BrickPool::uploadTextures()
+{
+    if(m_poolTextureID == 0)
+    {
+        m_poolTextureID = voxOpenGL::GLUtils::Create3DTexture(GL_RGBA8,
+                                                              m_slotsX * k_StoredBrickDim,
+                                                              m_slotsY * k_StoredBrickDim,
+                                                              m_slotsZ * k_StoredBrickDim,
+                                                              GL_RGBA,
+                                                              GL_UNSIGNED_BYTE,
+                                                              NULL,
+                                                              false,
+                                                              true,
+                                                              true);
+
+        m_pageTableTextureID = voxOpenGL::GLUtils::Create3DTexture(GL_RGBA8UI,
+                                                                   m_bricksX,
+                                                                   m_bricksY,
+                                                                   m_bricksZ,
+                                                                   GL_RGBA_INTEGER,
+                                                                   GL_UNSIGNED_BYTE,
+                                                                   &m_pageTable[0],
+                                                                   false,
+                                                                   false,
+                                                                   true);
+        m_pageTableChanged = false;
+
+        voxOpenGL::GLUtils::CheckOpenGLError();
+    }
+
+    for(size_t i = 0; i < m_brickUploads.size(); ++i)
+    {
+        const BrickUpload& upload = m_brickUploads[i];
+        voxOpenGL::GLUtils::Upload3DTexture(m_poolTextureID,
+                                            0,
+                                            upload.slotX * k_StoredBrickDim,
+                                            upload.slotY * k_StoredBrickDim,
+                                            upload.slotZ * k_StoredBrickDim,
+                                            k_StoredBrickDim,
+                                            k_StoredBrickDim,
+                                            k_StoredBrickDim,
+                                            GL_RGBA,
+                                            GL_UNSIGNED_BYTE,
+                                            &upload.colors[0]);
+    }
+    m_brickUploads.clear();
+
+    if(m_pageTableChanged)
+    {
+        voxOpenGL::GLUtils::Upload3DTexture(m_pageTableTextureID,
+                                            0,
+                                            0, 0, 0,
+                                            m_bricksX,
+                                            m_bricksY,
+                                            m_bricksZ,
+                                            GL_RGBA_INTEGER,
+                                            GL_UNSIGNED_BYTE,
+                                            &m_pageTable[0]);
+        m_pageTableChanged = false;
+    }
+
+    voxOpenGL::GLUtils::CheckOpenGLError();
+}
@@ -0,0 +1,158 @@
+#ifndef RC_BRICK_POOL_H
+#define RC_BRICK_POOL_H
+
+#include "VoxVizCore/Referenced.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/BoundingVolumes.h"
+
+#include <vector>
+#include <set>
+#include <map>
+
+namespace vox
+{
+    class Camera;
+    class VoxelChunkFile;
+}
+
+namespace rc
+{
+    //dense volumes that are too large for one texture are split into bricks of
+    //k_BrickDim^3 voxels and only the bricks that rays ask for are kept in a pool
+    //texture. A page table with an entry per brick tells RayCaster.frag where in
+    //the pool a brick is, that it is transparent black, or that it still has to
+    //be loaded, in which case the ray stops there and asks for it. The requests
+    //come back through a low resolution feedback pass, like the node usage
+    //lists of the GigaVoxels renderer. Bricks are read from the data set's
+    //voxels or, for chunk files read without their voxels, from the chunk file.
+    class BrickPool : public vox::Referenced
+    {
+    public:
+        static const size_t k_BrickDim = 32;
+        //voxels copied from the neighbor bricks on each side, so filtering and
+        //the gradients never reach into another slot of the pool
+        static const size_t k_BorderVoxels = 2;
+        static const size_t k_StoredBrickDim = k_BrickDim + (2 * k_BorderVoxels);
+        //bricks read per update, keeps frames interactive while the view fills in
+        static const size_t k_MaxBricksPerUpdate = 64;
+        //reads of a brick that can fail before it is left out as empty
+        static const unsigned int k_MaxBrickReadAttempts = 3;
+
+        //alpha of a page table entry, rgb hold the pool slot of resident bricks
+        enum PageState
+        {
+            PAGE_UNLOADED = 0,
+            PAGE_EMPTY = 1,
+            PAGE_RESIDENT = 2
+        };
+
+        struct BrickUpload
+        {
+            size_t slotX;
+            size_t slotY;
+            size_t slotZ;
+            std::vector<vox::Vec4ub> colors;//k_StoredBrickDim^3 colors
+        };
+        typedef std::vector<BrickUpload> BrickUploads;
+
+    private:
+        //not referenced, RayCastRenderer keeps the pool as the data set's user data
+        vox::VolumeDataSet* m_pVoxels;
+        vox::SmartPtr<vox::VoxelChunkFile> m_spChunkFile;
+        vox::VolumeDataSet::ColorLUT m_colorLUT;
+        vox::BoundingBox m_bbox;
+
+        size_t m_dimX;
+        size_t m_dimY;
+        size_t m_dimZ;
+        size_t m_bricksX;
+        size_t m_bricksY;
+        size_t m_bricksZ;
+        size_t m_slotsX;
+        size_t m_slotsY;
+        size_t m_slotsZ;
+
+        std::vector<vox::Vec4ub> m_pageTable;
+        bool m_pageTableChanged;
+
+        //brick held by each slot, k_NoBrick for free slots
+        std::vector<size_t> m_slotBricks;
+        //last update that the slot's brick was in view
+        std::vector<unsigned int> m_slotLastUsed;
+        unsigned int m_updateCount;
+
+        std::set<size_t> m_requestedBricks;
+        //failed reads of bricks that are still unloaded
+        std::map<size_t, unsigned int> m_brickReadFailures;
+        BrickUploads m_brickUploads;
+
+        unsigned int m_poolTextureID;
+        unsigned int m_pageTableTextureID;
+
+        static const size_t k_NoBrick = ~static_cast<size_t>(0);
+
+        BrickPool();
+        BrickPool(const BrickPool&);
+        BrickPool& operator=(const BrickPool&);
+
+        QVector3D brickCenter(size_t brickIndex) const;
+        size_t allocateSlot(const QVector3D& cameraPosition, float brickDistance);
+    protected:
+        virtual ~BrickPool();
+    public:
+        //volumes whose colors would take more than maxPoolBytes of texture memory,
+        //and chunk files read without their voxels
+        static bool NeedsPaging(const vox::VolumeDataSet& voxels, size_t maxPoolBytes);
+
+        //the pool gets as many slots as fit in maxPoolBytes, voxels are classified
+        //with colorLUT as they are read. pVoxels must outlive the pool. No GL calls
+        //are made until uploadTextures.
+        static BrickPool* Create(vox::VolumeDataSet* pVoxels,
+                                 const vox::VolumeDataSet::ColorLUT& colorLUT,
+                                 size_t maxPoolBytes);
+
+        size_t brickCountX() const { return m_bricksX; }
+        size_t brickCountY() const { return m_bricksY; }
+        size_t brickCountZ() const { return m_bricksZ; }
+
+        size_t brickIndex(size_t brickX, size_t brickY, size_t brickZ) const
+        {
+            return (((brickZ * m_bricksY) + brickY) * m_bricksX) + brickX;
+        }
+
+        size_t slotCountX() const { return m_slotsX; }
+        size_t slotCountY() const { return m_slotsY; }
+        size_t slotCountZ() const { return m_slotsZ; }
+
+        //brickCountX*brickCountY*brickCountZ entries in x, y, z order
+        const vox::Vec4ub* getPageTable() const { return &m_pageTable[0]; }
+
+        //classified colors of brick brickIndex and its borders, voxels outside
+        //the volume are transparent black. Returns false if they can't be read.
+        bool readBrick(size_t brickIndex, std::vector<vox::Vec4ub>& colors) const;
+
+        //pRequests holds pixelCount RGBA values of the feedback pass, pixels
+        //whose alpha is not 0 ask for brick (r, g, b)
+        void requestBricks(const unsigned short* pRequests, size_t pixelCount);
+        size_t requestedBrickCount() const { return m_requestedBricks.size(); }
+
+        //marks the resident bricks in the camera's view as used, then reads the
+        //requested bricks nearest to the camera into free slots or the slots of
+        //the bricks that were used least recently. Bricks that fail to read stay
+        //unloaded, so they are asked for again, until k_MaxBrickReadAttempts.
+        void update(const vox::Camera& camera);
+
+        //bricks that update read into the pool since the last uploadTextures
+        const BrickUploads& getBrickUploads() const { return m_brickUploads; }
+        void clearBrickUploads() { m_brickUploads.clear(); }
+
+        //creates the textures on first use and uploads what update changed
+        void uploadTextures();
+
+        unsigned int getPoolTextureID() const { return m_poolTextureID; }
+        unsigned int getPageTableTextureID() const { return m_pageTableTextureID; }
+    };
+}
+
+#endif
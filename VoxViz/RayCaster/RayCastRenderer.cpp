@@ -1,7 +1,10 @@
 #include "RayCaster/RayCastRenderer.h"
 #include "RayCaster/RayCasterShaderCodeTester.h"
+#include "RayCaster/RayCastBrickPool.h"
 #include "VoxVizCore/VolumeDataSet.h"
 #include "VoxVizCore/BoundingVolumes.h"
+#include "VoxVizCore/OpacityBlocks.h"
+#include "VoxVizCore/SmartPtr.h"
 
 #include "VoxVizOpenGL/GLExtensions.h"
 #include "VoxVizOpenGL/GLUtils.h"
@@ -24,6 +27,8 @@
 using namespace rc;
 
 static const GLint ONE_GB = 1024000000;
+//the brick feedback pass renders at 1/k_FeedbackDownScale of the viewport
+static const GLsizei k_FeedbackDownScale = 4;
 
 static voxOpenGL::ShaderProgram* s_pShaderProg = NULL;
 static voxOpenGL::ShaderProgram* s_pCameraNearPlaneProg = NULL;
@@ -33,6 +38,29 @@ void RayCastRenderer::RegisterRenderer()
 	static vox::SmartPtr<RayCastRenderer> s_spRenderer = new RayCastRenderer();
 }
 
+RayCastRenderer::~RayCastRenderer()
+{
+    if(m_feedbackColorTextureID != 0)
+        glDeleteTextures(1, &m_feedbackColorTextureID);
+    if(m_brickRequestTextureID != 0)
+        glDeleteTextures(1, &m_brickRequestTextureID);
+}
+
+vox::VolumeDataSet::ColorLUT RayCastRenderer::GetDefaultColorLUT()
+{
+    qreal intensity = 64.0/255.0;
+    qreal alpha = 64.0/255.0;
+    QVector4D colors[] =
+    {
+         QVector4D(0,  0,  0,  0),//transparent black
+         QVector4D(0, intensity,  0, alpha),//red
+         QVector4D(intensity,  0,  0, alpha),//green
+         QVector4D(0,  0, intensity, alpha) //blue
+    };
+
+    return vox::VolumeDataSet::ColorLUT(&colors[0], &colors[4]);
+}
+
 void RayCastRenderer::setup()
 {
     //create shader program
@@ -42,6 +70,15 @@ void RayCastRenderer::setup()
     s_pCameraNearPlaneProg = 
         voxOpenGL::ShaderProgramManager::instance().createShaderProgram(voxOpenGL::GLUtils::GetNearPlaneQuadVertexShaderFile(),
                                                                         "RayCaster.frag");
+
+    //the brick requests of paged volumes go to the feedback pass' second target
+    s_pShaderProg->bindFragDataLocation("FragColor", 0);
+    s_pShaderProg->bindFragDataLocation("BrickRequest", 1);
+    s_pShaderProg->link();
+
+    s_pCameraNearPlaneProg->bindFragDataLocation("FragColor", 0);
+    s_pCameraNearPlaneProg->bindFragDataLocation("BrickRequest", 1);
+    s_pCameraNearPlaneProg->link();
 }
 
 static void AddVertex(vox::FloatArray& vertexArray,
@@ -74,12 +111,37 @@ void RayCastRenderer::init(vox::Camera& camera,
 
     vox::TextureIDArray& textureIDs = pVoxels->getTextureIDArray();
 
-    textureIDs.reserve(2);
-    textureIDs.resize(2);
+    textureIDs.reserve(3);
+    textureIDs.resize(3);
+
+    //lets the rays step over blocks that the colors leave transparent black
+    vox::SmartPtr<vox::OpacityBlocks> spOpacityBlocks;
+
+    //volumes whose colors don't fit in the texture budget are paged through a
+    //pool of bricks, only the bricks that rays reach are read
+    vox::SmartPtr<BrickPool> spBrickPool;
+    if(BrickPool::NeedsPaging(*pVoxels, ONE_GB))
+    {
+        spBrickPool = BrickPool::Create(pVoxels, GetDefaultColorLUT(), ONE_GB);
+        //Create reported why, there is nothing in memory to fall back on
+        if(!spBrickPool.valid() && pVoxels->getRawData() == NULL && pVoxels->getColorsUB() == NULL)
+            return;
+    }
 
     vox::Vec4f* pVoxelColorsF = pVoxels->getColorsF();
-    if(pVoxelColorsF != NULL)
+    if(spBrickPool.valid())
+    {
+        //the pool and page table textures are created by the first draw
+        pVoxels->setUserData(spBrickPool.get());
+        textureIDs[0] = 0;
+    }
+    else if(pVoxelColorsF != NULL)
     {
+        spOpacityBlocks = vox::OpacityBlocks::Build(pVoxelColorsF,
+                                                    pVoxels->dimX(),
+                                                    pVoxels->dimY(),
+                                                    pVoxels->dimZ());
+
         textureIDs[0] = voxOpenGL::GLUtils::Create3DTexture(GL_RGBA32F,
                                                             pVoxels->dimX(),
                                                             pVoxels->dimY(),
@@ -90,9 +152,9 @@ void RayCastRenderer::init(vox::Camera& camera,
                                                             false,
                                                             true,
                                                             false);
-        delete [] pVoxelColorsF;
+        //the colors may be mapped from a file so let the data set free them
         pVoxelColorsF = NULL;
-        pVoxels->setColors(pVoxelColorsF);
+        pVoxels->freeColors();
     }
     else if(pVoxels->subVolumeCount() > 0)
     {
@@ -122,6 +184,14 @@ void RayCastRenderer::init(vox::Camera& camera,
                                                 false,
                                                 true,
                                                 false);
+		//compression can leave colors next to opaque ones not quite black
+		if(internalFormat != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+		{
+			spOpacityBlocks = vox::OpacityBlocks::Create(pVoxels->dimX(),
+														 pVoxels->dimY(),
+														 pVoxels->dimZ());
+		}
+
 		GLint compressedSize;
 		glGetTexLevelParameteriv(GL_TEXTURE_3D, 
 								 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE_ARB, &compressedSize);
@@ -145,6 +215,26 @@ void RayCastRenderer::init(vox::Camera& camera,
                                                  GL_UNSIGNED_BYTE : GL_FLOAT),
                                                 subVol.data());
 
+            if(spOpacityBlocks.get() != NULL)
+            {
+                if(subVol.getFormat() == vox::VolumeDataSet::SubVolume::FORMAT_UBYTE_RGBA)
+                {
+                    spOpacityBlocks->addColors(static_cast<const vox::Vec4ub*>(subVol.data()),
+                                               subVol.rangeStartX(), subVol.rangeStartY(), subVol.rangeStartZ(),
+                                               subVol.rangeEndX(), subVol.rangeEndY(), subVol.rangeEndZ());
+                }
+                else if(subVol.getFormat() == vox::VolumeDataSet::SubVolume::FORMAT_FLOAT_RGBA)
+                {
+                    spOpacityBlocks->addColors(static_cast<const vox::Vec4f*>(subVol.data()),
+                                               subVol.rangeStartX(), subVol.rangeStartY(), subVol.rangeStartZ(),
+                                               subVol.rangeEndX(), subVol.rangeEndY(), subVol.rangeEndZ());
+                }
+                else
+                {
+                    spOpacityBlocks = NULL;
+                }
+            }
+
 			voxOpenGL::GLUtils::CheckOpenGLError();
         }
     }
@@ -153,23 +243,18 @@ void RayCastRenderer::init(vox::Camera& camera,
         vox::Vec4ub* pVoxelColors = pVoxels->getColorsUB();
         if(pVoxelColors == NULL)
         {
-            qreal intensity = 64.0/255.0;
-            qreal alpha = 64.0/255.0;
-            QVector4D colors[] =
-            {
-                 QVector4D(0,  0,  0,  0),//transparent black
-                 QVector4D(0, intensity,  0, alpha),//red
-                 QVector4D(intensity,  0,  0, alpha),//green
-                 QVector4D(0,  0, intensity, alpha) //blue
-            };
-
-            vox::VolumeDataSet::ColorLUT colorLUT(&colors[0], &colors[4]);
+            vox::VolumeDataSet::ColorLUT colorLUT = GetDefaultColorLUT();
             size_t voxelCount = pVoxels->dimX() * pVoxels->dimY() * pVoxels->dimZ();
             pVoxelColors = new vox::Vec4ub[voxelCount];
     
             pVoxels->convert(colorLUT, pVoxelColors);
         }
 
+        spOpacityBlocks = vox::OpacityBlocks::Build(pVoxelColors,
+                                                    pVoxels->dimX(),
+                                                    pVoxels->dimY(),
+                                                    pVoxels->dimZ());
+
         textureIDs[0] = voxOpenGL::GLUtils::Create3DTexture(GL_RGBA8,
                                                             pVoxels->dimX(),
                                                             pVoxels->dimY(),
@@ -180,9 +265,11 @@ void RayCastRenderer::init(vox::Camera& camera,
                                                             false,
                                                             true,
                                                             false);
-        delete [] pVoxelColors;
+        if(pVoxelColors == pVoxels->getColorsUB())
+            pVoxels->freeColors();
+        else
+            delete [] pVoxelColors;
         pVoxelColors = NULL;
-        pVoxels->setColors(pVoxelColors);
 
 		voxOpenGL::GLUtils::CheckOpenGLError();
     }
@@ -190,6 +277,28 @@ void RayCastRenderer::init(vox::Camera& camera,
     GLsizei jitterTexSize = 32;
     textureIDs[1] = voxOpenGL::GLUtils::Create2DJitterTexture(jitterTexSize, jitterTexSize);
 
+    QVector3D volumeDimension(pVoxels->dimX(), pVoxels->dimY(), pVoxels->dimZ());
+    QVector3D blockCount(1.0f, 1.0f, 1.0f);
+    textureIDs[2] = 0;
+    if(spOpacityBlocks.get() != NULL)
+    {
+        blockCount = QVector3D(spOpacityBlocks->blockCountX(),
+                               spOpacityBlocks->blockCountY(),
+                               spOpacityBlocks->blockCountZ());
+        //fetched per block, never filtered
+        textureIDs[2] = voxOpenGL::GLUtils::Create3DTexture(GL_R8,
+                                                            spOpacityBlocks->blockCountX(),
+                                                            spOpacityBlocks->blockCountY(),
+                                                            spOpacityBlocks->blockCountZ(),
+                                                            GL_RED,
+                                                            GL_UNSIGNED_BYTE,
+                                                            spOpacityBlocks->getMaxValues(),
+                                                            false,
+                                                            false,
+                                                            true);
+        voxOpenGL::GLUtils::CheckOpenGLError();
+    }
+
     if(s_pShaderProg->bind())
     {
 
@@ -203,6 +312,14 @@ void RayCastRenderer::init(vox::Camera& camera,
 
 		s_pShaderProg->setUniformValue("ComputeLighting", true);
 
+        s_pShaderProg->setUniformValue("OpacityBlockSampler", 2);
+
+        s_pShaderProg->setUniformValue("VolumeDimension", volumeDimension);
+
+        s_pShaderProg->setUniformValue("BlockCount", blockCount);
+
+        s_pShaderProg->setUniformValue("PageTableSampler", 3);
+
         s_pShaderProg->release();
     }
 
@@ -218,6 +335,14 @@ void RayCastRenderer::init(vox::Camera& camera,
 
 		s_pCameraNearPlaneProg->setUniformValue("ComputeLighting", true);
 
+        s_pCameraNearPlaneProg->setUniformValue("OpacityBlockSampler", 2);
+
+        s_pCameraNearPlaneProg->setUniformValue("VolumeDimension", volumeDimension);
+
+        s_pCameraNearPlaneProg->setUniformValue("BlockCount", blockCount);
+
+        s_pCameraNearPlaneProg->setUniformValue("PageTableSampler", 3);
+
         s_pShaderProg->release();
     }
 
@@ -272,6 +397,101 @@ void RayCastRenderer::init(vox::Camera& camera,
 	voxOpenGL::GLUtils::CheckOpenGLError();
 }
 
+//draws the faces of the volume's box and the near plane quad for rays that
+//start inside it, the stencil keeps each pixel to the first ray
+static void DrawRays(vox::VolumeDataSet& voxels)
+{
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_EQUAL, 0, 0xFFFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+
+    s_pShaderProg->bind();
+
+    voxels.draw();
+
+    s_pShaderProg->release();
+
+	voxOpenGL::GLUtils::CheckOpenGLError();
+
+    s_pCameraNearPlaneProg->bind();
+
+    voxOpenGL::GLUtils::DrawNearPlaneQuad();
+
+    s_pCameraNearPlaneProg->release();
+
+	voxOpenGL::GLUtils::CheckOpenGLError();
+
+    glDisable(GL_STENCIL_TEST);
+}
+
+void RayCastRenderer::requestBricks(BrickPool& brickPool, vox::VolumeDataSet& voxels)
+{
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLsizei width = std::max(viewport[2] / k_FeedbackDownScale, 1);
+    GLsizei height = std::max(viewport[3] / k_FeedbackDownScale, 1);
+
+    if(!m_spFeedbackFrameBufferObject.valid() ||
+       width != m_feedbackWidth ||
+       height != m_feedbackHeight)
+    {
+        if(m_feedbackColorTextureID != 0)
+            glDeleteTextures(1, &m_feedbackColorTextureID);
+        if(m_brickRequestTextureID != 0)
+            glDeleteTextures(1, &m_brickRequestTextureID);
+
+        m_feedbackWidth = width;
+        m_feedbackHeight = height;
+        m_spFeedbackFrameBufferObject = new voxOpenGL::GLFrameBufferObject(width, height);
+        m_feedbackColorTextureID = voxOpenGL::GLUtils::Create2DTexture(GL_RGBA8,
+                                                                       width, height,
+                                                                       GL_RGBA,
+                                                                       GL_UNSIGNED_BYTE,
+                                                                       NULL,
+                                                                       false,
+                                                                       false);
+        m_brickRequestTextureID = voxOpenGL::GLUtils::Create2DTexture(GL_RGBA16UI,
+                                                                      width, height,
+                                                                      GL_RGBA_INTEGER,
+                                                                      GL_UNSIGNED_SHORT,
+                                                                      NULL,
+                                                                      false,
+                                                                      false);
+        m_brickRequests.resize(width * height * 4);
+    }
+
+    GLint prevFrameBufferID;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFrameBufferID);
+
+    m_spFeedbackFrameBufferObject->bind();
+    m_spFeedbackFrameBufferObject->attachColorBuffer(m_feedbackColorTextureID, 0);
+    m_spFeedbackFrameBufferObject->attachColorBuffer(m_brickRequestTextureID, 1);
+    m_spFeedbackFrameBufferObject->attachDepthStencilBuffer();
+    m_spFeedbackFrameBufferObject->mapDrawBuffers(2);
+    m_spFeedbackFrameBufferObject->setViewportWidthHeight(width, height);
+
+    static GLfloat zeroFloat[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glClearBufferfv(GL_COLOR, 0, zeroFloat);
+    static GLuint zeroUint[] = { 0, 0, 0, 0 };
+    glClearBufferuiv(GL_COLOR, 1, zeroUint);
+    static GLint stencil = 0;
+    glClearBufferiv(GL_STENCIL, 0, &stencil);
+
+    DrawRays(voxels);
+
+    glBindTexture(GL_TEXTURE_2D, m_brickRequestTextureID);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, &m_brickRequests[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFrameBufferID);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+	voxOpenGL::GLUtils::CheckOpenGLError();
+
+    //read by the next draw's BrickPool::update
+    brickPool.requestBricks(&m_brickRequests[0], width * height);
+}
+
 void RayCastRenderer::draw(vox::Camera& camera,
                              vox::SceneObject& scene)
 {
@@ -284,10 +504,23 @@ void RayCastRenderer::draw(vox::Camera& camera,
 
     glEnable(GL_CULL_FACE);
 
-    glEnable(GL_STENCIL_TEST);
-    //use the stencil to make sure that only one pixel modifies the color buffer
-    glStencilFunc(GL_EQUAL, 0, 0xFFFF);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
+    //the bricks that the last frame's rays stopped at are read first
+    BrickPool* pBrickPool = dynamic_cast<BrickPool*>(pVoxels->getUserData());
+    bool paged = pBrickPool != NULL;
+    QVector3D pageTableDimension(1.0f, 1.0f, 1.0f);
+    QVector3D brickPoolDimension(1.0f, 1.0f, 1.0f);
+    if(paged)
+    {
+        pBrickPool->update(camera);
+        pBrickPool->uploadTextures();
+
+        pageTableDimension = QVector3D(pBrickPool->brickCountX(),
+                                       pBrickPool->brickCountY(),
+                                       pBrickPool->brickCountZ());
+        brickPoolDimension = QVector3D(pBrickPool->slotCountX() * BrickPool::k_StoredBrickDim,
+                                       pBrickPool->slotCountY() * BrickPool::k_StoredBrickDim,
+                                       pBrickPool->slotCountZ() * BrickPool::k_StoredBrickDim);
+    }
 
     s_pShaderProg->bind();
 
@@ -352,20 +585,35 @@ void RayCastRenderer::draw(vox::Camera& camera,
 
     vox::TextureIDArray& textureIDs = pVoxels->getTextureIDArray();
 
+    bool skipEmptyBlocks = textureIDs.size() > 2 && textureIDs[2] != 0;
+    s_pShaderProg->setUniformValue("SkipEmptyBlocks", skipEmptyBlocks);
+
+    s_pShaderProg->setUniformValue("Paged", paged);
+    s_pShaderProg->setUniformValue("PageTableDimension", pageTableDimension);
+    s_pShaderProg->setUniformValue("BrickPoolDimension", brickPoolDimension);
+
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_3D, textureIDs[0]);
+    glBindTexture(GL_TEXTURE_3D, paged ? pBrickPool->getPoolTextureID() : textureIDs[0]);
 
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, textureIDs[1]);
 
+    if(skipEmptyBlocks)
+    {
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_3D, textureIDs[2]);
+    }
+
+    if(paged)
+    {
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_3D, pBrickPool->getPageTableTextureID());
+    }
+
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	voxOpenGL::GLUtils::CheckOpenGLError();
-
-    pVoxels->draw();
-
     s_pShaderProg->release();
 
 	voxOpenGL::GLUtils::CheckOpenGLError();
@@ -389,16 +637,21 @@ void RayCastRenderer::draw(vox::Camera& camera,
     s_pCameraNearPlaneProg->setUniformValue("CameraPosition", cameraPosition);
     s_pCameraNearPlaneProg->setUniformValue("LightPosition", lightPosition);
 	s_pCameraNearPlaneProg->setUniformValue("ComputeLighting", computeLighting);
+    s_pCameraNearPlaneProg->setUniformValue("SkipEmptyBlocks", skipEmptyBlocks);
+    s_pCameraNearPlaneProg->setUniformValue("Paged", paged);
+    s_pCameraNearPlaneProg->setUniformValue("PageTableDimension", pageTableDimension);
+    s_pCameraNearPlaneProg->setUniformValue("BrickPoolDimension", brickPoolDimension);
 
     /*bool runTest = false;
     if(runTest)
         rc::RayCasterShaderCodeTester::drawNearPlane(s_pCameraNearPlaneProg);*/
 
-    voxOpenGL::GLUtils::DrawNearPlaneQuad();
-
     s_pCameraNearPlaneProg->release();
 
 	voxOpenGL::GLUtils::CheckOpenGLError();
 
-    glDisable(GL_STENCIL_TEST);
+    DrawRays(*pVoxels);
+
+    if(paged)
+        requestBricks(*pBrickPool, *pVoxels);
 }
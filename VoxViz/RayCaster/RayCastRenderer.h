@@ -2,17 +2,46 @@
 #define RC_RAYCAST_RENDERER_H
 
 #include "VoxVizCore/Renderer.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/VolumeDataSet.h"
+
+#include "VoxVizOpenGL/GLFrameBufferObject.h"
+
+#include <vector>
 
 namespace rc
 {
+    class BrickPool;
+
     class RayCastRenderer : public vox::Renderer
     {
     private:
         size_t m_numSamples;
+
+        //low resolution pass that finds the bricks paged volumes' rays stop at
+        vox::SmartPtr<voxOpenGL::GLFrameBufferObject> m_spFeedbackFrameBufferObject;
+        unsigned int m_feedbackColorTextureID;
+        unsigned int m_brickRequestTextureID;
+        int m_feedbackWidth;
+        int m_feedbackHeight;
+        std::vector<unsigned short> m_brickRequests;
+
+        void requestBricks(BrickPool& brickPool, vox::VolumeDataSet& voxels);
     public:
 		static void RegisterRenderer();
 
-        RayCastRenderer(size_t numSamples=32) : vox::Renderer("rc"), m_numSamples(numSamples) {}
+        //classifies volumes that are loaded without colors
+        static vox::VolumeDataSet::ColorLUT GetDefaultColorLUT();
+
+        RayCastRenderer(size_t numSamples=32) :
+            vox::Renderer("rc"),
+            m_numSamples(numSamples),
+            m_feedbackColorTextureID(0),
+            m_brickRequestTextureID(0),
+            m_feedbackWidth(0),
+            m_feedbackHeight(0)
+        {
+        }
 
         size_t getNumSamples() { return m_numSamples; }
         void setNumSamples(size_t numSamples) { m_numSamples = numSamples; }
@@ -24,6 +53,8 @@ namespace rc
         virtual void draw(vox::Camera& camera,
                           vox::SceneObject& scene);
 
+    protected:
+        ~RayCastRenderer();
     };
 };
 #endif
@@ -1,13 +1,22 @@
 #include "RayCaster/RayCasterShaderCodeTester.h"
+#include "RayCaster/RayCastRenderer.h"
+#include "RayCaster/RayCastBrickPool.h"
 
 #include "VoxVizOpenGL/GLExtensions.h"
 #include "VoxVizOpenGL/GLUtils.h"
+#include "VoxVizCore/BoundingVolumes.h"
+#include "VoxVizCore/OpacityBlocks.h"
+#include "VoxVizCore/ScreenTiles.h"
 
 //#include <glm/core/setup.hpp>
 #define GLM_SWIZZLE GLM_SWIZZLE_FULL
 #include <glm/glm.hpp>
 
 #include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
 
 using namespace glm;
 
@@ -29,7 +38,7 @@ void NearPlaneVertexShader(in vec4 glVertex, out vec4& RayPosition)
 {
     //the near plane quad is already in view space
     gl_Position = ProjectionMatrix * glVertex;
-    
+
     vec3 rayPosition = (InverseModelViewMatrix * glVertex).xyz;
     rayPosition -= VolTranslation;
     rayPosition /= VolScale;
@@ -52,3 +61,698 @@ void rc::RayCasterShaderCodeTester::drawNearPlane(voxOpenGL::ShaderProgram* pSha
 
     NearPlaneVertexShader(vec4(0.5f, 0.4f, -1.0f, 1.0f), rayPosition);
 }
+
+//the GigaVoxels tester has types of the same names, they must not be merged
+//when both testers are linked into the viewer
+namespace
+{
+    //RGBA8 texture with GL_LINEAR filtering and a transparent black border, like
+    //the one RayCastRenderer::init creates
+    struct sampler3D
+    {
+        sampler3D() : w(0), h(0), d(0) {}
+        int w;
+        int h;
+        int d;
+        std::vector<vox::Vec4ub> data;
+    };
+
+    //the page table is uploaded as an RGBA8UI texture
+    struct usampler3D
+    {
+        usampler3D() : w(0), h(0), d(0) {}
+        int w;
+        int h;
+        int d;
+        std::vector<vox::Vec4ub> data;
+    };
+
+    struct sampler2D
+    {
+        sampler2D() : w(0), h(0) {}
+        int w;
+        int h;
+        std::vector<unsigned char> data;
+    };
+}
+
+static vec4 texelFetch(const sampler3D& sampler, int x, int y, int z)
+{
+    if(x < 0 || y < 0 || z < 0 ||
+       x >= sampler.w || y >= sampler.h || z >= sampler.d)
+    {
+        return vec4(0.0f);
+    }
+
+    const vox::Vec4ub& texel = sampler.data[(((static_cast<size_t>(z) * sampler.h) + y) * sampler.w) + x];
+    return vec4(texel.r, texel.g, texel.b, texel.a) / 255.0f;
+}
+
+//filters the 8 texels around (u, v, w), which is in texels not texture coords
+static vec4 SampleLinear(const sampler3D& sampler, float u, float v, float w)
+{
+    float x0f = std::floor(u);
+    float y0f = std::floor(v);
+    float z0f = std::floor(w);
+    float fx = u - x0f;
+    float fy = v - y0f;
+    float fz = w - z0f;
+    int x0 = static_cast<int>(x0f);
+    int y0 = static_cast<int>(y0f);
+    int z0 = static_cast<int>(z0f);
+
+    vec4 c00 = (texelFetch(sampler, x0, y0, z0) * (1.0f - fx)) + (texelFetch(sampler, x0 + 1, y0, z0) * fx);
+    vec4 c10 = (texelFetch(sampler, x0, y0 + 1, z0) * (1.0f - fx)) + (texelFetch(sampler, x0 + 1, y0 + 1, z0) * fx);
+    vec4 c01 = (texelFetch(sampler, x0, y0, z0 + 1) * (1.0f - fx)) + (texelFetch(sampler, x0 + 1, y0, z0 + 1) * fx);
+    vec4 c11 = (texelFetch(sampler, x0, y0 + 1, z0 + 1) * (1.0f - fx)) + (texelFetch(sampler, x0 + 1, y0 + 1, z0 + 1) * fx);
+
+    vec4 c0 = (c00 * (1.0f - fy)) + (c10 * fy);
+    vec4 c1 = (c01 * (1.0f - fy)) + (c11 * fy);
+
+    return (c0 * (1.0f - fz)) + (c1 * fz);
+}
+
+static vec4 texture(const sampler3D& sampler, const vec3& texCoord)
+{
+    return SampleLinear(sampler,
+                        (texCoord.x * sampler.w) - 0.5f,
+                        (texCoord.y * sampler.h) - 0.5f,
+                        (texCoord.z * sampler.d) - 0.5f);
+}
+
+static vec4 textureOffset(const sampler3D& sampler, const vec3& texCoord, const ivec3& offset)
+{
+    return SampleLinear(sampler,
+                        (texCoord.x * sampler.w) - 0.5f + offset.x,
+                        (texCoord.y * sampler.h) - 0.5f + offset.y,
+                        (texCoord.z * sampler.d) - 0.5f + offset.z);
+}
+
+static vec4 texelFetch(const sampler2D& sampler, const ivec2& texCoord, int)
+{
+    return vec4(static_cast<float>(sampler.data[(texCoord.y * sampler.w) + texCoord.x]) / 255.0f,
+                0.0f, 0.0f, 1.0f);
+}
+
+static uvec4 texelFetch(const usampler3D& sampler, const ivec3& texCoord, int)
+{
+    const vox::Vec4ub& texel = sampler.data[(((static_cast<size_t>(texCoord.z) * sampler.h) + texCoord.y) * sampler.w) + texCoord.x];
+    return uvec4(texel.r, texel.g, texel.b, texel.a);
+}
+
+//the blocks are uploaded as an R8 texture with GL_NEAREST filtering
+static vec4 texelFetch(const vox::SmartPtr<vox::OpacityBlocks>& sampler, const ivec3& texCoord, int)
+{
+    return vec4(static_cast<float>(sampler->getMaxValue(texCoord.x, texCoord.y, texCoord.z)) / 255.0f,
+                0.0f, 0.0f, 1.0f);
+}
+
+//#version 330
+
+uniform sampler3D VoxelSampler;
+uniform sampler2D JitterTexSampler;
+uniform int JitterTexSize;
+uniform float RayStepSize;
+uniform vec3 CameraPosition;
+uniform vec3 LightPosition;
+uniform vec3 VolExtentMin;
+uniform vec3 VolExtentMax;
+uniform bool ComputeLighting;
+
+uniform vox::SmartPtr<vox::OpacityBlocks> OpacityBlockSampler;
+uniform bool SkipEmptyBlocks;
+uniform vec3 VolumeDimension;
+uniform vec3 BlockCount;
+uniform bool Paged;
+uniform usampler3D PageTableSampler;
+uniform vec3 PageTableDimension;
+uniform vec3 BrickPoolDimension;
+
+const float k_BlockDim = static_cast<float>(vox::OpacityBlocks::k_BlockDim);
+const float k_BrickDim = static_cast<float>(rc::BrickPool::k_BrickDim);
+const float k_BrickBorder = static_cast<float>(rc::BrickPool::k_BorderVoxels);
+const float k_StoredBrickDim = k_BrickDim + (2.0f * k_BrickBorder);
+const uint k_PageEmpty = rc::BrickPool::PAGE_EMPTY;
+const uint k_PageResident = rc::BrickPool::PAGE_RESIDENT;
+
+static bool s_emptySpaceSkipping = true;
+//pages VoxelSampler and PageTableSampler for volumes loaded with loadPagedVolume
+static vox::SmartPtr<rc::BrickPool> s_spBrickPool;
+static vox::SmartPtr<vox::VolumeDataSet> s_spPagedVoxels;
+
+// lighting factors
+const vec3 k_Ambient = vec3(0.05f, 0.05f, 0.05f);
+const vec3 k_Diffuse = vec3(1.0f, 1.0f, 1.0f);
+const vec3 k_Specular = vec3(1.0f, 1.0f, 1.0f);
+const float k_Shininess = 100.0f;
+
+static vec3 shading(vec3 rgb, vec3 normal, vec3 toCamera, vec3 toLight)
+{
+    vec3 halfway = normalize(toLight + toCamera);
+
+    float diffuseLight = max(dot(toLight, normal), 0.0f);
+    vec3 diffuse = vec3(0, 0, 0);
+    vec3 specular = vec3(0, 0, 0);
+
+    if(diffuseLight > 0.0f)
+    {
+        diffuse = k_Diffuse * rgb * diffuseLight;
+
+        float specularLight = pow(max(dot(halfway, normal), 0.0f), k_Shininess);
+        specular = k_Specular * rgb * specularLight;
+    }
+
+    vec3 ambient = k_Ambient * rgb;
+
+    return ambient + diffuse + specular;
+}
+
+//returns how many steps the ray at texel, in block of blockDim texels, takes
+//to leave it. texelStep is the ray step in texels.
+static float stepsToLeaveBlock(vec3 texel, vec3 block, vec3 blockCount, float blockDim, vec3 texelStep)
+{
+    //the border is transparent black too, so the outer blocks reach past it
+    float exitStep = std::ceil(std::sqrt(3.0f) / RayStepSize) + 1.0f;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(texelStep[i] > 0.0f && block[i] < blockCount[i] - 1.0f)
+            exitStep = min(exitStep, (((block[i] + 1.0f) * blockDim) - texel[i]) / texelStep[i]);
+        else if(texelStep[i] < 0.0f && block[i] > 0.0f)
+            exitStep = min(exitStep, ((block[i] * blockDim) - texel[i]) / texelStep[i]);
+    }
+
+    //the steps before the exit are all in the block, rounding down keeps the
+    //first one after it from being skipped by a rounding error
+    return max(std::floor(exitStep), 1.0f);
+}
+
+//returns how many steps the ray at rayPosition can take before it can sample
+//anything but transparent black, or 0 if the sample at rayPosition may not be.
+//A sample is in the block of the lowest of the texels it filters.
+static float emptyStepCount(vec3 rayPosition, vec3 rayStep)
+{
+    if(!SkipEmptyBlocks)
+        return 0.0f;
+
+    vec3 texel = (rayPosition * VolumeDimension) - 0.5f;
+    vec3 block = clamp(floor(texel / k_BlockDim), vec3(0.0f), BlockCount - 1.0f);
+
+    if(texelFetch(OpacityBlockSampler, ivec3(block), 0).r > 0.0f)
+        return 0.0f;
+
+    return stepsToLeaveBlock(texel, block, BlockCount, k_BlockDim, rayStep * VolumeDimension);
+}
+
+//RayCaster.frag
+static void RayCasterFragmentShader(const ivec4& gl_FragCoord,
+                                    in vec4 RayPosition,
+                                    out vec4& FragColor,
+                                    out uvec4& BrickRequest)
+{
+    vec4 src;
+
+    vec4 dst = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    BrickRequest = uvec4(0u);
+
+    vec3 rayPosition = RayPosition.xyz;
+
+    //jitter start
+    vec3 rayDir = normalize(rayPosition - CameraPosition);
+    vec3 rayStep = (rayDir * RayStepSize);
+
+    ivec2 jitterTexCoord = ivec2(gl_FragCoord.x % JitterTexSize, gl_FragCoord.y % JitterTexSize);
+    rayPosition += (rayStep * texelFetch(JitterTexSampler, jitterTexCoord, 0).r);
+    //samples are placed at whole steps from the start so skipping empty blocks
+    //leaves the others where they were
+    vec3 rayStart = rayPosition;
+    float stepCount = 0.0f;
+
+    vec3 nextPosition = rayPosition + rayStep;
+    vec3 test1 = sign(nextPosition - VolExtentMin);
+    vec3 test2 = sign(VolExtentMax - nextPosition);
+    float inside = dot(test1, test2);
+
+    while(inside >= 3.0f)
+    {
+        float skipCount = emptyStepCount(rayPosition, rayStep);
+        vec3 samplePosition = rayPosition;
+        if(Paged && skipCount == 0.0f)
+        {
+            vec3 texel = (rayPosition * VolumeDimension) - 0.5f;
+            vec3 brick = clamp(floor(texel / k_BrickDim), vec3(0.0f), PageTableDimension - 1.0f);
+            uvec4 page = texelFetch(PageTableSampler, ivec3(brick), 0);
+
+            if(page.a == k_PageEmpty)
+            {
+                skipCount = stepsToLeaveBlock(texel, brick, PageTableDimension, k_BrickDim,
+                                              rayStep * VolumeDimension);
+            }
+            else if(page.a != k_PageResident)
+            {
+                BrickRequest = uvec4(uvec3(brick), 1u);
+                break;
+            }
+            else
+            {
+                //the brick's voxels start after the border of its slot
+                vec3 poolTexel = (vec3(page.x, page.y, page.z) * k_StoredBrickDim) + k_BrickBorder
+                               + (texel - (brick * k_BrickDim));
+                samplePosition = (poolTexel + 0.5f) / BrickPoolDimension;
+            }
+        }
+
+        if(skipCount > 0.0f)
+        {
+            stepCount += skipCount;
+            rayPosition = rayStart + (rayStep * stepCount);
+
+            test1 = sign(rayPosition - VolExtentMin);
+            test2 = sign(VolExtentMax - rayPosition);
+            inside = dot(test1, test2);
+            continue;
+        }
+
+        src = texture(VoxelSampler, samplePosition);
+
+        if(ComputeLighting)
+        {
+            //compute gradiant
+            vec3 sample1;
+            vec3 sample2;
+
+            const ivec4 offset = ivec4(1, 0, 0, -1);
+            sample1.x = textureOffset(VoxelSampler,
+                                      samplePosition,
+                                      ivec3(offset.x, offset.y, offset.z)).a;
+            sample2.x = textureOffset(VoxelSampler,
+                                      samplePosition,
+                                      ivec3(offset.w, offset.y, offset.z)).a;
+            sample1.y = textureOffset(VoxelSampler,
+                                      samplePosition,
+                                      ivec3(offset.y, offset.x, offset.z)).a;
+            sample2.y = textureOffset(VoxelSampler,
+                                      samplePosition,
+                                      ivec3(offset.y, offset.w, offset.z)).a;
+            sample1.z = textureOffset(VoxelSampler,
+                                      samplePosition,
+                                      ivec3(offset.y, offset.z, offset.x)).a;
+            sample2.z = textureOffset(VoxelSampler,
+                                      samplePosition,
+                                      ivec3(offset.y, offset.z, offset.w)).a;
+
+            vec3 normal = normalize(sample2 - sample1);
+            if(!std::isnan(normal.x) && !std::isnan(normal.y) && !std::isnan(normal.z))
+            {
+                vec3 toCamera = normalize(CameraPosition - rayPosition);
+                src.rgb += shading(src.rgb, normal, toCamera, normalize(LightPosition - rayPosition));
+            }
+        }
+
+        //src.rgb *= src.a;
+        dst = (1.0f - dst.a) * src + dst;
+
+        if(dst.a > 0.95f)
+            break;
+
+        stepCount += 1.0f;
+        rayPosition = rayStart + (rayStep * stepCount);
+
+        test1 = sign(rayPosition - VolExtentMin);
+        test2 = sign(VolExtentMax - rayPosition);
+        inside = dot(test1, test2);
+    }
+
+    FragColor = dst;
+}
+
+static mat4 ToMat4(const double* pMtx)
+{
+    mat4 mtx;
+    vox::ScreenRays::ToFloatMatrix(pMtx, &mtx[0][0]);
+    return mtx;
+}
+
+static vec3 WorldToVolume(const vec3& worldPosition)
+{
+    vec3 volumePosition;
+    vox::ScreenRays::WorldToVolume(&worldPosition[0], &VolTranslation[0], &VolScale[0], &volumePosition[0]);
+    return volumePosition;
+}
+
+namespace
+{
+    //renders the tiles of a frame, the rays start where the front faces or, with
+    //the camera inside, the near plane quad start them
+    class RenderTilesTask : public vox::ScreenTileTask
+    {
+    private:
+        vox::ScreenRays m_rays;
+        unsigned char* m_pRGBA;
+        unsigned short* m_pRequests;
+    public:
+        RenderTilesTask(const vox::ScreenRays& rays,
+                        int width, int height,
+                        unsigned char* pRGBA,
+                        unsigned short* pRequests) :
+            vox::ScreenTileTask(width, height),
+            m_rays(rays),
+            m_pRGBA(pRGBA),
+            m_pRequests(pRequests)
+        {
+        }
+    protected:
+        virtual void renderTile(int startX, int startY, int endX, int endY)
+        {
+            for(int y = startY; y < endY; ++y)
+            {
+                for(int x = startX; x < endX; ++x)
+                {
+                    vec4 fragColor(0.0f);
+                    uvec4 brickRequest(0u);
+
+                    vec3 rayPosition;
+                    if(m_rays.computeRayPosition(x, y, &rayPosition[0]))
+                        RayCasterFragmentShader(ivec4(x, y, 0, 0), vec4(rayPosition, 1.0f), fragColor, brickRequest);
+
+                    //the frame buffer clamps what is blended into it
+                    fragColor = clamp(fragColor, 0.0f, 1.0f);
+                    unsigned char* pColor = m_pRGBA + (((static_cast<size_t>(y) * m_width) + x) * 4);
+                    for(int i = 0; i < 4; ++i)
+                        pColor[i] = static_cast<unsigned char>((fragColor[i] * 255.0f) + 0.5f);
+
+                    if(m_pRequests != NULL)
+                    {
+                        unsigned short* pRequest = m_pRequests + (((static_cast<size_t>(y) * m_width) + x) * 4);
+                        for(int i = 0; i < 4; ++i)
+                            pRequest[i] = static_cast<unsigned short>(brickRequest[i]);
+                    }
+                }
+            }
+        }
+    };
+}
+
+//fills the jitter texture like GLUtils::Create2DJitterTexture but from a fixed
+//seed, so that frames can be compared
+static void InitJitterTexture(int jitterTexSize)
+{
+    JitterTexSize = jitterTexSize;
+    JitterTexSampler.w = JitterTexSampler.h = jitterTexSize;
+    JitterTexSampler.data.resize(jitterTexSize * jitterTexSize);
+
+    unsigned int seed = 1;
+    for(size_t i = 0; i < JitterTexSampler.data.size(); ++i)
+    {
+        seed = (seed * 1103515245u) + 12345u;
+        unsigned char randomUChar = static_cast<unsigned char>((seed >> 16) & 0xFF);
+        if(randomUChar == 0)
+            randomUChar += 1;
+        JitterTexSampler.data[i] = randomUChar;
+    }
+}
+
+//sets the uniforms that RayCastRenderer sets for any volume
+static void InitVolumeUniforms(const vox::VolumeDataSet* pVoxels,
+                               size_t numSamples,
+                               bool computeLighting)
+{
+    if(numSamples == 0)
+        numSamples = pVoxels->getNumSamples();
+    if(numSamples == 0)
+    {
+        numSamples = static_cast<size_t>(std::sqrt(static_cast<float>(
+                             (pVoxels->dimX() * pVoxels->dimX())
+                           + (pVoxels->dimY() * pVoxels->dimY())
+                           + (pVoxels->dimZ() * pVoxels->dimZ())))) + 2;
+    }
+    if(numSamples < 32)
+        numSamples = 32;
+
+    RayStepSize = std::sqrt(3.0f) / numSamples;
+    ComputeLighting = computeLighting;
+    InitJitterTexture(32);
+
+    const vox::BoundingBox& bbox = pVoxels->getBoundingBox();
+    QVector3D center = bbox.center();
+    VolTranslation = vec3(center.x(), center.y(), center.z());
+    VolScale = vec3(bbox.xMax() - bbox.xMin(),
+                    bbox.yMax() - bbox.yMin(),
+                    bbox.zMax() - bbox.zMin());
+    VolExtentMin = WorldToVolume(vec3(bbox.xMin(), bbox.yMin(), bbox.zMin()));
+    VolExtentMax = WorldToVolume(vec3(bbox.xMax(), bbox.yMax(), bbox.zMax()));
+
+    //RayCastRenderer::draw scales the light position without translating it
+    LightPosition = (vec3(0.0f, 100.0f, 0.0f) / VolScale) + 0.5f;
+}
+
+bool rc::RayCasterShaderCodeTester::loadVolume(const vox::VolumeDataSet* pVoxels,
+                                               size_t numSamples,
+                                               bool computeLighting)
+{
+    OpacityBlockSampler = NULL;
+    VoxelSampler = sampler3D();
+    PageTableSampler = usampler3D();
+    Paged = false;
+    s_spBrickPool = NULL;
+    s_spPagedVoxels = NULL;
+
+    if(pVoxels == NULL || pVoxels->dimX() == 0 || pVoxels->dimY() == 0 || pVoxels->dimZ() == 0)
+        return false;
+
+    size_t voxelCount = pVoxels->dimX() * pVoxels->dimY() * pVoxels->dimZ();
+    VoxelSampler.data.resize(voxelCount);
+
+    if(pVoxels->getColorsUB() != NULL)
+    {
+        std::copy(pVoxels->getColorsUB(), pVoxels->getColorsUB() + voxelCount, VoxelSampler.data.begin());
+    }
+    else if(pVoxels->getColorsF() != NULL)
+    {
+        //the renderer keeps float colors as floats, 8 bits are close enough here
+        const vox::Vec4f* pColorsF = pVoxels->getColorsF();
+        for(size_t i = 0; i < voxelCount; ++i)
+        {
+            vec4 color = clamp(vec4(pColorsF[i].x, pColorsF[i].y, pColorsF[i].z, pColorsF[i].w), 0.0f, 1.0f);
+            VoxelSampler.data[i] = vox::Vec4ub(static_cast<unsigned char>((color.r * 255.0f) + 0.5f),
+                                               static_cast<unsigned char>((color.g * 255.0f) + 0.5f),
+                                               static_cast<unsigned char>((color.b * 255.0f) + 0.5f),
+                                               static_cast<unsigned char>((color.a * 255.0f) + 0.5f));
+        }
+    }
+    else if(pVoxels->getRawData() != NULL)
+    {
+        pVoxels->convert(RayCastRenderer::GetDefaultColorLUT(), &VoxelSampler.data[0]);
+    }
+    else
+    {
+        std::cerr << "ERROR: The volume has neither voxels nor colors to ray cast." << std::endl;
+        VoxelSampler = sampler3D();
+        return false;
+    }
+
+    VoxelSampler.w = static_cast<int>(pVoxels->dimX());
+    VoxelSampler.h = static_cast<int>(pVoxels->dimY());
+    VoxelSampler.d = static_cast<int>(pVoxels->dimZ());
+
+    OpacityBlockSampler = vox::OpacityBlocks::Build(&VoxelSampler.data[0],
+                                                    pVoxels->dimX(),
+                                                    pVoxels->dimY(),
+                                                    pVoxels->dimZ());
+    VolumeDimension = vec3(VoxelSampler.w, VoxelSampler.h, VoxelSampler.d);
+    BlockCount = vec3(OpacityBlockSampler->blockCountX(),
+                      OpacityBlockSampler->blockCountY(),
+                      OpacityBlockSampler->blockCountZ());
+
+    InitVolumeUniforms(pVoxels, numSamples, computeLighting);
+
+    return true;
+}
+
+bool rc::RayCasterShaderCodeTester::loadPagedVolume(vox::VolumeDataSet* pVoxels,
+                                                    size_t maxPoolBytes,
+                                                    size_t numSamples,
+                                                    bool computeLighting)
+{
+    OpacityBlockSampler = NULL;
+    VoxelSampler = sampler3D();
+    PageTableSampler = usampler3D();
+    Paged = false;
+
+    s_spBrickPool = rc::BrickPool::Create(pVoxels, RayCastRenderer::GetDefaultColorLUT(), maxPoolBytes);
+    s_spPagedVoxels = pVoxels;
+    if(!s_spBrickPool.valid())
+    {
+        s_spPagedVoxels = NULL;
+        return false;
+    }
+
+    //the pool starts out empty like the texture that BrickPool::uploadTextures creates
+    VoxelSampler.w = static_cast<int>(s_spBrickPool->slotCountX() * rc::BrickPool::k_StoredBrickDim);
+    VoxelSampler.h = static_cast<int>(s_spBrickPool->slotCountY() * rc::BrickPool::k_StoredBrickDim);
+    VoxelSampler.d = static_cast<int>(s_spBrickPool->slotCountZ() * rc::BrickPool::k_StoredBrickDim);
+    VoxelSampler.data.resize(static_cast<size_t>(VoxelSampler.w) * VoxelSampler.h * VoxelSampler.d);
+
+    PageTableSampler.w = static_cast<int>(s_spBrickPool->brickCountX());
+    PageTableSampler.h = static_cast<int>(s_spBrickPool->brickCountY());
+    PageTableSampler.d = static_cast<int>(s_spBrickPool->brickCountZ());
+    PageTableSampler.data.assign(s_spBrickPool->getPageTable(),
+                                 s_spBrickPool->getPageTable() + (static_cast<size_t>(PageTableSampler.w) *
+                                                                  PageTableSampler.h *
+                                                                  PageTableSampler.d));
+
+    Paged = true;
+    VolumeDimension = vec3(pVoxels->dimX(), pVoxels->dimY(), pVoxels->dimZ());
+    BlockCount = vec3(1.0f);
+    PageTableDimension = vec3(PageTableSampler.w, PageTableSampler.h, PageTableSampler.d);
+    BrickPoolDimension = vec3(VoxelSampler.w, VoxelSampler.h, VoxelSampler.d);
+
+    InitVolumeUniforms(pVoxels, numSamples, computeLighting);
+
+    return true;
+}
+
+//copies what BrickPool::update read into the pool and page table samplers,
+//like BrickPool::uploadTextures does into the textures
+static void UploadBricks(rc::BrickPool& brickPool)
+{
+    const size_t storedDim = rc::BrickPool::k_StoredBrickDim;
+    const rc::BrickPool::BrickUploads& uploads = brickPool.getBrickUploads();
+    for(size_t i = 0; i < uploads.size(); ++i)
+    {
+        const rc::BrickPool::BrickUpload& upload = uploads[i];
+        for(size_t z = 0; z < storedDim; ++z)
+        {
+            for(size_t y = 0; y < storedDim; ++y)
+            {
+                size_t row = (((upload.slotZ * storedDim) + z) * VoxelSampler.h) + (upload.slotY * storedDim) + y;
+                size_t dest = (row * VoxelSampler.w) + (upload.slotX * storedDim);
+                std::copy(upload.colors.begin() + (((z * storedDim) + y) * storedDim),
+                          upload.colors.begin() + (((z * storedDim) + y + 1) * storedDim),
+                          VoxelSampler.data.begin() + dest);
+            }
+        }
+    }
+    brickPool.clearBrickUploads();
+
+    std::copy(brickPool.getPageTable(),
+              brickPool.getPageTable() + PageTableSampler.data.size(),
+              PageTableSampler.data.begin());
+}
+
+bool rc::RayCasterShaderCodeTester::renderFrame(const vox::Camera& camera,
+                                                unsigned char* pRGBA)
+{
+    if(VoxelSampler.data.empty())
+    {
+        std::cerr << "ERROR: A volume must be loaded before rendering a frame." << std::endl;
+        return false;
+    }
+
+    int width, height;
+    camera.getViewportWidthHeight(width, height);
+    if(width <= 0 || height <= 0)
+        return false;
+
+    ProjectionMatrix = ToMat4(camera.getProjectionMatrixPtr());
+    mat4 modelViewMatrix = ToMat4(camera.getViewMatrixPtr());
+    InverseModelViewMatrix = inverse(modelViewMatrix);
+
+    QVector3D position = camera.getPosition();
+    CameraPosition = WorldToVolume(vec3(position.x(), position.y(), position.z()));
+    SkipEmptyBlocks = s_emptySpaceSkipping && OpacityBlockSampler.get() != NULL;
+
+    //like RayCastRenderer::draw, the bricks that the last frame asked for are
+    //read before this one is rendered
+    std::vector<unsigned short> brickRequests;
+    if(s_spBrickPool.valid())
+    {
+        s_spBrickPool->update(camera);
+        UploadBricks(*s_spBrickPool);
+        brickRequests.resize(static_cast<size_t>(width) * height * 4);
+    }
+
+    mat4 invViewProjMtx = inverse(ProjectionMatrix * modelViewMatrix);
+    vox::ScreenRays rays(&invViewProjMtx[0][0],
+                         width, height,
+                         &VolTranslation[0], &VolScale[0],
+                         &VolExtentMin[0], &VolExtentMax[0]);
+
+    RenderTilesTask task(rays,
+                         width, height,
+                         pRGBA,
+                         brickRequests.empty() ? NULL : &brickRequests[0]);
+
+    vox::SlabThreads::Run(task, vox::SlabThreads::GetThreadCount());
+
+    if(s_spBrickPool.valid())
+        s_spBrickPool->requestBricks(&brickRequests[0], static_cast<size_t>(width) * height);
+
+    return true;
+}
+
+bool rc::RayCasterShaderCodeTester::comparePagedFrame(vox::VolumeDataSet* pVoxels,
+                                                      size_t maxPoolBytes,
+                                                      const vox::Camera& camera)
+{
+    //enough for a pool that holds every brick in view to fill in
+    const int k_MaxPagedFrames = 64;
+    //bricks are classified on their own, which can round a channel differently
+    const int k_ChannelTolerance = 2;
+
+    int width, height;
+    camera.getViewportWidthHeight(width, height);
+    size_t byteCount = static_cast<size_t>(width) * height * 4;
+    std::vector<unsigned char> rgba(byteCount);
+    std::vector<unsigned char> pagedRGBA(byteCount);
+
+    if(!loadVolume(pVoxels) || !renderFrame(camera, &rgba[0]))
+        return false;
+
+    if(!loadPagedVolume(pVoxels, maxPoolBytes))
+    {
+        loadVolume(pVoxels);
+        return false;
+    }
+
+    int frameCount = 0;
+    bool settled = false;
+    while(!settled && frameCount < k_MaxPagedFrames)
+    {
+        if(!renderFrame(camera, &pagedRGBA[0]))
+            break;
+        ++frameCount;
+        settled = s_spBrickPool->requestedBrickCount() == 0;
+    }
+
+    loadVolume(pVoxels);
+
+    if(!settled)
+    {
+        std::cerr << "ERROR: Paged frames still ask for bricks after " << frameCount
+                  << " frames." << std::endl;
+        return false;
+    }
+
+    int maxDifference = 0;
+    for(size_t i = 0; i < byteCount; ++i)
+        maxDifference = std::max(maxDifference, std::abs(static_cast<int>(pagedRGBA[i]) - static_cast<int>(rgba[i])));
+
+    if(maxDifference > k_ChannelTolerance)
+    {
+        std::cerr << "ERROR: The paged frame differs from the whole volume's by up to "
+                  << maxDifference << " after " << frameCount << " frames." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void rc::RayCasterShaderCodeTester::setEmptySpaceSkipping(bool flag)
+{
+    s_emptySpaceSkipping = flag;
+}
+
+bool rc::RayCasterShaderCodeTester::getEmptySpaceSkipping()
+{
+    return s_emptySpaceSkipping;
+}
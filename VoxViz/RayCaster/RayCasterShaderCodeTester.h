@@ -2,6 +2,8 @@
 #define RAY_CASTER_SHADER_CODE_TESTER_H
 
 #include "VoxVizOpenGL/GLShaderProgramManager.h"
+#include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/Camera.h"
 
 namespace rc
 {
@@ -9,6 +11,41 @@ namespace rc
     {
     public:
         static void drawNearPlane(voxOpenGL::ShaderProgram* pNearPlaneProg);
+
+        //copies the colors of pVoxels, or classifies its voxels, the way
+        //RayCastRenderer::init does so that frames can be rendered on the CPU.
+        //A numSamples of 0 takes the renderer's default for the volume.
+        static bool loadVolume(const vox::VolumeDataSet* pVoxels,
+                               size_t numSamples=0,
+                               bool computeLighting=true);
+
+        //pages the bricks of pVoxels through a pool of at most maxPoolBytes like
+        //RayCastRenderer does for volumes that need it, see rc::BrickPool
+        static bool loadPagedVolume(vox::VolumeDataSet* pVoxels,
+                                    size_t maxPoolBytes,
+                                    size_t numSamples=0,
+                                    bool computeLighting=true);
+
+        //ray casts the loaded volume from camera like RayCaster.frag, in screen
+        //tiles spread over all cores. pRGBA receives the viewport's width*height
+        //premultiplied RGBA pixels, bottom row first like glReadPixels. Only
+        //one frame can be rendered at a time. Paged volumes read the bricks the
+        //previous frame stopped at first, so the frames fill in as they repeat.
+        static bool renderFrame(const vox::Camera& camera,
+                                unsigned char* pRGBA);
+
+        //renders camera's frame of pVoxels paged through a pool of maxPoolBytes
+        //until the frame needs no more bricks and compares it against the frame
+        //of the whole volume. Returns false if paging doesn't settle or the
+        //frames differ. pVoxels is left loaded without paging.
+        static bool comparePagedFrame(vox::VolumeDataSet* pVoxels,
+                                      size_t maxPoolBytes,
+                                      const vox::Camera& camera);
+
+        //steps rays over blocks of transparent black voxels instead of sampling
+        //them, the frames are the same either way. On by default.
+        static void setEmptySpaceSkipping(bool flag);
+        static bool getEmptySpaceSkipping();
     };
 }
 
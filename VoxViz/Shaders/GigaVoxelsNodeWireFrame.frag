@@ -25,6 +25,7 @@ uniform int MaxTreeTraversals;//max number of tree traversals allowed per ray
 uniform int MaxNodesToPushThisFrame;//max number of nodes to push onto the node usage list this frame
 uniform bool RootNodeIsConstant;
 uniform bool GradientsAreUnsigned;//gradients are mapped to 0 to 1 and need to be mapped back to -1 to 1
+uniform bool GradientsAreOctEncoded;//gradients are octahedral encoded in rg (see vox::OctNormal)
 uniform bool ShowConstantNodes;
 uniform bool ComputeLighting;
 uniform float LodScalar;
@@ -311,8 +312,30 @@ vec3 shading(vec3 rgb, vec3 normal, vec3 toCamera, vec3 toLight)
     return ambient + diffuse + specular;
 }
 
+vec3 DecodeOctNormal(vec2 octNormal)
+{
+    //(0, 0) is reserved for voxels without a gradient
+    if(octNormal.x == 0.0f && octNormal.y == 0.0f)
+        return vec3(0.0f);
+
+    octNormal = (octNormal * 2.0f) - 1.0f;
+
+    vec3 normal = vec3(octNormal.xy, 1.0f - abs(octNormal.x) - abs(octNormal.y));
+    if(normal.z < 0.0f)
+    {
+        vec2 octSign = vec2(octNormal.x >= 0.0f ? 1.0f : -1.0f,
+                            octNormal.y >= 0.0f ? 1.0f : -1.0f);
+        normal.xy = (1.0f - abs(octNormal.yx)) * octSign;
+    }
+
+    return normalize(normal);
+}
+
 vec3 LookupGradient(vec3 curBrickRayPos)
 {
+    if(GradientsAreOctEncoded)
+        return DecodeOctNormal(texture(BrickGradientsSampler, curBrickRayPos).rg);
+
     vec3 normal = texture(BrickGradientsSampler, curBrickRayPos).rgb;
     
     if(GradientsAreUnsigned)
@@ -11,6 +11,25 @@ uniform vec3 LightPosition;
 uniform vec3 VolExtentMin;
 uniform vec3 VolExtentMax;
 uniform bool ComputeLighting;
+//largest channel of VoxelSampler's colors over blocks of k_BlockDim voxels,
+//see vox::OpacityBlocks
+uniform sampler3D OpacityBlockSampler;
+uniform bool SkipEmptyBlocks;
+uniform vec3 VolumeDimension;
+uniform vec3 BlockCount;
+//bricks of volumes too large for one texture are paged into VoxelSampler,
+//PageTableSampler has an entry per brick, see rc::BrickPool
+uniform bool Paged;
+uniform usampler3D PageTableSampler;
+uniform vec3 PageTableDimension;
+uniform vec3 BrickPoolDimension;
+
+const float k_BlockDim = 8.0;
+const float k_BrickDim = 32.0;
+const float k_BrickBorder = 2.0;
+const float k_StoredBrickDim = k_BrickDim + (2.0 * k_BrickBorder);
+const uint k_PageEmpty = 1u;
+const uint k_PageResident = 2u;
 
 // lighting factors
 const vec3 k_Ambient = vec3(0.05, 0.05, 0.05);
@@ -39,9 +58,47 @@ vec3 shading(vec3 rgb, vec3 normal, vec3 toCamera, vec3 toLight)
     return ambient + diffuse + specular;
 }
 
+//returns how many steps the ray at texel, in block of blockDim texels, takes
+//to leave it. texelStep is the ray step in texels.
+float stepsToLeaveBlock(vec3 texel, vec3 block, vec3 blockCount, float blockDim, vec3 texelStep)
+{
+    //the border is transparent black too, so the outer blocks reach past it
+    float exitStep = ceil(sqrt(3.0) / RayStepSize) + 1.0;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(texelStep[i] > 0.0 && block[i] < blockCount[i] - 1.0)
+            exitStep = min(exitStep, (((block[i] + 1.0) * blockDim) - texel[i]) / texelStep[i]);
+        else if(texelStep[i] < 0.0 && block[i] > 0.0)
+            exitStep = min(exitStep, ((block[i] * blockDim) - texel[i]) / texelStep[i]);
+    }
+
+    //the steps before the exit are all in the block, rounding down keeps the
+    //first one after it from being skipped by a rounding error
+    return max(floor(exitStep), 1.0);
+}
+
+//returns how many steps the ray at rayPosition can take before it can sample
+//anything but transparent black, or 0 if the sample at rayPosition may not be.
+//A sample is in the block of the lowest of the texels it filters.
+float emptyStepCount(vec3 rayPosition, vec3 rayStep)
+{
+    if(!SkipEmptyBlocks)
+        return 0.0;
+
+    vec3 texel = (rayPosition * VolumeDimension) - 0.5;
+    vec3 block = clamp(floor(texel / k_BlockDim), vec3(0.0), BlockCount - 1.0);
+
+    if(texelFetch(OpacityBlockSampler, ivec3(block), 0).r > 0.0)
+        return 0.0;
+
+    return stepsToLeaveBlock(texel, block, BlockCount, k_BlockDim, rayStep * VolumeDimension);
+}
+
 in vec4 RayPosition;
 layout(pixel_center_integer) in ivec4 gl_FragCoord;
 out vec4 FragColor;
+//brick that stopped the ray because it is not in the pool yet, alpha is 0 if none
+out uvec4 BrickRequest;
 
 void main()
 {
@@ -49,6 +106,7 @@ void main()
     vec4 src;
     
     vec4 dst = vec4(0.0, 0.0, 0.0, 0.0);
+    BrickRequest = uvec4(0u);
 
     vec3 rayPosition = RayPosition.xyz;
 
@@ -58,6 +116,10 @@ void main()
     
     ivec2 jitterTexCoord = ivec2(gl_FragCoord.xy % JitterTexSize);
     rayPosition += (rayStep * texelFetch(JitterTexSampler, jitterTexCoord, 0).r);
+    //samples are placed at whole steps from the start so skipping empty blocks
+    //leaves the others where they were
+    vec3 rayStart = rayPosition;
+    float stepCount = 0.0;
  
     vec3 nextPosition = rayPosition + rayStep;
     vec3 test1 = sign(nextPosition - VolExtentMin);
@@ -66,8 +128,46 @@ void main()
 
     while(inside >= 3.0)
     {
+        float skipCount = emptyStepCount(rayPosition, rayStep);
+        vec3 samplePosition = rayPosition;
+        if(Paged && skipCount == 0.0)
+        {
+            vec3 texel = (rayPosition * VolumeDimension) - 0.5;
+            vec3 brick = clamp(floor(texel / k_BrickDim), vec3(0.0), PageTableDimension - 1.0);
+            uvec4 page = texelFetch(PageTableSampler, ivec3(brick), 0);
+
+            if(page.a == k_PageEmpty)
+            {
+                skipCount = stepsToLeaveBlock(texel, brick, PageTableDimension, k_BrickDim,
+                                              rayStep * VolumeDimension);
+            }
+            else if(page.a != k_PageResident)
+            {
+                BrickRequest = uvec4(uvec3(brick), 1u);
+                break;
+            }
+            else
+            {
+                //the brick's voxels start after the border of its slot
+                vec3 poolTexel = (vec3(page.xyz) * k_StoredBrickDim) + k_BrickBorder
+                               + (texel - (brick * k_BrickDim));
+                samplePosition = (poolTexel + 0.5) / BrickPoolDimension;
+            }
+        }
+
+        if(skipCount > 0.0)
+        {
+            stepCount += skipCount;
+            rayPosition = rayStart + (rayStep * stepCount);
+
+            test1 = sign(rayPosition - VolExtentMin);
+            test2 = sign(VolExtentMax - rayPosition);
+            inside = dot(test1, test2);
+            continue;
+        }
+
         //voxel = texture(VoxelSampler, rayPosition).r;
-        src = texture(VoxelSampler, rayPosition);
+        src = texture(VoxelSampler, samplePosition);
         
 		if(ComputeLighting)
 		{
@@ -77,22 +177,22 @@ void main()
 
 			const ivec4 offset = ivec4(1, 0, 0, -1);
 			sample1.x = textureOffset(VoxelSampler, 
-									  rayPosition,
+									  samplePosition,
 									  offset.xyz).a;
 			sample2.x = textureOffset(VoxelSampler, 
-									  rayPosition,
+									  samplePosition,
 									  offset.wyz).a;
 			sample1.y = textureOffset(VoxelSampler, 
-									  rayPosition,
+									  samplePosition,
 									  offset.yxz).a;
 			sample2.y = textureOffset(VoxelSampler, 
-									  rayPosition,
+									  samplePosition,
 									  offset.ywz).a;
 			sample1.z = textureOffset(VoxelSampler, 
-									  rayPosition,
+									  samplePosition,
 									  offset.yzx).a;
 			sample2.z = textureOffset(VoxelSampler, 
-									  rayPosition,
+									  samplePosition,
 									  offset.yzw).a;
 
 			vec3 normal = normalize(sample2 - sample1);
@@ -109,7 +209,8 @@ void main()
         if(dst.a > 0.95)
             break;
 
-        rayPosition += rayStep;
+        stepCount += 1.0;
+        rayPosition = rayStart + (rayStep * stepCount);
         
         test1 = sign(rayPosition - VolExtentMin);
         test2 = sign(VolExtentMax - rayPosition);
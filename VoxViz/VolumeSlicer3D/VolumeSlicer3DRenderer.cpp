@@ -217,9 +217,9 @@ void VolumeSlicer3DRenderer::init(vox::Camera& camera,
                                                             false,
                                                             true,
                                                             false);
-        delete [] pVoxelColorsF;
+        //the colors may be mapped from a file so let the data set free them
         pVoxelColorsF = NULL;
-        pVoxels->setColors(pVoxelColorsF);
+        pVoxels->freeColors();
     }
     else if(pVoxels->subVolumeCount() > 0)
     {
@@ -305,9 +305,11 @@ void VolumeSlicer3DRenderer::init(vox::Camera& camera,
                                                             false,
                                                             true,
                                                             false);
-        delete [] pVoxelColors;
+        if(pVoxelColors == pVoxels->getColorsUB())
+            pVoxels->freeColors();
+        else
+            delete [] pVoxelColors;
         pVoxelColors = NULL;
-        pVoxels->setColors(pVoxelColors);
     }//textureIDs[1] = voxOpenGL::GLUtils::Create1DTexture(colorLUT, static_cast<int>(sizeof(colorLUT) / (sizeof(unsigned char) * 4.0f)));
 
     //create the slice plane geometry
@@ -1,5 +1,8 @@
 #include "VoxVizCore/DataSetReader.h"
 #include "VoxVizCore/PVMReader.h"
+#include "VoxVizCore/VoxelBinaryFile.h"
+#include "VoxVizCore/SlabThreads.h"
+#include "VoxVizCore/MappedFile.h"
 #include "VoxVizCore/SmartPtr.h"
 
 #include <QtCore/QFileInfo>
@@ -8,9 +11,135 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 
 using namespace vox;
 
+namespace
+{
+    struct SubImageFile
+    {
+        unsigned int rangeStartX, rangeStartY, rangeStartZ;
+        unsigned int rangeEndX, rangeEndY, rangeEndZ;
+        std::string path;
+    };
+
+    //reads VOXEL_SUB_IMAGE_FILE entries, one file per thread at a time
+    class ReadSubImagesSlabTask : public SlabTask
+    {
+    private:
+        const std::vector<SubImageFile>& m_subImageFiles;
+        VolumeDataSet::SubVolume::Format m_format;
+        VolumeDataSet* m_pData;
+        std::vector<VolumeDataSet::SubVolume>& m_subVolumes;
+        std::vector<char>& m_subImageRead;
+    public:
+        ReadSubImagesSlabTask(const std::vector<SubImageFile>& subImageFiles,
+                              VolumeDataSet::SubVolume::Format format,
+                              VolumeDataSet* pData,
+                              std::vector<VolumeDataSet::SubVolume>& subVolumes,
+                              std::vector<char>& subImageRead) :
+            m_subImageFiles(subImageFiles),
+            m_format(format),
+            m_pData(pData),
+            m_subVolumes(subVolumes),
+            m_subImageRead(subImageRead)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            for(size_t i = start; i < end; ++i)
+                m_subImageRead[i] = readSubImage(i) ? 1 : 0;
+        }
+    private:
+        bool readSubImage(size_t index);
+        bool readScalarsInPlace(std::ifstream& binaryInputStream, const SubImageFile& subImageFile);
+    };
+}
+
+bool ReadSubImagesSlabTask::readSubImage(size_t index)
+{
+    const SubImageFile& subImageFile = m_subImageFiles[index];
+    if(subImageFile.rangeEndX > m_pData->dimX() ||
+       subImageFile.rangeEndY > m_pData->dimY() ||
+       subImageFile.rangeEndZ > m_pData->dimZ() ||
+       subImageFile.rangeStartX > subImageFile.rangeEndX ||
+       subImageFile.rangeStartY > subImageFile.rangeEndY ||
+       subImageFile.rangeStartZ > subImageFile.rangeEndZ)
+        return false;
+
+    std::ifstream binaryInputStream;
+    binaryInputStream.open(subImageFile.path.c_str(),
+                           std::ios_base::in |
+                           std::ios_base::binary);
+    if(binaryInputStream.is_open() == false)
+        return false;
+
+    bool formatIsUByte = m_format != VolumeDataSet::SubVolume::FORMAT_FLOAT_RGBA;
+    int ubyteFormat;
+    binaryInputStream.read((char*)&ubyteFormat, sizeof(int));
+    if((ubyteFormat == 0 && formatIsUByte) || (ubyteFormat != 0 && formatIsUByte == false))
+        return false;
+
+    if(m_format == VolumeDataSet::SubVolume::FORMAT_UBYTE_SCALARS)
+        return readScalarsInPlace(binaryInputStream, subImageFile);
+
+    VolumeDataSet::SubVolume subVolume(subImageFile.rangeStartX, 
+                                       subImageFile.rangeStartY, 
+                                       subImageFile.rangeStartZ,
+                                       subImageFile.rangeEndX, 
+                                       subImageFile.rangeEndY, 
+                                       subImageFile.rangeEndZ,
+                                       m_format);
+    unsigned int dataSize;
+    binaryInputStream.read((char*)&dataSize, sizeof(unsigned int));
+    if(dataSize != subVolume.dataSize())
+        return false;
+    binaryInputStream.read((char*)subVolume.data(),
+                           subVolume.dataSize());
+    if(binaryInputStream.fail())
+        return false;
+
+    m_subVolumes[index] = subVolume;
+    return true;
+}
+
+bool ReadSubImagesSlabTask::readScalarsInPlace(std::ifstream& binaryInputStream, 
+                                               const SubImageFile& subImageFile)
+{
+    size_t xSize = subImageFile.rangeEndX - subImageFile.rangeStartX;
+    size_t ySize = subImageFile.rangeEndY - subImageFile.rangeStartY;
+    size_t zSize = subImageFile.rangeEndZ - subImageFile.rangeStartZ;
+
+    unsigned int dataSize;
+    binaryInputStream.read((char*)&dataSize, sizeof(unsigned int));
+    if(dataSize != xSize * ySize * zSize * sizeof(VolumeDataSet::Voxels))
+        return false;
+
+    size_t dimX = m_pData->dimX();
+    size_t dimY = m_pData->dimY();
+    VolumeDataSet::Voxels* pVoxels = m_pData->getData();
+
+    //sub-images that span whole rows are contiguous over each slice
+    bool readSlices = xSize == dimX;
+    for(size_t z = 0; z < zSize; ++z)
+    {
+        size_t rangeZ = subImageFile.rangeStartZ + z;
+        for(size_t y = 0; y < ySize; ++y)
+        {
+            size_t rangeY = subImageFile.rangeStartY + y;
+            size_t writeIndex = (rangeZ * dimY * dimX) + (rangeY * dimX) + subImageFile.rangeStartX;
+            size_t readSize = readSlices ? xSize * ySize : xSize;
+            binaryInputStream.read((char*)&pVoxels[writeIndex], readSize * sizeof(VolumeDataSet::Voxels));
+            if(readSlices)
+                break;
+        }
+    }
+
+    return !binaryInputStream.fail();
+}
+
 static const char * const PATH_SEPARATORS = "/\\";
 static unsigned int PATH_SEPARATORS_LEN = 2;
 
@@ -34,6 +163,44 @@ std::string DataSetReader::GetFileExtension(const std::string& fileName)
     return std::string(fileName.begin()+dot+1, fileName.end());
 }
 
+VoxelChunkFile* DataSetReader::getChunkFile(const std::string& inputFile)
+{
+    ChunkFileMap::iterator itr = m_chunkFiles.find(inputFile);
+    if(itr != m_chunkFiles.end())
+        return itr->second.get();
+
+    VoxelChunkFile* pChunkFile = VoxelChunkFile::Open(inputFile);
+    if(pChunkFile != NULL)
+        m_chunkFiles[inputFile] = pChunkFile;
+    return pChunkFile;
+}
+
+VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile,
+                                                 size_t startX, size_t startY, size_t startZ,
+                                                 size_t endX, size_t endY, size_t endZ)
+{
+    if(GetFileExtension(inputFile) != "voxc")
+        return readVolumeDataFile(inputFile);
+
+    VoxelChunkFile* pChunkFile = getChunkFile(inputFile);
+    if(pChunkFile == NULL)
+        return NULL;
+
+    return pChunkFile->readSubVolume(startX, startY, startZ, endX, endY, endZ);
+}
+
+VolumeDataSet* DataSetReader::readVolumeDataHeader(const std::string& inputFile)
+{
+    if(GetFileExtension(inputFile) != "voxc")
+        return readVolumeDataFile(inputFile);
+
+    VoxelChunkFile* pChunkFile = getChunkFile(inputFile);
+    if(pChunkFile == NULL)
+        return NULL;
+
+    return pChunkFile->readHeader();
+}
+
 VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
 {
     std::string ext = GetFileExtension(inputFile);
@@ -45,8 +212,18 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
     {
         return new VolumeDataSet(inputFile);
     }
+    else if(ext == "voxc")
+    {
+        VoxelChunkFile* pChunkFile = getChunkFile(inputFile);
+        return pChunkFile != NULL ? pChunkFile->readVolume() : NULL;
+    }
     else
     {
+        //parsing the text is slow, use the binary companion file if it is up to date
+        VolumeDataSet* pBinaryData = VoxelBinaryFile::Read(inputFile);
+        if(pBinaryData != NULL)
+            return pBinaryData;
+
         std::ifstream inputStream;
 
         inputStream.open(inputFile.c_str());
@@ -129,6 +306,7 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
                                                            pos, orient, 
                                                            scale, scale, scale,
                                                            dimX, dimY, dimZ);
+        bool parsedTextVoxels = false;
         inputStream >> text;
         if(text == "VOXEL_SCALARS")
         {
@@ -152,6 +330,7 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
                     }
                 }
             }
+            parsedTextVoxels = true;
         }
         else
         {
@@ -160,6 +339,18 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
             {
                 std::string extBinaryFile = inputFile + ".voxb";
                 //inputStream >> extBinaryFile;
+
+                //the file is a plain Vec4f array so map it rather than reading it
+                SmartPtr<MappedFile> spMappedFile = MappedFile::Map(extBinaryFile, 
+                                                                    0, 
+                                                                    sizeof(Vec4f) * voxelCount);
+                if(spMappedFile.valid())
+                {
+                    spData->setMappedFile(spMappedFile.get());
+                    spData->setColors(static_cast<Vec4f*>(spMappedFile->data()));
+                    return spData.release();
+                }
+
                 std::ifstream binaryInputStream;
                 binaryInputStream.open(extBinaryFile,
                                        std::ios_base::in |
@@ -177,22 +368,22 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
 
 				QDir baseDir = fileInfo.dir();
 
+                std::vector<SubImageFile> subImageFiles;
                 while(inputStream.eof() != true)
                 {
                     std::string subImageText;
                     inputStream >> subImageText;
                     if(subImageText != "VOXEL_SUB_IMAGE_FILE")
                         break;
-                    unsigned int rangeStartX, rangeStartY, rangeStartZ;
-                    inputStream >> rangeStartX;
-                    inputStream >> rangeStartY;
-                    inputStream >> rangeStartZ;
+                    SubImageFile subImageFile;
+                    inputStream >> subImageFile.rangeStartX;
+                    inputStream >> subImageFile.rangeStartY;
+                    inputStream >> subImageFile.rangeStartZ;
                     if(inputStream.fail())
                         return NULL;
-                    unsigned int rangeEndX, rangeEndY, rangeEndZ;
-                    inputStream >> rangeEndX;
-                    inputStream >> rangeEndY;
-                    inputStream >> rangeEndZ;
+                    inputStream >> subImageFile.rangeEndX;
+                    inputStream >> subImageFile.rangeEndY;
+                    inputStream >> subImageFile.rangeEndZ;
                     if(inputStream.fail())
                         return NULL;
                     //skip the space character
@@ -206,41 +397,47 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
 					extBinaryFilePath << baseDir.absolutePath().toAscii().data()
 									  << "/"
 									  << extBinaryFile.str();
+                    subImageFile.path = extBinaryFilePath.str();
 
                     std::cout << "Loading sub-image: " 
-							  << extBinaryFilePath.str() << std::endl;
-					
-                    std::ifstream binaryInputStream;
-                    binaryInputStream.open(extBinaryFilePath.str(),
-                                       std::ios_base::in |
-                                       std::ios_base::binary);
-                    if(binaryInputStream.is_open() == false)
-                        return NULL;
+							  << subImageFile.path << std::endl;
+
+                    subImageFiles.push_back(subImageFile);
+                }
+
+                VolumeDataSet::SubVolume::Format format = VolumeDataSet::SubVolume::FORMAT_UBYTE_RGBA;
+                if(formatIsUByte == true)
+                {
+                    if(typeIsScalars == true)
+                        format = VolumeDataSet::SubVolume::FORMAT_UBYTE_SCALARS;
+                }
+                else
+                    format = VolumeDataSet::SubVolume::FORMAT_FLOAT_RGBA;
+
+                //scalar sub-images are read straight into the final voxel array,
+                //color sub-images are kept as sub volumes for the renderers to upload
+                if(format == VolumeDataSet::SubVolume::FORMAT_UBYTE_SCALARS)
+                    spData->initVoxels();
 
-                    VolumeDataSet::SubVolume::Format format = VolumeDataSet::SubVolume::FORMAT_UBYTE_RGBA;
-                    if(formatIsUByte == true)
+                std::vector<VolumeDataSet::SubVolume> subVolumes(subImageFiles.size());
+                std::vector<char> subImageRead(subImageFiles.size(), 0);
+                ReadSubImagesSlabTask task(subImageFiles,
+                                           format,
+                                           spData.get(),
+                                           subVolumes,
+                                           subImageRead);
+                SlabThreads::Run(task, subImageFiles.size());
+
+                for(size_t i = 0; i < subImageFiles.size(); ++i)
+                {
+                    if(!subImageRead[i])
                     {
-                        if(typeIsScalars == true)
-                            format = VolumeDataSet::SubVolume::FORMAT_UBYTE_SCALARS;
-                    }
-                    else
-                        format = VolumeDataSet::SubVolume::FORMAT_FLOAT_RGBA;
-
-                    VolumeDataSet::SubVolume subVolume(rangeStartX, rangeStartY, rangeStartZ,
-                                                       rangeEndX, rangeEndY, rangeEndZ,
-                                                       format);
-                    int ubyteFormat;
-                    binaryInputStream.read((char*)&ubyteFormat, sizeof(int));
-                    if((ubyteFormat == 0 && formatIsUByte) || (ubyteFormat != 0 && formatIsUByte == false))
-                        return NULL;
-                    
-                    unsigned int dataSize;
-                    binaryInputStream.read((char*)&dataSize, sizeof(unsigned int));
-                    if(dataSize != subVolume.dataSize())
+                        std::cerr << "ERROR: failed to read sub-image " 
+                                  << subImageFiles[i].path << std::endl;
                         return NULL;
-                    binaryInputStream.read((char*)subVolume.data(),
-                                           subVolume.dataSize());
-                    spData->addSubVolume(subVolume);
+                    }
+                    if(format != VolumeDataSet::SubVolume::FORMAT_UBYTE_SCALARS)
+                        spData->addSubVolume(subVolumes[i]);
                 }
             }
             else
@@ -267,9 +464,13 @@ VolumeDataSet* DataSetReader::readVolumeDataFile(const std::string& inputFile)
                         }
                     }
                 }
+                parsedTextVoxels = true;
             }
         }
 
+        if(parsedTextVoxels)
+            VoxelBinaryFile::Write(spData.get(), inputFile);
+
         return spData.release();
     }
 }
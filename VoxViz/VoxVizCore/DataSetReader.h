@@ -2,6 +2,10 @@
 #define VOX_DATASET_READER_H
 
 #include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+#include "VoxVizCore/SmartPtr.h"
+
+#include <map>
 
 namespace vox
 {
@@ -9,10 +13,23 @@ namespace vox
     {
     public:
         VolumeDataSet* readVolumeDataFile(const std::string& inputFile);
+        //reads the voxels in [start, end) of a chunk file (.voxc), only the chunks
+        //that intersect the box are decompressed. Other formats are read in full.
+        VolumeDataSet* readVolumeDataFile(const std::string& inputFile,
+                                          size_t startX, size_t startY, size_t startZ,
+                                          size_t endX, size_t endY, size_t endZ);
+        //a chunk file (.voxc) without its voxels for renderers that stream the
+        //chunks, see VoxelChunkFile::readHeader. Other formats are read in full.
+        VolumeDataSet* readVolumeDataHeader(const std::string& inputFile);
 
         static std::string GetFileExtension(const std::string& fileName);
         static std::string GetFilePath(const std::string& fileName);
+    private:
+        //chunk files stay open so their chunk caches are reused between reads
+        typedef std::map<std::string, SmartPtr<VoxelChunkFile> > ChunkFileMap;
+        ChunkFileMap m_chunkFiles;
 
+        VoxelChunkFile* getChunkFile(const std::string& inputFile);
     };
 }
 
@@ -0,0 +1,73 @@
+#include "VoxVizCore/DiskCache.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+
+#ifdef _WIN32
+#include <sys/types.h>
+#include <sys/utime.h>
+#define utime _utime
+#else
+#include <utime.h>
+#endif
+
+#include <iostream>
+
+using namespace vox;
+
+bool DiskCache::GetFileStamp(const std::string& filename,
+                             unsigned long long& size,
+                             unsigned long long& modified)
+{
+    QFileInfo fileInfo(QString(filename.c_str()));
+    if(!fileInfo.exists())
+        return false;
+
+    size = static_cast<unsigned long long>(fileInfo.size());
+    modified = static_cast<unsigned long long>(fileInfo.lastModified().toTime_t());
+    return true;
+}
+
+void DiskCache::Touch(const std::string& cacheFile)
+{
+    //NULL sets the access and modification times to now
+    utime(cacheFile.c_str(), NULL);
+}
+
+void DiskCache::Trim(const std::string& cacheFile, unsigned long long maxBytes)
+{
+    QFileInfo cacheFileInfo(QString(cacheFile.c_str()));
+    QDir cacheDir = cacheFileInfo.absoluteDir();
+
+    //most recently used first
+    QFileInfoList entries = cacheDir.entryInfoList(QStringList() << ("*." + cacheFileInfo.suffix()),
+                                                   QDir::Files,
+                                                   QDir::Time);
+
+    //once an entry does not fit all older ones are removed too
+    unsigned long long usedBytes = static_cast<unsigned long long>(cacheFileInfo.size());
+    bool full = false;
+    for(int i = 0; i < entries.size(); ++i)
+    {
+        const QFileInfo& entry = entries[i];
+        if(entry.absoluteFilePath() == cacheFileInfo.absoluteFilePath())
+            continue;
+
+        unsigned long long entryBytes = static_cast<unsigned long long>(entry.size());
+        if(!full && usedBytes + entryBytes <= maxBytes)
+        {
+            usedBytes += entryBytes;
+            continue;
+        }
+
+        full = true;
+        if(QFile::remove(entry.absoluteFilePath()))
+        {
+            std::cout << "Evicted cache entry "
+                      << entry.absoluteFilePath().toAscii().data() << std::endl;
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef VOX_DISK_CACHE_H
+#define VOX_DISK_CACHE_H
+
+#include <string>
+
+namespace vox
+{
+    //helpers for the on disk caches that keep their entries in a directory next
+    //to the input file (see GigaVoxelsOctTreeCache and IsosurfaceCache). Entries
+    //are keyed by the input file's size and time stamp rather than its voxels and
+    //are evicted least recently used first, using an entry updates its time stamp.
+    class DiskCache
+    {
+    public:
+        //returns false if filename does not exist
+        static bool GetFileStamp(const std::string& filename,
+                                 unsigned long long& size,
+                                 unsigned long long& modified);
+
+        //marks cacheFile as just used so it is evicted last
+        static void Touch(const std::string& cacheFile);
+
+        //removes the least recently used files with cacheFile's suffix from its
+        //directory until the rest take maxBytes or less. cacheFile is always kept.
+        static void Trim(const std::string& cacheFile, unsigned long long maxBytes);
+    };
+}
+
+#endif
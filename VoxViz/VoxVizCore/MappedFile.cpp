@@ -0,0 +1,128 @@
+#include "VoxVizCore/MappedFile.h"
+
+//QFile::map only maps shared, a private mapping is needed so that writes
+//to the data sets' voxels do not fault on read only pages
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace vox;
+
+MappedFile::MappedFile() :
+    m_pData(NULL),
+    m_size(0),
+    m_pMapping(NULL),
+    m_mappingSize(0),
+    m_pFileHandle(NULL),
+    m_pMappingHandle(NULL)
+{
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if(m_pMapping != NULL)
+        UnmapViewOfFile(m_pMapping);
+    if(m_pMappingHandle != NULL)
+        CloseHandle(m_pMappingHandle);
+    if(m_pFileHandle != NULL)
+        CloseHandle(m_pFileHandle);
+#else
+    if(m_pMapping != NULL)
+        munmap(m_pMapping, m_mappingSize);
+#endif
+}
+
+MappedFile* MappedFile::Map(const std::string& filename, size_t offset, size_t size)
+{
+    if(size == 0)
+        return NULL;
+
+    MappedFile* pMappedFile = new MappedFile();
+
+#ifdef _WIN32
+    HANDLE hFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(hFile == INVALID_HANDLE_VALUE)
+    {
+        delete pMappedFile;
+        return NULL;
+    }
+    pMappedFile->m_pFileHandle = hFile;
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(hFile, &fileSize) ||
+       static_cast<unsigned long long>(fileSize.QuadPart) < static_cast<unsigned long long>(offset) + size)
+    {
+        delete pMappedFile;
+        return NULL;
+    }
+
+    //PAGE_WRITECOPY and FILE_MAP_COPY give copy on write pages
+    HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+    if(hMapping == NULL)
+    {
+        delete pMappedFile;
+        return NULL;
+    }
+    pMappedFile->m_pMappingHandle = hMapping;
+
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    size_t alignedOffset = offset - (offset % systemInfo.dwAllocationGranularity);
+    size_t mappingSize = (offset - alignedOffset) + size;
+    unsigned long long mappingOffset = alignedOffset;
+    void* pMapping = MapViewOfFile(hMapping, FILE_MAP_COPY,
+                                   static_cast<DWORD>(mappingOffset >> 32),
+                                   static_cast<DWORD>(mappingOffset & 0xFFFFFFFF),
+                                   mappingSize);
+    if(pMapping == NULL)
+    {
+        delete pMappedFile;
+        return NULL;
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        delete pMappedFile;
+        return NULL;
+    }
+
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0 ||
+       static_cast<unsigned long long>(fileStat.st_size) < static_cast<unsigned long long>(offset) + size)
+    {
+        close(fd);
+        delete pMappedFile;
+        return NULL;
+    }
+
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t alignedOffset = offset - (offset % pageSize);
+    size_t mappingSize = (offset - alignedOffset) + size;
+    //MAP_PRIVATE with PROT_WRITE gives copy on write pages, the mapping
+    //stays valid after the file is closed
+    void* pMapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                          fd, static_cast<off_t>(alignedOffset));
+    close(fd);
+    if(pMapping == MAP_FAILED)
+    {
+        delete pMappedFile;
+        return NULL;
+    }
+#endif
+
+    pMappedFile->m_pMapping = pMapping;
+    pMappedFile->m_mappingSize = mappingSize;
+    pMappedFile->m_pData = static_cast<unsigned char*>(pMapping) + (offset - alignedOffset);
+    pMappedFile->m_size = size;
+    return pMappedFile;
+}
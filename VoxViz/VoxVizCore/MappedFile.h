@@ -0,0 +1,47 @@
+#ifndef VOX_MAPPED_FILE_H
+#define VOX_MAPPED_FILE_H
+
+#include "VoxVizCore/Referenced.h"
+
+#include <string>
+
+namespace vox
+{
+    //copy on write memory mapping of part of a file. Pages are only read from
+    //disk when they are touched and are shared with other processes mapping
+    //the file until they are written to. Writes go to private copies of the
+    //pages and never reach the file.
+    class MappedFile : public Referenced
+    {
+    private:
+        unsigned char* m_pData;
+        size_t m_size;
+        //the mapping starts at a page boundary at or before the requested offset
+        void* m_pMapping;
+        size_t m_mappingSize;
+        //file and file mapping handles on Windows
+        void* m_pFileHandle;
+        void* m_pMappingHandle;
+
+        MappedFile();
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+    protected:
+        virtual ~MappedFile();
+    public:
+        //returns NULL if the file is too small or can not be mapped
+        static MappedFile* Map(const std::string& filename, size_t offset, size_t size);
+
+        const void* data() const { return m_pData; }
+        void* data() { return m_pData; }
+        size_t size() const { return m_size; }
+
+        bool contains(const void* pData) const
+        {
+            const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+            return pBytes >= m_pData && pBytes < m_pData + m_size;
+        }
+    };
+}
+
+#endif
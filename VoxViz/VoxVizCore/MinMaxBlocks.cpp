@@ -0,0 +1,174 @@
+#include "VoxVizCore/MinMaxBlocks.h"
+#include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/SlabThreads.h"
+#include "VoxVizCore/SmartPtr.h"
+
+#include <algorithm>
+
+using namespace vox;
+
+namespace
+{
+    //value ranges of the level 0 blocks of a range of block z layers
+    class BuildBlocksSlabTask : public SlabTask
+    {
+    private:
+        const VolumeDataSet& m_dataSet;
+        size_t m_blocksX;
+        size_t m_blocksY;
+        std::vector<MinMaxBlocks::Range>& m_ranges;
+    public:
+        BuildBlocksSlabTask(const VolumeDataSet& dataSet,
+                            size_t blocksX,
+                            size_t blocksY,
+                            std::vector<MinMaxBlocks::Range>& ranges) :
+            m_dataSet(dataSet),
+            m_blocksX(blocksX),
+            m_blocksY(blocksY),
+            m_ranges(ranges)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            const size_t blockDim = MinMaxBlocks::k_BlockDim;
+            for(size_t blockZ = start; blockZ < end; ++blockZ)
+            {
+                size_t z0 = blockZ * blockDim;
+                size_t z1 = std::min(z0 + blockDim, m_dataSet.dimZ() - 1);
+                for(size_t blockY = 0; blockY < m_blocksY; ++blockY)
+                {
+                    size_t y0 = blockY * blockDim;
+                    size_t y1 = std::min(y0 + blockDim, m_dataSet.dimY() - 1);
+                    for(size_t blockX = 0; blockX < m_blocksX; ++blockX)
+                    {
+                        size_t x0 = blockX * blockDim;
+                        size_t x1 = std::min(x0 + blockDim, m_dataSet.dimX() - 1);
+
+                        MinMaxBlocks::Range range;
+                        range.minValue = range.maxValue = m_dataSet.valueAsFloat(x0, y0, z0);
+                        for(size_t z = z0; z <= z1; ++z)
+                        {
+                            for(size_t y = y0; y <= y1; ++y)
+                            {
+                                for(size_t x = x0; x <= x1; ++x)
+                                {
+                                    float value = m_dataSet.valueAsFloat(x, y, z);
+                                    range.minValue = std::min(range.minValue, value);
+                                    range.maxValue = std::max(range.maxValue, value);
+                                }
+                            }
+                        }
+
+                        m_ranges[(((blockZ * m_blocksY) + blockY) * m_blocksX) + blockX] = range;
+                    }
+                }
+            }
+        }
+    };
+}
+
+static size_t BlockCount(size_t dim)
+{
+    //the last voxel only closes the cells of the block before it
+    size_t cellCount = dim > 1 ? dim - 1 : 1;
+    return (cellCount + MinMaxBlocks::k_BlockDim - 1) / MinMaxBlocks::k_BlockDim;
+}
+
+MinMaxBlocks* MinMaxBlocks::Build(const VolumeDataSet& dataSet)
+{
+    if(dataSet.getRawData() == NULL ||
+       dataSet.dimX() == 0 || dataSet.dimY() == 0 || dataSet.dimZ() == 0)
+        return NULL;
+
+    SmartPtr<MinMaxBlocks> spBlocks = new MinMaxBlocks();
+
+    Level level;
+    level.blocksX = BlockCount(dataSet.dimX());
+    level.blocksY = BlockCount(dataSet.dimY());
+    level.blocksZ = BlockCount(dataSet.dimZ());
+    level.ranges.resize(level.blocksX * level.blocksY * level.blocksZ);
+
+    BuildBlocksSlabTask task(dataSet, level.blocksX, level.blocksY, level.ranges);
+    SlabThreads::Run(task, level.blocksZ);
+
+    spBlocks->m_levels.push_back(level);
+
+    //merge 2x2x2 blocks until a single block covers the volume
+    while(level.blocksX > 1 || level.blocksY > 1 || level.blocksZ > 1)
+    {
+        const Level& fine = spBlocks->m_levels.back();
+        Level coarse;
+        coarse.blocksX = (fine.blocksX + 1) / 2;
+        coarse.blocksY = (fine.blocksY + 1) / 2;
+        coarse.blocksZ = (fine.blocksZ + 1) / 2;
+        coarse.ranges.resize(coarse.blocksX * coarse.blocksY * coarse.blocksZ);
+
+        for(size_t z = 0; z < coarse.blocksZ; ++z)
+        {
+            for(size_t y = 0; y < coarse.blocksY; ++y)
+            {
+                for(size_t x = 0; x < coarse.blocksX; ++x)
+                {
+                    Range range = fine.ranges[(((2 * z * fine.blocksY) + (2 * y)) * fine.blocksX) + (2 * x)];
+                    for(size_t fz = 2 * z; fz < std::min(2 * z + 2, fine.blocksZ); ++fz)
+                    {
+                        for(size_t fy = 2 * y; fy < std::min(2 * y + 2, fine.blocksY); ++fy)
+                        {
+                            for(size_t fx = 2 * x; fx < std::min(2 * x + 2, fine.blocksX); ++fx)
+                            {
+                                const Range& fineRange = fine.ranges[(((fz * fine.blocksY) + fy) * fine.blocksX) + fx];
+                                range.minValue = std::min(range.minValue, fineRange.minValue);
+                                range.maxValue = std::max(range.maxValue, fineRange.maxValue);
+                            }
+                        }
+                    }
+                    coarse.ranges[(((z * coarse.blocksY) + y) * coarse.blocksX) + x] = range;
+                }
+            }
+        }
+
+        spBlocks->m_levels.push_back(coarse);
+        level.blocksX = coarse.blocksX;
+        level.blocksY = coarse.blocksY;
+        level.blocksZ = coarse.blocksZ;
+    }
+
+    return spBlocks.release();
+}
+
+void MinMaxBlocks::findBlocks(float minValue, float maxValue,
+                              size_t level, size_t blockX, size_t blockY, size_t blockZ,
+                              std::vector<size_t>& blockIndices) const
+{
+    const Range& range = getRange(blockX, blockY, blockZ, level);
+    if(range.minValue > maxValue || range.maxValue <= minValue)
+        return;
+
+    if(level == 0)
+    {
+        blockIndices.push_back(blockIndex(blockX, blockY, blockZ));
+        return;
+    }
+
+    const Level& fine = m_levels[level - 1];
+    for(size_t z = 2 * blockZ; z < std::min(2 * blockZ + 2, fine.blocksZ); ++z)
+    {
+        for(size_t y = 2 * blockY; y < std::min(2 * blockY + 2, fine.blocksY); ++y)
+        {
+            for(size_t x = 2 * blockX; x < std::min(2 * blockX + 2, fine.blocksX); ++x)
+                findBlocks(minValue, maxValue, level - 1, x, y, z, blockIndices);
+        }
+    }
+}
+
+void MinMaxBlocks::findBlocks(float minValue, float maxValue, std::vector<size_t>& blockIndices) const
+{
+    blockIndices.clear();
+    if(m_levels.empty())
+        return;
+
+    findBlocks(minValue, maxValue, m_levels.size() - 1, 0, 0, 0, blockIndices);
+
+    std::sort(blockIndices.begin(), blockIndices.end());
+}
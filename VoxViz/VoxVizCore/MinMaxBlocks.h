@@ -0,0 +1,79 @@
+#ifndef VOX_MIN_MAX_BLOCKS_H
+#define VOX_MIN_MAX_BLOCKS_H
+
+#include "VoxVizCore/Referenced.h"
+
+#include <vector>
+
+namespace vox
+{
+    class VolumeDataSet;
+
+    //hierarchy of value ranges (valueAsFloat) over blocks of a volume. Block
+    //(x, y, z) of level 0 holds the range of voxels [x * k_BlockDim, (x + 1) * k_BlockDim]
+    //in each dimension, the far faces are included so the block covers every cell
+    //whose low corner is in it. Each higher level merges 2x2x2 blocks of the one below.
+    class MinMaxBlocks : public Referenced
+    {
+    public:
+        static const size_t k_BlockDim = 8;
+
+        struct Range
+        {
+            float minValue;
+            float maxValue;
+        };
+
+    private:
+        struct Level
+        {
+            size_t blocksX;
+            size_t blocksY;
+            size_t blocksZ;
+            std::vector<Range> ranges;
+        };
+
+        std::vector<Level> m_levels;
+
+        MinMaxBlocks() {}
+        MinMaxBlocks(const MinMaxBlocks&);
+        MinMaxBlocks& operator=(const MinMaxBlocks&);
+
+        void findBlocks(float minValue, float maxValue,
+                        size_t level, size_t blockX, size_t blockY, size_t blockZ,
+                        std::vector<size_t>& blockIndices) const;
+    protected:
+        virtual ~MinMaxBlocks() {}
+    public:
+        static MinMaxBlocks* Build(const VolumeDataSet& dataSet);
+
+        size_t levelCount() const { return m_levels.size(); }
+        size_t blockCountX(size_t level=0) const { return m_levels[level].blocksX; }
+        size_t blockCountY(size_t level=0) const { return m_levels[level].blocksY; }
+        size_t blockCountZ(size_t level=0) const { return m_levels[level].blocksZ; }
+
+        size_t blockIndex(size_t blockX, size_t blockY, size_t blockZ, size_t level=0) const
+        {
+            const Level& lvl = m_levels[level];
+            return (((blockZ * lvl.blocksY) + blockY) * lvl.blocksX) + blockX;
+        }
+
+        const Range& getRange(size_t blockX, size_t blockY, size_t blockZ, size_t level=0) const
+        {
+            return m_levels[level].ranges[blockIndex(blockX, blockY, blockZ, level)];
+        }
+
+        //indices of the level 0 blocks with a voxel at or below maxValue and one
+        //above minValue, sorted so they are in z, y, x order
+        void findBlocks(float minValue, float maxValue, std::vector<size_t>& blockIndices) const;
+
+        //level 0 blocks that can contain cells cut by an isosurface, i.e. that
+        //have voxels both at or below and above isoLevel
+        void findIsosurfaceBlocks(float isoLevel, std::vector<size_t>& blockIndices) const
+        {
+            findBlocks(isoLevel, isoLevel, blockIndices);
+        }
+    };
+}
+
+#endif
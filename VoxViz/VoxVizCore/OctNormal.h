@@ -0,0 +1,100 @@
+#ifndef VOX_OCT_NORMAL_H
+#define VOX_OCT_NORMAL_H
+
+#include <cmath>
+
+namespace vox
+{
+    //unit vector stored as its octahedral projection with 16 bits per axis,
+    //i.e. 4 bytes instead of the 12 needed for 3 floats.
+    //(0, 0) is reserved for the zero vector (homogeneous regions have no gradient).
+    //It is one of the four corners of the octahedral square which all decode to -z,
+    //so the encoder can always use another corner and no direction is lost.
+    struct OctNormal
+    {
+        unsigned short u;
+        unsigned short v;
+        OctNormal() : u(0), v(0) {}
+        OctNormal(unsigned short _u, unsigned short _v) : u(_u), v(_v) {}
+
+        bool isZero() const { return u == 0 && v == 0; }
+    };
+
+    static const float k_OctNormalMax = 65535.0f;
+
+    inline float OctNormalSign(float value)
+    {
+        return value >= 0.0f ? 1.0f : -1.0f;
+    }
+
+    inline unsigned short OctNormalQuantize(float value)
+    {
+        //[-1, 1] -> [0, 65535]
+        float unsignedValue = std::floor((((value + 1.0f) * 0.5f) * k_OctNormalMax) + 0.5f);
+        if(unsignedValue < 0.0f)
+            unsignedValue = 0.0f;
+        else if(unsignedValue > k_OctNormalMax)
+            unsignedValue = k_OctNormalMax;
+
+        return static_cast<unsigned short>(unsignedValue);
+    }
+
+    inline OctNormal EncodeOctNormal(float x, float y, float z)
+    {
+        float l1Norm = std::fabs(x) + std::fabs(y) + std::fabs(z);
+        if(!(l1Norm > 0.0f))
+            return OctNormal();
+
+        float octX = x / l1Norm;
+        float octY = y / l1Norm;
+        if(z < 0.0f)
+        {
+            //fold the lower hemisphere over the diagonals
+            float foldX = (1.0f - std::fabs(octY)) * OctNormalSign(octX);
+            float foldY = (1.0f - std::fabs(octX)) * OctNormalSign(octY);
+            octX = foldX;
+            octY = foldY;
+        }
+
+        OctNormal normal(OctNormalQuantize(octX), OctNormalQuantize(octY));
+        if(normal.isZero())
+        {
+            //(-1, -1) and (1, 1) are both -z
+            normal.u = static_cast<unsigned short>(k_OctNormalMax);
+            normal.v = static_cast<unsigned short>(k_OctNormalMax);
+        }
+
+        return normal;
+    }
+
+    inline void DecodeOctNormal(const OctNormal& normal, float& x, float& y, float& z)
+    {
+        if(normal.isZero())
+        {
+            x = y = z = 0.0f;
+            return;
+        }
+
+        float octX = ((static_cast<float>(normal.u) / k_OctNormalMax) * 2.0f) - 1.0f;
+        float octY = ((static_cast<float>(normal.v) / k_OctNormalMax) * 2.0f) - 1.0f;
+
+        z = 1.0f - std::fabs(octX) - std::fabs(octY);
+        if(z < 0.0f)
+        {
+            x = (1.0f - std::fabs(octY)) * OctNormalSign(octX);
+            y = (1.0f - std::fabs(octX)) * OctNormalSign(octY);
+        }
+        else
+        {
+            x = octX;
+            y = octY;
+        }
+
+        float len = std::sqrt((x * x) + (y * y) + (z * z));
+        x /= len;
+        y /= len;
+        z /= len;
+    }
+}
+
+#endif
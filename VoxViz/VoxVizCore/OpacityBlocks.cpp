@@ -0,0 +1,203 @@
+#include "VoxVizCore/OpacityBlocks.h"
+#include "VoxVizCore/VolumeDataSet.h"
+#include "VoxVizCore/SlabThreads.h"
+#include "VoxVizCore/SmartPtr.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vox;
+
+static unsigned char MaxChannel(const Vec4ub& color)
+{
+    return std::max(std::max(color.r, color.g), std::max(color.b, color.a));
+}
+
+static unsigned char MaxChannel(const Vec4f& color)
+{
+    //round up so that colors that are not quite black do not become 0
+    float maxValue = std::max(std::max(color.x, color.y), std::max(color.z, color.w));
+    if(maxValue <= 0.0f)
+        return 0;
+    if(maxValue >= 1.0f)
+        return 255;
+    return static_cast<unsigned char>(std::ceil(maxValue * 255.0f));
+}
+
+//first and one past the last block that hold the voxels [start, end), blocks
+//share their last voxel with the first of the next block
+static void BlockRange(size_t start, size_t end, size_t blockCount,
+                       size_t& startBlock, size_t& endBlock)
+{
+    const size_t blockDim = OpacityBlocks::k_BlockDim;
+    startBlock = start / blockDim;
+    if(startBlock > 0 && start % blockDim == 0)
+        --startBlock;
+    endBlock = std::min(((end - 1) / blockDim) + 1, blockCount);
+}
+
+namespace
+{
+    //raises the max values of a range of block z layers to the colors of a box
+    //of voxels
+    template<typename ColorType>
+    class AddColorsSlabTask : public SlabTask
+    {
+    private:
+        const ColorType* m_pColors;
+        size_t m_startX, m_startY, m_startZ;
+        size_t m_endX, m_endY, m_endZ;
+        size_t m_startBlockX, m_endBlockX;
+        size_t m_startBlockY, m_endBlockY;
+        size_t m_startBlockZ;
+        size_t m_blocksX;
+        size_t m_blocksY;
+        std::vector<unsigned char>& m_maxValues;
+    public:
+        AddColorsSlabTask(const ColorType* pColors,
+                          size_t startX, size_t startY, size_t startZ,
+                          size_t endX, size_t endY, size_t endZ,
+                          size_t blocksX, size_t blocksY,
+                          size_t startBlockZ,
+                          std::vector<unsigned char>& maxValues) :
+            m_pColors(pColors),
+            m_startX(startX), m_startY(startY), m_startZ(startZ),
+            m_endX(endX), m_endY(endY), m_endZ(endZ),
+            m_startBlockZ(startBlockZ),
+            m_blocksX(blocksX),
+            m_blocksY(blocksY),
+            m_maxValues(maxValues)
+        {
+            BlockRange(startX, endX, blocksX, m_startBlockX, m_endBlockX);
+            BlockRange(startY, endY, blocksY, m_startBlockY, m_endBlockY);
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            const size_t blockDim = OpacityBlocks::k_BlockDim;
+            size_t rowSize = m_endX - m_startX;
+            size_t sliceSize = rowSize * (m_endY - m_startY);
+            for(size_t blockZ = m_startBlockZ + start; blockZ < m_startBlockZ + end; ++blockZ)
+            {
+                size_t z0 = std::max(blockZ * blockDim, m_startZ);
+                size_t z1 = std::min((blockZ * blockDim) + blockDim + 1, m_endZ);
+                for(size_t blockY = m_startBlockY; blockY < m_endBlockY; ++blockY)
+                {
+                    size_t y0 = std::max(blockY * blockDim, m_startY);
+                    size_t y1 = std::min((blockY * blockDim) + blockDim + 1, m_endY);
+                    for(size_t blockX = m_startBlockX; blockX < m_endBlockX; ++blockX)
+                    {
+                        size_t x0 = std::max(blockX * blockDim, m_startX);
+                        size_t x1 = std::min((blockX * blockDim) + blockDim + 1, m_endX);
+
+                        unsigned char& maxValue = m_maxValues[(((blockZ * m_blocksY) + blockY) * m_blocksX) + blockX];
+                        for(size_t z = z0; z < z1; ++z)
+                        {
+                            for(size_t y = y0; y < y1; ++y)
+                            {
+                                const ColorType* pColor = m_pColors
+                                                        + ((z - m_startZ) * sliceSize)
+                                                        + ((y - m_startY) * rowSize)
+                                                        + (x0 - m_startX);
+                                const ColorType* pColorEnd = pColor + (x1 - x0);
+                                for(; pColor != pColorEnd; ++pColor)
+                                    maxValue = std::max(maxValue, MaxChannel(*pColor));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    template<typename ColorType>
+    void AddColors(const ColorType* pColors,
+                   size_t startX, size_t startY, size_t startZ,
+                   size_t endX, size_t endY, size_t endZ,
+                   size_t blocksX, size_t blocksY, size_t blocksZ,
+                   std::vector<unsigned char>& maxValues)
+    {
+        if(pColors == NULL || startX >= endX || startY >= endY || startZ >= endZ)
+            return;
+
+        size_t startBlockZ, endBlockZ;
+        BlockRange(startZ, endZ, blocksZ, startBlockZ, endBlockZ);
+
+        AddColorsSlabTask<ColorType> task(pColors,
+                                          startX, startY, startZ,
+                                          endX, endY, endZ,
+                                          blocksX, blocksY,
+                                          startBlockZ,
+                                          maxValues);
+        SlabThreads::Run(task, endBlockZ - startBlockZ);
+    }
+}
+
+static size_t BlockCount(size_t dim)
+{
+    //the last voxel only closes the cells of the block before it
+    size_t cellCount = dim > 1 ? dim - 1 : 1;
+    return (cellCount + OpacityBlocks::k_BlockDim - 1) / OpacityBlocks::k_BlockDim;
+}
+
+OpacityBlocks* OpacityBlocks::Create(size_t dimX, size_t dimY, size_t dimZ)
+{
+    if(dimX == 0 || dimY == 0 || dimZ == 0)
+        return NULL;
+
+    OpacityBlocks* pBlocks = new OpacityBlocks();
+    pBlocks->m_blocksX = BlockCount(dimX);
+    pBlocks->m_blocksY = BlockCount(dimY);
+    pBlocks->m_blocksZ = BlockCount(dimZ);
+    pBlocks->m_maxValues.resize(pBlocks->m_blocksX * pBlocks->m_blocksY * pBlocks->m_blocksZ, 0);
+
+    return pBlocks;
+}
+
+OpacityBlocks* OpacityBlocks::Build(const Vec4ub* pColors,
+                                    size_t dimX, size_t dimY, size_t dimZ)
+{
+    if(pColors == NULL)
+        return NULL;
+
+    SmartPtr<OpacityBlocks> spBlocks = Create(dimX, dimY, dimZ);
+    if(spBlocks.get() != NULL)
+        spBlocks->addColors(pColors, 0, 0, 0, dimX, dimY, dimZ);
+
+    return spBlocks.release();
+}
+
+OpacityBlocks* OpacityBlocks::Build(const Vec4f* pColors,
+                                    size_t dimX, size_t dimY, size_t dimZ)
+{
+    if(pColors == NULL)
+        return NULL;
+
+    SmartPtr<OpacityBlocks> spBlocks = Create(dimX, dimY, dimZ);
+    if(spBlocks.get() != NULL)
+        spBlocks->addColors(pColors, 0, 0, 0, dimX, dimY, dimZ);
+
+    return spBlocks.release();
+}
+
+void OpacityBlocks::addColors(const Vec4ub* pColors,
+                              size_t startX, size_t startY, size_t startZ,
+                              size_t endX, size_t endY, size_t endZ)
+{
+    AddColors(pColors,
+              startX, startY, startZ,
+              endX, endY, endZ,
+              m_blocksX, m_blocksY, m_blocksZ,
+              m_maxValues);
+}
+
+void OpacityBlocks::addColors(const Vec4f* pColors,
+                              size_t startX, size_t startY, size_t startZ,
+                              size_t endX, size_t endY, size_t endZ)
+{
+    AddColors(pColors,
+              startX, startY, startZ,
+              endX, endY, endZ,
+              m_blocksX, m_blocksY, m_blocksZ,
+              m_maxValues);
+}
@@ -0,0 +1,79 @@
+#ifndef VOX_OPACITY_BLOCKS_H
+#define VOX_OPACITY_BLOCKS_H
+
+#include "VoxVizCore/Referenced.h"
+#include "VoxVizCore/MinMaxBlocks.h"
+
+#include <vector>
+
+namespace vox
+{
+    struct Vec4ub;
+    struct Vec4f;
+
+    //largest channel of the classified colors over blocks of a volume, laid out
+    //like level 0 of MinMaxBlocks: block (x, y, z) holds the colors
+    //[x * k_BlockDim, (x + 1) * k_BlockDim] in each dimension, so every trilinear
+    //sample whose low texel is in the block only filters colors of the block.
+    //Blocks that are 0 are transparent black and ray casters can step over them.
+    class OpacityBlocks : public Referenced
+    {
+    public:
+        static const size_t k_BlockDim = MinMaxBlocks::k_BlockDim;
+
+    private:
+        size_t m_blocksX;
+        size_t m_blocksY;
+        size_t m_blocksZ;
+        std::vector<unsigned char> m_maxValues;
+
+        OpacityBlocks() : m_blocksX(0), m_blocksY(0), m_blocksZ(0) {}
+        OpacityBlocks(const OpacityBlocks&);
+        OpacityBlocks& operator=(const OpacityBlocks&);
+    protected:
+        virtual ~OpacityBlocks() {}
+    public:
+        //blocks for a dimX*dimY*dimZ volume that are all empty, for volumes that
+        //arrive in sub volumes
+        static OpacityBlocks* Create(size_t dimX, size_t dimY, size_t dimZ);
+
+        //pColors holds dimX*dimY*dimZ linear colors, like VolumeDataSet::convert gives
+        static OpacityBlocks* Build(const Vec4ub* pColors,
+                                    size_t dimX, size_t dimY, size_t dimZ);
+        static OpacityBlocks* Build(const Vec4f* pColors,
+                                    size_t dimX, size_t dimY, size_t dimZ);
+
+        //raises the blocks that hold the voxels [start, end) to their colors,
+        //pColors holds the box's colors linearly like a VolumeDataSet::SubVolume
+        void addColors(const Vec4ub* pColors,
+                       size_t startX, size_t startY, size_t startZ,
+                       size_t endX, size_t endY, size_t endZ);
+        void addColors(const Vec4f* pColors,
+                       size_t startX, size_t startY, size_t startZ,
+                       size_t endX, size_t endY, size_t endZ);
+
+        size_t blockCountX() const { return m_blocksX; }
+        size_t blockCountY() const { return m_blocksY; }
+        size_t blockCountZ() const { return m_blocksZ; }
+
+        size_t blockIndex(size_t blockX, size_t blockY, size_t blockZ) const
+        {
+            return (((blockZ * m_blocksY) + blockY) * m_blocksX) + blockX;
+        }
+
+        unsigned char getMaxValue(size_t blockX, size_t blockY, size_t blockZ) const
+        {
+            return m_maxValues[blockIndex(blockX, blockY, blockZ)];
+        }
+
+        bool isEmpty(size_t blockX, size_t blockY, size_t blockZ) const
+        {
+            return getMaxValue(blockX, blockY, blockZ) == 0;
+        }
+
+        //blockCountX*blockCountY*blockCountZ values in x, y, z order
+        const unsigned char* getMaxValues() const { return &m_maxValues[0]; }
+    };
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include "VoxVizCore/PVMReader.h"
+#include "VoxVizCore/SlabThreads.h"
 
 #include <algorithm>
+#include <vector>
 
 using namespace vox;
 
@@ -16,13 +18,17 @@ static unsigned char *ReadPVMVolume(const char *filename,
                                     unsigned char **description,
                                     unsigned char **courtesy,
                                     unsigned char **parameter,
-                                    unsigned char **comment);
+                                    unsigned char **comment,
+                                    bool parallelInterleave);
 
-static unsigned char *Quantize16to8(unsigned char *volume,
-                                    unsigned int width,unsigned int height,unsigned int depth,
-                                    int linear=0);
+static VolumeDataSet::Voxels16* ConvertTo16Bit(const unsigned char* pVolume,
+                                               size_t count,
+                                               unsigned int& valueMin,
+                                               unsigned int& valueMax);
 
-VolumeDataSet* PVMReader::readVolumeData(const std::string& inputFile)
+//parallelInterleave restores the DDS interleave blocks on SlabThreads,
+//it must be false when the caller already runs on them
+static VolumeDataSet* ReadVolume(const std::string& inputFile, bool parallelInterleave)
 {
     unsigned int width, height, depth, comps;
     float scaleX, scaleY, scaleZ;
@@ -31,17 +37,23 @@ VolumeDataSet* PVMReader::readVolumeData(const std::string& inputFile)
                                               &width, &height, &depth, 
                                               &comps, 
                                               &scaleX, &scaleY, &scaleZ, 
-                                              &desc, &ctsy, &param, &cmnt);
+                                              &desc, &ctsy, &param, &cmnt,
+                                              parallelInterleave);
 
     if(pVoxelData == NULL)
         return NULL;
 
+    VolumeDataSet::Voxels16* pVoxelData16 = NULL;
+    unsigned int valueMin = 0;
+    unsigned int valueMax = 0;
     if(comps == 2)
     {
-        pVoxelData = Quantize16to8(pVoxelData,
-                                   width, height, depth);
-                                   
-                                   
+        //keep the full 16 bit precision, the value range is mapped to [0, 1]
+        pVoxelData16 = ConvertTo16Bit(pVoxelData,
+                                      static_cast<size_t>(width) * height * depth,
+                                      valueMin, valueMax);
+        free(pVoxelData);
+        pVoxelData = NULL;
     }
     else if(comps != 1)
     {
@@ -62,104 +74,83 @@ VolumeDataSet* PVMReader::readVolumeData(const std::string& inputFile)
                             height,
                             depth);
 
-    pVolume->setData(pVoxelData);
+    if(pVoxelData16 != NULL)
+        pVolume->setData(pVoxelData16, valueMin, valueMax);
+    else
+        pVolume->setData(pVoxelData);
 
     return pVolume;
 }
 
-// The following code originally written by Stefan Roettger as part of
-// V3 viewer
-
-#include <string.h>
-#include <stdlib.h>
-#include <stdio.h>
-
-#define DDS_MAXSTR (256)
-
-#define DDS_BLOCKSIZE (1<<20)
-#define DDS_INTERLEAVE (1<<24)
-
-#define DDS_RL (7)
-
-#define DDS_ISINTEL (*((unsigned char *)(&DDS_INTEL)+1)==0)
-
-FILE *DDS_file;
-
-char DDS_ID[]="DDS v3d\n";
-char DDS_ID2[]="DDS v3e\n";
-
-unsigned int DDS_buffer;
-int DDS_bufsize, DDS_bitcnt;
-
-unsigned short int DDS_INTEL=1;
-
-inline unsigned int DDS_shiftl(const unsigned int value,const int bits)
+VolumeDataSet* PVMReader::readVolumeData(const std::string& inputFile)
 {
-    return((bits>=32) ? 0 : value << bits);
+    return ReadVolume(inputFile, true);
 }
 
-inline unsigned int DDS_shiftr(const unsigned int value,const int bits)
+namespace
 {
-    return((bits>=32) ? 0:value >> bits);
-}
+    //reads one volume per item, each file is decoded on a single thread
+    class ReadVolumesSlabTask : public SlabTask
+    {
+    private:
+        const std::vector<std::string>& m_filenames;
+        std::vector<VolumeDataSet*>& m_volumes;
+    public:
+        ReadVolumesSlabTask(const std::vector<std::string>& filenames,
+                            std::vector<VolumeDataSet*>& volumes) :
+            m_filenames(filenames),
+            m_volumes(volumes)
+        {
+        }
 
-static void InitBuffer()
-{
-    DDS_buffer=0;
-    DDS_bufsize=0;
-    DDS_bitcnt=0;
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            for(size_t i = start; i < end; ++i)
+                m_volumes[i] = ReadVolume(m_filenames[i], false);
+        }
+    };
 }
 
-void DDS_swapuint(unsigned int *x)
+void PVMReader::readVolumeData(const std::vector<std::string>& filenames,
+                               std::vector<VolumeDataSet*>& volumes)
 {
-    unsigned int tmp=*x;
+    volumes.assign(filenames.size(), NULL);
 
-    *x=((tmp&0xff)<<24)|
-        ((tmp&0xff00)<<8)|
-        ((tmp&0xff0000)>>8)|
-        ((tmp&0xff000000)>>24);
-}
+    //with fewer files than threads the files are read one after another and
+    //each one's interleave blocks are spread over the threads instead, so the
+    //two never start threads from inside each other
+    if(filenames.size() < SlabThreads::GetThreadCount())
+    {
+        for(size_t i = 0; i < filenames.size(); ++i)
+            volumes[i] = ReadVolume(filenames[i], true);
+        return;
+    }
 
-static inline void PrintError()
-{
-    fprintf(stderr,"fatal error in <%s> at line %d!\n", __FILE__, __LINE__);
-    exit(EXIT_FAILURE);
+    ReadVolumesSlabTask task(filenames, volumes);
+    SlabThreads::Run(task, filenames.size());
 }
 
-static unsigned int ReadBits(FILE *file,int bits)
-{
-    unsigned int value;
+// The following code originally written by Stefan Roettger as part of
+// V3 viewer
 
-    if (bits<0 || bits>32) PrintError();
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 
-    if (bits==0) return(0);
+#define DDS_MAXSTR (256)
 
-    if (bits<DDS_bufsize)
-    {
-        DDS_bufsize-=bits;
-        value=DDS_shiftr(DDS_buffer,DDS_bufsize);
-    }
-    else
-    {
-        value=DDS_shiftl(DDS_buffer,bits-DDS_bufsize);
-        DDS_buffer=0;
-        fread(&DDS_buffer,1,4,file);
-        if (DDS_ISINTEL) 
-            DDS_swapuint(&DDS_buffer);
-
-        DDS_bufsize+=32-bits;
-        value|=DDS_shiftr(DDS_buffer,DDS_bufsize);
-    }
+#define DDS_BLOCKSIZE (1<<20)
+#define DDS_INTERLEAVE (1<<24)
 
-    DDS_buffer&=DDS_shiftl(1,DDS_bufsize)-1;
-    DDS_bitcnt+=bits;
+#define DDS_RL (7)
 
-    return(value);
-}
+static const char DDS_ID[]="DDS v3d\n";
+static const char DDS_ID2[]="DDS v3e\n";
 
-static inline int DDS_decode(int bits)
+static inline void PrintError()
 {
-    return(bits>=1?bits+1:bits);
+    fprintf(stderr,"fatal error in <%s> at line %d!\n", __FILE__, __LINE__);
+    exit(EXIT_FAILURE);
 }
 
 #ifndef TRUE
@@ -170,154 +161,202 @@ static inline int DDS_decode(int bits)
     #define FALSE 0
 #endif
 
-static void deinterleave(unsigned char *data,unsigned int bytes,unsigned int skip,unsigned int block=0, int restore=FALSE)
+namespace
 {
-    unsigned int i,j,k;
-
-    unsigned char *data2,*ptr;
-
-    if (skip<=1) return;
-
-    if (block==0)
+    //msb first bit reader over an in memory DDS stream, all state is local
+    //so any number of streams can be decoded at the same time.
+    //reading past the end returns zero bits like the original file reader
+    class DDSBitReader
     {
-        if ((data2=(unsigned char *)malloc(bytes))==NULL) PrintError();
+    private:
+        const unsigned char* m_pData;
+        const unsigned char* m_pEnd;
+        unsigned long long m_bits;//valid bits are kept at the top
+        int m_bitCount;
+    public:
+        DDSBitReader(const unsigned char* pData, size_t size) :
+            m_pData(pData),
+            m_pEnd(pData + size),
+            m_bits(0),
+            m_bitCount(0)
+        {
+        }
 
-        if (!restore)
-            for (ptr=data2,i=0; i<skip; i++)
-            for (j=i; j<bytes; j+=skip) *ptr++=data[j];
-        else
-            for (ptr=data,i=0; i<skip; i++)
-            for (j=i; j<bytes; j+=skip) data2[j]=*ptr++;
+        unsigned int readBits(int bits)
+        {
+            if(bits <= 0)
+                return 0;
 
-        memcpy(data,data2,bytes);
-    }
-    else
-    {
-        if ((data2=(unsigned char *)malloc((bytes<skip*block)?bytes:skip*block))==NULL) PrintError();
+            if(m_bitCount < bits)
+                refill();
 
-        if (!restore)
+            unsigned int value = static_cast<unsigned int>(m_bits >> (64 - bits));
+            m_bits <<= bits;
+            m_bitCount -= bits;
+            return value;
+        }
+    private:
+        void refill()
         {
-            for (k=0; k<bytes/skip/block; k++)
+            //top up to at least 57 bits, a whole byte at a time
+            while(m_bitCount <= 56)
             {
-                for (ptr=data2,i=0; i<skip; i++)
-                    for (j=i; j<skip*block; j+=skip) *ptr++=data[k*skip*block+j];
-
-                memcpy(data+k*skip*block,data2,skip*block);
+                unsigned long long byte = m_pData < m_pEnd ? *m_pData++ : 0;
+                m_bits |= byte << (56 - m_bitCount);
+                m_bitCount += 8;
             }
+        }
+    };
 
-            for (ptr=data2,i=0; i<skip; i++)
-                for (j=i; j<bytes-k*skip*block; j+=skip) *ptr++=data[k*skip*block+j];
-
-            memcpy(data+k*skip*block,data2,bytes-k*skip*block);
+    //undoes the byte interleaving of a DDS stream, the interleave
+    //blocks are independent so they are restored on several threads
+    class InterleaveSlabTask : public SlabTask
+    {
+    private:
+        unsigned char* m_pData;
+        size_t m_bytes;
+        size_t m_skip;
+        size_t m_blockSize;
+    public:
+        InterleaveSlabTask(unsigned char* pData, size_t bytes, size_t skip, size_t blockSize) :
+            m_pData(pData),
+            m_bytes(bytes),
+            m_skip(skip),
+            m_blockSize(blockSize)
+        {
         }
-        else
+
+        size_t blockCount() const { return (m_bytes + m_blockSize - 1) / m_blockSize; }
+
+        virtual void runSlab(size_t, size_t startBlock, size_t endBlock)
         {
-            for (k=0; k<bytes/skip/block; k++)
+            std::vector<unsigned char> temp(std::min(m_blockSize, m_bytes));
+            for(size_t block = startBlock; block < endBlock; ++block)
             {
-                for (ptr=data+k*skip*block,i=0; i<skip; i++)
-                    for (j=i; j<skip*block; j+=skip) data2[j]=*ptr++;
+                unsigned char* pBlock = m_pData + (block * m_blockSize);
+                size_t blockBytes = std::min(m_blockSize, m_bytes - (block * m_blockSize));
 
-                memcpy(data+k*skip*block,data2,skip*block);
+                const unsigned char* pRead = pBlock;
+                for(size_t i = 0; i < m_skip; ++i)
+                {
+                    for(size_t j = i; j < blockBytes; j += m_skip)
+                        temp[j] = *pRead++;
+                }
+
+                memcpy(pBlock, &temp[0], blockBytes);
             }
+        }
+    };
+}
+
+// interleave a byte stream, in blocks of skip*block bytes (the whole stream if block is 0)
+static void interleave(unsigned char *data,unsigned int bytes,unsigned int skip,unsigned int block,bool parallel)
+{
+    if (skip<=1 || bytes==0) return;
+
+    size_t blockSize = block==0 ? bytes : static_cast<size_t>(skip)*block;
+    InterleaveSlabTask task(data, bytes, skip, blockSize);
+    if (parallel)
+        SlabThreads::Run(task, task.blockCount());
+    else
+        task.runSlab(0, 0, task.blockCount());
+}
 
-            for (ptr=data+k*skip*block,i=0; i<skip; i++)
-                for (j=i; j<bytes-k*skip*block; j+=skip) data2[j]=*ptr++;
+static bool ReadFileIntoMemory(const char *filename, std::vector<unsigned char>& buffer)
+{
+    FILE* pFile = fopen(filename,"rb");
+    if (pFile==NULL) return(false);
 
-            memcpy(data+k*skip*block,data2,bytes-k*skip*block);
-        }
+    bool success = fseek(pFile,0,SEEK_END)==0;
+    long size = success ? ftell(pFile) : -1;
+    success = size>=0 && fseek(pFile,0,SEEK_SET)==0;
+    if (success)
+    {
+        buffer.resize(static_cast<size_t>(size));
+        if (size>0)
+            success = fread(&buffer[0],1,buffer.size(),pFile)==buffer.size();
     }
 
-    free(data2);
+    fclose(pFile);
+    return(success);
 }
-// interleave a byte stream
-void interleave(unsigned char *data,unsigned int bytes,unsigned int skip,unsigned int block=0)
+
+static inline int DDS_decode(int bits)
 {
-    deinterleave(data,bytes,skip,block,TRUE);
+    return(bits>=1?bits+1:bits);
 }
 
-static unsigned char *ReadDDSfile(const char *filename,unsigned int *bytes)
+static unsigned char *ReadDDSfile(const char *filename,unsigned int *bytes,bool parallelInterleave)
 {
-    int version=1;
+    //the whole file is read with one call and decoded from memory,
+    //the decoder only touches local state so it is reentrant
+    std::vector<unsigned char> file;
+    if (!ReadFileIntoMemory(filename,file)) return(NULL);
+
+    size_t idLength=strlen(DDS_ID);
+    if (file.size()<idLength) return(NULL);
+
+    int version;
+    if (memcmp(&file[0],DDS_ID,idLength)==0) version=1;
+    else if (memcmp(&file[0],DDS_ID2,idLength)==0) version=2;
+    else return(NULL);
+
+    DDSBitReader reader(&file[0]+idLength,file.size()-idLength);
 
     unsigned int skip,strip;
 
     unsigned char *data,*ptr;
 
-    unsigned int cnt,cnt1,cnt2;
+    size_t cnt,capacity,cnt1,cnt2;
     int bits,act;
 
-    if ((DDS_file=fopen(filename,"rb"))==NULL) return(NULL);
+    skip=reader.readBits(2)+1;
+    strip=reader.readBits(16)+1;
 
-    for (cnt=0; DDS_ID[cnt]!='\0'; cnt++)
-    {
-        if (fgetc(DDS_file)!=DDS_ID[cnt])
-        {
-            fclose(DDS_file);
-            version=0;
-            break;
-        }
-    }
+    data=ptr=NULL;
+    cnt=capacity=0;
+    act=0;
 
-    if (version==0)
+    while ((cnt1=reader.readBits(DDS_RL))!=0)
     {
-        if ((DDS_file=fopen(filename,"rb"))==NULL) return(NULL);
+        bits=DDS_decode(reader.readBits(3));
+        int offset=(1<<bits)/2;
 
-        for (cnt=0; DDS_ID2[cnt]!='\0'; cnt++)
+        if (cnt+cnt1>capacity)
         {
-            if (fgetc(DDS_file)!=DDS_ID2[cnt])
-            {
-                fclose(DDS_file);
-                return(NULL);
-            }
-        }
-
-        version=2;
-    }
-
-    InitBuffer();
+            //grow geometrically rather than one block at a time
+            capacity=std::max(capacity*2,capacity+DDS_BLOCKSIZE);
+            if ((data=(unsigned char *)realloc(data,capacity))==NULL) 
+                PrintError();
 
-    skip=ReadBits(DDS_file,2)+1;
-    strip=ReadBits(DDS_file,16)+1;
-
-    data=ptr=NULL;
-    cnt=act=0;
-
-    while ((cnt1=ReadBits(DDS_file,DDS_RL))!=0)
-    {
-        bits=DDS_decode(ReadBits(DDS_file,3));
+            ptr=&data[cnt];
+        }
 
         for (cnt2=0; cnt2<cnt1; cnt2++)
         {
-            if (cnt<=strip) act+=ReadBits(DDS_file,bits)-(1<<bits)/2;
-            else act+=*(ptr-strip)-*(ptr-strip-1)+ReadBits(DDS_file,bits)-(1<<bits)/2;
+            if (cnt<=strip) act+=reader.readBits(bits)-offset;
+            else act+=*(ptr-strip)-*(ptr-strip-1)+reader.readBits(bits)-offset;
 
-            while (act<0) act+=256;
-            while (act>255) act-=256;
-
-            if (cnt%DDS_BLOCKSIZE==0)
-            {
-                if ((data=(unsigned char *)realloc(data,cnt+DDS_BLOCKSIZE))==NULL) 
-                    PrintError();
-
-                ptr=&data[cnt];
-            }
+            act&=255;
 
             *ptr++=act;
             cnt++;
         }
     }
 
-    fclose(DDS_file);
-
-    if (cnt==0) return(NULL);
+    if (cnt==0) 
+    {
+        free(data);
+        return(NULL);
+    }
 
     if ((data=(unsigned char *)realloc(data,cnt))==NULL) 
         PrintError();
 
     if (version==1) 
-        interleave(data,cnt,skip);
+        interleave(data,cnt,skip,0,parallelInterleave);
     else 
-        interleave(data,cnt,skip,DDS_INTERLEAVE);
+        interleave(data,cnt,skip,DDS_INTERLEAVE,parallelInterleave);
 
     *bytes=cnt;
 
@@ -330,7 +369,8 @@ static unsigned char *ReadPVMVolume(const char *filename,
                                     unsigned char **description,
                                     unsigned char **courtesy,
                                     unsigned char **parameter,
-                                    unsigned char **comment)
+                                    unsigned char **comment,
+                                    bool parallelInterleave)
 {
     unsigned char *data,*ptr;
     unsigned int bytes,numc;
@@ -343,7 +383,7 @@ static unsigned char *ReadPVMVolume(const char *filename,
 
     unsigned int len1=0,len2=0,len3=0,len4=0;
 
-    if ((data=ReadDDSfile(filename,&bytes))==NULL) 
+    if ((data=ReadDDSfile(filename,&bytes,parallelInterleave))==NULL) 
         return(NULL);
     if (bytes<5) 
         return(NULL);
@@ -403,13 +443,13 @@ static unsigned char *ReadPVMVolume(const char *filename,
     if (version==3) 
         len4=strlen((char *)(ptr+(*width)*(*height)*(*depth)*numc+len1+len2+len3))+1;
 
-    if ((volume=(unsigned char *)malloc((*width)*(*height)*(*depth)*numc+len1+len2+len3+len4))==NULL) 
-        PrintError();
     if (data+bytes!=ptr+(*width)*(*height)*(*depth)*numc+len1+len2+len3+len4) 
         PrintError();
 
-    memcpy(volume,ptr,(*width)*(*height)*(*depth)*numc+len1+len2+len3+len4);
-    free(data);
+    //drop the header in place rather than copying the volume into a new buffer
+    memmove(data,ptr,(*width)*(*height)*(*depth)*numc+len1+len2+len3+len4);
+    if ((volume=(unsigned char *)realloc(data,(*width)*(*height)*(*depth)*numc+len1+len2+len3+len4))==NULL) 
+        PrintError();
 
     if (description!=NULL)
         if (len1>1) 
@@ -438,172 +478,29 @@ static unsigned char *ReadPVMVolume(const char *filename,
     return(volume);
 }
 
-// helper functions for quantize:
-
-inline int DDS_get(unsigned short int *volume,
-                   unsigned int width,unsigned int height,unsigned int depth,
-                   unsigned int i,unsigned int j,unsigned int k)
+// big endian 16 bit PVM data to native unsigned shorts, also finds the value range
+static VolumeDataSet::Voxels16* ConvertTo16Bit(const unsigned char* pVolume,
+                                               size_t count,
+                                               unsigned int& valueMin,
+                                               unsigned int& valueMax)
 {
-    return(volume[i+(j+k*height)*width]);
-}
-
-inline double DDS_getgrad(unsigned short int *volume,
-                          unsigned int width,unsigned int height,unsigned int depth,
-                          unsigned int i,unsigned int j,unsigned int k)
-{
-    double gx,gy,gz;
-
-    if (i>0)
-    {
-        if (i<width-1) 
-            gx=(DDS_get(volume,width,height,depth,i+1,j,k)-DDS_get(volume,width,height,depth,i-1,j,k))/2.0;
-        else 
-            gx=DDS_get(volume,width,height,depth,i,j,k)-DDS_get(volume,width,height,depth,i-1,j,k);
-    }
-    else 
-        gx=DDS_get(volume,width,height,depth,i+1,j,k)-DDS_get(volume,width,height,depth,i,j,k);
-
-    if (j>0)
-    {
-        if (j<height-1) 
-            gy=(DDS_get(volume,width,height,depth,i,j+1,k)-DDS_get(volume,width,height,depth,i,j-1,k))/2.0;
-        else 
-            gy=DDS_get(volume,width,height,depth,i,j,k)-DDS_get(volume,width,height,depth,i,j-1,k);
-    }
-    else 
-        gy=DDS_get(volume,width,height,depth,i,j+1,k)-DDS_get(volume,width,height,depth,i,j,k);
-
-    if (k>0)
-    {
-        if (k<depth-1) 
-            gz=(DDS_get(volume,width,height,depth,i,j,k+1)-DDS_get(volume,width,height,depth,i,j,k-1))/2.0;
-        else 
-            gz=DDS_get(volume,width,height,depth,i,j,k)-DDS_get(volume,width,height,depth,i,j,k-1);
-    }
-    else 
-        gz=DDS_get(volume,width,height,depth,i,j,k+1)-DDS_get(volume,width,height,depth,i,j,k);
-
-    return(sqrt(gx*gx+gy*gy+gz*gz));
-}
-
-// quantize 16 bit volume to 8 bit using a non-linear mapping
-static unsigned char *Quantize16to8(unsigned char *volume,
-                                    unsigned int width,unsigned int height,unsigned int depth,
-                                    int linear/*=0*/)
-{
-    unsigned int i,j,k;
-
-    unsigned char *volume2;
-    unsigned short int *volume3;
-
-    int v,vmin,vmax;
-
-    double *err,eint;
-
-    err=new double[65536];
+    VolumeDataSet::Voxels16* pVolume16 = new VolumeDataSet::Voxels16[count];
 
-    int done;
-
-    if ((volume3=(unsigned short int*)malloc(width*height*depth*sizeof(unsigned short int)))==NULL) 
-        PrintError();
-
-    vmin=vmax=256*volume[0]+volume[1];
-
-    for (k=0; k<depth; k++)
+    valueMin = 0xFFFF;
+    valueMax = 0;
+    for(size_t i = 0; i < count; ++i)
     {
-        for (j=0; j<height; j++)
-        {
-            for (i=0; i<width; i++)
-            {
-                v=256*volume[2*(i+(j+k*height)*width)]+volume[2*(i+(j+k*height)*width)+1];
-                volume3[i+(j+k*height)*width]=v;
+        unsigned int value = (256 * pVolume[2*i]) + pVolume[(2*i)+1];
+        pVolume16[i] = static_cast<VolumeDataSet::Voxels16>(value);
 
-                if (v<vmin) 
-                    vmin=v;
-                else if (v>vmax) 
-                    vmax=v;
-            }
-        }
-    }
-
-    free(volume);
-
-    //if (verbose)
-    //std::cout << "16 bit volume has scalar range=[" << vmin << "," << vmax << std::endl;
-
-    if (linear)
-    {
-        for (i=0; i<65536; i++) 
-        {
-            err[i]=255*(double)i/vmax;
-        }
-    }
-    else
-    {
-        for (i=0; i<65536; i++) 
-            err[i]=0.0;
-
-        for (k=0; k<depth; k++)
-        {
-            for (j=0; j<height; j++)
-            {
-                for (i=0; i<width; i++)
-                {
-                    err[DDS_get(volume3,width,height,depth,i,j,k)]+=sqrt(DDS_getgrad(volume3,width,height,depth,i,j,k));
-                }
-            }
-        }
-
-        for (i=0; i<65536; i++) 
-            err[i]=pow(err[i],1.0/3);
-
-        err[vmin]=err[vmax]=0.0;
-
-        for (k=0; k<256; k++)
-        {
-            for (eint=0.0,i=0; i<65536; i++) 
-                eint+=err[i];
-
-            done=TRUE;
-
-            for (i=0; i<65536; i++)
-            {
-                if (err[i]>eint/256)
-                {
-                    err[i]=eint/256;
-                    done=FALSE;
-                }
-            }
-
-            if (done) break;
-        }
-
-        for (i=1; i<65536; i++) 
-            err[i]+=err[i-1];
-
-        if (err[65535]>0.0f)
-        {
-            for (i=0; i<65536; i++) 
-                err[i]*=255.0f/err[65535];
-        }
-    }
-
-    if ((volume2=(unsigned char *)malloc(width*height*depth))==NULL) 
-        PrintError();
-
-    for (k=0; k<depth; k++)
-    {            
-        for (j=0; j<height; j++)
-        {
-            for (i=0; i<width; i++)
-            {
-                volume2[i+(j+k*height)*width]=(int)(err[DDS_get(volume3,width,height,depth,i,j,k)]+0.5);
-            }
-        }
+        if(value < valueMin)
+            valueMin = value;
+        if(value > valueMax)
+            valueMax = value;
     }
 
-    delete err;
-    free(volume3);
+    if(count == 0)
+        valueMin = valueMax = 0;
 
-    return(volume2);
+    return pVolume16;
 }
@@ -3,6 +3,9 @@
 
 #include <VoxVizCore/VolumeDataSet.h>
 
+#include <string>
+#include <vector>
+
 namespace vox
 {
     class PVMReader
@@ -10,6 +13,10 @@ namespace vox
     public:
         static PVMReader& instance();
         vox::VolumeDataSet* readVolumeData(const std::string& filename);
+        //reads several volumes at once, volumes[i] is NULL if filenames[i]
+        //could not be read
+        void readVolumeData(const std::vector<std::string>& filenames,
+                            std::vector<vox::VolumeDataSet*>& volumes);
     private:
         PVMReader() {}
         PVMReader(const PVMReader&) {}
@@ -16,7 +16,8 @@ Renderer::Renderer(const std::string& algorithm) :
         m_drawGUI(true),
         m_enableLighting(true),
 		m_computeLighting(false),
-		m_lodScalar(2.0f)
+		m_lodScalar(2.0f),
+        m_isoLevel(0.5f)
 {
     RegisterRendererAlgorithm(algorithm, this);
 }
@@ -39,7 +40,7 @@ void Renderer::RegisterRendererAlgorithm(const std::string& algorithm, Renderer*
 
 bool Renderer::acceptsFileExtension(const std::string& ext) const
 {
-    return ext == "pvm" || ext == "voxt";
+    return ext == "pvm" || ext == "voxt" || ext == "voxc";
 }
 
 NvUIButton* Renderer::CreateGUIButton(const std::string& label,
@@ -28,6 +28,7 @@ namespace vox
         bool m_enableLighting;
 		bool m_computeLighting;
 		float m_lodScalar;
+        float m_isoLevel;
     public:
         Renderer(const std::string& algorithm);
 
@@ -56,6 +57,10 @@ namespace vox
 		void setLodScalar(float lodScalar) { m_lodScalar = lodScalar; }
 		float getLodScalar() const { return m_lodScalar; }
 
+        //iso level of renderers that draw an isosurface, in valueAsFloat units
+        void setIsoLevel(float isoLevel) { m_isoLevel = isoLevel; }
+        float getIsoLevel() const { return m_isoLevel; }
+
         virtual void initGUI(NvUIWindow&) {}
         virtual void updateGUI(NvUIWindow&) {}
 
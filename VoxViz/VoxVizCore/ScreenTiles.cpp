@@ -0,0 +1,146 @@
+#include "VoxVizCore/ScreenTiles.h"
+
+#include <QtCore/QMutexLocker>
+
+#include <cmath>
+
+using namespace vox;
+
+static const float k_AlmostZero = 0.000001f;
+
+ScreenTileTask::ScreenTileTask(int width, int height) :
+    m_width(width),
+    m_height(height),
+    m_tileCountX((width + k_TileSize - 1) / k_TileSize),
+    m_tileCount(0),
+    m_nextTile(0)
+{
+    int tileCountY = (height + k_TileSize - 1) / k_TileSize;
+    m_tileCount = static_cast<size_t>(m_tileCountX) * tileCountY;
+}
+
+//each slab is a worker that takes tiles until none are left
+void ScreenTileTask::runSlab(size_t, size_t, size_t)
+{
+    size_t tile;
+    while(takeTile(tile))
+    {
+        int startX = static_cast<int>(tile % m_tileCountX) * k_TileSize;
+        int startY = static_cast<int>(tile / m_tileCountX) * k_TileSize;
+        int endX = startX + k_TileSize < m_width ? startX + k_TileSize : m_width;
+        int endY = startY + k_TileSize < m_height ? startY + k_TileSize : m_height;
+
+        renderTile(startX, startY, endX, endY);
+    }
+}
+
+bool ScreenTileTask::takeTile(size_t& tile)
+{
+    QMutexLocker locker(&m_nextTileMutex);
+    if(m_nextTile == m_tileCount)
+        return false;
+
+    tile = m_nextTile++;
+    return true;
+}
+
+ScreenRays::ScreenRays(const float* pInvViewProjMtx,
+                       int width, int height,
+                       const float* pVolTranslation,
+                       const float* pVolScale,
+                       const float* pExtentMin,
+                       const float* pExtentMax) :
+    m_width(width),
+    m_height(height)
+{
+    for(int i = 0; i < 16; ++i)
+        m_invViewProjMtx[i] = pInvViewProjMtx[i];
+
+    for(int i = 0; i < 3; ++i)
+    {
+        m_volTranslation[i] = pVolTranslation[i];
+        m_volScale[i] = pVolScale[i];
+        m_extentMin[i] = pExtentMin[i];
+        m_extentMax[i] = pExtentMax[i];
+    }
+}
+
+bool ScreenRays::computeRayPosition(int x, int y, float* pRayPosition) const
+{
+    float ndcX = (((static_cast<float>(x) + 0.5f) / static_cast<float>(m_width)) * 2.0f) - 1.0f;
+    float ndcY = (((static_cast<float>(y) + 0.5f) / static_cast<float>(m_height)) * 2.0f) - 1.0f;
+
+    float rayStart[3];
+    float rayEnd[3];
+    unproject(ndcX, ndcY, -1.0f, rayStart);
+    unproject(ndcX, ndcY, 1.0f, rayEnd);
+
+    float rayVector[3];
+    for(int i = 0; i < 3; ++i)
+        rayVector[i] = rayEnd[i] - rayStart[i];
+
+    float tEnter = 0.0f;
+    float tExit = 1.0f;
+    for(int i = 0; i < 3; ++i)
+    {
+        if(std::fabs(rayVector[i]) < k_AlmostZero)
+        {
+            if(rayStart[i] < m_extentMin[i] || rayStart[i] > m_extentMax[i])
+                return false;
+            continue;
+        }
+
+        float tMin = (m_extentMin[i] - rayStart[i]) / rayVector[i];
+        float tMax = (m_extentMax[i] - rayStart[i]) / rayVector[i];
+        if(tMin > tMax)
+        {
+            float tSwap = tMin;
+            tMin = tMax;
+            tMax = tSwap;
+        }
+
+        tEnter = tEnter > tMin ? tEnter : tMin;
+        tExit = tExit < tMax ? tExit : tMax;
+    }
+
+    if(tEnter >= tExit)
+        return false;
+
+    for(int i = 0; i < 3; ++i)
+        pRayPosition[i] = rayStart[i] + (rayVector[i] * tEnter);
+    return true;
+}
+
+void ScreenRays::unproject(float ndcX, float ndcY, float ndcZ, float* pVolumePosition) const
+{
+    const float ndc[4] = { ndcX, ndcY, ndcZ, 1.0f };
+
+    //summed a column at a time like glm's mat4 * vec4
+    float position[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for(int col = 0; col < 4; ++col)
+    {
+        for(int row = 0; row < 4; ++row)
+            position[row] += m_invViewProjMtx[(col * 4) + row] * ndc[col];
+    }
+
+    float worldPosition[3];
+    for(int i = 0; i < 3; ++i)
+        worldPosition[i] = position[i] / position[3];
+
+    WorldToVolume(worldPosition, m_volTranslation, m_volScale, pVolumePosition);
+}
+
+void ScreenRays::ToFloatMatrix(const double* pMtx, float* pFloatMtx)
+{
+    for(int i = 0; i < 16; ++i)
+        pFloatMtx[i] = static_cast<float>(pMtx[i]);
+}
+
+void ScreenRays::WorldToVolume(const float* pWorldPosition,
+                               const float* pVolTranslation,
+                               const float* pVolScale,
+                               float* pVolumePosition)
+{
+    for(int i = 0; i < 3; ++i)
+        pVolumePosition[i] = ((pWorldPosition[i] - pVolTranslation[i]) / pVolScale[i]) + 0.5f;
+}
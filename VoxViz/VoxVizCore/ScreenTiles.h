@@ -0,0 +1,77 @@
+#ifndef VOX_SCREEN_TILES_H
+#define VOX_SCREEN_TILES_H
+
+#include "VoxVizCore/SlabThreads.h"
+
+#include <QtCore/QMutex>
+
+namespace vox
+{
+    //splits a frame into square tiles that SlabThreads workers take from a
+    //shared counter, so the workers that get empty tiles help out with the rest.
+    //Run it with SlabThreads::Run(task, SlabThreads::GetThreadCount()).
+    class ScreenTileTask : public SlabTask
+    {
+    public:
+        //size in pixels of the square tiles
+        static const int k_TileSize = 16;
+
+        ScreenTileTask(int width, int height);
+
+        virtual void runSlab(size_t slabIndex, size_t start, size_t end);
+    protected:
+        //renders the pixels [startX, endX) x [startY, endY), called concurrently
+        //for different tiles
+        virtual void renderTile(int startX, int startY, int endX, int endY) = 0;
+
+        int m_width;
+        int m_height;
+    private:
+        bool takeTile(size_t& tile);
+
+        int m_tileCountX;
+        size_t m_tileCount;
+
+        QMutex m_nextTileMutex;
+        size_t m_nextTile;
+    };
+
+    //where the rays through the pixels of a frame enter a volume, in the
+    //volume's texture space like the ray casting shaders. All vectors are
+    //3 floats and all matrices are column major.
+    class ScreenRays
+    {
+    public:
+        ScreenRays(const float* pInvViewProjMtx,
+                   int width, int height,
+                   const float* pVolTranslation,
+                   const float* pVolScale,
+                   const float* pExtentMin,
+                   const float* pExtentMax);
+
+        //computes where the ray through the center of pixel (x, y) enters the
+        //volume extent, which is where the front faces or, with the camera inside,
+        //the near plane quad start it. Returns false if the ray misses.
+        bool computeRayPosition(int x, int y, float* pRayPosition) const;
+
+        static void ToFloatMatrix(const double* pMtx, float* pFloatMtx);
+
+        //converts a world position to the volume's texture space like the vertex shaders
+        static void WorldToVolume(const float* pWorldPosition,
+                                  const float* pVolTranslation,
+                                  const float* pVolScale,
+                                  float* pVolumePosition);
+    private:
+        void unproject(float ndcX, float ndcY, float ndcZ, float* pVolumePosition) const;
+
+        float m_invViewProjMtx[16];
+        int m_width;
+        int m_height;
+        float m_volTranslation[3];
+        float m_volScale[3];
+        float m_extentMin[3];
+        float m_extentMax[3];
+    };
+}
+
+#endif
@@ -0,0 +1,99 @@
+#include "VoxVizCore/SlabThreads.h"
+
+#include <QtCore/QThread>
+
+#include <vector>
+
+using namespace vox;
+
+static size_t s_threadCount = 0;
+
+class SlabThread : public QThread
+{
+private:
+    SlabTask* m_pTask;
+    size_t m_slabIndex;
+    size_t m_start;
+    size_t m_end;
+public:
+    SlabThread(SlabTask* pTask, size_t slabIndex, size_t start, size_t end) :
+        m_pTask(pTask),
+        m_slabIndex(slabIndex),
+        m_start(start),
+        m_end(end)
+    {
+    }
+protected:
+    virtual void run()
+    {
+        m_pTask->runSlab(m_slabIndex, m_start, m_end);
+    }
+};
+
+size_t SlabThreads::GetThreadCount()
+{
+    if(s_threadCount == 0)
+    {
+        int idealThreadCount = QThread::idealThreadCount();
+        s_threadCount = idealThreadCount > 0 ? static_cast<size_t>(idealThreadCount) : 1;
+    }
+    return s_threadCount;
+}
+
+void SlabThreads::SetThreadCount(size_t threadCount)
+{
+    s_threadCount = threadCount;
+}
+
+size_t SlabThreads::GetSlabCount(size_t count, size_t minSlabSize)
+{
+    if(minSlabSize == 0)
+        minSlabSize = 1;
+
+    size_t slabCount = count / minSlabSize;
+    size_t threadCount = GetThreadCount();
+    if(slabCount > threadCount)
+        slabCount = threadCount;
+    if(slabCount == 0)
+        slabCount = 1;
+
+    return slabCount;
+}
+
+void SlabThreads::Run(SlabTask& task, size_t count, size_t minSlabSize)
+{
+    size_t slabCount = GetSlabCount(count, minSlabSize);
+    if(slabCount == 1)
+    {
+        task.runSlab(0, 0, count);
+        return;
+    }
+
+    size_t slabSize = count / slabCount;
+    size_t remainder = count % slabCount;
+
+    std::vector<SlabThread*> threads;
+    threads.reserve(slabCount-1);
+
+    size_t start = 0;
+    for(size_t i = 0; i < slabCount; ++i)
+    {
+        //spread the remainder over the first slabs
+        size_t end = start + slabSize + (i < remainder ? 1 : 0);
+        if(i == slabCount-1)
+            task.runSlab(i, start, end);
+        else
+        {
+            SlabThread* pThread = new SlabThread(&task, i, start, end);
+            pThread->start();
+            threads.push_back(pThread);
+        }
+        start = end;
+    }
+
+    for(size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i]->wait();
+        delete threads[i];
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef VOX_SLAB_THREADS_H
+#define VOX_SLAB_THREADS_H
+
+#include <cstddef>
+
+namespace vox
+{
+    //work that can be split into independent contiguous ranges (e.g. z slabs of a volume)
+    class SlabTask
+    {
+    public:
+        virtual ~SlabTask() {}
+        //process items [start, end), may be called concurrently for different ranges
+        virtual void runSlab(size_t slabIndex, size_t start, size_t end) = 0;
+    };
+
+    class SlabThreads
+    {
+    public:
+        //number of threads used by Run, defaults to QThread::idealThreadCount()
+        static size_t GetThreadCount();
+        static void SetThreadCount(size_t threadCount);
+
+        //returns the number of slabs that Run will split count items into
+        static size_t GetSlabCount(size_t count, size_t minSlabSize=1);
+
+        //splits [0, count) into GetSlabCount() contiguous slabs, runs each on its
+        //own thread (the calling thread runs the last one) and returns when all are done
+        static void Run(SlabTask& task, size_t count, size_t minSlabSize=1);
+    };
+}
+
+#endif
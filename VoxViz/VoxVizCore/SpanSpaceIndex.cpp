@@ -0,0 +1,116 @@
+#include "VoxVizCore/SpanSpaceIndex.h"
+#include "VoxVizCore/MinMaxBlocks.h"
+#include "VoxVizCore/SmartPtr.h"
+
+#include <algorithm>
+
+using namespace vox;
+
+static const MinMaxBlocks::Range& BlockRange(const MinMaxBlocks& blocks, size_t blockIndex)
+{
+    size_t blockX = blockIndex % blocks.blockCountX();
+    size_t blockY = (blockIndex / blocks.blockCountX()) % blocks.blockCountY();
+    size_t blockZ = blockIndex / (blocks.blockCountX() * blocks.blockCountY());
+    return blocks.getRange(blockX, blockY, blockZ);
+}
+
+int SpanSpaceIndex::buildNode(const MinMaxBlocks& blocks, std::vector<size_t>& blockIndices)
+{
+    if(blockIndices.empty())
+        return -1;
+
+    //split at the median min value, the block it belongs to always
+    //contains the split value so every node stores at least one block
+    std::vector<float> minValues(blockIndices.size());
+    for(size_t i = 0; i < blockIndices.size(); ++i)
+        minValues[i] = BlockRange(blocks, blockIndices[i]).minValue;
+    std::vector<float>::iterator median = minValues.begin() + (minValues.size() / 2);
+    std::nth_element(minValues.begin(), median, minValues.end());
+
+    Node node;
+    node.splitValue = *median;
+    node.first = m_byMinValue.size();
+    node.lowChild = node.highChild = -1;
+
+    std::vector<size_t> lowBlocks;
+    std::vector<size_t> highBlocks;
+    for(size_t i = 0; i < blockIndices.size(); ++i)
+    {
+        const MinMaxBlocks::Range& range = BlockRange(blocks, blockIndices[i]);
+        if(range.maxValue <= node.splitValue)
+            lowBlocks.push_back(blockIndices[i]);
+        else if(range.minValue > node.splitValue)
+            highBlocks.push_back(blockIndices[i]);
+        else
+        {
+            Entry minEntry = { range.minValue, blockIndices[i] };
+            Entry maxEntry = { range.maxValue, blockIndices[i] };
+            m_byMinValue.push_back(minEntry);
+            m_byMaxValue.push_back(maxEntry);
+        }
+    }
+    std::vector<size_t>().swap(blockIndices);
+
+    node.count = m_byMinValue.size() - node.first;
+    std::sort(m_byMinValue.begin() + node.first, m_byMinValue.end(), LessValue);
+    std::sort(m_byMaxValue.begin() + node.first, m_byMaxValue.end(), GreaterValue);
+
+    int nodeIndex = static_cast<int>(m_nodes.size());
+    m_nodes.push_back(node);
+
+    int lowChild = buildNode(blocks, lowBlocks);
+    int highChild = buildNode(blocks, highBlocks);
+    m_nodes[nodeIndex].lowChild = lowChild;
+    m_nodes[nodeIndex].highChild = highChild;
+
+    return nodeIndex;
+}
+
+SpanSpaceIndex* SpanSpaceIndex::Build(const MinMaxBlocks& blocks)
+{
+    SmartPtr<SpanSpaceIndex> spIndex = new SpanSpaceIndex();
+
+    std::vector<size_t> blockIndices;
+    size_t blockCount = blocks.blockCountX() * blocks.blockCountY() * blocks.blockCountZ();
+    for(size_t i = 0; i < blockCount; ++i)
+    {
+        const MinMaxBlocks::Range& range = BlockRange(blocks, i);
+        if(range.minValue < range.maxValue)
+            blockIndices.push_back(i);
+    }
+
+    spIndex->buildNode(blocks, blockIndices);
+
+    return spIndex.release();
+}
+
+void SpanSpaceIndex::findBlocks(float value, std::vector<size_t>& blockIndices) const
+{
+    blockIndices.clear();
+
+    int nodeIndex = m_nodes.empty() ? -1 : 0;
+    while(nodeIndex >= 0)
+    {
+        const Node& node = m_nodes[nodeIndex];
+        if(value < node.splitValue)
+        {
+            //every block of the node ends above the split value
+            const Entry* pEntry = &m_byMinValue[node.first];
+            const Entry* pEnd = pEntry + node.count;
+            for(; pEntry != pEnd && pEntry->value <= value; ++pEntry)
+                blockIndices.push_back(pEntry->blockIndex);
+            nodeIndex = node.lowChild;
+        }
+        else
+        {
+            //every block of the node starts at or below the split value
+            const Entry* pEntry = &m_byMaxValue[node.first];
+            const Entry* pEnd = pEntry + node.count;
+            for(; pEntry != pEnd && pEntry->value > value; ++pEntry)
+                blockIndices.push_back(pEntry->blockIndex);
+            nodeIndex = value > node.splitValue ? node.highChild : -1;
+        }
+    }
+
+    std::sort(blockIndices.begin(), blockIndices.end());
+}
@@ -0,0 +1,65 @@
+#ifndef VOX_SPAN_SPACE_INDEX_H
+#define VOX_SPAN_SPACE_INDEX_H
+
+#include "VoxVizCore/Referenced.h"
+
+#include <vector>
+
+namespace vox
+{
+    class MinMaxBlocks;
+
+    //interval tree over the value ranges of the level 0 min max blocks. A
+    //block is active for a value v when minValue <= v < maxValue, the same
+    //test the marching cubes cell classification uses, so finding the active
+    //blocks of an iso level costs O(log n + k) whatever the data looks like.
+    //Blocks of a single value are never active and are left out.
+    class SpanSpaceIndex : public Referenced
+    {
+    private:
+        //the blocks whose range contains splitValue are stored at the node,
+        //blocks entirely below it in the low subtree and above it in the high one
+        struct Node
+        {
+            float splitValue;
+            size_t first;
+            size_t count;
+            int lowChild;
+            int highChild;
+        };
+
+        //block ranges of each node sorted by increasing min value and
+        //by decreasing max value, values and block indices side by side
+        struct Entry
+        {
+            float value;
+            size_t blockIndex;
+        };
+
+        std::vector<Node> m_nodes;
+        std::vector<Entry> m_byMinValue;
+        std::vector<Entry> m_byMaxValue;
+
+        static bool LessValue(const Entry& lhs, const Entry& rhs) { return lhs.value < rhs.value; }
+        static bool GreaterValue(const Entry& lhs, const Entry& rhs) { return lhs.value > rhs.value; }
+
+        SpanSpaceIndex() {}
+        SpanSpaceIndex(const SpanSpaceIndex&);
+        SpanSpaceIndex& operator=(const SpanSpaceIndex&);
+
+        int buildNode(const MinMaxBlocks& blocks, std::vector<size_t>& blockIndices);
+    protected:
+        virtual ~SpanSpaceIndex() {}
+    public:
+        static SpanSpaceIndex* Build(const MinMaxBlocks& blocks);
+
+        //number of blocks that can be active for some value
+        size_t blockCount() const { return m_byMinValue.size(); }
+
+        //indices of the level 0 blocks active for value, sorted so they
+        //are in z, y, x order
+        void findBlocks(float value, std::vector<size_t>& blockIndices) const;
+    };
+}
+
+#endif
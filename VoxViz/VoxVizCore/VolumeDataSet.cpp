@@ -1,9 +1,16 @@
 #include "VoxVizCore/VolumeDataSet.h"
 
 #include "VoxVizCore/DataSetReader.h"
+#include "VoxVizCore/SlabThreads.h"
 
 #include <cmath>
 #include <iostream>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOX_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace vox;
 
@@ -48,33 +55,48 @@ VolumeDataSet::~VolumeDataSet()
     freeVoxels();
 }
 
+template<typename T>
+static void FreeArray(const VolumeDataSet& dataSet, T*& pArray)
+{
+    if(pArray && !dataSet.isMapped(pArray))
+        delete [] pArray;
+    pArray = NULL;
+}
+
 void VolumeDataSet::freeVoxels()
 {
-    if(m_pVoxels)
-    {
-        delete [] m_pVoxels; 
-        m_pVoxels = NULL;
-    }
-    if(m_pVoxelColorsUB)
-    {
-        delete [] m_pVoxelColorsUB;
-        m_pVoxelColorsUB = NULL;
-    }
-    if(m_pVoxelColorsF)
+    FreeArray(*this, m_pVoxels);
+    FreeArray(*this, m_pVoxels16);
+    freeColors();
+    m_spMappedFile = NULL;
+    m_spMinMaxBlocks = NULL;
+    m_spSpanSpaceIndex = NULL;
+}
+
+const MinMaxBlocks* VolumeDataSet::getMinMaxBlocks() const
+{
+    if(!m_spMinMaxBlocks.valid())
+        m_spMinMaxBlocks = MinMaxBlocks::Build(*this);
+    return m_spMinMaxBlocks.get();
+}
+
+const SpanSpaceIndex* VolumeDataSet::getSpanSpaceIndex() const
+{
+    if(!m_spSpanSpaceIndex.valid())
     {
-        delete [] m_pVoxelColorsF;
-        m_pVoxelColorsF = NULL;
+        const MinMaxBlocks* pMinMaxBlocks = getMinMaxBlocks();
+        if(pMinMaxBlocks != NULL)
+            m_spSpanSpaceIndex = SpanSpaceIndex::Build(*pMinMaxBlocks);
     }
+    return m_spSpanSpaceIndex.get();
 }
 
-static float GetAlpha(Vec4ub* pVoxelColors, 
-                size_t dimX, size_t dimY, 
-                size_t x, size_t y, size_t z)
+void VolumeDataSet::freeColors()
 {
-    size_t index = (z * dimY * dimX) + (y * dimX) + x;
-    unsigned char alpha = pVoxelColors[index].a;
-
-    return static_cast<float>(alpha) / 255.0f;
+    FreeArray(*this, m_pVoxelColorsUB);
+    FreeArray(*this, m_pVoxelColorsF);
+    if(m_pVoxels == NULL && m_pVoxels16 == NULL)
+        m_spMappedFile = NULL;
 }
 
 void VolumeDataSet::generateFromSubVolumes()
@@ -109,106 +131,385 @@ void VolumeDataSet::generateFromSubVolumes()
                 unsigned int rangeX = subVol.rangeStartX();
                 unsigned int writeIndex = (rangeZ * m_dimY * m_dimX) + (rangeY * m_dimX) + rangeX;
                 
-                Voxels* pWritePtr = &m_pVoxels[writeIndex];
-                memcpy(pWritePtr, pReadPtr, readRowSize);
+                if(m_voxelLayout == VOXEL_LAYOUT_LINEAR)
+                {
+                    Voxels* pWritePtr = &m_pVoxels[writeIndex];
+                    memcpy(pWritePtr, pReadPtr, readRowSize);
+                }
+                else
+                {
+                    for(unsigned int x = 0; x < xSize; ++x)
+                        m_pVoxels[voxelIndex(rangeX + x, rangeY, rangeZ)] = pReadPtr[x];
+                }
             }
         }
     }
 }
 
-void VolumeDataSet::convert(const VolumeDataSet::ColorLUT& colorLUT,
-                            Vec4ub* pVoxelColors,
-                            Vec3f* pVoxelGrads/*=NULL*/) const
-{
-    size_t voxelCount = m_dimX * m_dimY * m_dimZ;
-    
-    for(size_t index = 0; 
-        index < voxelCount; 
-        ++index)
-    {
-         const vox::VolumeDataSet::Voxels& voxel = m_pVoxels[index];
-         float voxelFloat = (static_cast<float>(voxel) / 255.0f);
-         size_t voxelBase = static_cast<size_t>(voxelFloat * (colorLUT.size()-1));
-         size_t voxelNext = voxelBase < colorLUT.size()-1 ? voxelBase+1 : voxelBase;
-
-         float voxelInterp = 1.0f - (voxelFloat - std::floor(voxelFloat));
-         QVector4D color = (colorLUT.at(voxelBase)*voxelInterp) 
-                            + (colorLUT.at(voxelNext)*(1.0f - voxelInterp));
-         
-         pVoxelColors[index].r = static_cast<unsigned char>((color.x() * 255.0));
-         pVoxelColors[index].g = static_cast<unsigned char>((color.y() * 255.0));
-         pVoxelColors[index].b = static_cast<unsigned char>((color.z() * 255.0));
-         pVoxelColors[index].a = static_cast<unsigned char>((color.w() * 255.0));
-    }
+namespace
+{
+    template<typename VoxelType, typename SrcIndexer, typename DstIndexer>
+    class ReorderSlabTask : public SlabTask
+    {
+    private:
+        const VoxelType* m_pSrc;
+        VoxelType* m_pDst;
+        size_t m_dimX;
+        size_t m_dimY;
+        size_t m_dimZ;
+        SrcIndexer m_srcIndex;
+        DstIndexer m_dstIndex;
+    public:
+        ReorderSlabTask(const VoxelType* pSrc, VoxelType* pDst,
+                        size_t dimX, size_t dimY, size_t dimZ) :
+            m_pSrc(pSrc),
+            m_pDst(pDst),
+            m_dimX(dimX),
+            m_dimY(dimY),
+            m_dimZ(dimZ),
+            m_srcIndex(dimX, dimY, dimZ),
+            m_dstIndex(dimX, dimY, dimZ)
+        {
+        }
 
-    if(pVoxelGrads == NULL)
+        //the slabs are counted in whole bricks so that two threads never
+        //write to the same brick
+        virtual void runSlab(size_t, size_t startBrickZ, size_t endBrickZ)
+        {
+            size_t startZ = startBrickZ << VolumeDataSet::k_BrickDimLog2;
+            size_t endZ = std::min(endBrickZ << VolumeDataSet::k_BrickDimLog2, m_dimZ);
+            for(size_t z = startZ; z < endZ; ++z)
+            {
+                for(size_t y = 0; y < m_dimY; ++y)
+                {
+                    for(size_t x = 0; x < m_dimX; ++x)
+                        m_pDst[m_dstIndex(x, y, z)] = m_pSrc[m_srcIndex(x, y, z)];
+                }
+            }
+        }
+    };
+}
+
+template<typename VoxelType, typename SrcIndexer, typename DstIndexer>
+static void ReorderVoxels(const VoxelType* pSrc, VoxelType* pDst,
+                          size_t dimX, size_t dimY, size_t dimZ)
+{
+    ReorderSlabTask<VoxelType, SrcIndexer, DstIndexer> task(pSrc, pDst, dimX, dimY, dimZ);
+    size_t brickCountZ = (dimZ + VolumeDataSet::k_BrickMask) >> VolumeDataSet::k_BrickDimLog2;
+    SlabThreads::Run(task, brickCountZ);
+}
+
+template<typename VoxelType>
+static VoxelType* ReorderVoxels(const VoxelType* pSrc,
+                                VolumeDataSet::VoxelLayout srcLayout,
+                                VolumeDataSet::VoxelLayout dstLayout,
+                                size_t dstCount,
+                                size_t dimX, size_t dimY, size_t dimZ)
+{
+    //value initialized so that the padding of partial bricks is zero
+    VoxelType* pDst = new VoxelType[dstCount]();
+    if(srcLayout == VolumeDataSet::VOXEL_LAYOUT_LINEAR)
+        ReorderVoxels<VoxelType, 
+                      VolumeDataSet::LinearIndexer, 
+                      VolumeDataSet::BrickedIndexer>(pSrc, pDst, dimX, dimY, dimZ);
+    else
+        ReorderVoxels<VoxelType, 
+                      VolumeDataSet::BrickedIndexer, 
+                      VolumeDataSet::LinearIndexer>(pSrc, pDst, dimX, dimY, dimZ);
+    return pDst;
+}
+
+void VolumeDataSet::setVoxelLayout(VoxelLayout layout)
+{
+    if(layout == m_voxelLayout)
         return;
 
-    for(size_t z = 0; z < m_dimZ; ++z)
+    VoxelLayout oldLayout = m_voxelLayout;
+    m_voxelLayout = layout;
+    size_t count = voxelStorageCount();
+
+    //the old arrays may be mapped, FreeArray only deletes heap arrays
+    if(m_pVoxels != NULL)
+    {
+        Voxels* pVoxels = ReorderVoxels(m_pVoxels, oldLayout, layout, count, m_dimX, m_dimY, m_dimZ);
+        FreeArray(*this, m_pVoxels);
+        m_pVoxels = pVoxels;
+    }
+    if(m_pVoxels16 != NULL)
+    {
+        Voxels16* pVoxels16 = ReorderVoxels(m_pVoxels16, oldLayout, layout, count, m_dimX, m_dimY, m_dimZ);
+        FreeArray(*this, m_pVoxels16);
+        m_pVoxels16 = pVoxels16;
+    }
+}
+
+void VolumeDataSet::copyLinearVoxels(void* pDest) const
+{
+    if(m_voxelLayout == VOXEL_LAYOUT_LINEAR)
+    {
+        memcpy(pDest, getRawData(), m_dimX * m_dimY * m_dimZ * getVoxelSize());
+    }
+    else if(m_voxelFormat == VOXEL_FORMAT_USHORT)
+    {
+        ReorderVoxels<Voxels16, BrickedIndexer, LinearIndexer>(m_pVoxels16, 
+                                                               static_cast<Voxels16*>(pDest), 
+                                                               m_dimX, m_dimY, m_dimZ);
+    }
+    else
+    {
+        ReorderVoxels<Voxels, BrickedIndexer, LinearIndexer>(m_pVoxels, 
+                                                             static_cast<Voxels*>(pDest), 
+                                                             m_dimX, m_dimY, m_dimZ);
+    }
+}
+
+namespace
+{
+    //colors and alphas for every possible voxel value (256 or 65536 entries)
+    struct ConvertTables
+    {
+        std::vector<Vec4ub> colors;
+        std::vector<float> alphas;
+    };
+
+    template<typename VoxelType, typename Indexer>
+    class ConvertSlabTask : public SlabTask
+    {
+    private:
+        const VoxelType* m_pVoxels;
+        Indexer m_indexer;
+        size_t m_dimX;
+        size_t m_dimY;
+        size_t m_dimZ;
+        const ConvertTables& m_tables;
+        Vec4ub* m_pVoxelColors;
+        OctNormal* m_pVoxelNormals;
+    public:
+        ConvertSlabTask(const VoxelType* pVoxels,
+                        size_t dimX, size_t dimY, size_t dimZ,
+                        const ConvertTables& tables,
+                        Vec4ub* pVoxelColors,
+                        OctNormal* pVoxelNormals) :
+            m_pVoxels(pVoxels),
+            m_indexer(dimX, dimY, dimZ),
+            m_dimX(dimX),
+            m_dimY(dimY),
+            m_dimZ(dimZ),
+            m_tables(tables),
+            m_pVoxelColors(pVoxelColors),
+            m_pVoxelNormals(pVoxelNormals)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t startZ, size_t endZ);
+    };
+}
+
+static void BuildConvertTables(const VolumeDataSet& dataSet,
+                               const VolumeDataSet::ColorLUT& colorLUT,
+                               ConvertTables& tables)
+{
+    bool is16Bit = dataSet.getVoxelFormat() == VolumeDataSet::VOXEL_FORMAT_USHORT;
+    size_t valueCount = is16Bit ? 65536 : 256;
+    tables.colors.resize(valueCount);
+    tables.alphas.resize(valueCount);
+
+    for(size_t voxel = 0; voxel < valueCount; ++voxel)
+    {
+        float voxelFloat = is16Bit ? 
+            dataSet.normalizeValue16(static_cast<VolumeDataSet::Voxels16>(voxel)) :
+            (static_cast<float>(voxel) / 255.0f);
+        size_t voxelBase = static_cast<size_t>(voxelFloat * (colorLUT.size()-1));
+        size_t voxelNext = voxelBase < colorLUT.size()-1 ? voxelBase+1 : voxelBase;
+
+        float voxelInterp = 1.0f - (voxelFloat - std::floor(voxelFloat));
+        QVector4D color = (colorLUT.at(voxelBase)*voxelInterp) 
+                           + (colorLUT.at(voxelNext)*(1.0f - voxelInterp));
+
+        Vec4ub& voxelColor = tables.colors[voxel];
+        voxelColor.r = static_cast<unsigned char>((color.x() * 255.0));
+        voxelColor.g = static_cast<unsigned char>((color.y() * 255.0));
+        voxelColor.b = static_cast<unsigned char>((color.z() * 255.0));
+        voxelColor.a = static_cast<unsigned char>((color.w() * 255.0));
+
+        tables.alphas[voxel] = static_cast<float>(voxelColor.a) / 255.0f;
+    }
+}
+
+#ifdef VOX_USE_SSE2
+//x * invLength for 4 floats, the product is taken in double precision
+static inline __m128 ScaleGradients(__m128 x, __m128d invLengthLo, __m128d invLengthHi)
+{
+    __m128d xLo = _mm_mul_pd(_mm_cvtps_pd(x), invLengthLo);
+    __m128d xHi = _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), invLengthHi);
+    return _mm_movelh_ps(_mm_cvtpd_ps(xLo), _mm_cvtpd_ps(xHi));
+}
+#endif
+
+//scales count gradients stored as separate x, y and z arrays to unit length,
+//zero gradients stay zero. count must be a multiple of 4. The length is
+//taken in double precision like QVector3D::normalize so the encoded normals
+//do not change.
+static void NormalizeGradients(float* pX, float* pY, float* pZ, size_t count)
+{
+#ifdef VOX_USE_SSE2
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128 zero = _mm_setzero_ps();
+    for(size_t i = 0; i < count; i += 4)
+    {
+        __m128 x = _mm_load_ps(pX + i);
+        __m128 y = _mm_load_ps(pY + i);
+        __m128 z = _mm_load_ps(pZ + i);
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), 
+                                                _mm_mul_ps(y, y)), 
+                                     _mm_mul_ps(z, z));
+        //zero lengths give 1/0 = inf, they are masked back to zero afterwards
+        __m128d invLengthLo = _mm_div_pd(one, _mm_sqrt_pd(_mm_cvtps_pd(lengthSq)));
+        __m128d invLengthHi = _mm_div_pd(one, _mm_sqrt_pd(_mm_cvtps_pd(_mm_movehl_ps(lengthSq, lengthSq))));
+        __m128 nonZero = _mm_cmpgt_ps(lengthSq, zero);
+        _mm_store_ps(pX + i, _mm_and_ps(ScaleGradients(x, invLengthLo, invLengthHi), nonZero));
+        _mm_store_ps(pY + i, _mm_and_ps(ScaleGradients(y, invLengthLo, invLengthHi), nonZero));
+        _mm_store_ps(pZ + i, _mm_and_ps(ScaleGradients(z, invLengthLo, invLengthHi), nonZero));
+    }
+#else
+    for(size_t i = 0; i < count; ++i)
+    {
+        float lengthSq = (pX[i] * pX[i]) + (pY[i] * pY[i]) + (pZ[i] * pZ[i]);
+        double invLength = lengthSq > 0.0f ? 1.0 / std::sqrt(static_cast<double>(lengthSq)) : 0.0;
+        pX[i] = static_cast<float>(pX[i] * invLength);
+        pY[i] = static_cast<float>(pY[i] * invLength);
+        pZ[i] = static_cast<float>(pZ[i] * invLength);
+    }
+#endif
+}
+
+//16 byte aligned row of floats for NormalizeGradients, padded to a multiple of 4
+class GradientRow
+{
+private:
+    std::vector<float> m_data;
+    float* m_pAligned;
+    size_t m_count;
+public:
+    GradientRow(size_t count) :
+        m_data(((count + 3) & ~static_cast<size_t>(3)) + 3, 0.0f),
+        m_count((count + 3) & ~static_cast<size_t>(3))
+    {
+        size_t misalignment = (reinterpret_cast<size_t>(&m_data[0]) >> 2) & 3;
+        m_pAligned = &m_data[0] + ((4 - misalignment) & 3);
+    }
+
+    float* data() { return m_pAligned; }
+    size_t paddedCount() const { return m_count; }
+};
+
+template<typename VoxelType, typename Indexer>
+void ConvertSlabTask<VoxelType, Indexer>::runSlab(size_t, size_t startZ, size_t endZ)
+{
+    const size_t sliceSize = m_dimX * m_dimY;
+    const Vec4ub* pColorTable = &m_tables.colors[0];
+    const float* pAlphaTable = &m_tables.alphas[0];
+    const VoxelType* pVoxels = m_pVoxels;
+    const Indexer& index = m_indexer;
+
+    //central differences of a row, normalized together before they are encoded
+    GradientRow gradientRowX(m_dimX);
+    GradientRow gradientRowY(m_dimX);
+    GradientRow gradientRowZ(m_dimX);
+    float* pGradX = gradientRowX.data();
+    float* pGradY = gradientRowY.data();
+    float* pGradZ = gradientRowZ.data();
+
+    for(size_t z = startZ; z < endZ; ++z)
     {
         for(size_t y = 0; y < m_dimY; ++y)
         {
-            for(size_t x = 0; x < m_dimX; ++x)
-            {
-                vox::Vec3f sample1;
-                vox::Vec3f sample2;
-                if(x == 0)//clamp to border
-                    sample1.x = 0.0f;
-                else
-                    sample1.x = GetAlpha(pVoxelColors, 
-                                         m_dimX, m_dimY,
-                                         x-1, y, z);
+            //the colors and normals are always linear, the voxels are in the indexer's layout
+            size_t rowIndex = (z * sliceSize) + (y * m_dimX);
 
-                if(x == m_dimX-1)
-                    sample2.x = 0.0f;
-                else
-                    sample2.x = GetAlpha(pVoxelColors, 
-                                         m_dimX, m_dimY,
-                                         x+1, y, z);
-                if(y == 0)
-                    sample1.y = 0.0f;
-                else
-                    sample1.y = GetAlpha(pVoxelColors, 
-                                         m_dimX, m_dimY,
-                                         x, y-1, z);
+            Vec4ub* pColorRow = &m_pVoxelColors[rowIndex];
+            for(size_t x = 0; x < m_dimX; ++x)
+                pColorRow[x] = pColorTable[pVoxels[index(x, y, z)]];
 
-                if(y == m_dimY-1)
-                    sample2.y = 0.0f;
-                else
-                    sample2.y = GetAlpha(pVoxelColors, 
-                                         m_dimX, m_dimY,
-                                         x, y+1, z);
+            if(m_pVoxelNormals == NULL)
+                continue;
 
-                if(z == 0)
-                    sample1.z = 0.0f;
-                else
-                    sample1.z = GetAlpha(pVoxelColors, 
-                                         m_dimX, m_dimY,
-                                         x, y, z-1);
+            //alpha of the neighbors is looked up straight from the voxels so
+            //this does not depend on colors written by other slabs
+            bool hasBelow = y > 0;
+            bool hasAbove = y < m_dimY-1;
+            bool hasBehind = z > 0;
+            bool hasInFront = z < m_dimZ-1;
 
-                if(z == m_dimZ-1)
-                    sample2.z = 0.0f;
-                else
-                    sample2.z = GetAlpha(pVoxelColors, 
-                                         m_dimX, m_dimY,
-                                         x, y, z+1);
-
-                QVector3D normal;
-                normal.setX(sample1.x - sample2.x);
-                normal.setY(sample1.y - sample2.y);
-                normal.setZ(sample1.z - sample2.z);
-                qreal len = normal.length();
-                if(len > 0)
-                    normal /= len;
-                else
-                {
-                    normal.setX(0);
-                    normal.setY(0);
-                    normal.setZ(0);
-                }
+            for(size_t x = 0; x < m_dimX; ++x)
+            {
+                //clamp to border
+                float sample1X = x == 0 ? 0.0f : pAlphaTable[pVoxels[index(x-1, y, z)]];
+                float sample2X = x == m_dimX-1 ? 0.0f : pAlphaTable[pVoxels[index(x+1, y, z)]];
+                float sample1Y = hasBelow ? pAlphaTable[pVoxels[index(x, y-1, z)]] : 0.0f;
+                float sample2Y = hasAbove ? pAlphaTable[pVoxels[index(x, y+1, z)]] : 0.0f;
+                float sample1Z = hasBehind ? pAlphaTable[pVoxels[index(x, y, z-1)]] : 0.0f;
+                float sample2Z = hasInFront ? pAlphaTable[pVoxels[index(x, y, z+1)]] : 0.0f;
 
-                pVoxelGrads[(z * m_dimY * m_dimX) + (y * m_dimX) + x] = Vec3f(normal);
+                pGradX[x] = sample1X - sample2X;
+                pGradY[x] = sample1Y - sample2Y;
+                pGradZ[x] = sample1Z - sample2Z;
             }
+
+            NormalizeGradients(pGradX, pGradY, pGradZ, gradientRowX.paddedCount());
+
+            OctNormal* pNormalRow = &m_pVoxelNormals[rowIndex];
+            for(size_t x = 0; x < m_dimX; ++x)
+                pNormalRow[x] = EncodeOctNormal(pGradX[x], pGradY[x], pGradZ[x]);
         }
     }
 }
+
+template<typename VoxelType>
+static void RunConvert(const VoxelType* pVoxels,
+                       VolumeDataSet::VoxelLayout layout,
+                       size_t dimX, size_t dimY, size_t dimZ,
+                       const ConvertTables& tables,
+                       Vec4ub* pVoxelColors,
+                       OctNormal* pVoxelNormals,
+                       size_t minSlabSize)
+{
+    if(layout == VolumeDataSet::VOXEL_LAYOUT_BRICKED)
+    {
+        ConvertSlabTask<VoxelType, VolumeDataSet::BrickedIndexer> task(pVoxels,
+                                                                       dimX, dimY, dimZ,
+                                                                       tables,
+                                                                       pVoxelColors,
+                                                                       pVoxelNormals);
+        SlabThreads::Run(task, dimZ, minSlabSize);
+    }
+    else
+    {
+        ConvertSlabTask<VoxelType, VolumeDataSet::LinearIndexer> task(pVoxels,
+                                                                      dimX, dimY, dimZ,
+                                                                      tables,
+                                                                      pVoxelColors,
+                                                                      pVoxelNormals);
+        SlabThreads::Run(task, dimZ, minSlabSize);
+    }
+}
+
+void VolumeDataSet::convert(const VolumeDataSet::ColorLUT& colorLUT,
+                            Vec4ub* pVoxelColors,
+                            OctNormal* pVoxelNormals/*=NULL*/) const
+{
+    //the lut is applied through a table of all 256 (or 65536) voxel values and the
+    //gradients are computed in the same sweep, one z slab per thread
+    ConvertTables tables;
+    BuildConvertTables(*this, colorLUT, tables);
+
+    //keep slabs large enough that thread start up is not the bottleneck
+    size_t minSlabSize = (256 * 256) / std::max(m_dimX * m_dimY, static_cast<size_t>(1)) + 1;
+
+    if(m_voxelFormat == VOXEL_FORMAT_USHORT)
+        RunConvert(m_pVoxels16, m_voxelLayout, m_dimX, m_dimY, m_dimZ, 
+                   tables, pVoxelColors, pVoxelNormals, minSlabSize);
+    else
+        RunConvert(m_pVoxels, m_voxelLayout, m_dimX, m_dimY, m_dimZ, 
+                   tables, pVoxelColors, pVoxelNormals, minSlabSize);
+}
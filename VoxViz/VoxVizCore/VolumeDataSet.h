@@ -3,9 +3,15 @@
 
 #include <VoxVizCore/Referenced.h>
 #include <VoxVizCore/SceneObject.h>
+#include <VoxVizCore/OctNormal.h>
+#include <VoxVizCore/MappedFile.h>
+#include <VoxVizCore/MinMaxBlocks.h>
+#include <VoxVizCore/SpanSpaceIndex.h>
+#include <VoxVizCore/SmartPtr.h>
 
 #include <vector>
 #include <algorithm>
+#include <cassert>
 
 namespace vox
 {
@@ -49,6 +55,68 @@ namespace vox
     {
     public:
         typedef unsigned char Voxels;
+        typedef unsigned short Voxels16;
+
+        enum VoxelFormat
+        {
+            VOXEL_FORMAT_UBYTE,//m_pVoxels
+            VOXEL_FORMAT_USHORT//m_pVoxels16
+        };
+
+        //order of the voxels in m_pVoxels/m_pVoxels16, colors are always linear
+        enum VoxelLayout
+        {
+            VOXEL_LAYOUT_LINEAR,//x, then y, then z
+            VOXEL_LAYOUT_BRICKED//k_BrickDim^3 bricks, each brick and the bricks themselves linear
+        };
+
+        static const size_t k_BrickDimLog2 = 3;
+        static const size_t k_BrickDim = 1 << k_BrickDimLog2;
+        static const size_t k_BrickMask = k_BrickDim - 1;
+
+        //voxel index functors so that the hot loops can be templated on the layout
+        class LinearIndexer
+        {
+        private:
+            size_t m_dimX;
+            size_t m_sliceSize;
+        public:
+            LinearIndexer(size_t dimX, size_t dimY, size_t) : 
+                m_dimX(dimX), 
+                m_sliceSize(dimX * dimY) 
+            {
+            }
+
+            size_t operator()(size_t x, size_t y, size_t z) const
+            {
+                return (z * m_sliceSize) + (y * m_dimX) + x;
+            }
+        };
+
+        class BrickedIndexer
+        {
+        private:
+            size_t m_bricksX;
+            size_t m_brickSliceSize;
+        public:
+            BrickedIndexer(size_t dimX, size_t dimY, size_t) :
+                m_bricksX((dimX + k_BrickMask) >> k_BrickDimLog2),
+                m_brickSliceSize(m_bricksX * ((dimY + k_BrickMask) >> k_BrickDimLog2))
+            {
+            }
+
+            size_t operator()(size_t x, size_t y, size_t z) const
+            {
+                size_t brick = ((z >> k_BrickDimLog2) * m_brickSliceSize)
+                                + ((y >> k_BrickDimLog2) * m_bricksX)
+                                + (x >> k_BrickDimLog2);
+                size_t brickVoxel = ((z & k_BrickMask) << (2 * k_BrickDimLog2))
+                                     | ((y & k_BrickMask) << k_BrickDimLog2)
+                                     | (x & k_BrickMask);
+                return (brick << (3 * k_BrickDimLog2)) | brickVoxel;
+            }
+        };
+
         class SubVolume
         {
         public:
@@ -159,9 +227,22 @@ namespace vox
         size_t m_dimY;
         size_t m_dimZ;
         size_t m_numSamples;
+        VoxelFormat m_voxelFormat;
+        VoxelLayout m_voxelLayout;
+        //built once from the dimensions so voxel access does not recompute them
+        LinearIndexer m_linearIndexer;
+        BrickedIndexer m_brickedIndexer;
         Voxels* m_pVoxels;
+        Voxels16* m_pVoxels16;
+        //range of the 16 bit values that is mapped to [0, 1]
+        unsigned int m_voxelValueMin;
+        unsigned int m_voxelValueMax;
         Vec4ub* m_pVoxelColorsUB;
         Vec4f* m_pVoxelColorsF;
+        //voxel and color arrays that point into this mapping are not owned
+        SmartPtr<MappedFile> m_spMappedFile;
+        mutable SmartPtr<MinMaxBlocks> m_spMinMaxBlocks;
+        mutable SmartPtr<SpanSpaceIndex> m_spSpanSpaceIndex;
         std::vector<SubVolume> m_voxelSubVolumes;
     public:
         VolumeDataSet(const std::string& filename,
@@ -182,7 +263,14 @@ namespace vox
             m_dimY(dimY),
             m_dimZ(dimZ),
             m_numSamples(0),
+            m_voxelFormat(VOXEL_FORMAT_UBYTE),
+            m_voxelLayout(VOXEL_LAYOUT_LINEAR),
+            m_linearIndexer(dimX, dimY, dimZ),
+            m_brickedIndexer(dimX, dimY, dimZ),
             m_pVoxels(NULL),
+            m_pVoxels16(NULL),
+            m_voxelValueMin(0),
+            m_voxelValueMax(0xFFFF),
             m_pVoxelColorsUB(NULL),
             m_pVoxelColorsF(NULL)
         {
@@ -190,8 +278,8 @@ namespace vox
 
         void initVoxels()
         {
-            m_pVoxels = new Voxels[dimX() * dimY() * dimZ()];
-            memset(m_pVoxels, 0, sizeof(Voxels) * dimX() * dimY() * dimZ());
+            m_pVoxels = new Voxels[voxelStorageCount()];
+            memset(m_pVoxels, 0, sizeof(Voxels) * voxelStorageCount());
         }
 
         void addSubVolume(const SubVolume& subVolume)
@@ -230,7 +318,14 @@ namespace vox
             m_dimY(0),
             m_dimZ(0),
             m_numSamples(0),
+            m_voxelFormat(VOXEL_FORMAT_UBYTE),
+            m_voxelLayout(VOXEL_LAYOUT_LINEAR),
+            m_linearIndexer(0, 0, 0),
+            m_brickedIndexer(0, 0, 0),
             m_pVoxels(NULL),
+            m_pVoxels16(NULL),
+            m_voxelValueMin(0),
+            m_voxelValueMax(0xFFFF),
             m_pVoxelColorsUB(NULL),
             m_pVoxelColorsF(NULL)
         {
@@ -254,48 +349,178 @@ namespace vox
         }
 
         void freeVoxels();
+        //frees the color arrays only, e.g. once they have been uploaded
+        void freeColors();
+
+        //the voxels or colors can point into a read only file mapping rather than
+        //owning heap arrays, set the mapping before the pointers into it
+        void setMappedFile(MappedFile* pMappedFile) { m_spMappedFile = pMappedFile; }
+        const MappedFile* getMappedFile() const { return m_spMappedFile.get(); }
+        bool isMapped(const void* pData) const
+        {
+            return m_spMappedFile.valid() && pData != NULL && m_spMappedFile->contains(pData);
+        }
+
+        //value ranges of blocks of voxels, built from the voxels on first use.
+        //Call it once before sharing the data set between threads.
+        const MinMaxBlocks* getMinMaxBlocks() const;
+        //interval tree over the min max blocks, same rules as getMinMaxBlocks
+        const SpanSpaceIndex* getSpanSpaceIndex() const;
 
         size_t dimX() const { return m_dimX; }
         size_t dimY() const { return m_dimY; }
         size_t dimZ() const { return m_dimZ; }
 
+        double scaleX() const { return m_scaleX; }
+        double scaleY() const { return m_scaleY; }
+        double scaleZ() const { return m_scaleZ; }
+
         virtual BoundingSphere computeBoundingSphere() const;
 
         virtual BoundingBox computeBoundingBox() const;
 
+        //8 bit value of the voxel, 16 bit voxels are normalized over their value range
         unsigned char value(size_t x, size_t y, size_t z) const
         {
             return (*this)(x, y, z);
         }
 
+        //only for 8 bit volumes
         unsigned char& value(size_t x, size_t y, size_t z)
         {
             return (*this)(x, y, z);
         }
 
+        VoxelLayout getVoxelLayout() const { return m_voxelLayout; }
+        //reorders the voxels in place, the bricked layout keeps neighbors
+        //in all three directions close together in memory
+        void setVoxelLayout(VoxelLayout layout);
+
+        //number of voxels allocated, bricked volumes are padded to whole bricks
+        size_t voxelStorageCount() const
+        {
+            if(m_voxelLayout == VOXEL_LAYOUT_BRICKED)
+            {
+                return ((m_dimX + k_BrickMask) >> k_BrickDimLog2)
+                        * ((m_dimY + k_BrickMask) >> k_BrickDimLog2)
+                        * ((m_dimZ + k_BrickMask) >> k_BrickDimLog2)
+                        * k_BrickDim * k_BrickDim * k_BrickDim;
+            }
+            return m_dimX * m_dimY * m_dimZ;
+        }
+
+        const LinearIndexer& getLinearIndexer() const { return m_linearIndexer; }
+        const BrickedIndexer& getBrickedIndexer() const { return m_brickedIndexer; }
+
+        size_t voxelIndex(size_t x, size_t y, size_t z) const
+        {
+            if(m_voxelLayout == VOXEL_LAYOUT_BRICKED)
+                return m_brickedIndexer(x, y, z);
+            return m_linearIndexer(x, y, z);
+        }
+
         float valueAsFloat(size_t x, size_t y, size_t z) const
         {
-            return static_cast<float>((*this)(x, y, z)) / 255.0f;
+            return valueAsFloatAt(voxelIndex(x, y, z));
+        }
+
+        //for loops templated on the layout, indexer must match getVoxelLayout()
+        template<typename Indexer>
+        float valueAsFloat(const Indexer& indexer, size_t x, size_t y, size_t z) const
+        {
+            return valueAsFloatAt(indexer(x, y, z));
         }
 
+        float valueAsFloatAt(size_t index) const
+        {
+            if(m_voxelFormat == VOXEL_FORMAT_USHORT)
+                return normalizeValue16(m_pVoxels16[index]);
+
+            return static_cast<float>(m_pVoxels[index]) / 255.0f;
+        }
+
+        //maps a 16 bit value to [0, 1] using the voxel value range
+        float normalizeValue16(Voxels16 value) const
+        {
+            if(value <= m_voxelValueMin || m_voxelValueMax <= m_voxelValueMin)
+                return 0.0f;
+            if(value >= m_voxelValueMax)
+                return 1.0f;
+
+            return static_cast<float>(value - m_voxelValueMin) 
+                    / static_cast<float>(m_voxelValueMax - m_voxelValueMin);
+        }
+
+        //8 bit value of the voxel, 16 bit voxels are normalized over their
+        //value range. Use valueAsFloat to keep their precision.
         unsigned char operator()(size_t x, size_t y, size_t z) const
         {
-            return m_pVoxels[(z * dimY() * dimX()) + (y * dimX()) + x];
+            size_t index = voxelIndex(x, y, z);
+            if(m_voxelFormat == VOXEL_FORMAT_USHORT)
+                return static_cast<unsigned char>((normalizeValue16(m_pVoxels16[index]) * 255.0f) + 0.5f);
+
+            return m_pVoxels[index];
         }
 
+        //raw 8 bit access for writing voxels, 16 bit volumes have no 8 bit voxels
         unsigned char& operator()(size_t x, size_t y, size_t z)
         {
-            return m_pVoxels[(z * dimY() * dimX()) + (y * dimX()) + x];
+            assert(m_voxelFormat == VOXEL_FORMAT_UBYTE && m_pVoxels != NULL);
+            return m_pVoxels[voxelIndex(x, y, z)];
         }
 
         QVector3D xyz(size_t x, size_t y, size_t z) const;
 
+        //the min max blocks and span space index are rebuilt for the new voxels
         void setData(Voxels* pData)
         {
+            m_voxelFormat = VOXEL_FORMAT_UBYTE;
             m_pVoxels = pData;
+            m_spMinMaxBlocks = NULL;
+            m_spSpanSpaceIndex = NULL;
         }
 
+        void setData(Voxels16* pData,
+                     unsigned int valueMin=0,
+                     unsigned int valueMax=0xFFFF)
+        {
+            m_voxelFormat = VOXEL_FORMAT_USHORT;
+            m_pVoxels16 = pData;
+            m_voxelValueMin = valueMin;
+            m_voxelValueMax = valueMax;
+            m_spMinMaxBlocks = NULL;
+            m_spSpanSpaceIndex = NULL;
+        }
+
+        VoxelFormat getVoxelFormat() const { return m_voxelFormat; }
+        size_t getVoxelSize() const 
+        { 
+            return m_voxelFormat == VOXEL_FORMAT_USHORT ? sizeof(Voxels16) : sizeof(Voxels); 
+        }
+
+        void getVoxelValueRange(unsigned int& valueMin, unsigned int& valueMax) const
+        {
+            valueMin = m_voxelValueMin;
+            valueMax = m_voxelValueMax;
+        }
+
+        //8 bit voxels, NULL if the voxels are 16 bit. The raw arrays are in
+        //getVoxelLayout() order, use copyLinearVoxels where linear data is needed
         const Voxels* getData() const { return m_pVoxels; }
+        Voxels* getData() { return m_pVoxels; }
+        //16 bit voxels, NULL if the voxels are 8 bit
+        const Voxels16* getData16() const { return m_pVoxels16; }
+        //copies the voxels to pDest in linear order, pDest must hold
+        //dimX*dimY*dimZ voxels of getVoxelSize() bytes
+        void copyLinearVoxels(void* pDest) const;
+
+        //voxels in whichever format they are stored (see getVoxelFormat)
+        const void* getRawData() const 
+        { 
+            return m_voxelFormat == VOXEL_FORMAT_USHORT ? 
+                        static_cast<const void*>(m_pVoxels16) : 
+                        static_cast<const void*>(m_pVoxels); 
+        }
 
         void setColors(Vec4ub* pColors)
         {
@@ -322,9 +547,11 @@ namespace vox
         }
 
         typedef std::vector<QVector4D> ColorLUT;
+        //applies colorLUT to the voxels and, if pVoxelNormals is not NULL, computes
+        //the normalized gradient of the resulting alpha (octahedral encoded)
         void convert(const VolumeDataSet::ColorLUT& colorLUT,
                      Vec4ub* pVoxelColors,
-                     Vec3f* pVoxelGrads=NULL) const;
+                     OctNormal* pVoxelNormals=NULL) const;
 
     private:
         ~VolumeDataSet();
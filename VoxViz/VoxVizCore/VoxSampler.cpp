@@ -1,101 +1,240 @@
 #include "VoxVizCore/VoxSampler.h"
 
+#include <algorithm>
+
 using namespace vox;
 
+static const size_t k_NoPlane = static_cast<size_t>(-1);
+
 VoxSampler::VoxSampler(VolumeDataSet& dataSet,
                        size_t sampleStride,
                        size_t sampleCount) :
     m_pDataSet(&dataSet),
-    m_sampleStride(sampleStride),
-    m_curSampleX(0),
-    m_curSampleY(0),
-    m_curSampleZ(0)
+    m_sampleStride(std::max(sampleStride, static_cast<size_t>(1))),
+    m_cellsX(0),
+    m_cellsY(0),
+    m_cellsZ(0),
+    m_curCellX(0),
+    m_curCellY(0),
+    m_curCellZ(0)
 {
+    reset();
 }
 
-bool VoxSampler::getNextSample(VoxSample& sample)
+static size_t CellCount(size_t dim, size_t stride)
+{
+    if(dim < 2)
+        return 0;
+    return (dim - 1 + stride - 1) / stride;
+}
+
+void VoxSampler::reset()
+{
+    VolumeDataSet& dataSet = *m_pDataSet;
+
+    m_cellsX = CellCount(dataSet.dimX(), m_sampleStride);
+    m_cellsY = CellCount(dataSet.dimY(), m_sampleStride);
+    m_cellsZ = CellCount(dataSet.dimZ(), m_sampleStride);
+    if(m_cellsX == 0 || m_cellsY == 0)
+        m_cellsZ = 0;
+
+    m_curCellX = m_curCellY = m_curCellZ = 0;
+
+    m_origin = dataSet.xyz(0, 0, 0);
+    m_axisX = dataSet.xyz(1, 0, 0) - m_origin;
+    m_axisY = dataSet.xyz(0, 1, 0) - m_origin;
+    m_axisZ = dataSet.xyz(0, 0, 1) - m_origin;
+
+    //the planes are allocated by the first row read, block reads do not need them
+    for(size_t i = 0; i < 2; ++i)
+    {
+        m_planeValues[i].clear();
+        m_planePositions[i].clear();
+        m_planeZ[i] = k_NoPlane;
+    }
+}
+
+//the last cell is clamped to the volume when the stride does not divide it
+size_t VoxSampler::sampleCoord(size_t cell, size_t dim) const
+{
+    return std::min(cell * m_sampleStride, dim - 1);
+}
+
+//the plane and block loops are templated on the layout so that the linear
+//layout does not pay for the bricked index math
+template<typename Indexer>
+void VoxSampler::loadPlane(const Indexer& indexer, size_t plane, size_t cellZ)
 {
     VolumeDataSet& dataSet = *m_pDataSet;
 
-    if(m_curSampleZ >= dataSet.dimZ() - 1)
+    size_t planeSize = (m_cellsX + 1) * (m_cellsY + 1);
+    m_planeValues[plane].resize(planeSize);
+    m_planePositions[plane].resize(planeSize);
+
+    size_t z = sampleCoord(cellZ, dataSet.dimZ());
+    float* pValues = &m_planeValues[plane].front();
+    QVector3D* pPositions = &m_planePositions[plane].front();
+    for(size_t cellY = 0; cellY <= m_cellsY; ++cellY)
     {
+        size_t y = sampleCoord(cellY, dataSet.dimY());
+        QVector3D rowOrigin = m_origin + (m_axisY * y) + (m_axisZ * z);
+        for(size_t cellX = 0; cellX <= m_cellsX; ++cellX)
+        {
+            size_t x = sampleCoord(cellX, dataSet.dimX());
+            *pValues++ = dataSet.valueAsFloat(indexer, x, y, z);
+            *pPositions++ = rowOrigin + (m_axisX * x);
+        }
+    }
+    m_planeZ[plane] = cellZ;
+}
+
+void VoxSampler::loadPlane(size_t plane, size_t cellZ)
+{
+    if(m_pDataSet->getVoxelLayout() == VolumeDataSet::VOXEL_LAYOUT_BRICKED)
+        loadPlane(m_pDataSet->getBrickedIndexer(), plane, cellZ);
+    else
+        loadPlane(m_pDataSet->getLinearIndexer(), plane, cellZ);
+}
+
+void VoxSampler::loadPlanes(size_t cellZ)
+{
+    if(m_planeZ[0] == cellZ && m_planeZ[1] == cellZ + 1)
+        return;
+
+    //moving up one cell, the old high plane becomes the low plane
+    if(m_planeZ[1] == cellZ)
+    {
+        m_planeValues[0].swap(m_planeValues[1]);
+        m_planePositions[0].swap(m_planePositions[1]);
+        m_planeZ[0] = cellZ;
+    }
+    else
+        loadPlane(0, cellZ);
+
+    loadPlane(1, cellZ + 1);
+}
+
+void VoxSampler::getRow(size_t cellY, size_t cellZ, VoxSampleRow& row)
+{
+    loadPlanes(cellZ);
+
+    size_t width = m_cellsX + 1;
+    size_t y0 = cellY * width;
+    size_t y1 = (cellY + 1) * width;
+
+    row.cellCount = m_cellsX;
+    row.values[VoxSampleRow::ROW_Y0_Z0] = &m_planeValues[0][y0];
+    row.values[VoxSampleRow::ROW_Y1_Z0] = &m_planeValues[0][y1];
+    row.values[VoxSampleRow::ROW_Y0_Z1] = &m_planeValues[1][y0];
+    row.values[VoxSampleRow::ROW_Y1_Z1] = &m_planeValues[1][y1];
+    row.positions[VoxSampleRow::ROW_Y0_Z0] = &m_planePositions[0][y0];
+    row.positions[VoxSampleRow::ROW_Y1_Z0] = &m_planePositions[0][y1];
+    row.positions[VoxSampleRow::ROW_Y0_Z1] = &m_planePositions[1][y0];
+    row.positions[VoxSampleRow::ROW_Y1_Z1] = &m_planePositions[1][y1];
+}
+
+//samples the corner planes [firstPlane, lastPlane] of the block, plane 0 is at block.cellZ
+template<typename Indexer>
+void VoxSampler::sampleBlockPlanes(const Indexer& indexer,
+                                   size_t firstPlane, size_t lastPlane,
+                                   VoxSampleBlock& block) const
+{
+    const VolumeDataSet& dataSet = *m_pDataSet;
+
+    size_t corner = firstPlane * (block.cellsX + 1) * (block.cellsY + 1);
+    for(size_t z = block.cellZ + firstPlane; z <= block.cellZ + lastPlane; ++z)
+    {
+        size_t sampleZ = sampleCoord(z, dataSet.dimZ());
+        for(size_t y = block.cellY; y <= block.cellY + block.cellsY; ++y)
+        {
+            size_t sampleY = sampleCoord(y, dataSet.dimY());
+            QVector3D rowOrigin = m_origin + (m_axisY * sampleY) + (m_axisZ * sampleZ);
+            for(size_t x = block.cellX; x <= block.cellX + block.cellsX; ++x, ++corner)
+            {
+                size_t sampleX = sampleCoord(x, dataSet.dimX());
+                block.values[corner] = dataSet.valueAsFloat(indexer, sampleX, sampleY, sampleZ);
+                block.positions[corner] = rowOrigin + (m_axisX * sampleX);
+            }
+        }
+    }
+}
+
+void VoxSampler::sampleBlockPlanes(size_t firstPlane, size_t lastPlane, VoxSampleBlock& block) const
+{
+    if(m_pDataSet->getVoxelLayout() == VolumeDataSet::VOXEL_LAYOUT_BRICKED)
+        sampleBlockPlanes(m_pDataSet->getBrickedIndexer(), firstPlane, lastPlane, block);
+    else
+        sampleBlockPlanes(m_pDataSet->getLinearIndexer(), firstPlane, lastPlane, block);
+}
+
+void VoxSampler::getBlock(size_t cellX, size_t cellY, size_t cellZ,
+                          size_t cellsX, size_t cellsY, size_t cellsZ,
+                          VoxSampleBlock& block) const
+{
+    block.cellX = cellX;
+    block.cellY = cellY;
+    block.cellZ = cellZ;
+    block.cellsX = std::min(cellsX, m_cellsX - std::min(cellX, m_cellsX));
+    block.cellsY = std::min(cellsY, m_cellsY - std::min(cellY, m_cellsY));
+    block.cellsZ = std::min(cellsZ, m_cellsZ - std::min(cellZ, m_cellsZ));
+
+    size_t cornerCount = (block.cellsX + 1) * (block.cellsY + 1) * (block.cellsZ + 1);
+    block.values.resize(cornerCount);
+    block.positions.resize(cornerCount);
+
+    sampleBlockPlanes(0, block.cellsZ, block);
+}
+
+bool VoxSampler::nextBlockLayer(VoxSampleBlock& block) const
+{
+    if(block.cellsZ != 1 || block.cellZ + 1 >= m_cellsZ)
         return false;
+
+    //the top corners become the bottom ones, only the new top plane is sampled
+    size_t planeSize = (block.cellsX + 1) * (block.cellsY + 1);
+    std::copy(block.values.begin() + planeSize, block.values.end(), block.values.begin());
+    std::copy(block.positions.begin() + planeSize, block.positions.end(), block.positions.begin());
+    ++block.cellZ;
+
+    sampleBlockPlanes(1, 1, block);
+    return true;
+}
+
+bool VoxSampler::getNextRow(VoxSampleRow& row)
+{
+    if(m_curCellZ >= m_cellsZ)
+        return false;
+
+    getRow(m_curCellY, m_curCellZ, row);
+
+    ++m_curCellY;
+    if(m_curCellY >= m_cellsY)
+    {
+        m_curCellY = 0;
+        ++m_curCellZ;
     }
 
-    //sw lowest grid value
-    sample.values[0] = dataSet.valueAsFloat(m_curSampleX, 
-                                            m_curSampleY, 
-                                            m_curSampleZ);
-    sample.positions[0] = dataSet.xyz(m_curSampleX, 
-                                     m_curSampleY, 
-                                     m_curSampleZ);
-
-    //se lowest grid value
-    sample.values[1] = dataSet.valueAsFloat(m_curSampleX + m_sampleStride, 
-                                            m_curSampleY, 
-                                            m_curSampleZ);
-    sample.positions[1] = dataSet.xyz(m_curSampleX + m_sampleStride, 
-                                     m_curSampleY, 
-                                     m_curSampleZ);
-
-    //ne lowest grid value
-    sample.values[2] = dataSet.valueAsFloat(m_curSampleX + m_sampleStride, 
-                                            m_curSampleY + m_sampleStride, 
-                                            m_curSampleZ);
-    sample.positions[2] = dataSet.xyz(m_curSampleX + m_sampleStride, 
-                                     m_curSampleY + m_sampleStride, 
-                                     m_curSampleZ);
-
-    //nw lowest grid value
-    sample.values[3] = dataSet.valueAsFloat(m_curSampleX, 
-                                            m_curSampleY + m_sampleStride, 
-                                            m_curSampleZ);
-    sample.positions[3] = dataSet.xyz(m_curSampleX, 
-                                     m_curSampleY + m_sampleStride, 
-                                     m_curSampleZ);
-
-    //sw highest grid value
-    sample.values[4] = dataSet.valueAsFloat(m_curSampleX, 
-                                            m_curSampleY, 
-                                            m_curSampleZ + m_sampleStride);
-    sample.positions[4] = dataSet.xyz(m_curSampleX, 
-                                     m_curSampleY, 
-                                     m_curSampleZ + m_sampleStride);
-
-    //se highest grid value
-    sample.values[5] = dataSet.valueAsFloat(m_curSampleX + m_sampleStride, 
-                                            m_curSampleY, 
-                                            m_curSampleZ + m_sampleStride);
-    sample.positions[5] = dataSet.xyz(m_curSampleX + m_sampleStride, 
-                                     m_curSampleY, 
-                                     m_curSampleZ + m_sampleStride);
-
-    //ne highest grid value
-    sample.values[6] = dataSet.valueAsFloat(m_curSampleX + m_sampleStride, 
-                                            m_curSampleY + m_sampleStride, 
-                                            m_curSampleZ + m_sampleStride);
-    sample.positions[6] = dataSet.xyz(m_curSampleX + m_sampleStride, 
-                                     m_curSampleY + m_sampleStride, 
-                                     m_curSampleZ + m_sampleStride);
-
-    //nw highest grid value
-    sample.values[7] = dataSet.valueAsFloat(m_curSampleX, 
-                                            m_curSampleY + m_sampleStride, 
-                                            m_curSampleZ + m_sampleStride);
-    sample.positions[7] = dataSet.xyz(m_curSampleX, 
-                                     m_curSampleY + m_sampleStride, 
-                                     m_curSampleZ + m_sampleStride);
-
-    m_curSampleX += m_sampleStride;
-    if(m_curSampleX >= dataSet.dimX()-1)
+    return true;
+}
+
+bool VoxSampler::getNextSample(VoxSample& sample)
+{
+    if(m_curCellZ >= m_cellsZ)
+        return false;
+
+    VoxSampleRow row;
+    getRow(m_curCellY, m_curCellZ, row);
+    row.getCell(m_curCellX, sample);
+
+    ++m_curCellX;
+    if(m_curCellX >= m_cellsX)
     {
-        m_curSampleX = 0;
-        m_curSampleY += m_sampleStride;
-        if(m_curSampleY >= dataSet.dimY()-1)
+        m_curCellX = 0;
+        ++m_curCellY;
+        if(m_curCellY >= m_cellsY)
         {
-            m_curSampleX = 0;
-            m_curSampleY = 0;
-            m_curSampleZ += m_sampleStride;
+            m_curCellY = 0;
+            ++m_curCellZ;
         }
     }
 
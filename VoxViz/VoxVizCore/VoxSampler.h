@@ -19,28 +19,153 @@ namespace vox
         Positions positions;
     };
 
+    //a row of cells along x, the corners are shared between neighboring cells.
+    //The pointers are into the sampler and are valid until it is advanced.
+    struct VoxSampleRow
+    {
+        enum CornerRow
+        {
+            ROW_Y0_Z0,
+            ROW_Y1_Z0,
+            ROW_Y0_Z1,
+            ROW_Y1_Z1,
+            ROW_COUNT
+        };
+
+        size_t cellCount;
+        //corner i of the row is at cell i's low x corner, there are cellCount + 1
+        const float* values[ROW_COUNT];
+        const QVector3D* positions[ROW_COUNT];
+
+        //fills the 8 corners of a cell in the order getNextSample returns them
+        void getCell(size_t cellIndex, VoxSample& sample) const
+        {
+            static const CornerRow s_cornerRows[8] =
+            {
+                ROW_Y0_Z0, ROW_Y0_Z0, ROW_Y1_Z0, ROW_Y1_Z0,
+                ROW_Y0_Z1, ROW_Y0_Z1, ROW_Y1_Z1, ROW_Y1_Z1
+            };
+            static const size_t s_cornerOffsets[8] = { 0, 1, 1, 0, 0, 1, 1, 0 };
+
+            for(size_t i = 0; i < 8; ++i)
+            {
+                size_t corner = cellIndex + s_cornerOffsets[i];
+                sample.values[i] = values[s_cornerRows[i]][corner];
+                sample.positions[i] = positions[s_cornerRows[i]][corner];
+            }
+        }
+    };
+
+    //box of cells sampled at once, the corners are shared between the cells
+    struct VoxSampleBlock
+    {
+        //first cell and number of cells in each dimension
+        size_t cellX;
+        size_t cellY;
+        size_t cellZ;
+        size_t cellsX;
+        size_t cellsY;
+        size_t cellsZ;
+        //(cellsX + 1) * (cellsY + 1) * (cellsZ + 1) corners, x fastest
+        Values values;
+        Positions positions;
+
+        //fills the 8 corners of cell (x, y, z) of the block in the order
+        //getNextSample returns them
+        void getCell(size_t x, size_t y, size_t z, VoxSample& sample) const
+        {
+            size_t rowSize = cellsX + 1;
+            size_t planeSize = rowSize * (cellsY + 1);
+            size_t corner0 = (z * planeSize) + (y * rowSize) + x;
+            const size_t cornerOffsets[8] =
+            {
+                0, 1, rowSize + 1, rowSize,
+                planeSize, planeSize + 1, planeSize + rowSize + 1, planeSize + rowSize
+            };
+
+            for(size_t i = 0; i < 8; ++i)
+            {
+                sample.values[i] = values[corner0 + cornerOffsets[i]];
+                sample.positions[i] = positions[corner0 + cornerOffsets[i]];
+            }
+        }
+    };
+
+    //walks the cells of a data set in x, y, z order. The values and transformed
+    //positions of the sample points are computed once per z plane and the
+    //previous plane is kept, so each point is sampled once instead of 8 times.
     class VoxSampler
     {
     private:
-        VolumeDataSet* m_pDataSet; 
+        VolumeDataSet* m_pDataSet;
         size_t m_sampleStride;
 
-        size_t m_curSampleX;
-        size_t m_curSampleY;
-        size_t m_curSampleZ;
+        //cells in each dimension with the current stride
+        size_t m_cellsX;
+        size_t m_cellsY;
+        size_t m_cellsZ;
+
+        size_t m_curCellX;
+        size_t m_curCellY;
+        size_t m_curCellZ;
+
+        //xyz() is affine, positions are origin + x * axisX + y * axisY + z * axisZ
+        QVector3D m_origin;
+        QVector3D m_axisX;
+        QVector3D m_axisY;
+        QVector3D m_axisZ;
+
+        //sample planes at m_planeZ[0] (low) and m_planeZ[1] (high)
+        Values m_planeValues[2];
+        Positions m_planePositions[2];
+        size_t m_planeZ[2];
 
+        void reset();
+        template<typename Indexer>
+        void loadPlane(const Indexer& indexer, size_t plane, size_t cellZ);
+        void loadPlane(size_t plane, size_t cellZ);
+        template<typename Indexer>
+        void sampleBlockPlanes(const Indexer& indexer,
+                               size_t firstPlane, size_t lastPlane,
+                               VoxSampleBlock& block) const;
+        void sampleBlockPlanes(size_t firstPlane, size_t lastPlane, VoxSampleBlock& block) const;
+        void loadPlanes(size_t cellZ);
     public:
         VoxSampler(VolumeDataSet& dataSet,
                    size_t sampleStride,
                    size_t sampleCount);
 
-        void setVolumeDataSet(VolumeDataSet& dataSet) 
-        { 
-            m_pDataSet = &dataSet; 
-            m_curSampleX = m_curSampleY = m_curSampleZ = 0;
+        void setVolumeDataSet(VolumeDataSet& dataSet)
+        {
+            m_pDataSet = &dataSet;
+            reset();
         }
 
+        size_t cellCountX() const { return m_cellsX; }
+        size_t cellCountY() const { return m_cellsY; }
+        size_t cellCountZ() const { return m_cellsZ; }
+
+        //voxel coordinate of a cell's low corner along a dimension of size dim
+        size_t sampleCoord(size_t cell, size_t dim) const;
+
         bool getNextSample(VoxSample& sample);
+
+        //returns the next full row of cells, rows and single samples can not be
+        //mixed in one pass
+        bool getNextRow(VoxSampleRow& row);
+
+        //row of cells at (cellY, cellZ), rows are fastest to read in z, y order
+        void getRow(size_t cellY, size_t cellZ, VoxSampleRow& row);
+
+        //samples a box of cells without touching the plane cache, the box is
+        //clipped to the cells of the volume
+        void getBlock(size_t cellX, size_t cellY, size_t cellZ,
+                      size_t cellsX, size_t cellsY, size_t cellsZ,
+                      VoxSampleBlock& block) const;
+
+        //moves a block one cell thick up by a cell, the shared corner plane is
+        //kept so each plane is sampled once. Returns false at the top of the volume.
+        bool nextBlockLayer(VoxSampleBlock& block) const;
     };
 };
 #endif
@@ -0,0 +1,240 @@
+#include "VoxVizCore/VoxelBinaryFile.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/MappedFile.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+
+#include <cstring>
+#include <iostream>
+
+using namespace vox;
+
+static bool s_binaryFilesEnabled = true;
+
+static const char k_BinaryMagic[8] = { 'V', 'O', 'X', 'B', 'I', 'N', '\n', '\0' };
+static const quint32 k_BinaryVersion = 1;
+
+enum BinaryContent
+{
+    CONTENT_UBYTE_SCALARS,//VolumeDataSet::Voxels
+    CONTENT_UBYTE_COLORS//Vec4ub
+};
+
+//all fields are 8 byte aligned so the struct has no padding
+struct BinaryHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 content;
+    //size and time stamp of the text file the binary file was made from
+    quint64 sourceSize;
+    quint64 sourceModified;
+    quint64 dimX;
+    quint64 dimY;
+    quint64 dimZ;
+    double position[3];
+    double orientation[4];//scalar, x, y, z
+    double scale[3];
+};
+
+void VoxelBinaryFile::SetEnabled(bool flag)
+{
+    s_binaryFilesEnabled = flag;
+}
+
+bool VoxelBinaryFile::GetEnabled()
+{
+    return s_binaryFilesEnabled;
+}
+
+std::string VoxelBinaryFile::GetBinaryFile(const std::string& textFile)
+{
+    return textFile + ".voxbin";
+}
+
+static quint64 GetDataSize(const BinaryHeader& header)
+{
+    quint64 voxelSize = header.content == CONTENT_UBYTE_COLORS ?
+                            sizeof(Vec4ub) : sizeof(VolumeDataSet::Voxels);
+    return header.dimX * header.dimY * header.dimZ * voxelSize;
+}
+
+VolumeDataSet* VoxelBinaryFile::Read(const std::string& textFile)
+{
+    if(!s_binaryFilesEnabled)
+        return NULL;
+
+    QFileInfo textFileInfo(QString(textFile.c_str()));
+    QFile binaryFile(QString(GetBinaryFile(textFile).c_str()));
+    if(!textFileInfo.exists() || !binaryFile.exists())
+        return NULL;
+
+    if(!binaryFile.open(QIODevice::ReadOnly))
+        return NULL;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    BinaryHeader header;
+    if(binaryFile.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header))
+        return NULL;
+
+    if(memcmp(header.magic, k_BinaryMagic, sizeof(k_BinaryMagic)) != 0 ||
+       header.version != k_BinaryVersion ||
+       (header.content != CONTENT_UBYTE_SCALARS && header.content != CONTENT_UBYTE_COLORS))
+        return NULL;
+
+    //the text file was edited after the binary file was written
+    if(header.sourceSize != static_cast<quint64>(textFileInfo.size()) ||
+       header.sourceModified != static_cast<quint64>(textFileInfo.lastModified().toTime_t()))
+        return NULL;
+
+    quint64 dataSize = GetDataSize(header);
+    if(static_cast<quint64>(binaryFile.size()) != sizeof(header) + dataSize)
+        return NULL;
+
+    QVector3D pos(header.position[0], header.position[1], header.position[2]);
+    QQuaternion orient(header.orientation[0],
+                       header.orientation[1],
+                       header.orientation[2],
+                       header.orientation[3]);
+
+    SmartPtr<VolumeDataSet> spData = new VolumeDataSet(textFile,
+                                                       pos, orient,
+                                                       header.scale[0],
+                                                       header.scale[1],
+                                                       header.scale[2],
+                                                       static_cast<size_t>(header.dimX),
+                                                       static_cast<size_t>(header.dimY),
+                                                       static_cast<size_t>(header.dimZ));
+
+    //map the voxels copy on write straight from the file so pages are only
+    //read when the renderers touch them and are shared between processes
+    //until the data set writes to them
+    SmartPtr<MappedFile> spMappedFile = MappedFile::Map(GetBinaryFile(textFile),
+                                                        sizeof(header),
+                                                        static_cast<size_t>(dataSize));
+    char* pDest = NULL;
+    if(spMappedFile.valid())
+    {
+        spData->setMappedFile(spMappedFile.get());
+        pDest = static_cast<char*>(spMappedFile->data());
+    }
+
+    if(header.content == CONTENT_UBYTE_SCALARS)
+    {
+        if(pDest == NULL)
+            pDest = reinterpret_cast<char*>(new VolumeDataSet::Voxels[static_cast<size_t>(dataSize)]);
+        spData->setData(reinterpret_cast<VolumeDataSet::Voxels*>(pDest));
+    }
+    else
+    {
+        if(pDest == NULL)
+            pDest = reinterpret_cast<char*>(new Vec4ub[static_cast<size_t>(dataSize / sizeof(Vec4ub))]);
+        spData->setColors(reinterpret_cast<Vec4ub*>(pDest));
+    }
+
+    //fall back to plain reads if the file can not be mapped
+    if(!spMappedFile.valid() &&
+       binaryFile.read(pDest, dataSize) != static_cast<qint64>(dataSize))
+    {
+        std::cerr << "WARNING: failed to read binary voxel file "
+                  << GetBinaryFile(textFile) << std::endl;
+        return NULL;
+    }
+
+    std::cout << "Loaded binary voxel file " << GetBinaryFile(textFile)
+              << " in " << timer.elapsed() << " ms." << std::endl;
+
+    return spData.release();
+}
+
+bool VoxelBinaryFile::Write(const VolumeDataSet* pData, const std::string& textFile)
+{
+    if(!s_binaryFilesEnabled)
+        return false;
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, k_BinaryMagic, sizeof(k_BinaryMagic));
+    header.version = k_BinaryVersion;
+
+    const char* pSource = NULL;
+    if(pData->getVoxelFormat() == VolumeDataSet::VOXEL_FORMAT_UBYTE && 
+       pData->getVoxelLayout() == VolumeDataSet::VOXEL_LAYOUT_LINEAR &&
+       pData->getData() != NULL)
+    {
+        header.content = CONTENT_UBYTE_SCALARS;
+        pSource = reinterpret_cast<const char*>(pData->getData());
+    }
+    else if(pData->getColorsUB() != NULL)
+    {
+        header.content = CONTENT_UBYTE_COLORS;
+        pSource = reinterpret_cast<const char*>(pData->getColorsUB());
+    }
+    else
+        return false;
+
+    QFileInfo textFileInfo(QString(textFile.c_str()));
+    header.sourceSize = static_cast<quint64>(textFileInfo.size());
+    header.sourceModified = static_cast<quint64>(textFileInfo.lastModified().toTime_t());
+    header.dimX = pData->dimX();
+    header.dimY = pData->dimY();
+    header.dimZ = pData->dimZ();
+
+    const QVector3D& pos = pData->getPosition();
+    header.position[0] = pos.x();
+    header.position[1] = pos.y();
+    header.position[2] = pos.z();
+
+    const QQuaternion& orient = pData->getOrientation();
+    header.orientation[0] = orient.scalar();
+    header.orientation[1] = orient.x();
+    header.orientation[2] = orient.y();
+    header.orientation[3] = orient.z();
+
+    header.scale[0] = pData->scaleX();
+    header.scale[1] = pData->scaleY();
+    header.scale[2] = pData->scaleZ();
+
+    //write to a temporary file first so that an interrupted write
+    //never leaves behind a binary file that looks valid
+    QString binaryFileName(GetBinaryFile(textFile).c_str());
+    QString tmpFileName = binaryFileName + ".tmp";
+    QFile tmpFile(tmpFileName);
+    if(!tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        std::cerr << "WARNING: failed to create binary voxel file "
+                  << tmpFileName.toAscii().data() << std::endl;
+        return false;
+    }
+
+    quint64 dataSize = GetDataSize(header);
+    bool success =
+        tmpFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+        tmpFile.write(pSource, dataSize) == static_cast<qint64>(dataSize);
+    tmpFile.close();
+
+    if(!success)
+    {
+        std::cerr << "WARNING: failed to write binary voxel file "
+                  << tmpFileName.toAscii().data() << std::endl;
+        QFile::remove(tmpFileName);
+        return false;
+    }
+
+    QFile::remove(binaryFileName);
+    if(!QFile::rename(tmpFileName, binaryFileName))
+    {
+        std::cerr << "WARNING: failed to rename binary voxel file "
+                  << binaryFileName.toAscii().data() << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote binary voxel file " << binaryFileName.toAscii().data() << std::endl;
+
+    return true;
+}
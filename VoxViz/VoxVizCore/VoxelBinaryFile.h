@@ -0,0 +1,28 @@
+#ifndef VOX_VOXEL_BINARY_FILE_H
+#define VOX_VOXEL_BINARY_FILE_H
+
+#include "VoxVizCore/VolumeDataSet.h"
+
+#include <string>
+
+namespace vox
+{
+    //binary companion of a text voxel file (VOXEL_SCALARS or VOXEL_SLICE colors).
+    //It is written next to the text file the first time that is parsed and is
+    //memory mapped on later loads as long as the text file has not changed.
+    class VoxelBinaryFile
+    {
+    public:
+        static void SetEnabled(bool flag);
+        static bool GetEnabled();
+
+        static std::string GetBinaryFile(const std::string& textFile);
+
+        //returns NULL if there is no up to date binary file for textFile
+        static VolumeDataSet* Read(const std::string& textFile);
+
+        static bool Write(const VolumeDataSet* pData, const std::string& textFile);
+    };
+}
+
+#endif
@@ -0,0 +1,671 @@
+#include "VoxVizCore/VoxelChunkFile.h"
+#include "VoxVizCore/SmartPtr.h"
+#include "VoxVizCore/SlabThreads.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QByteArray>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QElapsedTimer>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace vox;
+
+static const char k_ChunkMagic[8] = { 'V', 'O', 'X', 'C', 'H', 'N', 'K', '\n' };
+static const quint32 k_ChunkVersion = 1;
+
+//all fields are 8 byte aligned so the struct has no padding
+struct ChunkHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 voxelFormat;//VolumeDataSet::VoxelFormat
+    quint64 dimX;
+    quint64 dimY;
+    quint64 dimZ;
+    quint64 chunkDim;
+    quint32 valueMin;
+    quint32 valueMax;
+    double position[3];
+    double orientation[4];//scalar, x, y, z
+    double scale[3];
+};
+
+//the header is followed by a {offset, size} entry per chunk (x fastest) and then
+//the zlib compressed chunks. Chunk voxels are linear within the chunk and each
+//row is delta encoded along x, which makes smooth scans compress much better.
+
+template<typename T>
+static void DeltaEncodeRows(T* pVoxels, size_t rowLength, size_t rowCount)
+{
+    for(size_t row = 0; row < rowCount; ++row)
+    {
+        T* pRow = pVoxels + (row * rowLength);
+        for(size_t x = rowLength - 1; x > 0; --x)
+            pRow[x] = static_cast<T>(pRow[x] - pRow[x - 1]);
+    }
+}
+
+template<typename T>
+static void DeltaDecodeRows(T* pVoxels, size_t rowLength, size_t rowCount)
+{
+    for(size_t row = 0; row < rowCount; ++row)
+    {
+        T* pRow = pVoxels + (row * rowLength);
+        for(size_t x = 1; x < rowLength; ++x)
+            pRow[x] = static_cast<T>(pRow[x] + pRow[x - 1]);
+    }
+}
+
+static size_t ChunkCount(size_t dim, size_t chunkDim)
+{
+    return (dim + chunkDim - 1) / chunkDim;
+}
+
+namespace
+{
+    //gathers and compresses a range of chunks of a data set
+    class CompressChunksSlabTask : public SlabTask
+    {
+    private:
+        const VolumeDataSet* m_pData;
+        size_t m_chunkDim;
+        size_t m_chunksX;
+        size_t m_chunksY;
+        size_t m_firstChunk;
+        std::vector<QByteArray>& m_compressedChunks;
+
+        template<typename T>
+        void gatherChunk(const T* pSource,
+                         size_t startX, size_t startY, size_t startZ,
+                         size_t sizeX, size_t sizeY, size_t sizeZ,
+                         T* pDest) const
+        {
+            bool linear = m_pData->getVoxelLayout() == VolumeDataSet::VOXEL_LAYOUT_LINEAR;
+            for(size_t z = 0; z < sizeZ; ++z)
+            {
+                for(size_t y = 0; y < sizeY; ++y)
+                {
+                    T* pRow = pDest + (((z * sizeY) + y) * sizeX);
+                    if(linear)
+                    {
+                        memcpy(pRow,
+                               pSource + m_pData->voxelIndex(startX, startY + y, startZ + z),
+                               sizeX * sizeof(T));
+                        continue;
+                    }
+
+                    for(size_t x = 0; x < sizeX; ++x)
+                        pRow[x] = pSource[m_pData->voxelIndex(startX + x, startY + y, startZ + z)];
+                }
+            }
+            DeltaEncodeRows(pDest, sizeX, sizeY * sizeZ);
+        }
+    public:
+        CompressChunksSlabTask(const VolumeDataSet* pData,
+                               size_t chunkDim,
+                               size_t firstChunk,
+                               std::vector<QByteArray>& compressedChunks) :
+            m_pData(pData),
+            m_chunkDim(chunkDim),
+            m_chunksX(ChunkCount(pData->dimX(), chunkDim)),
+            m_chunksY(ChunkCount(pData->dimY(), chunkDim)),
+            m_firstChunk(firstChunk),
+            m_compressedChunks(compressedChunks)
+        {
+        }
+
+        virtual void runSlab(size_t, size_t start, size_t end)
+        {
+            std::vector<unsigned char> voxels;
+            for(size_t i = start; i < end; ++i)
+            {
+                size_t chunk = m_firstChunk + i;
+                size_t startX = (chunk % m_chunksX) * m_chunkDim;
+                size_t startY = ((chunk / m_chunksX) % m_chunksY) * m_chunkDim;
+                size_t startZ = (chunk / (m_chunksX * m_chunksY)) * m_chunkDim;
+                size_t sizeX = std::min(m_chunkDim, m_pData->dimX() - startX);
+                size_t sizeY = std::min(m_chunkDim, m_pData->dimY() - startY);
+                size_t sizeZ = std::min(m_chunkDim, m_pData->dimZ() - startZ);
+
+                voxels.resize(sizeX * sizeY * sizeZ * m_pData->getVoxelSize());
+                if(m_pData->getVoxelFormat() == VolumeDataSet::VOXEL_FORMAT_USHORT)
+                    gatherChunk(m_pData->getData16(),
+                                startX, startY, startZ, sizeX, sizeY, sizeZ,
+                                reinterpret_cast<VolumeDataSet::Voxels16*>(&voxels[0]));
+                else
+                    gatherChunk(m_pData->getData(),
+                                startX, startY, startZ, sizeX, sizeY, sizeZ,
+                                &voxels[0]);
+
+                m_compressedChunks[i] = qCompress(&voxels[0], static_cast<int>(voxels.size()));
+            }
+        }
+    };
+}
+
+bool VoxelChunkFile::Write(const VolumeDataSet* pData,
+                           const std::string& filename,
+                           size_t chunkDim)
+{
+    if(pData->getRawData() == NULL || chunkDim == 0 ||
+       pData->dimX() == 0 || pData->dimY() == 0 || pData->dimZ() == 0)
+    {
+        std::cerr << "ERROR: chunk files can only be written from scalar volumes." << std::endl;
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    ChunkHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, k_ChunkMagic, sizeof(k_ChunkMagic));
+    header.version = k_ChunkVersion;
+    header.voxelFormat = pData->getVoxelFormat();
+    header.dimX = pData->dimX();
+    header.dimY = pData->dimY();
+    header.dimZ = pData->dimZ();
+    header.chunkDim = chunkDim;
+    unsigned int valueMin = 0;
+    unsigned int valueMax = 0;
+    pData->getVoxelValueRange(valueMin, valueMax);
+    header.valueMin = valueMin;
+    header.valueMax = valueMax;
+
+    const QVector3D& pos = pData->getPosition();
+    header.position[0] = pos.x();
+    header.position[1] = pos.y();
+    header.position[2] = pos.z();
+
+    const QQuaternion& orient = pData->getOrientation();
+    header.orientation[0] = orient.scalar();
+    header.orientation[1] = orient.x();
+    header.orientation[2] = orient.y();
+    header.orientation[3] = orient.z();
+
+    header.scale[0] = pData->scaleX();
+    header.scale[1] = pData->scaleY();
+    header.scale[2] = pData->scaleZ();
+
+    size_t chunksX = ChunkCount(pData->dimX(), chunkDim);
+    size_t chunksY = ChunkCount(pData->dimY(), chunkDim);
+    size_t chunksZ = ChunkCount(pData->dimZ(), chunkDim);
+    std::vector<ChunkEntry> chunkEntries(chunksX * chunksY * chunksZ);
+
+    //write to a temporary file first so that an interrupted write
+    //never leaves behind a chunk file that looks valid
+    QString chunkFileName(filename.c_str());
+    QString tmpFileName = chunkFileName + ".tmp";
+    QFile tmpFile(tmpFileName);
+    if(!tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        std::cerr << "WARNING: failed to create chunk file "
+                  << tmpFileName.toAscii().data() << std::endl;
+        return false;
+    }
+
+    qint64 indexSize = static_cast<qint64>(chunkEntries.size() * sizeof(ChunkEntry));
+    bool success =
+        tmpFile.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+        tmpFile.seek(sizeof(header) + indexSize);
+
+    //compress a layer of chunks at a time to bound the memory use
+    unsigned long long offset = sizeof(header) + indexSize;
+    size_t layerSize = chunksX * chunksY;
+    std::vector<QByteArray> compressedChunks(layerSize);
+    for(size_t chunkZ = 0; success && chunkZ < chunksZ; ++chunkZ)
+    {
+        size_t firstChunk = chunkZ * layerSize;
+        CompressChunksSlabTask task(pData, chunkDim, firstChunk, compressedChunks);
+        SlabThreads::Run(task, layerSize);
+
+        for(size_t i = 0; success && i < layerSize; ++i)
+        {
+            const QByteArray& chunk = compressedChunks[i];
+            ChunkEntry& entry = chunkEntries[firstChunk + i];
+            entry.offset = offset;
+            entry.size = static_cast<unsigned long long>(chunk.size());
+            offset += entry.size;
+            success = tmpFile.write(chunk) == chunk.size();
+        }
+    }
+
+    success = success &&
+              tmpFile.seek(sizeof(header)) &&
+              tmpFile.write(reinterpret_cast<const char*>(&chunkEntries[0]), indexSize) == indexSize;
+    tmpFile.close();
+
+    if(!success)
+    {
+        std::cerr << "WARNING: failed to write chunk file "
+                  << tmpFileName.toAscii().data() << std::endl;
+        QFile::remove(tmpFileName);
+        return false;
+    }
+
+    QFile::remove(chunkFileName);
+    if(!QFile::rename(tmpFileName, chunkFileName))
+    {
+        std::cerr << "WARNING: failed to rename chunk file "
+                  << chunkFileName.toAscii().data() << std::endl;
+        return false;
+    }
+
+    std::cout << "Wrote chunk file " << filename << " ("
+              << chunkEntries.size() << " chunks, " << offset << " bytes) in "
+              << timer.elapsed() << " ms." << std::endl;
+
+    return true;
+}
+
+VoxelChunkFile::VoxelChunkFile() :
+    m_pFile(NULL),
+    m_dimX(0),
+    m_dimY(0),
+    m_dimZ(0),
+    m_chunkDim(0),
+    m_chunksX(0),
+    m_chunksY(0),
+    m_chunksZ(0),
+    m_voxelFormat(VolumeDataSet::VOXEL_FORMAT_UBYTE),
+    m_valueMin(0),
+    m_valueMax(0xFFFF),
+    m_cacheSize(k_DefaultCacheSize),
+    m_cachedBytes(0)
+{
+    m_scale[0] = m_scale[1] = m_scale[2] = 1.0;
+}
+
+VoxelChunkFile::~VoxelChunkFile()
+{
+    delete m_pFile;
+}
+
+VoxelChunkFile* VoxelChunkFile::Open(const std::string& filename)
+{
+    SmartPtr<VoxelChunkFile> spChunkFile = new VoxelChunkFile();
+    spChunkFile->m_filename = filename;
+    spChunkFile->m_pFile = new QFile(QString(filename.c_str()));
+    QFile& file = *spChunkFile->m_pFile;
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        std::cerr << "ERROR: failed to open chunk file " << filename << std::endl;
+        return NULL;
+    }
+
+    ChunkHeader header;
+    if(file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+       memcmp(header.magic, k_ChunkMagic, sizeof(k_ChunkMagic)) != 0 ||
+       header.version != k_ChunkVersion ||
+       (header.voxelFormat != VolumeDataSet::VOXEL_FORMAT_UBYTE &&
+        header.voxelFormat != VolumeDataSet::VOXEL_FORMAT_USHORT) ||
+       header.chunkDim == 0 || header.dimX == 0 || header.dimY == 0 || header.dimZ == 0)
+    {
+        std::cerr << "ERROR: " << filename << " is not a valid chunk file." << std::endl;
+        return NULL;
+    }
+
+    spChunkFile->m_dimX = static_cast<size_t>(header.dimX);
+    spChunkFile->m_dimY = static_cast<size_t>(header.dimY);
+    spChunkFile->m_dimZ = static_cast<size_t>(header.dimZ);
+    spChunkFile->m_chunkDim = static_cast<size_t>(header.chunkDim);
+    spChunkFile->m_chunksX = ChunkCount(spChunkFile->m_dimX, spChunkFile->m_chunkDim);
+    spChunkFile->m_chunksY = ChunkCount(spChunkFile->m_dimY, spChunkFile->m_chunkDim);
+    spChunkFile->m_chunksZ = ChunkCount(spChunkFile->m_dimZ, spChunkFile->m_chunkDim);
+    spChunkFile->m_voxelFormat = static_cast<VolumeDataSet::VoxelFormat>(header.voxelFormat);
+    spChunkFile->m_valueMin = header.valueMin;
+    spChunkFile->m_valueMax = header.valueMax;
+    spChunkFile->m_position = QVector3D(header.position[0], header.position[1], header.position[2]);
+    spChunkFile->m_orientation = QQuaternion(header.orientation[0],
+                                             header.orientation[1],
+                                             header.orientation[2],
+                                             header.orientation[3]);
+    spChunkFile->m_scale[0] = header.scale[0];
+    spChunkFile->m_scale[1] = header.scale[1];
+    spChunkFile->m_scale[2] = header.scale[2];
+
+    std::vector<ChunkEntry>& chunkEntries = spChunkFile->m_chunkEntries;
+    chunkEntries.resize(spChunkFile->m_chunksX * spChunkFile->m_chunksY * spChunkFile->m_chunksZ);
+    qint64 indexSize = static_cast<qint64>(chunkEntries.size() * sizeof(ChunkEntry));
+    if(file.read(reinterpret_cast<char*>(&chunkEntries[0]), indexSize) != indexSize)
+    {
+        std::cerr << "ERROR: failed to read the chunk index of " << filename << std::endl;
+        return NULL;
+    }
+
+    unsigned long long fileSize = static_cast<unsigned long long>(file.size());
+    for(size_t i = 0; i < chunkEntries.size(); ++i)
+    {
+        if(chunkEntries[i].offset + chunkEntries[i].size > fileSize)
+        {
+            std::cerr << "ERROR: chunk file " << filename << " is truncated." << std::endl;
+            return NULL;
+        }
+    }
+
+    return spChunkFile.release();
+}
+
+void VoxelChunkFile::chunkSize(size_t chunkX, size_t chunkY, size_t chunkZ,
+                               size_t& sizeX, size_t& sizeY, size_t& sizeZ) const
+{
+    sizeX = std::min(m_chunkDim, m_dimX - (chunkX * m_chunkDim));
+    sizeY = std::min(m_chunkDim, m_dimY - (chunkY * m_chunkDim));
+    sizeZ = std::min(m_chunkDim, m_dimZ - (chunkZ * m_chunkDim));
+}
+
+void VoxelChunkFile::setCacheSize(size_t cacheSize)
+{
+    QMutexLocker lock(&m_cacheMutex);
+    m_cacheSize = cacheSize;
+    trimCache();
+}
+
+bool VoxelChunkFile::getCachedChunk(size_t chunkIndex, std::vector<unsigned char>& voxels)
+{
+    QMutexLocker lock(&m_cacheMutex);
+    std::map<size_t, ChunkList::iterator>::iterator itr = m_cachedChunkMap.find(chunkIndex);
+    if(itr == m_cachedChunkMap.end())
+        return false;
+
+    //move to the front of the list
+    m_cachedChunks.splice(m_cachedChunks.begin(), m_cachedChunks, itr->second);
+    voxels = itr->second->second;
+    return true;
+}
+
+void VoxelChunkFile::addCachedChunk(size_t chunkIndex, const std::vector<unsigned char>& voxels)
+{
+    QMutexLocker lock(&m_cacheMutex);
+    //another thread may have decompressed the same chunk
+    if(voxels.size() > m_cacheSize || m_cachedChunkMap.count(chunkIndex) != 0)
+        return;
+
+    m_cachedChunks.push_front(std::make_pair(chunkIndex, voxels));
+    m_cachedChunkMap[chunkIndex] = m_cachedChunks.begin();
+    m_cachedBytes += voxels.size();
+    trimCache();
+}
+
+void VoxelChunkFile::trimCache()
+{
+    while(m_cachedBytes > m_cacheSize && !m_cachedChunks.empty())
+    {
+        m_cachedBytes -= m_cachedChunks.back().second.size();
+        m_cachedChunkMap.erase(m_cachedChunks.back().first);
+        m_cachedChunks.pop_back();
+    }
+}
+
+bool VoxelChunkFile::readChunk(size_t chunkIndex, std::vector<unsigned char>& voxels)
+{
+    if(chunkIndex >= m_chunkEntries.size())
+        return false;
+
+    if(getCachedChunk(chunkIndex, voxels))
+        return true;
+
+    const ChunkEntry& entry = m_chunkEntries[chunkIndex];
+    QByteArray compressed;
+    {
+        QMutexLocker lock(&m_fileMutex);
+        if(!m_pFile->seek(static_cast<qint64>(entry.offset)))
+            return false;
+        compressed = m_pFile->read(static_cast<qint64>(entry.size));
+    }
+
+    size_t chunkX = chunkIndex % m_chunksX;
+    size_t chunkY = (chunkIndex / m_chunksX) % m_chunksY;
+    size_t chunkZ = chunkIndex / (m_chunksX * m_chunksY);
+    size_t sizeX, sizeY, sizeZ;
+    chunkSize(chunkX, chunkY, chunkZ, sizeX, sizeY, sizeZ);
+    size_t voxelSize = m_voxelFormat == VolumeDataSet::VOXEL_FORMAT_USHORT ?
+                            sizeof(VolumeDataSet::Voxels16) : sizeof(VolumeDataSet::Voxels);
+
+    //decompress outside of the file lock so chunks are decoded in parallel
+    QByteArray uncompressed = qUncompress(compressed);
+    if(static_cast<size_t>(uncompressed.size()) != sizeX * sizeY * sizeZ * voxelSize)
+    {
+        std::cerr << "ERROR: failed to decompress chunk " << chunkIndex
+                  << " of " << m_filename << std::endl;
+        return false;
+    }
+
+    voxels.assign(uncompressed.constData(), uncompressed.constData() + uncompressed.size());
+    if(m_voxelFormat == VolumeDataSet::VOXEL_FORMAT_USHORT)
+        DeltaDecodeRows(reinterpret_cast<VolumeDataSet::Voxels16*>(&voxels[0]), sizeX, sizeY * sizeZ);
+    else
+        DeltaDecodeRows(&voxels[0], sizeX, sizeY * sizeZ);
+
+    addCachedChunk(chunkIndex, voxels);
+
+    return true;
+}
+
+namespace
+{
+    struct ChunkBox
+    {
+        size_t chunkIndex;
+        //chunk origin and size in volume coordinates
+        size_t originX, originY, originZ;
+        size_t sizeX, sizeY, sizeZ;
+    };
+
+    //the chunks of chunkFile that intersect [start, end)
+    void GetChunkBoxes(const VoxelChunkFile& chunkFile,
+                       const size_t start[3], const size_t end[3],
+                       std::vector<ChunkBox>& chunks)
+    {
+        size_t chunkDim = chunkFile.chunkDim();
+        for(size_t chunkZ = start[2] / chunkDim; chunkZ <= (end[2] - 1) / chunkDim; ++chunkZ)
+        {
+            for(size_t chunkY = start[1] / chunkDim; chunkY <= (end[1] - 1) / chunkDim; ++chunkY)
+            {
+                for(size_t chunkX = start[0] / chunkDim; chunkX <= (end[0] - 1) / chunkDim; ++chunkX)
+                {
+                    ChunkBox chunk;
+                    chunk.chunkIndex = chunkFile.chunkIndex(chunkX, chunkY, chunkZ);
+                    chunk.originX = chunkX * chunkDim;
+                    chunk.originY = chunkY * chunkDim;
+                    chunk.originZ = chunkZ * chunkDim;
+                    chunkFile.chunkSize(chunkX, chunkY, chunkZ, chunk.sizeX, chunk.sizeY, chunk.sizeZ);
+                    chunks.push_back(chunk);
+                }
+            }
+        }
+    }
+
+    //copies the rows of a decompressed chunk that are in [start, end) into pDest,
+    //which holds the voxels of [start, end)
+    void CopyChunkRows(const ChunkBox& chunk,
+                       const std::vector<unsigned char>& voxels,
+                       size_t voxelSize,
+                       const size_t start[3], const size_t end[3],
+                       unsigned char* pDest)
+    {
+        size_t destDimX = end[0] - start[0];
+        size_t destDimY = end[1] - start[1];
+
+        size_t x0 = std::max(start[0], chunk.originX);
+        size_t x1 = std::min(end[0], chunk.originX + chunk.sizeX);
+        size_t y0 = std::max(start[1], chunk.originY);
+        size_t y1 = std::min(end[1], chunk.originY + chunk.sizeY);
+        size_t z0 = std::max(start[2], chunk.originZ);
+        size_t z1 = std::min(end[2], chunk.originZ + chunk.sizeZ);
+        size_t rowBytes = (x1 - x0) * voxelSize;
+
+        for(size_t z = z0; z < z1; ++z)
+        {
+            for(size_t y = y0; y < y1; ++y)
+            {
+                size_t src = ((z - chunk.originZ) * chunk.sizeY * chunk.sizeX) +
+                             ((y - chunk.originY) * chunk.sizeX) +
+                             (x0 - chunk.originX);
+                size_t dest = ((z - start[2]) * destDimY * destDimX) +
+                              ((y - start[1]) * destDimX) +
+                              (x0 - start[0]);
+                memcpy(pDest + (dest * voxelSize), &voxels[src * voxelSize], rowBytes);
+            }
+        }
+    }
+
+    //decompresses the chunks that intersect a sub box and copies their rows into it
+    class ReadChunksSlabTask : public SlabTask
+    {
+    private:
+        VoxelChunkFile& m_chunkFile;
+        const std::vector<ChunkBox>& m_chunks;
+        size_t m_voxelSize;
+        size_t m_start[3];
+        size_t m_end[3];
+        unsigned char* m_pDest;
+        std::vector<char>& m_slabFailed;
+    public:
+        ReadChunksSlabTask(VoxelChunkFile& chunkFile,
+                           const std::vector<ChunkBox>& chunks,
+                           size_t voxelSize,
+                           const size_t start[3], const size_t end[3],
+                           unsigned char* pDest,
+                           std::vector<char>& slabFailed) :
+            m_chunkFile(chunkFile),
+            m_chunks(chunks),
+            m_voxelSize(voxelSize),
+            m_pDest(pDest),
+            m_slabFailed(slabFailed)
+        {
+            for(int i = 0; i < 3; ++i)
+            {
+                m_start[i] = start[i];
+                m_end[i] = end[i];
+            }
+        }
+
+        virtual void runSlab(size_t slabIndex, size_t start, size_t end)
+        {
+            std::vector<unsigned char> voxels;
+            for(size_t i = start; i < end; ++i)
+            {
+                const ChunkBox& chunk = m_chunks[i];
+                if(!m_chunkFile.readChunk(chunk.chunkIndex, voxels))
+                {
+                    m_slabFailed[slabIndex] = 1;
+                    return;
+                }
+
+                CopyChunkRows(chunk, voxels, m_voxelSize, m_start, m_end, m_pDest);
+            }
+        }
+    };
+}
+
+bool VoxelChunkFile::readBox(size_t startX, size_t startY, size_t startZ,
+                             size_t endX, size_t endY, size_t endZ,
+                             unsigned char* pDest)
+{
+    size_t start[3] = { startX, startY, startZ };
+    size_t end[3] = { endX, endY, endZ };
+    if(startX >= endX || startY >= endY || startZ >= endZ ||
+       endX > m_dimX || endY > m_dimY || endZ > m_dimZ)
+    {
+        std::cerr << "ERROR: box outside of " << m_filename << " requested." << std::endl;
+        return false;
+    }
+
+    size_t voxelSize = m_voxelFormat == VolumeDataSet::VOXEL_FORMAT_USHORT ?
+                            sizeof(VolumeDataSet::Voxels16) : sizeof(VolumeDataSet::Voxels);
+
+    std::vector<ChunkBox> chunks;
+    GetChunkBoxes(*this, start, end, chunks);
+
+    std::vector<unsigned char> voxels;
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        if(!readChunk(chunks[i].chunkIndex, voxels))
+            return false;
+
+        CopyChunkRows(chunks[i], voxels, voxelSize, start, end, pDest);
+    }
+
+    return true;
+}
+
+VolumeDataSet* VoxelChunkFile::readSubVolume(size_t startX, size_t startY, size_t startZ,
+                                             size_t endX, size_t endY, size_t endZ)
+{
+    endX = std::min(endX, m_dimX);
+    endY = std::min(endY, m_dimY);
+    endZ = std::min(endZ, m_dimZ);
+    if(startX >= endX || startY >= endY || startZ >= endZ)
+    {
+        std::cerr << "ERROR: empty sub volume requested from " << m_filename << std::endl;
+        return NULL;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    size_t start[3] = { startX, startY, startZ };
+    size_t end[3] = { endX, endY, endZ };
+    std::vector<ChunkBox> chunks;
+    GetChunkBoxes(*this, start, end, chunks);
+
+    //place the sub box where it is in the full volume
+    QMatrix4x4 transform;
+    transform.translate(m_position);
+    transform.rotate(m_orientation);
+    QVector3D pos = transform * QVector3D(startX * m_scale[0],
+                                          startY * m_scale[1],
+                                          startZ * m_scale[2]);
+
+    SmartPtr<VolumeDataSet> spData = new VolumeDataSet(m_filename,
+                                                       pos, m_orientation,
+                                                       m_scale[0], m_scale[1], m_scale[2],
+                                                       endX - startX,
+                                                       endY - startY,
+                                                       endZ - startZ);
+    size_t count = spData->dimX() * spData->dimY() * spData->dimZ();
+    unsigned char* pDest = NULL;
+    if(m_voxelFormat == VolumeDataSet::VOXEL_FORMAT_USHORT)
+    {
+        VolumeDataSet::Voxels16* pVoxels = new VolumeDataSet::Voxels16[count];
+        spData->setData(pVoxels, m_valueMin, m_valueMax);
+        pDest = reinterpret_cast<unsigned char*>(pVoxels);
+    }
+    else
+    {
+        VolumeDataSet::Voxels* pVoxels = new VolumeDataSet::Voxels[count];
+        spData->setData(pVoxels);
+        pDest = pVoxels;
+    }
+
+    std::vector<char> slabFailed(SlabThreads::GetSlabCount(chunks.size()), 0);
+    ReadChunksSlabTask task(*this, chunks, spData->getVoxelSize(),
+                            start, end, pDest, slabFailed);
+    SlabThreads::Run(task, chunks.size());
+
+    if(std::find(slabFailed.begin(), slabFailed.end(), 1) != slabFailed.end())
+        return NULL;
+
+    std::cout << "Read " << chunks.size() << " of " << m_chunkEntries.size()
+              << " chunks from " << m_filename << " in "
+              << timer.elapsed() << " ms." << std::endl;
+
+    return spData.release();
+}
+
+VolumeDataSet* VoxelChunkFile::readVolume()
+{
+    return readSubVolume(0, 0, 0, m_dimX, m_dimY, m_dimZ);
+}
+
+VolumeDataSet* VoxelChunkFile::readHeader()
+{
+    return new VolumeDataSet(m_filename,
+                             m_position, m_orientation,
+                             m_scale[0], m_scale[1], m_scale[2],
+                             m_dimX, m_dimY, m_dimZ);
+}
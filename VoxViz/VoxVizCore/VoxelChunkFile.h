@@ -0,0 +1,124 @@
+#ifndef VOX_VOXEL_CHUNK_FILE_H
+#define VOX_VOXEL_CHUNK_FILE_H
+
+#include "VoxVizCore/Referenced.h"
+#include "VoxVizCore/VolumeDataSet.h"
+
+#include <QtCore/QMutex>
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+
+class QFile;
+
+namespace vox
+{
+    //scalar volume split into k^3 chunks that are compressed independently (.voxc).
+    //A chunk index at the start of the file allows reading any sub box of the
+    //volume by decompressing only the chunks that intersect it. Decompressed
+    //chunks are kept in a LRU cache so overlapping reads are cheap.
+    class VoxelChunkFile : public Referenced
+    {
+    public:
+        static const size_t k_DefaultChunkDim = 64;
+        static const size_t k_DefaultCacheSize = 256 * 1024 * 1024;
+
+        static bool Write(const VolumeDataSet* pData,
+                          const std::string& filename,
+                          size_t chunkDim=k_DefaultChunkDim);
+
+        //returns NULL if the file does not exist or is not a chunk file
+        static VoxelChunkFile* Open(const std::string& filename);
+
+        size_t dimX() const { return m_dimX; }
+        size_t dimY() const { return m_dimY; }
+        size_t dimZ() const { return m_dimZ; }
+        size_t chunkDim() const { return m_chunkDim; }
+        VolumeDataSet::VoxelFormat getVoxelFormat() const { return m_voxelFormat; }
+        //range that 16 bit values are normalized over, see VolumeDataSet::normalizeValue16
+        void getVoxelValueRange(unsigned int& valueMin, unsigned int& valueMax) const
+        {
+            valueMin = m_valueMin;
+            valueMax = m_valueMax;
+        }
+
+        //max bytes of decompressed chunks kept in memory
+        void setCacheSize(size_t cacheSize);
+        size_t getCacheSize() const { return m_cacheSize; }
+
+        //reads the voxels in [start, end) into a new data set placed where the
+        //sub box is in the full volume, end values are clamped to the dimensions
+        VolumeDataSet* readSubVolume(size_t startX, size_t startY, size_t startZ,
+                                     size_t endX, size_t endY, size_t endZ);
+        VolumeDataSet* readVolume();
+        //a data set placed like the volume with its dimensions but no voxels,
+        //for renderers that read the chunks themselves
+        VolumeDataSet* readHeader();
+
+        //copies the voxels in [start, end) into pDest, x fastest then y then z.
+        //Unlike readSubVolume the chunks are read on the calling thread, so it can
+        //be called from SlabThreads tasks. The box must be in the volume.
+        bool readBox(size_t startX, size_t startY, size_t startZ,
+                     size_t endX, size_t endY, size_t endZ,
+                     unsigned char* pDest);
+
+        //copies chunk chunkIndex into voxels, decompressing it if it is not cached
+        bool readChunk(size_t chunkIndex, std::vector<unsigned char>& voxels);
+
+        size_t chunkIndex(size_t chunkX, size_t chunkY, size_t chunkZ) const
+        {
+            return (chunkZ * m_chunksY * m_chunksX) + (chunkY * m_chunksX) + chunkX;
+        }
+        //size of a chunk, chunks on the far borders can be smaller than chunkDim
+        void chunkSize(size_t chunkX, size_t chunkY, size_t chunkZ,
+                       size_t& sizeX, size_t& sizeY, size_t& sizeZ) const;
+    protected:
+        virtual ~VoxelChunkFile();
+    private:
+        VoxelChunkFile();
+        VoxelChunkFile(const VoxelChunkFile&);
+        VoxelChunkFile& operator=(const VoxelChunkFile&);
+
+        struct ChunkEntry
+        {
+            unsigned long long offset;
+            unsigned long long size;
+        };
+
+        typedef std::list<std::pair<size_t, std::vector<unsigned char> > > ChunkList;
+
+        std::string m_filename;
+        QFile* m_pFile;
+        QMutex m_fileMutex;
+
+        size_t m_dimX;
+        size_t m_dimY;
+        size_t m_dimZ;
+        size_t m_chunkDim;
+        size_t m_chunksX;
+        size_t m_chunksY;
+        size_t m_chunksZ;
+        VolumeDataSet::VoxelFormat m_voxelFormat;
+        unsigned int m_valueMin;
+        unsigned int m_valueMax;
+        QVector3D m_position;
+        QQuaternion m_orientation;
+        double m_scale[3];
+        std::vector<ChunkEntry> m_chunkEntries;
+
+        //most recently used chunks at the front
+        QMutex m_cacheMutex;
+        ChunkList m_cachedChunks;
+        std::map<size_t, ChunkList::iterator> m_cachedChunkMap;
+        size_t m_cacheSize;
+        size_t m_cachedBytes;
+
+        bool getCachedChunk(size_t chunkIndex, std::vector<unsigned char>& voxels);
+        void addCachedChunk(size_t chunkIndex, const std::vector<unsigned char>& voxels);
+        void trimCache();
+    };
+}
+
+#endif
@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <vector>
 #include <time.h>
 #include <stdlib.h>
 
@@ -271,10 +272,36 @@ unsigned int GLUtils::Create3DTexture(const vox::VolumeDataSet& voxels)
     
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+    //textures are always linear
+    size_t voxelCount = voxels.dimX() * voxels.dimY() * voxels.dimZ();
+    std::vector<unsigned char> linearVoxels;
+    std::vector<vox::VolumeDataSet::Voxels16> normalizedVoxels;
+    const void* pVoxelData = voxels.getRawData();
+    bool is16Bit = voxels.getVoxelFormat() == vox::VolumeDataSet::VOXEL_FORMAT_USHORT;
+    if(is16Bit)
+    {
+        //16 bit values are stretched over their value range like normalizeValue16 does
+        normalizedVoxels.resize(voxelCount);
+        voxels.copyLinearVoxels(&normalizedVoxels[0]);
+        for(size_t i = 0; i < voxelCount; ++i)
+        {
+            float value = voxels.normalizeValue16(normalizedVoxels[i]);
+            normalizedVoxels[i] = static_cast<vox::VolumeDataSet::Voxels16>((value * 65535.0f) + 0.5f);
+        }
+        pVoxelData = &normalizedVoxels[0];
+    }
+    else if(voxels.getVoxelLayout() != vox::VolumeDataSet::VOXEL_LAYOUT_LINEAR)
+    {
+        linearVoxels.resize(voxelCount * voxels.getVoxelSize());
+        voxels.copyLinearVoxels(&linearVoxels[0]);
+        pVoxelData = &linearVoxels[0];
+    }
+
     glTexImage3D(GL_TEXTURE_3D, 
-                 0, GL_LUMINANCE, 
+                 0, is16Bit ? GL_LUMINANCE16 : GL_LUMINANCE, 
                  voxels.dimX(), voxels.dimY(), voxels.dimZ(), 
-                 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, voxels.getData());
+                 0, GL_LUMINANCE, is16Bit ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, 
+                 pVoxelData);
 
     //glTexParameteri(GL_TEXTURE_3D, GL_GENERATE_MIPMAP, GL_TRUE);
     glGenerateMipmap(GL_TEXTURE_3D);
@@ -11,7 +11,9 @@
 
 #include "NvUI/NvUI.h"
 
+#include <algorithm>
 #include <iostream>
+#include <set>
 
 using namespace voxOpenGL;
 
@@ -343,6 +345,22 @@ void GLWidget::keyPressEvent(QKeyEvent *evt)
             std::cout << "LOD: " << pRenderer->getLodScalar() << std::endl;
         }
         break;
+    case Qt::Key_PageUp:
+    case Qt::Key_PageDown:
+        {
+            //scene objects can share a renderer, step each renderer once
+            float step = evt->key() == Qt::Key_PageUp ? 0.01f : -0.01f;
+            std::set<vox::Renderer*> steppedRenderers;
+            for(size_t i = 0; i < m_sceneObjects.size(); ++i)
+            {
+                vox::Renderer* pRenderer = m_sceneObjects.at(i)->getRenderer();
+                if(pRenderer == NULL || !steppedRenderers.insert(pRenderer).second)
+                    continue;
+                pRenderer->setIsoLevel(std::min(std::max(pRenderer->getIsoLevel() + step, 0.0f), 1.0f));
+                std::cout << "Iso Level: " << pRenderer->getIsoLevel() << std::endl;
+            }
+        }
+        break;
    }
 }
 
@@ -0,0 +1,521 @@
+#include "VoxVizViewer/RenderRegression.h"
+
+#include "VoxVizCore/Camera.h"
+#include "VoxVizCore/SlabThreads.h"
+#include "VoxVizCore/DataSetReader.h"
+#include "VoxVizCore/SmartPtr.h"
+
+#include "GigaVoxels/GigaVoxelsShaderCodeTester.h"
+#include "RayCaster/RayCasterShaderCodeTester.h"
+#include "RayCaster/RayCastBrickPool.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QDir>
+#include <QtCore/qstring.h>
+#include <QtGui/qimage.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdlib>
+
+using namespace vox;
+
+namespace
+{
+    class GigaVoxelsFrameRenderer : public RenderRegression::FrameRenderer
+    {
+    public:
+        virtual bool load(const std::string& inputFile) override
+        {
+            return gv::GigaVoxelsShaderCodeTester::readCapture(inputFile);
+        }
+
+        virtual bool renderFrame(const Camera& camera,
+                                 unsigned char* pRGBA) override
+        {
+            return gv::GigaVoxelsShaderCodeTester::renderFrame(camera, pRGBA);
+        }
+
+        //ray packets of each width must render the frame the same as rays
+        //traced one at a time, and the node usage lists of the frame must
+        //compress the same way for each number of nodes GigaVoxelsRenderer
+        //pushes per pixel
+        virtual bool checkFrame(const Camera& camera) override
+        {
+            if(!gv::GigaVoxelsShaderCodeTester::compareRayPacketWidths(camera))
+                return false;
+
+            int width, height;
+            camera.getViewportWidthHeight(width, height);
+
+            std::vector<unsigned char> rgba(static_cast<size_t>(width) * height * 4);
+            std::vector<unsigned int> nodeUsageLists(static_cast<size_t>(width) * height * 3 * 4);
+            if(!gv::GigaVoxelsShaderCodeTester::renderFrame(camera, &rgba[0], &nodeUsageLists[0]))
+                return false;
+
+            for(int maxNodesToPush = 4; maxNodesToPush <= 12; maxNodesToPush += 4)
+            {
+                if(!gv::GigaVoxelsShaderCodeTester::checkNodeUsageListCompressor(&nodeUsageLists[0],
+                                                                                 width, height,
+                                                                                 maxNodesToPush))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    class RayCasterFrameRenderer : public RenderRegression::FrameRenderer
+    {
+    private:
+        SmartPtr<VolumeDataSet> m_spVoxels;
+    public:
+        virtual bool load(const std::string& inputFile) override
+        {
+            DataSetReader reader;
+            m_spVoxels = reader.readVolumeDataFile(inputFile);
+            if(m_spVoxels.get() == NULL)
+                return false;
+
+            return rc::RayCasterShaderCodeTester::loadVolume(m_spVoxels.get());
+        }
+
+        virtual bool renderFrame(const Camera& camera,
+                                 unsigned char* pRGBA) override
+        {
+            return rc::RayCasterShaderCodeTester::renderFrame(camera, pRGBA);
+        }
+
+        //the frame must fill in to the same pixels when the volume is paged
+        //through a pool with a slot for each of its bricks
+        virtual bool checkFrame(const Camera& camera) override
+        {
+            const size_t brickDim = rc::BrickPool::k_BrickDim;
+            const size_t storedBrickDim = rc::BrickPool::k_StoredBrickDim;
+            size_t brickCount = ((m_spVoxels->dimX() + brickDim - 1) / brickDim)
+                              * ((m_spVoxels->dimY() + brickDim - 1) / brickDim)
+                              * ((m_spVoxels->dimZ() + brickDim - 1) / brickDim);
+            size_t maxPoolBytes = brickCount * storedBrickDim * storedBrickDim * storedBrickDim * sizeof(Vec4ub);
+
+            return rc::RayCasterShaderCodeTester::comparePagedFrame(m_spVoxels.get(), maxPoolBytes, camera);
+        }
+    };
+}
+
+RenderRegression::FrameRenderer* RenderRegression::CreateFrameRenderer(const std::string& algorithm)
+{
+    if(algorithm == "gv")
+        return new GigaVoxelsFrameRenderer();
+    else if(algorithm == "rc")
+        return new RayCasterFrameRenderer();
+
+    return NULL;
+}
+
+//the premultiplied pixels are stored as they are, so that a reference reads
+//back exactly the bytes that were rendered
+static bool WriteImage(const std::string& filename,
+                       const std::vector<unsigned char>& rgba,
+                       int width, int height)
+{
+    QImage image(width, height, QImage::Format_ARGB32);
+    for(int y = 0; y < height; ++y)
+    {
+        const unsigned char* pPixel = &rgba[static_cast<size_t>(height - 1 - y) * width * 4];
+        for(int x = 0; x < width; ++x, pPixel += 4)
+            image.setPixel(x, y, qRgba(pPixel[0], pPixel[1], pPixel[2], pPixel[3]));
+    }
+
+    return image.save(QString(filename.c_str()), "PNG");
+}
+
+static bool ReadImage(const std::string& filename,
+                      std::vector<unsigned char>& rgba,
+                      int width, int height)
+{
+    QImage image(QString(filename.c_str()));
+    if(image.isNull())
+        return false;
+
+    if(image.width() != width || image.height() != height)
+    {
+        std::cerr << "ERROR: " << filename << " is "
+                  << image.width() << "x" << image.height() << ", not "
+                  << width << "x" << height << "." << std::endl;
+        return false;
+    }
+
+    image = image.convertToFormat(QImage::Format_ARGB32);
+
+    rgba.resize(static_cast<size_t>(width) * height * 4);
+    for(int y = 0; y < height; ++y)
+    {
+        unsigned char* pPixel = &rgba[static_cast<size_t>(height - 1 - y) * width * 4];
+        for(int x = 0; x < width; ++x, pPixel += 4)
+        {
+            QRgb pixel = image.pixel(x, y);
+            pPixel[0] = static_cast<unsigned char>(qRed(pixel));
+            pPixel[1] = static_cast<unsigned char>(qGreen(pixel));
+            pPixel[2] = static_cast<unsigned char>(qBlue(pixel));
+            pPixel[3] = static_cast<unsigned char>(qAlpha(pixel));
+        }
+    }
+
+    return true;
+}
+
+//returns the number of pixels with a channel that differs by more than
+//channelTolerance, maxDifference receives the largest channel difference
+static size_t CompareImages(const std::vector<unsigned char>& rgba,
+                            const std::vector<unsigned char>& referenceRGBA,
+                            int channelTolerance,
+                            int& maxDifference)
+{
+    size_t differingPixelCount = 0;
+    maxDifference = 0;
+    for(size_t i = 0; i < rgba.size(); i += 4)
+    {
+        int pixelDifference = 0;
+        for(size_t j = i; j < i + 4; ++j)
+        {
+            int difference = std::abs(static_cast<int>(rgba[j]) - static_cast<int>(referenceRGBA[j]));
+            if(difference > pixelDifference)
+                pixelDifference = difference;
+        }
+
+        if(pixelDifference > channelTolerance)
+            ++differingPixelCount;
+        if(pixelDifference > maxDifference)
+            maxDifference = pixelDifference;
+    }
+    return differingPixelCount;
+}
+
+static std::string GetTimingKey(const RenderRegression::Scene& scene,
+                                const RenderRegression::View& view)
+{
+    return scene.name + "/" + view.name;
+}
+
+RenderRegression::RenderRegression() :
+    m_referenceDir("."),
+    m_updateReferences(false),
+    m_updateBaseline(false),
+    m_timingTolerance(0.2f),
+    m_repeatCount(3)
+{
+}
+
+bool RenderRegression::readSuite(const std::string& filename)
+{
+    std::ifstream suiteFile(filename.c_str());
+    if(suiteFile.is_open() == false)
+    {
+        std::cerr << "ERROR: unable to open regression suite " << filename << std::endl;
+        return false;
+    }
+
+    //input files are relative to the suite file
+    QDir suiteDir = QFileInfo(QString(filename.c_str())).dir();
+
+    int lineNumber = 0;
+    std::string line;
+    while(std::getline(suiteFile, line))
+    {
+        ++lineNumber;
+
+        std::stringstream lineStr(line);
+        std::string token;
+        if(!(lineStr >> token) || token[0] == '#')
+            continue;
+
+        bool valid = true;
+        if(token == "SCENE")
+        {
+            Scene scene;
+            scene.width = 640;
+            scene.height = 480;
+            scene.channelTolerance = 2;
+            scene.pixelTolerance = 0.001f;
+            valid = static_cast<bool>(lineStr >> scene.name >> scene.algorithm >> scene.inputFile);
+            if(valid)
+            {
+                QString inputFile(scene.inputFile.c_str());
+                if(QFileInfo(inputFile).isRelative())
+                    scene.inputFile = suiteDir.filePath(inputFile).toAscii().data();
+                m_scenes.push_back(scene);
+            }
+        }
+        else if(m_scenes.empty())
+        {
+            valid = false;
+        }
+        else if(token == "VIEWPORT")
+        {
+            Scene& scene = m_scenes.back();
+            valid = (lineStr >> scene.width >> scene.height)
+                    && scene.width > 0 && scene.height > 0;
+        }
+        else if(token == "TOLERANCE")
+        {
+            Scene& scene = m_scenes.back();
+            valid = static_cast<bool>(lineStr >> scene.channelTolerance >> scene.pixelTolerance);
+        }
+        else if(token == "VIEW")
+        {
+            View view;
+            float x, y, z, lookX, lookY, lookZ;
+            valid = static_cast<bool>(lineStr >> view.name >> x >> y >> z >> lookX >> lookY >> lookZ);
+
+            view.position = QVector3D(x, y, z);
+            view.lookAt = QVector3D(lookX, lookY, lookZ);
+            if(!(lineStr >> view.nearPlaneDist >> view.farPlaneDist))
+            {
+                view.nearPlaneDist = 1.0f;
+                view.farPlaneDist = 10000.0f;
+            }
+
+            if(valid)
+                m_scenes.back().views.push_back(view);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if(!valid)
+        {
+            std::cerr << "ERROR: " << filename << ":" << lineNumber
+                      << ": unable to parse \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool RenderRegression::readBaseline(Timings& baseline) const
+{
+    std::ifstream baselineFile(m_baselineFile.c_str());
+    if(baselineFile.is_open() == false)
+        return false;
+
+    std::string line;
+    while(std::getline(baselineFile, line))
+    {
+        std::stringstream lineStr(line);
+        std::string key;
+        Timing timing;
+        if((lineStr >> key) && key[0] != '#'
+           && (lineStr >> timing.threadCount >> timing.milliseconds))
+            baseline[key] = timing;
+    }
+
+    return true;
+}
+
+bool RenderRegression::writeBaseline(const Timings& timings) const
+{
+    std::ofstream baselineFile(m_baselineFile.c_str());
+    if(baselineFile.is_open() == false)
+    {
+        std::cerr << "ERROR: unable to write timing baseline " << m_baselineFile << std::endl;
+        return false;
+    }
+
+    baselineFile << "# <scene>/<view> <thread count> <milliseconds>" << std::endl;
+    for(Timings::const_iterator itr = timings.begin();
+        itr != timings.end();
+        ++itr)
+    {
+        baselineFile << itr->first << " "
+                     << itr->second.threadCount << " "
+                     << std::fixed << std::setprecision(3) << itr->second.milliseconds
+                     << std::endl;
+    }
+
+    return true;
+}
+
+std::string RenderRegression::getImageFile(const Scene& scene,
+                                           const View& view,
+                                           const std::string& suffix) const
+{
+    return m_referenceDir + "/" + scene.name + "_" + view.name + suffix + ".png";
+}
+
+bool RenderRegression::runView(FrameRenderer& frameRenderer,
+                               const Scene& scene,
+                               const View& view,
+                               const Timings& baseline,
+                               Timings& timings) const
+{
+    FlyCamera camera;
+    camera.setViewport(0, 0, scene.width, scene.height);
+    camera.setNearPlaneDist(view.nearPlaneDist);
+    camera.setFarPlaneDist(view.farPlaneDist);
+    camera.setPosition(view.position);
+    camera.setLookAt(view.lookAt);
+    camera.computeProjectionMatrix();
+    camera.computeViewMatrix();
+
+    std::string key = GetTimingKey(scene, view);
+
+    std::vector<unsigned char> rgba(static_cast<size_t>(scene.width) * scene.height * 4);
+
+    Timing timing;
+    timing.threadCount = static_cast<int>(SlabThreads::GetThreadCount());
+    timing.milliseconds = 0.0;
+    for(int i = 0; i < m_repeatCount; ++i)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        if(!frameRenderer.renderFrame(camera, &rgba[0]))
+        {
+            std::cout << "FAIL " << key << " unable to render frame" << std::endl;
+            return false;
+        }
+        double milliseconds = static_cast<double>(timer.nsecsElapsed()) / 1000000.0;
+        if(i == 0 || milliseconds < timing.milliseconds)
+            timing.milliseconds = milliseconds;
+    }
+    timings[key] = timing;
+
+    std::stringstream report;
+    report << key << std::fixed << std::setprecision(3);
+    bool passed = true;
+
+    if(!frameRenderer.checkFrame(camera))
+    {
+        passed = false;
+        report << " check failed";
+    }
+
+    if(m_updateReferences)
+    {
+        std::string referenceFile = getImageFile(scene, view, "");
+        if(!WriteImage(referenceFile, rgba, scene.width, scene.height))
+        {
+            std::cerr << "ERROR: unable to write reference image " << referenceFile << std::endl;
+            passed = false;
+        }
+        report << " wrote reference";
+    }
+    else
+    {
+        std::vector<unsigned char> referenceRGBA;
+        if(ReadImage(getImageFile(scene, view, ""), referenceRGBA, scene.width, scene.height))
+        {
+            int maxDifference;
+            size_t differingPixelCount = CompareImages(rgba, referenceRGBA,
+                                                       scene.channelTolerance,
+                                                       maxDifference);
+            float differingFraction = static_cast<float>(differingPixelCount) /
+                                      static_cast<float>(scene.width * scene.height);
+            if(differingFraction > scene.pixelTolerance)
+                passed = false;
+
+            report << " max difference " << maxDifference
+                   << " differing pixels " << differingPixelCount
+                   << " (" << (differingFraction * 100.0f) << "%)";
+        }
+        else
+        {
+            passed = false;
+            report << " no reference image";
+        }
+
+        if(!passed)
+            WriteImage(getImageFile(scene, view, ".failed"), rgba, scene.width, scene.height);
+    }
+
+    report << " " << timing.milliseconds << " ms";
+
+    Timings::const_iterator baselineItr = baseline.find(key);
+    if(!m_updateBaseline
+       && baselineItr != baseline.end()
+       && baselineItr->second.threadCount == timing.threadCount)
+    {
+        //a baseline of 0 ms was too fast to time, there is no change to compare
+        double baselineMilliseconds = baselineItr->second.milliseconds;
+        report << " baseline " << baselineMilliseconds << " ms";
+        if(baselineMilliseconds > 0.0)
+        {
+            double change = (timing.milliseconds - baselineMilliseconds) / baselineMilliseconds;
+            report << " (" << std::showpos << (change * 100.0) << std::noshowpos << "%)";
+            if(change > m_timingTolerance)
+            {
+                passed = false;
+                report << " slower than baseline";
+            }
+        }
+    }
+
+    std::cout << (passed ? "PASS " : "FAIL ") << report.str() << std::endl;
+
+    return passed;
+}
+
+int RenderRegression::run()
+{
+    Timings baseline;
+    if(!m_baselineFile.empty())
+        readBaseline(baseline);
+
+    std::cout << "Rendering with " << SlabThreads::GetThreadCount() << " threads" << std::endl;
+
+    int failedCount = 0;
+    size_t frameCount = 0;
+    Timings timings;
+    for(size_t i = 0; i < m_scenes.size(); ++i)
+    {
+        const Scene& scene = m_scenes[i];
+        frameCount += scene.views.size();
+
+        FrameRenderer* pFrameRenderer = CreateFrameRenderer(scene.algorithm);
+        if(pFrameRenderer == NULL || !pFrameRenderer->load(scene.inputFile))
+        {
+            if(pFrameRenderer == NULL)
+                std::cerr << "ERROR: no CPU renderer for algorithm " << scene.algorithm << std::endl;
+            else
+                std::cerr << "ERROR: unable to load " << scene.inputFile << std::endl;
+
+            for(size_t j = 0; j < scene.views.size(); ++j)
+                std::cout << "FAIL " << GetTimingKey(scene, scene.views[j]) << " unable to load scene" << std::endl;
+            failedCount += static_cast<int>(scene.views.size());
+
+            delete pFrameRenderer;
+            continue;
+        }
+
+        for(size_t j = 0; j < scene.views.size(); ++j)
+        {
+            if(!runView(*pFrameRenderer, scene, scene.views[j], baseline, timings))
+                ++failedCount;
+        }
+
+        delete pFrameRenderer;
+    }
+
+    if(m_updateBaseline && !m_baselineFile.empty())
+    {
+        //keep the timings of scenes that are not in this suite
+        for(Timings::const_iterator itr = timings.begin();
+            itr != timings.end();
+            ++itr)
+        {
+            baseline[itr->first] = itr->second;
+        }
+
+        if(!writeBaseline(baseline))
+            ++failedCount;
+    }
+
+    std::cout << failedCount << " of " << frameCount << " frames failed" << std::endl;
+
+    return failedCount;
+}
@@ -0,0 +1,124 @@
+#ifndef VOX_RENDER_REGRESSION_H
+#define VOX_RENDER_REGRESSION_H
+
+#include <QtGui/qvector3d.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace vox
+{
+    class Camera;
+
+    //renders the views of a suite file with the CPU versions of the renderers,
+    //so it needs no GL context, and compares each frame against a reference
+    //image and its render time against a baseline file. A suite file holds
+    //lines like these, each VIEW belongs to the SCENE above it:
+    //
+    //  # comment
+    //  SCENE <name> <algorithm> <input file>
+    //  VIEWPORT <width> <height>
+    //  TOLERANCE <max channel difference> <max fraction of differing pixels>
+    //  VIEW <name> <pos x> <pos y> <pos z> <look at x> <look at y> <look at z> [<near> <far>]
+    //
+    //Input files are relative to the suite file. gv scenes read oct tree
+    //captures written by GigaVoxelsShaderCodeTester, rc scenes read any volume
+    //file DataSetReader knows. mc and vs have no CPU renderer, so their scenes
+    //fail to load. Regression/suite.txt is the suite the renderers are held to.
+    class RenderRegression
+    {
+    public:
+        struct View
+        {
+            std::string name;
+            QVector3D position;
+            QVector3D lookAt;
+            float nearPlaneDist;
+            float farPlaneDist;
+        };
+
+        struct Scene
+        {
+            std::string name;
+            std::string algorithm;
+            std::string inputFile;
+            int width;
+            int height;
+            int channelTolerance;
+            float pixelTolerance;
+            std::vector<View> views;
+        };
+
+        //renders the frames of one scene
+        class FrameRenderer
+        {
+        public:
+            virtual ~FrameRenderer() {}
+            virtual bool load(const std::string& inputFile) = 0;
+            //pRGBA receives the camera viewport's premultiplied RGBA pixels,
+            //bottom row first
+            virtual bool renderFrame(const Camera& camera,
+                                     unsigned char* pRGBA) = 0;
+            //extra checks of a view that are run once outside the timed
+            //renders, returns false if one fails
+            virtual bool checkFrame(const Camera& camera) { return true; }
+        };
+
+    private:
+        struct Timing
+        {
+            int threadCount;
+            double milliseconds;
+        };
+        typedef std::map<std::string, Timing> Timings;
+
+        std::vector<Scene> m_scenes;
+        std::string m_referenceDir;
+        std::string m_baselineFile;
+        bool m_updateReferences;
+        bool m_updateBaseline;
+        float m_timingTolerance;
+        int m_repeatCount;
+
+        static FrameRenderer* CreateFrameRenderer(const std::string& algorithm);
+
+        bool readBaseline(Timings& baseline) const;
+        bool writeBaseline(const Timings& timings) const;
+
+        std::string getImageFile(const Scene& scene,
+                                 const View& view,
+                                 const std::string& suffix) const;
+
+        bool runView(FrameRenderer& frameRenderer,
+                     const Scene& scene,
+                     const View& view,
+                     const Timings& baseline,
+                     Timings& timings) const;
+    public:
+        RenderRegression();
+
+        bool readSuite(const std::string& filename);
+
+        //reference images are <scene>_<view>.png in referenceDir, frames that
+        //fail are written next to them as <scene>_<view>.failed.png
+        void setReferenceDirectory(const std::string& referenceDir) { m_referenceDir = referenceDir; }
+        void setBaselineFile(const std::string& baselineFile) { m_baselineFile = baselineFile; }
+
+        //write the rendered frames and timings instead of comparing them
+        void setUpdateReferences(bool flag) { m_updateReferences = flag; }
+        void setUpdateBaseline(bool flag) { m_updateBaseline = flag; }
+
+        //a frame fails when it takes this fraction longer than its baseline,
+        //which is only compared when it was timed with the same thread count
+        void setTimingTolerance(float fraction) { m_timingTolerance = fraction; }
+
+        //each frame is rendered this many times and the fastest time is kept
+        void setRepeatCount(int repeatCount) { m_repeatCount = repeatCount; }
+
+        //returns the number of frames that failed
+        int run();
+    };
+}
+
+#endif
@@ -3,11 +3,19 @@
 #include "VoxVizCore/DataSetWriter.h"
 #include "VoxVizCore/VolumeDataSet.h"
 #include "VoxVizCore/Renderer.h"
+#include "VoxVizCore/VoxelBinaryFile.h"
+#include "VoxVizCore/VoxelChunkFile.h"
+#include "VoxVizCore/SlabThreads.h"
 
 #include "MarchingCubes/MarchingCubesRenderer.h"
+#include "MarchingCubes/IsosurfaceCache.h"
 #include "VolumeSlicer3D/VolumeSlicer3DRenderer.h"
 #include "RayCaster/RayCastRenderer.h"
 #include "GigaVoxels/GigaVoxelsRenderer.h"
+#include "GigaVoxels/GigaVoxelsOctTreeCache.h"
+#include "GigaVoxels/GigaVoxelsShaderCodeTester.h"
+
+#include "VoxVizViewer/RenderRegression.h"
 
 #include "VoxVizOpenGL/GLWindow.h"
 #include "VoxVizOpenGL/GLShaderProgramManager.h"
@@ -23,6 +31,7 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 
 static void PrintUsage()
 {
@@ -33,6 +42,26 @@ static void PrintUsage()
                  "[--samples < number of samples; defaults to max volume dimension > ] "
 				 "[--camera-params start-x start-y start-z look-x look-y look-z] "
 				 "[--camera-scalars move-amt rot-amt] " 
+                 "[--no-octree-cache] "
+                 "[--no-voxel-binary] "
+                 "[--no-mc-cache] "
+                 "[--bricked-voxels] "
+                 "[--sub-box start-x start-y start-z end-x end-y end-z] "
+                 "[--write-chunked <name of .voxc output file>] "
+                 "[--out-of-core] "
+                 "[--write-gv-capture <name of capture file> <frame number>] "
+                 "[--gv-cpu-node-usage-lists] "
+              << std::endl
+              << "VoxViz "
+                 "--regression <name of suite file> "
+                 "[--references <reference image directory>] "
+                 "[--timing-baseline <name of baseline file>] "
+                 "[--timing-tolerance <fraction; defaults to 0.2>] "
+                 "[--repeat <renders per frame; defaults to 3>] "
+                 "[--threads <number of threads>] "
+                 "[--ray-packet-width < 1 | 4 | 8 (default) | 16 >] "
+                 "[--update-references] "
+                 "[--update-baseline] "
               << std::endl;
 }
 
@@ -123,6 +152,16 @@ bool ParseCmdLineArgs(const QCoreApplication& app,
                       float& cameraMoveAmt,
                       float& cameraRotAmt,
                       bool& noLighting,
+                      bool& noOctTreeCache,
+                      bool& noVoxelBinary,
+                      bool& noMCCache,
+                      bool& brickedVoxels,
+                      std::vector<size_t>& subBox,
+                      std::string& chunkedOutputFile,
+                      bool& outOfCore,
+                      std::string& gvCaptureFile,
+                      size_t& gvCaptureFrame,
+                      bool& gvCPUNodeUsageLists,
                       std::stringstream& errorMessage)
 {
     const QStringList& args = app.arguments();
@@ -193,12 +232,124 @@ bool ParseCmdLineArgs(const QCoreApplication& app,
         {
             noLighting = true;
         }
+        else if(arg == "--no-octree-cache")
+        {
+            noOctTreeCache = true;
+        }
+        else if(arg == "--no-voxel-binary")
+        {
+            noVoxelBinary = true;
+        }
+        else if(arg == "--no-mc-cache")
+        {
+            noMCCache = true;
+        }
+        else if(arg == "--bricked-voxels")
+        {
+            brickedVoxels = true;
+        }
+        else if(arg == "--sub-box")
+        {
+            subBox.clear();
+            for(int j = 0; j < 6; ++j)
+                subBox.push_back(args[++i].toULong());
+        }
+        else if(arg == "--write-chunked")
+        {
+            chunkedOutputFile = args[i+1].toAscii().data();
+            ++i;
+        }
+        else if(arg == "--out-of-core")
+        {
+            outOfCore = true;
+        }
+        else if(arg == "--write-gv-capture")
+        {
+            gvCaptureFile = args[++i].toAscii().data();
+            gvCaptureFrame = args[++i].toULong();
+        }
+        else if(arg == "--gv-cpu-node-usage-lists")
+        {
+            gvCPUNodeUsageLists = true;
+        }
+    }
+
+    //only mc and rc stream the chunks of a .voxc file, everything else
+    //needs the voxels in memory
+    if(outOfCore && 
+       (vox::DataSetReader::GetFileExtension(inputFile) != "voxc" ||
+        (algorithm != "mc" && algorithm != "rc")))
+    {
+        errorMessage << "Error: --out-of-core needs a .voxc input file and the mc or rc algorithm.";
+        return false;
     }
 
     return inputFile.size() > 0 
            && algorithm.size() > 0;
 }
 
+//renders the suite on the CPU without creating a window, returns the number
+//of frames that failed
+static int RunRegression(const QCoreApplication& app)
+{
+    vox::RenderRegression regression;
+    std::string suiteFile;
+
+    const QStringList& args = app.arguments();
+    for(int i = 1; i < args.size(); ++i)
+    {
+        const QString& arg = args[i];
+        if(arg == "--regression")
+        {
+            suiteFile = args[++i].toAscii().data();
+        }
+        else if(arg == "--references")
+        {
+            regression.setReferenceDirectory(args[++i].toAscii().data());
+        }
+        else if(arg == "--timing-baseline")
+        {
+            regression.setBaselineFile(args[++i].toAscii().data());
+        }
+        else if(arg == "--timing-tolerance")
+        {
+            regression.setTimingTolerance(args[++i].toFloat());
+        }
+        else if(arg == "--repeat")
+        {
+            regression.setRepeatCount(std::max(args[++i].toInt(), 1));
+        }
+        else if(arg == "--threads")
+        {
+            vox::SlabThreads::SetThreadCount(args[++i].toULong());
+        }
+        else if(arg == "--ray-packet-width")
+        {
+            gv::GigaVoxelsShaderCodeTester::setRayPacketWidth(args[++i].toInt());
+        }
+        else if(arg == "--update-references")
+        {
+            regression.setUpdateReferences(true);
+        }
+        else if(arg == "--update-baseline")
+        {
+            regression.setUpdateBaseline(true);
+        }
+    }
+
+    //read the suite's volumes as they are rather than writing binary
+    //companions next to them
+    vox::VoxelBinaryFile::SetEnabled(false);
+
+    if(suiteFile.empty() || !regression.readSuite(suiteFile))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    return regression.run() > 0 ? 1 : 0;
+}
+
 static void Cleanup()
 {
     //std::cout << "HERE" << std::endl;
@@ -238,7 +389,17 @@ void checkGLError(const char* file, int32_t line)
 
 int main(int argc, char* argv[])
 {
-    QApplication app(argc, argv);
+    bool regression = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(std::string(argv[i]) == "--regression")
+            regression = true;
+    }
+
+    //regression runs are headless
+    QApplication app(argc, argv, !regression);
+    if(regression)
+        return RunRegression(app);
 
     NvAssetLoaderInit(NULL);
 
@@ -257,6 +418,16 @@ int main(int argc, char* argv[])
 	float cameraNear = 1.0f;
 	float cameraFar = 10000.0f;
     bool noLighting = false;
+    bool noOctTreeCache = false;
+    bool noVoxelBinary = false;
+    bool noMCCache = false;
+    bool brickedVoxels = false;
+    std::vector<size_t> subBox;
+    std::string chunkedOutputFile;
+    bool outOfCore = false;
+    std::string gvCaptureFile;
+    size_t gvCaptureFrame = 0;
+    bool gvCPUNodeUsageLists = false;
     std::stringstream errorMessage;
 
     if(!ParseCmdLineArgs(app,
@@ -273,6 +444,16 @@ int main(int argc, char* argv[])
                      cameraMoveAmt,
                      cameraRotAmt,
                      noLighting,
+                     noOctTreeCache,
+                     noVoxelBinary,
+                     noMCCache,
+                     brickedVoxels,
+                     subBox,
+                     chunkedOutputFile,
+                     outOfCore,
+                     gvCaptureFile,
+                     gvCaptureFrame,
+                     gvCPUNodeUsageLists,
                      errorMessage))
     {
         std::cerr << errorMessage.str() << std::endl;
@@ -294,9 +475,20 @@ int main(int argc, char* argv[])
               << std::endl;
 
     //read in a volume dataset
+    vox::VoxelBinaryFile::SetEnabled(!noVoxelBinary);
     vox::DataSetReader reader;
 
-    vox::SmartPtr<vox::VolumeDataSet> spDataSet = reader.readVolumeDataFile(inputFile);
+    vox::SmartPtr<vox::VolumeDataSet> spDataSet;
+    //only the chunks of a .voxc file that intersect the sub box are read,
+    //out of core none are, renderers that can stream them do it themselves
+    if(outOfCore)
+        spDataSet = reader.readVolumeDataHeader(inputFile);
+    else if(subBox.size() == 6)
+        spDataSet = reader.readVolumeDataFile(inputFile,
+                                              subBox[0], subBox[1], subBox[2],
+                                              subBox[3], subBox[4], subBox[5]);
+    else
+        spDataSet = reader.readVolumeDataFile(inputFile);
 
     if(!spDataSet.valid())
     {
@@ -308,8 +500,15 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if(!chunkedOutputFile.empty())
+        vox::VoxelChunkFile::Write(spDataSet.get(), chunkedOutputFile);
+
     if(numSamples > 0)
         spDataSet->setNumSamples(numSamples);
+
+    //keeps z neighbors in cache for the cpu passes over the voxels
+    if(brickedVoxels)
+        spDataSet->setVoxelLayout(vox::VolumeDataSet::VOXEL_LAYOUT_BRICKED);
 	 
     const vox::BoundingBox& bbox = spDataSet->getBoundingBox();
 
@@ -320,7 +519,7 @@ int main(int argc, char* argv[])
     {
         pCamera = &modelCamera;
 
-        if(spDataSet->getData() != nullptr)
+        if(spDataSet->getRawData() != nullptr)
         {
             modelCamera.setOffset(bbox.radius()*2.5f);
         }
@@ -391,6 +590,12 @@ int main(int argc, char* argv[])
 	vs3D::VolumeSlicer3DRenderer::RegisterRenderer();
 	mc::MarchingCubesRenderer::RegisterRenderer();
 
+    gv::GigaVoxelsOctTreeCache::SetEnabled(!noOctTreeCache);
+    if(!gvCaptureFile.empty())
+        gv::GigaVoxelsRenderer::SetCaptureFile(gvCaptureFile, gvCaptureFrame);
+    gv::GigaVoxelsRenderer::SetCompressNodeUsageListsOnCPU(gvCPUNodeUsageLists);
+    mc::IsosurfaceCache::SetEnabled(!noMCCache);
+
     //feed it into a volume renderer
     vox::SmartPtr<vox::Renderer> spRenderer = vox::Renderer::CreateRenderer(algorithm);
     if(spRenderer.get() == NULL)